@@ -0,0 +1,160 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "util.h"
+#include "version.h"
+
+#include <unordered_map>
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block) : nonce(GetRand(std::numeric_limits<uint64_t>::max())),
+                                                                             header(block.GetBlockHeader()),
+                                                                             vchBlockSig(block.vchBlockSig)
+{
+    FillShortTxIDSelector();
+
+    // The coinbase, and the coinstake of proof-of-stake blocks, are never in
+    // the mempool of the receiver
+    size_t nPrefilled = block.IsProofOfStake() ? 2 : 1;
+    nPrefilled = std::min(nPrefilled, block.vtx.size());
+    prefilledtxn.resize(nPrefilled);
+    for (size_t i = 0; i < nPrefilled; i++) {
+        prefilledtxn[i].index = 0;
+        prefilledtxn[i].tx = block.vtx[i];
+    }
+    if (block.vtx.size() > nPrefilled)
+        shorttxids.resize(block.vtx.size() - nPrefilled);
+    for (size_t i = nPrefilled; i < block.vtx.size(); i++)
+        shorttxids[i - nPrefilled] = GetShortID(block.vtx[i].GetHash());
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << header << nonce;
+    uint256 hash;
+    CSHA256().Write((const unsigned char*)&stream[0], stream.size()).Finalize(hash.begin());
+    shorttxidk0 = ReadLE64(hash.begin());
+    shorttxidk1 = ReadLE64(hash.begin() + 8);
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const
+{
+    return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffULL;
+}
+
+CompactBlockReadStatus CPartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock)
+{
+    if (cmpctblock.header.IsNull() || (cmpctblock.shorttxids.empty() && cmpctblock.prefilledtxn.empty()))
+        return READ_STATUS_INVALID;
+    if (cmpctblock.BlockTxCount() > MAX_BLOCK_SIZE_CURRENT / ::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION))
+        return READ_STATUS_INVALID;
+
+    assert(header.IsNull() && txn_available.empty());
+    header = cmpctblock.header;
+    vchBlockSig = cmpctblock.vchBlockSig;
+    txn_available.resize(cmpctblock.BlockTxCount());
+
+    int32_t nLastPrefilled = -1;
+    for (size_t i = 0; i < cmpctblock.prefilledtxn.size(); i++) {
+        if (cmpctblock.prefilledtxn[i].tx.IsNull())
+            return READ_STATUS_INVALID;
+
+        // Indexes are differentially encoded and may not point past the end
+        nLastPrefilled += cmpctblock.prefilledtxn[i].index + 1;
+        if (nLastPrefilled > std::numeric_limits<uint16_t>::max())
+            return READ_STATUS_INVALID;
+        if ((uint32_t)nLastPrefilled > cmpctblock.shorttxids.size() + i)
+            return READ_STATUS_INVALID;
+        txn_available[nLastPrefilled] = std::make_shared<const CTransaction>(cmpctblock.prefilledtxn[i].tx);
+    }
+    prefilled_count = cmpctblock.prefilledtxn.size();
+
+    // Position in the block of each short id, skipping the prefilled transactions
+    std::unordered_map<uint64_t, uint16_t> mapShortIDs(cmpctblock.shorttxids.size());
+    uint16_t nIndexOffset = 0;
+    for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
+        while (txn_available[i + nIndexOffset])
+            nIndexOffset++;
+        mapShortIDs[cmpctblock.shorttxids[i]] = i + nIndexOffset;
+    }
+    // Two transactions of the block with the same short id: they cannot be told
+    // apart, so the whole block is needed
+    if (mapShortIDs.size() != cmpctblock.shorttxids.size())
+        return READ_STATUS_FAILED;
+
+    std::vector<bool> vHaveTxn(txn_available.size());
+    {
+        LOCK(pool->cs);
+        for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = pool->mapTx.begin(); it != pool->mapTx.end(); ++it) {
+            std::unordered_map<uint64_t, uint16_t>::iterator idit = mapShortIDs.find(cmpctblock.GetShortID(it->first));
+            if (idit == mapShortIDs.end())
+                continue;
+            if (!vHaveTxn[idit->second]) {
+                txn_available[idit->second] = std::make_shared<const CTransaction>(it->second.GetTx());
+                vHaveTxn[idit->second] = true;
+                mempool_count++;
+            } else if (txn_available[idit->second]) {
+                // Two mempool transactions match the short id, request it instead
+                txn_available[idit->second].reset();
+                mempool_count--;
+            }
+            if (mempool_count == cmpctblock.shorttxids.size())
+                break;
+        }
+    }
+
+    LogPrint("cmpctblock", "Initialized compact block %s with %u transactions, %u prefilled and %u from the mempool\n",
+        cmpctblock.header.GetHash().ToString(), txn_available.size(), prefilled_count, mempool_count);
+    return READ_STATUS_OK;
+}
+
+bool CPartiallyDownloadedBlock::IsTxAvailable(size_t index) const
+{
+    assert(!header.IsNull());
+    assert(index < txn_available.size());
+    return txn_available[index] != nullptr;
+}
+
+CompactBlockReadStatus CPartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<CTransaction>& vtx_missing)
+{
+    assert(!header.IsNull());
+    block = CBlock(header);
+    block.vchBlockSig = vchBlockSig;
+    block.vtx.resize(txn_available.size());
+
+    size_t nMissingOffset = 0;
+    for (size_t i = 0; i < txn_available.size(); i++) {
+        if (!txn_available[i]) {
+            if (vtx_missing.size() <= nMissingOffset)
+                return READ_STATUS_INVALID;
+            block.vtx[i] = vtx_missing[nMissingOffset++];
+        } else {
+            block.vtx[i] = *txn_available[i];
+        }
+    }
+
+    // The block can only be filled once
+    header.SetNull();
+    txn_available.clear();
+
+    if (vtx_missing.size() != nMissingOffset)
+        return READ_STATUS_INVALID;
+
+    // A short id collision with a mempool transaction shows up as a wrong merkle
+    // root, which is no fault of the peer: the full block is requested instead
+    bool fMutated = false;
+    if (block.BuildMerkleTree(&fMutated) != block.hashMerkleRoot || fMutated)
+        return READ_STATUS_FAILED;
+
+    LogPrint("cmpctblock", "Reconstructed block %s, %u transactions requested\n", block.GetHash().ToString(), vtx_missing.size());
+    return READ_STATUS_OK;
+}
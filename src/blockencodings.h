@@ -0,0 +1,212 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef sQuorum_BLOCKENCODINGS_H
+#define sQuorum_BLOCKENCODINGS_H
+
+#include "primitives/block.h"
+
+#include <memory>
+
+class CTxMemPool;
+
+/** Version of the compact block encoding, as sent in sendcmpct */
+static const uint64_t CMPCTBLOCKS_VERSION = 1;
+/** Depth below which blocks are still sent as compact blocks, deeper ones as full blocks */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Depth below which blocktxn answers getblocktxn, deeper blocks are sent in full */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** Number of peers asked to announce new blocks with cmpctblock right away */
+static const unsigned int MAX_HIGH_BANDWIDTH_CMPCT_PEERS = 3;
+
+/** Transactions of a block requested with getblocktxn, by position in the block */
+class CBlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<uint16_t> indexes; //! in increasing order, sent as differences to the previous one
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(blockhash);
+        uint64_t nIndexes = indexes.size();
+        READWRITE(COMPACTSIZE(nIndexes));
+        if (ser_action.ForRead()) {
+            // Grow as the indexes are read, rather than trusting the announced count
+            size_t i = 0;
+            while (indexes.size() < nIndexes) {
+                indexes.resize(std::min((uint64_t)(1000 + indexes.size()), nIndexes));
+                for (; i < indexes.size(); i++) {
+                    uint64_t nIndex = 0;
+                    READWRITE(COMPACTSIZE(nIndex));
+                    if (nIndex > std::numeric_limits<uint16_t>::max())
+                        throw std::ios_base::failure("index overflowed 16 bits");
+                    indexes[i] = nIndex;
+                }
+            }
+
+            uint32_t nOffset = 0;
+            for (size_t j = 0; j < indexes.size(); j++) {
+                if (uint64_t(indexes[j]) + uint64_t(nOffset) > std::numeric_limits<uint16_t>::max())
+                    throw std::ios_base::failure("indexes overflowed 16 bits");
+                indexes[j] = indexes[j] + nOffset;
+                nOffset = indexes[j] + 1;
+            }
+        } else {
+            for (size_t i = 0; i < indexes.size(); i++) {
+                uint64_t nIndex = indexes[i] - (i == 0 ? 0 : (indexes[i - 1] + 1));
+                READWRITE(COMPACTSIZE(nIndex));
+            }
+        }
+    }
+};
+
+/** Answer to getblocktxn, with the requested transactions in the same order */
+class CBlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> txn;
+
+    CBlockTransactions() {}
+    explicit CBlockTransactions(const CBlockTransactionsRequest& req) : blockhash(req.blockhash), txn(req.indexes.size()) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(blockhash);
+        READWRITE(txn);
+    }
+};
+
+/** A transaction sent along with a compact block, such as the coinbase and coinstake */
+struct CPrefilledTransaction {
+    //! Position in the block, as the difference to the previous prefilled transaction
+    uint16_t index;
+    CTransaction tx;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        uint64_t nIndex = index;
+        READWRITE(COMPACTSIZE(nIndex));
+        if (nIndex > std::numeric_limits<uint16_t>::max())
+            throw std::ios_base::failure("index overflowed 16 bits");
+        index = nIndex;
+        READWRITE(tx);
+    }
+};
+
+enum CompactBlockReadStatus {
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, //! the peer sent something invalid
+    READ_STATUS_FAILED,  //! short id collision or similar, ask for the full block
+};
+
+/**
+ * A block as relayed by cmpctblock (BIP 152): its header and block signature,
+ * the coinbase and coinstake, and 6 byte short ids of the other transactions,
+ * which the receiver usually has in its mempool already.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    mutable uint64_t shorttxidk0, shorttxidk1;
+    uint64_t nonce;
+
+    void FillShortTxIDSelector() const;
+
+    friend class CPartiallyDownloadedBlock;
+
+protected:
+    std::vector<uint64_t> shorttxids;
+    std::vector<CPrefilledTransaction> prefilledtxn;
+
+public:
+    CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
+
+    // Dummy for deserialization
+    CBlockHeaderAndShortTxIDs() {}
+
+    explicit CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    uint64_t GetShortID(const uint256& txhash) const;
+
+    size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(header);
+        READWRITE(nonce);
+
+        uint64_t nShortTxIDs = shorttxids.size();
+        READWRITE(COMPACTSIZE(nShortTxIDs));
+        if (ser_action.ForRead()) {
+            size_t i = 0;
+            while (shorttxids.size() < nShortTxIDs) {
+                shorttxids.resize(std::min((uint64_t)(1000 + shorttxids.size()), nShortTxIDs));
+                for (; i < shorttxids.size(); i++) {
+                    uint32_t lsb = 0;
+                    uint16_t msb = 0;
+                    READWRITE(lsb);
+                    READWRITE(msb);
+                    shorttxids[i] = (uint64_t(msb) << 32) | uint64_t(lsb);
+                }
+            }
+        } else {
+            for (size_t i = 0; i < shorttxids.size(); i++) {
+                uint32_t lsb = shorttxids[i] & 0xffffffff;
+                uint16_t msb = (shorttxids[i] >> 32) & 0xffff;
+                READWRITE(lsb);
+                READWRITE(msb);
+            }
+        }
+
+        READWRITE(prefilledtxn);
+        READWRITE(vchBlockSig);
+
+        if (ser_action.ForRead()) {
+            if (BlockTxCount() > std::numeric_limits<uint16_t>::max())
+                throw std::ios_base::failure("indexes overflowed 16 bits");
+            FillShortTxIDSelector();
+        }
+    }
+};
+
+/**
+ * A block being rebuilt from a compact block: the transactions found in the
+ * mempool, and those that still have to be requested with getblocktxn.
+ */
+class CPartiallyDownloadedBlock
+{
+private:
+    std::vector<std::shared_ptr<const CTransaction> > txn_available;
+    size_t prefilled_count, mempool_count;
+    CTxMemPool* pool;
+
+public:
+    CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
+
+    explicit CPartiallyDownloadedBlock(CTxMemPool* poolIn) : prefilled_count(0), mempool_count(0), pool(poolIn) {}
+
+    CompactBlockReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock);
+    bool IsTxAvailable(size_t index) const;
+    size_t BlockTxCount() const { return txn_available.size(); }
+    //! Completes block with vtx_missing, the transactions that were not available, in order
+    CompactBlockReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtx_missing);
+};
+
+#endif // sQuorum_BLOCKENCODINGS_H
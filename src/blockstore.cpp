@@ -0,0 +1,198 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstore.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CBlockCache blockCache;
+CBlockFileMapper blockFileMapper;
+
+void CBlockCache::Evict(size_t nMax)
+{
+    while (nBytes > nMax && !listEntries.empty()) {
+        const CEntry& entry = listEntries.back();
+        nBytes -= entry.nSize;
+        mapEntries.erase(entry.hash);
+        listEntries.pop_back();
+    }
+}
+
+std::shared_ptr<const CBlock> CBlockCache::Get(const uint256& hash)
+{
+    std::lock_guard<std::mutex> lock(cs_cache);
+    std::map<uint256, EntryList::iterator>::iterator it = mapEntries.find(hash);
+    if (it == mapEntries.end()) {
+        nMisses++;
+        return nullptr;
+    }
+    nHits++;
+    listEntries.splice(listEntries.begin(), listEntries, it->second);
+    return it->second->pblock;
+}
+
+void CBlockCache::Insert(const std::shared_ptr<const CBlock>& pblock)
+{
+    size_t nSize = ::GetSerializeSize(*pblock, SER_DISK, CLIENT_VERSION);
+    uint256 hash = pblock->GetHash();
+
+    std::lock_guard<std::mutex> lock(cs_cache);
+    if (nSize > nMaxBytes || mapEntries.count(hash))
+        return;
+    Evict(nMaxBytes - nSize);
+    listEntries.push_front(CEntry{hash, pblock, nSize});
+    mapEntries.emplace(hash, listEntries.begin());
+    nBytes += nSize;
+}
+
+void CBlockCache::SetMaxSize(size_t nMaxBytesIn)
+{
+    std::lock_guard<std::mutex> lock(cs_cache);
+    nMaxBytes = nMaxBytesIn;
+    Evict(nMaxBytes);
+}
+
+void CBlockCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(cs_cache);
+    listEntries.clear();
+    mapEntries.clear();
+    nBytes = 0;
+}
+
+CBlockCacheStats CBlockCache::GetStats()
+{
+    std::lock_guard<std::mutex> lock(cs_cache);
+    CBlockCacheStats stats;
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    stats.nBlocks = listEntries.size();
+    stats.nBytes = nBytes;
+    stats.nMaxBytes = nMaxBytes;
+    return stats;
+}
+
+/** A read only mapping of a whole block file, unmapped once the last reader released it */
+struct CBlockFileMapper::CMappedFile {
+    const unsigned char* pdata;
+    size_t nSize;
+
+    CMappedFile(const unsigned char* pdataIn, size_t nSizeIn) : pdata(pdataIn), nSize(nSizeIn) {}
+    ~CMappedFile()
+    {
+#ifndef WIN32
+        munmap(const_cast<unsigned char*>(pdata), nSize);
+#endif
+    }
+};
+
+bool CBlockFileMapper::IsSupported()
+{
+#ifndef WIN32
+    return sizeof(void*) == 8;
+#else
+    return false;
+#endif
+}
+
+bool CBlockFileMapper::SetEnabled(bool fEnable)
+{
+    fEnabled = fEnable && IsSupported();
+    if (!fEnabled)
+        Clear();
+    return fEnabled;
+}
+
+std::shared_ptr<CBlockFileMapper::CMappedFile> CBlockFileMapper::GetFile(int nFile, uint64_t nMinSize)
+{
+    std::lock_guard<std::mutex> lock(cs_mapper);
+    std::map<int, std::shared_ptr<CMappedFile> >::iterator it = mapFiles.find(nFile);
+    if (it != mapFiles.end() && it->second->nSize >= nMinSize)
+        return it->second;
+
+#ifndef WIN32
+    // Not mapped yet, or the file has grown since: (re)map it as a whole. Readers
+    // of the previous mapping keep it alive until they are done.
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || (uint64_t)st.st_size < nMinSize) {
+        close(fd);
+        return nullptr;
+    }
+    void* pdata = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pdata == MAP_FAILED) {
+        LogPrint("bench", "%s: mapping %s failed\n", __func__, path.string());
+        return nullptr;
+    }
+    std::shared_ptr<CMappedFile> file = std::make_shared<CMappedFile>(static_cast<const unsigned char*>(pdata), st.st_size);
+    mapFiles[nFile] = file;
+    return file;
+#else
+    return nullptr;
+#endif
+}
+
+bool CBlockFileMapper::ReadBlock(CBlock& block, const CDiskBlockPos& pos)
+{
+    // Blocks are stored after the network magic and their serialized size
+    static const unsigned int nHeaderSize = MESSAGE_START_SIZE + sizeof(uint32_t);
+    if (!fEnabled || pos.nPos < nHeaderSize)
+        return false;
+
+    std::shared_ptr<CMappedFile> file = GetFile(pos.nFile, pos.nPos);
+    if (!file)
+        return false;
+    const unsigned char* pheader = file->pdata + pos.nPos - nHeaderSize;
+    if (memcmp(pheader, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+        return false;
+    uint64_t nEnd = (uint64_t)pos.nPos + ReadLE32(pheader + MESSAGE_START_SIZE);
+    if (nEnd > file->nSize) {
+        file = GetFile(pos.nFile, nEnd);
+        if (!file)
+            return false;
+    }
+
+    try {
+        CBufferReader reader((const char*)file->pdata + pos.nPos, (const char*)file->pdata + nEnd, SER_DISK, CLIENT_VERSION);
+        reader >> block;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+void CBlockFileMapper::Unmap(int nFile)
+{
+    std::lock_guard<std::mutex> lock(cs_mapper);
+    mapFiles.erase(nFile);
+}
+
+void CBlockFileMapper::Clear()
+{
+    std::lock_guard<std::mutex> lock(cs_mapper);
+    mapFiles.clear();
+}
+
+size_t CBlockFileMapper::MappedFiles()
+{
+    std::lock_guard<std::mutex> lock(cs_mapper);
+    return mapFiles.size();
+}
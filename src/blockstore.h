@@ -0,0 +1,114 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef sQuorum_BLOCKSTORE_H
+#define sQuorum_BLOCKSTORE_H
+
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+class CBlock;
+struct CDiskBlockPos;
+
+/** Default for -blockcachesize, the memory in MiB kept for recently read blocks */
+static const unsigned int DEFAULT_BLOCK_CACHE_SIZE = 16;
+/** Default for -blockmmap, reading block files through memory mappings */
+static const bool DEFAULT_BLOCK_MMAP = false;
+
+/** Statistics of the block cache, as returned by CBlockCache::GetStats() */
+struct CBlockCacheStats {
+    uint64_t nHits;       //! lookups answered from memory
+    uint64_t nMisses;     //! lookups that had to read the block from disk
+    size_t nBlocks;       //! blocks kept in memory
+    size_t nBytes;        //! serialized size of the blocks kept in memory
+    size_t nMaxBytes;     //! serialized size above which the least recently used blocks are evicted
+};
+
+/**
+ * Least recently used cache of blocks read from disk, so blocks that are
+ * requested over and over (the tip being served to peers, explorers walking
+ * the same range through RPC) are deserialized only once.
+ *
+ * Blocks are shared immutable objects: a block evicted while somebody still
+ * uses it stays alive until the last reference goes away. Its size is
+ * accounted as its serialized size, which is close to what it takes in memory.
+ */
+class CBlockCache
+{
+private:
+    struct CEntry {
+        uint256 hash;
+        std::shared_ptr<const CBlock> pblock;
+        size_t nSize;
+    };
+    typedef std::list<CEntry> EntryList;
+
+    std::mutex cs_cache;
+    EntryList listEntries; //! most recently used first
+    std::map<uint256, EntryList::iterator> mapEntries;
+    size_t nBytes;
+    size_t nMaxBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    void Evict(size_t nMax);
+
+public:
+    CBlockCache() : nBytes(0), nMaxBytes(0), nHits(0), nMisses(0) {}
+
+    //! Returns the block with this hash, or nothing if it is not in memory
+    std::shared_ptr<const CBlock> Get(const uint256& hash);
+    //! Keeps a block just read from disk, unless the cache is disabled or the block is larger than it
+    void Insert(const std::shared_ptr<const CBlock>& pblock);
+    void SetMaxSize(size_t nMaxBytesIn);
+    void Clear();
+    CBlockCacheStats GetStats();
+};
+
+/**
+ * Reads blocks through read only memory mappings of the block files instead
+ * of opening, seeking and reading the file for every block. Files are mapped
+ * on first use and remapped once they have grown past their mapping.
+ *
+ * Only available on 64 bit POSIX systems, where address space is not scarce.
+ * ReadBlock() returns false whenever a block cannot be read from a mapping, so
+ * the caller falls back to the regular file read and reports errors itself.
+ */
+class CBlockFileMapper
+{
+private:
+    struct CMappedFile;
+
+    std::mutex cs_mapper;
+    std::map<int, std::shared_ptr<CMappedFile> > mapFiles;
+    bool fEnabled;
+
+    std::shared_ptr<CMappedFile> GetFile(int nFile, uint64_t nMinSize);
+
+public:
+    CBlockFileMapper() : fEnabled(false) {}
+
+    static bool IsSupported();
+
+    //! Enables or disables the mappings, returns whether they are enabled
+    bool SetEnabled(bool fEnable);
+    bool IsEnabled() const { return fEnabled; }
+
+    bool ReadBlock(CBlock& block, const CDiskBlockPos& pos);
+
+    //! Drops the mapping of a block file, to be called before it is deleted or truncated
+    void Unmap(int nFile);
+    void Clear();
+    size_t MappedFiles();
+};
+
+extern CBlockCache blockCache;
+extern CBlockFileMapper blockFileMapper;
+
+#endif // sQuorum_BLOCKSTORE_H
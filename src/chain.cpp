@@ -8,6 +8,8 @@
 
 #include "chain.h"
 
+#include <set>
+
 
 /**
  * CChain implementation
@@ -78,4 +80,42 @@ uint256 CBlockIndex::GetBlockTrust() const
         uint256 bnPoWTrust = ((~uint256(0) >> 20) / (bnTarget + 1));
         return bnPoWTrust > 1 ? bnPoWTrust : 1;
     }
-}
\ No newline at end of file
+}
+CBlockIndexArena::Slot* CBlockIndexArena::NewSlot()
+{
+    std::lock_guard<std::mutex> lock(cs_arena);
+    if (!vFree.empty()) {
+        Slot* pslot = vFree.back();
+        vFree.pop_back();
+        return pslot;
+    }
+    if (nUsed == nChunkSize) {
+        vChunks.push_back(new Slot[nChunkSize]);
+        nUsed = 0;
+    }
+    return &vChunks.back()[nUsed++];
+}
+
+void CBlockIndexArena::Delete(CBlockIndex* pindex)
+{
+    pindex->~CBlockIndex();
+    std::lock_guard<std::mutex> lock(cs_arena);
+    vFree.push_back(reinterpret_cast<Slot*>(pindex));
+}
+
+void CBlockIndexArena::Clear()
+{
+    std::lock_guard<std::mutex> lock(cs_arena);
+    std::set<Slot*> setFree(vFree.begin(), vFree.end());
+    for (size_t i = 0; i < vChunks.size(); i++) {
+        size_t nSlots = (i + 1 == vChunks.size()) ? nUsed : nChunkSize;
+        for (size_t j = 0; j < nSlots; j++) {
+            if (!setFree.count(&vChunks[i][j]))
+                reinterpret_cast<CBlockIndex*>(&vChunks[i][j])->~CBlockIndex();
+        }
+        delete[] vChunks[i];
+    }
+    vChunks.clear();
+    vFree.clear();
+    nUsed = nChunkSize;
+}
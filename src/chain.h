@@ -17,6 +17,11 @@
 #include "util.h"
 #include "libzerocoin/Denominations.h"
 
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 
 
@@ -181,9 +186,11 @@ public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
-    //! zerocoin specific fields
-    std::map<libzerocoin::CoinDenomination, int64_t> mapZerocoinSupply;
-    std::vector<libzerocoin::CoinDenomination> vMintDenominationsInBlock;
+    //! zerocoin specific fields, indexed by libzerocoin::ZerocoinDenominationToIndex()
+    //! total of mints of each denomination in the zerocoin supply
+    int64_t nZerocoinSupply[libzerocoin::zerocoinDenomCount];
+    //! number of mints of each denomination in this block
+    uint16_t nMintsInBlock[libzerocoin::zerocoinDenomCount];
 
     void SetNull()
     {
@@ -216,10 +223,8 @@ public:
         nNonce = 0;
         nAccumulatorCheckpoint = 0;
         // Start supply of each denomination with 0s
-        for (auto& denom : libzerocoin::zerocoinDenomList) {
-            mapZerocoinSupply.insert(std::make_pair(denom, 0));
-        }
-        vMintDenominationsInBlock.clear();
+        std::fill(std::begin(nZerocoinSupply), std::end(nZerocoinSupply), 0);
+        std::fill(std::begin(nMintsInBlock), std::end(nMintsInBlock), 0);
     }
 
     CBlockIndex()
@@ -297,7 +302,17 @@ public:
      */
     int64_t GetZcMints(libzerocoin::CoinDenomination denom) const
     {
-        return mapZerocoinSupply.at(denom);
+        return nZerocoinSupply[DenomIndex(denom)];
+    }
+
+    void SetZcMints(libzerocoin::CoinDenomination denom, int64_t nMints)
+    {
+        nZerocoinSupply[DenomIndex(denom)] = nMints;
+    }
+
+    void AddZcMints(libzerocoin::CoinDenomination denom, int64_t nMints)
+    {
+        nZerocoinSupply[DenomIndex(denom)] += nMints;
     }
 
     /**
@@ -312,7 +327,34 @@ public:
 
     bool MintedDenomination(libzerocoin::CoinDenomination denom) const
     {
-        return std::find(vMintDenominationsInBlock.begin(), vMintDenominationsInBlock.end(), denom) != vMintDenominationsInBlock.end();
+        int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+        return nIndex >= 0 && nMintsInBlock[nIndex] > 0;
+    }
+
+    //! Number of mints of a denomination in this block
+    int GetMintsInBlock(libzerocoin::CoinDenomination denom) const
+    {
+        int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+        return nIndex >= 0 ? nMintsInBlock[nIndex] : 0;
+    }
+
+    void AddMintInBlock(libzerocoin::CoinDenomination denom)
+    {
+        nMintsInBlock[DenomIndex(denom)]++;
+    }
+
+    void ClearMintsInBlock()
+    {
+        std::fill(std::begin(nMintsInBlock), std::end(nMintsInBlock), 0);
+    }
+
+    //! Denominations of the mints of this block, one entry per mint
+    std::vector<libzerocoin::CoinDenomination> GetMintDenominationsInBlock() const
+    {
+        std::vector<libzerocoin::CoinDenomination> vDenoms;
+        for (auto& denom : libzerocoin::zerocoinDenomList)
+            vDenoms.insert(vDenoms.end(), GetMintsInBlock(denom), denom);
+        return vDenoms;
     }
 
     uint256 GetBlockHash() const
@@ -422,6 +464,52 @@ public:
     //! Efficiently find an ancestor of this block.
     CBlockIndex* GetAncestor(int height);
     const CBlockIndex* GetAncestor(int height) const;
+
+private:
+    static int DenomIndex(libzerocoin::CoinDenomination denom)
+    {
+        int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+        if (nIndex < 0)
+            throw std::out_of_range("CBlockIndex : invalid zerocoin denomination");
+        return nIndex;
+    }
+};
+
+/**
+ * Allocates block index entries from large contiguous chunks rather than
+ * one heap allocation each. Entries stay valid until the arena is cleared.
+ * New() may be called from several threads at once, as the block index
+ * loader does.
+ */
+class CBlockIndexArena
+{
+private:
+    typedef std::aligned_storage<sizeof(CBlockIndex), alignof(CBlockIndex)>::type Slot;
+    static const size_t nChunkSize = 4096;
+
+    std::mutex cs_arena;
+    std::vector<Slot*> vChunks;
+    //! number of slots in use in the last chunk
+    size_t nUsed;
+    //! slots of deleted entries, handed out again first
+    std::vector<Slot*> vFree;
+
+    CBlockIndexArena(const CBlockIndexArena&);
+    void operator=(const CBlockIndexArena&);
+
+    Slot* NewSlot();
+
+public:
+    CBlockIndexArena() : nUsed(nChunkSize) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    CBlockIndex* New() { return new (NewSlot()) CBlockIndex(); }
+    CBlockIndex* New(const CBlock& block) { return new (NewSlot()) CBlockIndex(block); }
+    //! Destroys an entry that is no longer referenced, its slot is reused
+    void Delete(CBlockIndex* pindex);
+
+    //! Destroys every entry allocated so far
+    void Clear();
 };
 
 /** Used to marshal pointers into hashes for db storage. */
@@ -491,8 +579,24 @@ public:
         READWRITE(nNonce);
         if(this->nVersion > 3) {
             READWRITE(nAccumulatorCheckpoint);
+
+            // Stored as a map of the supply and a list of the minted denominations
+            std::map<libzerocoin::CoinDenomination, int64_t> mapZerocoinSupply;
+            std::vector<libzerocoin::CoinDenomination> vMintDenominationsInBlock;
+            if (!ser_action.ForRead()) {
+                for (auto& denom : libzerocoin::zerocoinDenomList)
+                    mapZerocoinSupply.insert(std::make_pair(denom, GetZcMints(denom)));
+                vMintDenominationsInBlock = GetMintDenominationsInBlock();
+            }
             READWRITE(mapZerocoinSupply);
             READWRITE(vMintDenominationsInBlock);
+            if (ser_action.ForRead()) {
+                for (auto& supply : mapZerocoinSupply)
+                    SetZcMints(supply.first, supply.second);
+                ClearMintsInBlock();
+                for (auto& denom : vMintDenominationsInBlock)
+                    AddMintInBlock(denom);
+            }
         }
 
     }
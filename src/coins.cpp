@@ -7,9 +7,12 @@
 
 #include "coins.h"
 
+#include "checkqueue.h"
 #include "random.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <string.h>
 
 /**
  * calculate number of bytes for the bitmask, and its number of non-zero bytes
@@ -63,6 +66,13 @@ bool CCoins::Spend(int nPos)
 
 bool CCoinsView::GetCoins(const uint256& txid, CCoins& coins) const { return false; }
 bool CCoinsView::HaveCoins(const uint256& txid) const { return false; }
+void CCoinsView::GetCoinsBatch(const std::vector<uint256>& vTxids, std::vector<CCoins>& vCoins, std::vector<char>& vFound) const
+{
+    vCoins.assign(vTxids.size(), CCoins());
+    vFound.assign(vTxids.size(), false);
+    for (size_t i = 0; i < vTxids.size(); i++)
+        vFound[i] = GetCoins(vTxids[i], vCoins[i]);
+}
 uint256 CCoinsView::GetBestBlock() const { return uint256(0); }
 bool CCoinsView::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) { return false; }
 bool CCoinsView::GetStats(CCoinsStats& stats) const { return false; }
@@ -71,6 +81,7 @@ bool CCoinsView::GetStats(CCoinsStats& stats) const { return false; }
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView* viewIn) : base(viewIn) {}
 bool CCoinsViewBacked::GetCoins(const uint256& txid, CCoins& coins) const { return base->GetCoins(txid, coins); }
 bool CCoinsViewBacked::HaveCoins(const uint256& txid) const { return base->HaveCoins(txid); }
+void CCoinsViewBacked::GetCoinsBatch(const std::vector<uint256>& vTxids, std::vector<CCoins>& vCoins, std::vector<char>& vFound) const { base->GetCoinsBatch(vTxids, vCoins, vFound); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView& viewIn) { base = &viewIn; }
 bool CCoinsViewBacked::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
@@ -78,18 +89,25 @@ bool CCoinsViewBacked::GetStats(CCoinsStats& stats) const { return base->GetStat
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView* baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView* baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0), cachedCoinsUsage(0), nAccessCounter(0) {}
 
 CCoinsViewCache::~CCoinsViewCache()
 {
     assert(!hasModifier);
 }
 
+size_t CCoinsViewCache::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
+}
+
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256& txid) const
 {
     CCoinsMap::iterator it = cacheCoins.find(txid);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        it->second.nAccessed = ++nAccessCounter;
         return it;
+    }
     CCoins tmp;
     if (!base->GetCoins(txid, tmp))
         return cacheCoins.end();
@@ -100,9 +118,73 @@ CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256& txid) const
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
+    ret->second.nAccessed = ++nAccessCounter;
+    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
     return ret;
 }
 
+bool CCoinsPrefetch::operator()()
+{
+    std::vector<CCoins> vCoins;
+    std::vector<char> vFound;
+    try {
+        base->GetCoinsBatch(vTxids, vCoins, vFound);
+    } catch (const std::exception&) {
+        // Left to the lookups that need them, which report the error
+        return true;
+    }
+    for (size_t i = 0; i < vTxids.size(); i++) {
+        pfound[i] = vFound[i];
+        pcoins[i].swap(vCoins[i]);
+    }
+    return true;
+}
+
+void CCoinsViewCache::PrefetchCoins(const std::vector<uint256>& vTxids, CCheckQueue<CCoinsPrefetch>* pqueue, unsigned int nParts)
+{
+    assert(!hasModifier);
+    std::vector<uint256> vMissing;
+    for (const uint256& txid : vTxids) {
+        if (!cacheCoins.count(txid))
+            vMissing.push_back(txid);
+    }
+    // In the order of the database keys, so that each run reads one stretch of them
+    std::sort(vMissing.begin(), vMissing.end(), [](const uint256& a, const uint256& b) {
+        return memcmp(a.begin(), b.begin(), a.size()) < 0;
+    });
+    vMissing.erase(std::unique(vMissing.begin(), vMissing.end()), vMissing.end());
+    if (vMissing.empty())
+        return;
+
+    nParts = pqueue ? std::max(1U, std::min<unsigned int>(nParts, vMissing.size())) : 1;
+    std::vector<CCoins> vCoins(vMissing.size());
+    std::vector<char> vFound(vMissing.size(), false);
+    std::vector<CCoinsPrefetch> vRuns;
+    for (unsigned int i = 0; i < nParts; i++) {
+        size_t nBegin = vMissing.size() * i / nParts;
+        size_t nEnd = vMissing.size() * (i + 1) / nParts;
+        vRuns.push_back(CCoinsPrefetch(base, vMissing.begin() + nBegin, vMissing.begin() + nEnd, &vCoins[nBegin], &vFound[nBegin]));
+    }
+    if (pqueue) {
+        CCheckQueueControl<CCoinsPrefetch> control(pqueue);
+        control.Add(vRuns);
+        control.Wait();
+    } else {
+        vRuns[0]();
+    }
+
+    for (size_t i = 0; i < vMissing.size(); i++) {
+        if (!vFound[i])
+            continue;
+        CCoinsMap::iterator it = cacheCoins.insert(std::make_pair(vMissing[i], CCoinsCacheEntry())).first;
+        it->second.coins.swap(vCoins[i]);
+        if (it->second.coins.IsPruned())
+            it->second.flags = CCoinsCacheEntry::FRESH;
+        it->second.nAccessed = ++nAccessCounter;
+        cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+    }
+}
+
 bool CCoinsViewCache::GetCoins(const uint256& txid, CCoins& coins) const
 {
     CCoinsMap::const_iterator it = FetchCoins(txid);
@@ -117,6 +199,7 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256& txid)
 {
     assert(!hasModifier);
     std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    size_t cachedCoinUsage = 0;
     if (ret.second) {
         if (!base->GetCoins(txid, ret.first->second.coins)) {
             // The parent view does not have this entry; mark it as fresh.
@@ -126,10 +209,13 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256& txid)
             // The parent view only has a pruned entry for this; mark it as fresh.
             ret.first->second.flags = CCoinsCacheEntry::FRESH;
         }
+    } else {
+        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first);
+    ret.first->second.nAccessed = ++nAccessCounter;
+    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
 
 const CCoins* CCoinsViewCache::AccessCoins(const uint256& txid) const
@@ -180,17 +266,23 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
                     entry.coins.swap(it->second.coins);
                     entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                    entry.nAccessed = ++nAccessCounter;
+                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
                 }
             } else {
                 if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
+                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
+                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
+                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    itUs->second.nAccessed = ++nAccessCounter;
                 }
             }
         }
@@ -205,9 +297,76 @@ bool CCoinsViewCache::Flush()
 {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
+    cachedCoinsUsage = 0;
     return fOk;
 }
 
+bool CCoinsViewCache::FlushRetaining(size_t nRetainUsage)
+{
+    assert(!hasModifier);
+
+    // Rank the unspent entries, most recently used first
+    std::vector<std::pair<uint32_t, CCoinsMap::iterator> > vRanked;
+    vRanked.reserve(cacheCoins.size());
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+        if (!it->second.coins.IsPruned())
+            vRanked.push_back(std::make_pair(it->second.nAccessed, it));
+    }
+    std::sort(vRanked.begin(), vRanked.end(), [](const std::pair<uint32_t, CCoinsMap::iterator>& a, const std::pair<uint32_t, CCoinsMap::iterator>& b) {
+        return a.first > b.first;
+    });
+
+    // Keep entries while they fit in nRetainUsage, counting the map node of each
+    const size_t nNodeUsage = memusage::MallocUsage(sizeof(memusage::boost_unordered_node<CCoinsMap::value_type>));
+    size_t nRetained = 0;
+    size_t nRetainedUsage = 0;
+    size_t nRetainedCoinsUsage = 0;
+    for (; nRetained < vRanked.size(); nRetained++) {
+        size_t nCoinsUsage = vRanked[nRetained].second->second.coins.DynamicMemoryUsage();
+        if (nRetainedUsage + nNodeUsage + nCoinsUsage > nRetainUsage)
+            break;
+        nRetainedUsage += nNodeUsage + nCoinsUsage;
+        nRetainedCoinsUsage += nCoinsUsage;
+    }
+
+    // Move the dirty entries that go out of the cache to the batch for base,
+    // and copy the dirty entries that stay, which become clean
+    CCoinsMap mapWrite;
+    for (size_t i = nRetained; i < vRanked.size(); i++) {
+        CCoinsMap::iterator it = vRanked[i].second;
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            CCoinsCacheEntry& entryWrite = mapWrite[it->first];
+            entryWrite.coins.swap(it->second.coins);
+            entryWrite.flags = it->second.flags;
+        }
+        cacheCoins.erase(it);
+    }
+    for (size_t i = 0; i < nRetained; i++) {
+        CCoinsCacheEntry& entry = vRanked[i].second->second;
+        if (entry.flags & CCoinsCacheEntry::DIRTY)
+            mapWrite[vRanked[i].second->first] = entry;
+        entry.flags = 0;
+        // Renumber the accesses from zero, so the counter does not wrap around
+        entry.nAccessed = nRetained - i;
+    }
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.coins.IsPruned()) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                CCoinsCacheEntry& entryWrite = mapWrite[it->first];
+                entryWrite.coins.swap(it->second.coins);
+                entryWrite.flags = it->second.flags;
+            }
+            cacheCoins.erase(it++);
+        } else {
+            it++;
+        }
+    }
+    cachedCoinsUsage = nRetainedCoinsUsage;
+    nAccessCounter = nRetained;
+
+    return base->BatchWrite(mapWrite, hashBlock);
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const
 {
     return cacheCoins.size();
@@ -266,7 +425,7 @@ double CCoinsViewCache::GetPriority(const CTransaction& tx, int nHeight) const
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_) : cache(cache_), it(it_)
+CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage)
 {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
@@ -279,5 +438,9 @@ CCoinsModifier::~CCoinsModifier()
     it->second.coins.Cleanup();
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
         cache.cacheCoins.erase(it);
+    } else {
+        // If the coin still exists after the modification, add the new usage
+        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
     }
+    cache.cachedCoinsUsage -= cachedCoinUsage;
 }
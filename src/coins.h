@@ -10,6 +10,7 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "memusage.h"
 #include "script/standard.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -164,6 +165,15 @@ public:
 
     void CalcMaskSize(unsigned int& nBytes, unsigned int& nNonzeroBytes) const;
 
+    //! memory held by vout and the output scripts
+    size_t DynamicMemoryUsage() const
+    {
+        size_t ret = memusage::DynamicUsage(vout);
+        for (const CTxOut& out : vout)
+            ret += memusage::DynamicUsage(static_cast<const std::vector<unsigned char>&>(out.scriptPubKey));
+        return ret;
+    }
+
     bool IsCoinBase() const
     {
         return fCoinBase;
@@ -309,13 +319,14 @@ public:
 struct CCoinsCacheEntry {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    uint32_t nAccessed; // The cache's access counter at the last lookup of this entry.
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsCacheEntry() : coins(), flags(0), nAccessed(0) {}
 };
 
 typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
@@ -344,6 +355,9 @@ public:
     //! This may (but cannot always) return true for fully spent transactions
     virtual bool HaveCoins(const uint256& txid) const;
 
+    //! Retrieve the CCoins of several txids at once, vFound[i] tells whether vTxids[i] has any
+    virtual void GetCoinsBatch(const std::vector<uint256>& vTxids, std::vector<CCoins>& vCoins, std::vector<char>& vFound) const;
+
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
@@ -369,6 +383,7 @@ public:
     CCoinsViewBacked(CCoinsView* viewIn);
     bool GetCoins(const uint256& txid, CCoins& coins) const;
     bool HaveCoins(const uint256& txid) const;
+    void GetCoinsBatch(const std::vector<uint256>& vTxids, std::vector<CCoins>& vCoins, std::vector<char>& vFound) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView& viewIn);
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
@@ -377,6 +392,37 @@ public:
 
 class CCoinsViewCache;
 
+template <typename T>
+class CCheckQueue;
+
+/**
+ * A run of the coins loaded by CCoinsViewCache::PrefetchCoins(), read from its
+ * base view by a CCheckQueue worker. The results go to the vectors of the call.
+ */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsView* base;
+    std::vector<uint256> vTxids;
+    CCoins* pcoins;
+    char* pfound;
+
+public:
+    CCoinsPrefetch() : base(NULL), pcoins(NULL), pfound(NULL) {}
+    CCoinsPrefetch(const CCoinsView* baseIn, std::vector<uint256>::const_iterator itBegin, std::vector<uint256>::const_iterator itEnd, CCoins* pcoinsIn, char* pfoundIn) :
+        base(baseIn), vTxids(itBegin, itEnd), pcoins(pcoinsIn), pfound(pfoundIn) {}
+
+    bool operator()();
+
+    void swap(CCoinsPrefetch& check)
+    {
+        std::swap(base, check.base);
+        vTxids.swap(check.vTxids);
+        std::swap(pcoins, check.pcoins);
+        std::swap(pfound, check.pfound);
+    }
+};
+
 /** Flags for nSequence and nLockTime locks */
 enum {
     /* Interpret sequence numbers as relative lock-time constraints. */
@@ -400,7 +446,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -423,6 +470,12 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
+    /* Counts the lookups, to rank the entries by their last use. */
+    mutable uint32_t nAccessCounter;
+
 public:
     CCoinsViewCache(CCoinsView* baseIn);
     ~CCoinsViewCache();
@@ -455,9 +508,27 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base, like Flush(),
+     * but keep the most recently used unspent entries, up to nRetainUsage bytes
+     * of memory, as clean entries. The cache is then not cold after a flush.
+     */
+    bool FlushRetaining(size_t nRetainUsage);
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+
+    /**
+     * Load the coins of the txids missing from this cache. The base view reads
+     * them with GetCoinsBatch(), split into nParts runs for the threads of
+     * pqueue, or in one run on this thread if pqueue is NULL. The base view must
+     * then allow concurrent reads, as the coin database does and a cache does not.
+     */
+    void PrefetchCoins(const std::vector<uint256>& vTxids, CCheckQueue<CCoinsPrefetch>* pqueue, unsigned int nParts);
+
     /**
      * Amount of coin coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
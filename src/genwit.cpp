@@ -8,12 +8,13 @@
 #include <iostream>
 #include "genwit.h"
 #include "chainparams.h"
+#include "hash.h"
 #include "util.h"
 
-CGenWit::CGenWit() : accWitValue(0) {}
+CGenWit::CGenWit() : accWitValue(0), pfrom(nullptr) {}
 
 CGenWit::CGenWit(const CBloomFilter &filter, int startingHeight, libzerocoin::CoinDenomination den, int requestNum, CBigNum accWitValue)
-        : filter(filter), startingHeight(startingHeight), den(den), requestNum(requestNum), accWitValue(accWitValue) {}
+        : filter(filter), startingHeight(startingHeight), den(den), requestNum(requestNum), accWitValue(accWitValue), pfrom(nullptr) {}
 
 bool CGenWit::isValid(int chainActiveHeight) {
     if (den == libzerocoin::CoinDenomination::ZQ_ERROR){
@@ -63,7 +64,13 @@ const CBigNum &CGenWit::getAccWitValue() const {
 }
 
 const std::string CGenWit::toString() const {
-    return "From: " + pfrom->addrName + ",\n" +
+    return "From: " + (pfrom ? pfrom->addrName : std::string("local")) + ",\n" +
            "Height: " + std::to_string(startingHeight) + ",\n" +
            "accWit: " + accWitValue.GetHex();
 }
+
+uint256 CGenWit::getWorkHash() const {
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << filter << startingHeight << den << accWitValue;
+    return ss.GetHash();
+}
@@ -50,6 +50,9 @@ class CGenWit {
 
     const std::string toString() const;
 
+    /** Hash of what determines the witness, which identical requests from different peers share */
+    uint256 getWorkHash() const;
+
 private:
     CBloomFilter filter;
     int startingHeight;
@@ -17,6 +17,7 @@
 #include "activemasternode.h"
 #include "addrman.h"
 #include "amount.h"
+#include "blockstore.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "httpserver.h"
@@ -33,6 +34,7 @@
 #include "rpc/server.h"
 #include "script/standard.h"
 #include "scheduler.h"
+#include "snapshot.h"
 #include "spork.h"
 #include "sporkdb.h"
 #include "txdb.h"
@@ -42,6 +44,9 @@
 #include "utilmoneystr.h"
 #include "validationinterface.h"
 #include "zsqr/accumulatorcheckpoints.h"
+#include "zsqr/spendcache.h"
+#include "libzerocoin/FixedBaseTable.h"
+#include "libzerocoin/ProofWorkers.h"
 #include "zsqrchain.h"
 
 #ifdef ENABLE_WALLET
@@ -167,7 +172,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB* pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher* pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -241,10 +245,14 @@ void PrepareShutdown()
         pcoinsTip = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
+        delete pcoinsflusher;
+        pcoinsflusher = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        blockCache.Clear();
+        blockFileMapper.Clear();
         delete zerocoinDB;
         zerocoinDB = NULL;
         delete pSporkDB;
@@ -379,9 +387,16 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
+    strUsage += HelpMessageOpt("-assumevalid=<hex>", _("Skip script and zerocoin spend proof verification for the ancestors of this block, once it is in a best header chain with at least -minimumchainwork (0 to verify all, default: 0)"));
+    strUsage += HelpMessageOpt("-asyncflush", strprintf(_("Write the chainstate to disk on a background thread while blocks keep being connected (default: %u)"), DEFAULT_ASYNC_FLUSH));
+    strUsage += HelpMessageOpt("-blockcachesize=<n>", strprintf(_("Keep up to <n> MiB of recently read blocks in memory (0 to disable, default: %u)"), DEFAULT_BLOCK_CACHE_SIZE));
+#ifndef WIN32
+    strUsage += HelpMessageOpt("-blockmmap", strprintf(_("Read block files through memory mappings instead of file reads (64 bit systems only, default: %u)"), DEFAULT_BLOCK_MMAP));
+#endif
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-blocksizenotify=<cmd>", _("Execute command when the best block changes and its size is over (%s in cmd is replaced by block hash, %d with the block size)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 500));
+    strUsage += HelpMessageOpt("-coinsbyoutpoint", strprintf(_("Store the chainstate as one record per unspent output, converting an existing chainstate at startup. This cannot be undone without -reindex (default: %u)"), DEFAULT_COINS_BY_OUTPOINT));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), "squorum.conf"));
     if (mode == HMM_BITCOIND) {
 #if !defined(WIN32)
@@ -391,16 +406,22 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-loadsnapshot=<file>", _("Start from a chainstate snapshot written by dumptxoutset instead of the blocks below it, if the chainstate is empty. Requires -prune and -snapshothash"));
     strUsage += HelpMessageOpt("-maxreorg=<n>", strprintf(_("Set the Maximum reorg depth (default: %u)"), Params(CBaseChainParams::MAIN).MaxReorganizationDepth()));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-minimumchainwork=<hex>", _("Chain work the best header chain must have for -assumevalid to take effect (default: 0)"));
+    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script and zerocoin spend verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "squorum.pid"));
 #endif
+    strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode is incompatible with -txindex, -rescan and masternodes. "
+            "Warning: Reverting this setting requires re-downloading the entire blockchain. "
+            "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), (MIN_DISK_SPACE_FOR_BLOCK_FILES + 1024 * 1024 - 1) / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild block chain index from current blk000??.dat files") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-reindexaccumulators", _("Reindex the accumulator database") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-reindexmoneysupply", _("Reindex the SQR and zSQR money supply statistics") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-resync", _("Delete blockchain folders and resync from scratch") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-snapshothash=<hex>", _("Hash the -loadsnapshot file must have, as reported by dumptxoutset on a trusted node"));
 #if !defined(WIN32)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
@@ -423,15 +444,18 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), 125));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), 5000));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000));
+    strUsage += HelpMessageOpt("-msghandthreads=<n>", strprintf(_("Number of threads processing messages from peers, each peer is handled by one of them (1-%d, default: %d)"), MAX_MSGHAND_THREADS, DEFAULT_MSGHAND_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), 1));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
     strUsage += HelpMessageOpt("-peerbloomfilterszc", strprintf(_("Support the zerocoin light node protocol (default: %u)"), DEFAULT_PEERBLOOMFILTERS_ZC));
+    strUsage += HelpMessageOpt("-lightzsqrthreads=<n>", strprintf(_("Number of threads computing witnesses for zerocoin light nodes (1-%d, default: %d)"), MAX_LIGHT_ZSQR_THREADS, DEFAULT_LIGHT_ZSQR_THREADS));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), 9009, 19009));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), 1));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("How to wait for peer sockets to become ready, one of: %s. epoll allows more than %d connections (default: %s)"), GetSupportedSocketEventsModes(), FD_SETSIZE, DEFAULT_SOCKETEVENTS));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -501,7 +525,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf(_("Stop running after importing blocks from disk (default: %u)"), 0));
         strUsage += HelpMessageOpt("-sporkkey=<privkey>", _("Enable spork administration functionality with the appropriate private key."));
     }
-    std::string debugCategories = "addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, tor, mempool, net, proxy, http, libevent, squorum, (obfuscation, swiftx, masternode, mnpayments, mnbudget, zero, precompute, staking)"; // Don't translate these and qt below
+    std::string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, lock, rand, rpc, selectcoins, tor, mempool, net, proxy, http, libevent, squorum, (obfuscation, swiftx, masternode, mnpayments, mnbudget, zero, precompute, staking)"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
@@ -519,6 +543,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf(_("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default:%u)"), 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf(_("Require high priority for relaying free or low-fee transactions (default:%u)"), 1));
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf(_("Limit size of signature cache to <n> entries (default: %u)"), 50000));
+        strUsage += HelpMessageOpt("-maxzerocoinspendcachesize=<n>", strprintf(_("Limit size of the verified zerocoin spend proof cache to <n> entries (default: %u)"), DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in SQR/Kb) smaller than this are considered zero fee for relaying (default: %s)"), FormatMoney(::minRelayTxFee.GetFeePerK())));
@@ -565,6 +590,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-precomputecachelength=<n>", strprintf(_("Set the number of included blocks to precompute per cycle. (minimum: %d) (maximum: %d) (default: %d)"), MIN_PRECOMPUTE_LENGTH, MAX_PRECOMPUTE_LENGTH, DEFAULT_PRECOMPUTE_LENGTH));
     strUsage += HelpMessageOpt("-zsqrbackuppath=<dir|file>", _("Specify custom backup path to add a copy of any automatic zSQR backup. If set as dir, every backup generates a timestamped file. If set as file, will rewrite to that file every backup. If backuppath is set as well, 4 backups will happen"));
 #endif // ENABLE_WALLET
+    strUsage += HelpMessageOpt("-zerocoinfixedbasewindow=<n>", strprintf(_("Window size in bits of the precomputed tables used to verify zSQR spends, 0 to disable. Each extra bit roughly doubles the table memory (0-%u, default: %u)"), libzerocoin::MAX_FIXED_BASE_WINDOW_BITS, libzerocoin::DEFAULT_FIXED_BASE_WINDOW_BITS));
+    strUsage += HelpMessageOpt("-zerocoinproofthreads=<n>", strprintf(_("Set the number of threads computing the rounds of a single zSQR spend proof, when creating or verifying it (0 = one per core, 1 = no parallelism, max: %u, default: %u)"), libzerocoin::MAX_PROOF_THREADS, libzerocoin::DEFAULT_PROOF_THREADS));
     strUsage += HelpMessageOpt("-reindexzerocoin=<n>", strprintf(_("Delete all zerocoin spends and mints that have been recorded to the blockchain database and reindex them (0-1, default: %u)"), 0));
 
     strUsage += HelpMessageGroup(_("SwiftX options:"));
@@ -661,18 +688,7 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     // -reindex
     if (fReindex) {
         CImportingNow imp;
-        int nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE* file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(file, &pos);
-            nFile++;
-        }
+        ReindexBlockFiles();
         pblocktree->WriteReindexing(false);
         fReindex = false;
         LogPrintf("Reindexing finished\n");
@@ -876,6 +892,31 @@ bool AppInit2()
             LogPrintf("AppInit2 : parameter interaction: -enableswifttx=false -> setting -nSwiftTXDepth=0\n");
     }
 
+    // if using block pruning, then disable txindex, the zerocoin reindexes and wallet rescans need the old blocks too
+    if (GetArg("-prune", 0)) {
+        if (GetBoolArg("-txindex", false))
+            return InitError(_("Prune mode is incompatible with -txindex."));
+        if (SoftSetBoolArg("-txindex", false))
+            LogPrintf("AppInit2 : parameter interaction: -prune set -> setting -txindex=0\n");
+        if (GetBoolArg("-reindexzerocoin", false) || GetBoolArg("-reindexaccumulators", false) || GetBoolArg("-reindexmoneysupply", false))
+            return InitError(_("Prune mode is incompatible with -reindexzerocoin, -reindexaccumulators and -reindexmoneysupply."));
+#ifdef ENABLE_WALLET
+        if (GetBoolArg("-rescan", false))
+            return InitError(_("Rescans are not possible in pruned mode. You will need to use -reindex which will download the whole blockchain again."));
+#endif
+    }
+
+    // a node started from a snapshot has no blocks below it, as if they had been pruned
+    if (mapArgs.count("-loadsnapshot")) {
+        if (!GetArg("-prune", 0))
+            return InitError(_("-loadsnapshot requires -prune."));
+        if (GetBoolArg("-reindex", false))
+            return InitError(_("-loadsnapshot is incompatible with -reindex."));
+        std::string strSnapshotHash = GetArg("-snapshothash", "");
+        if (!IsHex(strSnapshotHash) || strSnapshotHash.size() != 64)
+            return InitError(strprintf(_("-loadsnapshot requires the 64 hex digit hash of the snapshot in -snapshothash, got '%s'"), strSnapshotHash));
+    }
+
     if (mapArgs.count("-reservebalance")) {
         if (!ParseMoney(mapArgs["-reservebalance"], nReserveBalance)) {
             InitError(_("Invalid amount for -reservebalance=<amount>"));
@@ -883,10 +924,16 @@ bool AppInit2()
         }
     }
 
+    std::string strSocketEvents = GetArg("-socketevents", DEFAULT_SOCKETEVENTS);
+    if (!SetSocketEventsMode(strSocketEvents))
+        return InitError(strprintf(_("Invalid -socketevents mode '%s', supported: %s"), strSocketEvents, GetSupportedSocketEventsModes()));
+
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", 125);
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+    if (socketEventsMode == SOCKETEVENTS_SELECT)
+        nMaxConnections = std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS));
+    nMaxConnections = std::max(nMaxConnections, 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -922,6 +969,29 @@ bool AppInit2()
     fCheckBlockIndex = GetBoolArg("-checkblockindex", Params().DefaultConsistencyChecks());
     Checkpoints::fEnabled = GetBoolArg("-checkpoints", true);
 
+    std::string strAssumeValid = GetArg("-assumevalid", "0");
+    std::string strMinimumChainWork = GetArg("-minimumchainwork", "0");
+    if (!IsHex(strAssumeValid) || strAssumeValid.size() > 64)
+        return InitError(strprintf(_("Invalid block hash for -assumevalid: '%s'"), strAssumeValid));
+    if (!IsHex(strMinimumChainWork) || strMinimumChainWork.size() > 64)
+        return InitError(strprintf(_("Invalid amount of chain work for -minimumchainwork: '%s'"), strMinimumChainWork));
+    hashAssumeValid = uint256(strAssumeValid);
+    nMinimumChainWork = uint256(strMinimumChainWork);
+    if (hashAssumeValid != 0)
+        LogPrintf("Assuming ancestors of block %s have valid scripts and zerocoin spend proofs\n", hashAssumeValid.GetHex());
+
+    // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
+    int64_t nSignedPruneTarget = GetArg("-prune", 0) * 1024 * 1024;
+    if (nSignedPruneTarget < 0)
+        return InitError(_("Prune cannot be configured with a negative value."));
+    nPruneTarget = (uint64_t)nSignedPruneTarget;
+    if (nPruneTarget) {
+        if (nPruneTarget < MIN_DISK_SPACE_FOR_BLOCK_FILES)
+            return InitError(strprintf(_("Prune configured below the minimum of %d MiB.  Please use a higher number."), (MIN_DISK_SPACE_FOR_BLOCK_FILES + 1024 * 1024 - 1) / 1024 / 1024));
+        LogPrintf("Prune configured to target %uMiB on disk for block and undo files.\n", nPruneTarget / 1024 / 1024);
+        fPruneMode = true;
+    }
+
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
     if (nScriptCheckThreads <= 0)
@@ -931,6 +1001,11 @@ bool AppInit2()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    int nFixedBaseWindowBits = GetArg("-zerocoinfixedbasewindow", libzerocoin::DEFAULT_FIXED_BASE_WINDOW_BITS);
+    libzerocoin::SetFixedBaseWindowBits(std::max(nFixedBaseWindowBits, 0));
+    int nProofThreads = GetArg("-zerocoinproofthreads", libzerocoin::DEFAULT_PROOF_THREADS);
+    libzerocoin::SetProofThreads(std::max(nProofThreads, 0));
+
     fServer = GetBoolArg("-server", false);
     setvbuf(stdout, NULL, _IOLBF, 0); /// ***TODO*** do we still need this after -printtoconsole is gone?
 
@@ -1066,10 +1141,15 @@ bool AppInit2()
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for script and zerocoin spend verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads per zerocoin spend proof\n", libzerocoin::GetProofThreads());
     if (nScriptCheckThreads) {
         for (int i = 0; i < nScriptCheckThreads - 1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i = 0; i < nScriptCheckThreads - 1; i++)
+            threadGroup.create_thread(&ThreadZerocoinSpendCheck);
+        for (int i = 0; i < nScriptCheckThreads - 1; i++)
+            threadGroup.create_thread(&ThreadCoinsPrefetch);
     }
 
     if (mapArgs.count("-sporkkey")) // spork priv key
@@ -1407,7 +1487,12 @@ bool AppInit2()
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache; // the rest goes to the in-memory coins cache
+
+    // blocks read from disk get their own cache, on top of -dbcache
+    blockCache.SetMaxSize(std::max<int64_t>(GetArg("-blockcachesize", DEFAULT_BLOCK_CACHE_SIZE), 0) << 20);
+    if (GetBoolArg("-blockmmap", DEFAULT_BLOCK_MMAP) && !blockFileMapper.SetEnabled(true))
+        LogPrintf("Memory mapped block files are not supported on this system, ignoring -blockmmap\n");
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1421,8 +1506,10 @@ bool AppInit2()
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
-                delete pcoinsdbview;
                 delete pcoinscatcher;
+                delete pcoinsflusher;
+                pcoinsflusher = NULL;
+                delete pcoinsdbview;
                 delete pblocktree;
                 delete zerocoinDB;
                 delete pSporkDB;
@@ -1433,11 +1520,51 @@ bool AppInit2()
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                if (GetBoolArg("-asyncflush", DEFAULT_ASYNC_FLUSH)) {
+                    pcoinsflusher = new CCoinsViewFlusher(pcoinsdbview);
+                    pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsflusher);
+                } else {
+                    pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                }
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
-                if (fReindex)
+                // A snapshot import that was interrupted leaves incomplete databases behind
+                bool fSnapshotLoading = false;
+                if (pblocktree->ReadFlag("snapshotloading", fSnapshotLoading) && fSnapshotLoading) {
+                    strLoadError = _("Loading the chainstate snapshot was interrupted. You need to restart with -resync");
+                    break;
+                }
+
+                if (fReindex) {
                     pblocktree->WriteReindexing(true);
+                    // If we're reindexing in prune mode, wipe away unusable block files and all undo data files
+                    if (fPruneMode)
+                        CleanupBlockRevFiles();
+                }
+
+                // Convert the chainstate to per-output records, or finish an interrupted conversion
+                if (GetBoolArg("-coinsbyoutpoint", DEFAULT_COINS_BY_OUTPOINT) || pcoinsdbview->IsOutpointLayout()) {
+                    uiInterface.InitMessage(_("Upgrading chainstate database..."));
+                    if (!pcoinsdbview->UpgradeToOutpoints()) {
+                        strLoadError = _("Error upgrading chainstate database");
+                        break;
+                    }
+                }
+
+                // Start from a snapshot, unless the chainstate was already loaded by an earlier start
+                if (mapArgs.count("-loadsnapshot")) {
+                    if (pcoinsdbview->GetBestBlock() == 0) {
+                        uiInterface.InitMessage(_("Loading chainstate snapshot..."));
+                        boost::filesystem::path pathSnapshot(mapArgs["-loadsnapshot"]);
+                        if (!pathSnapshot.is_complete()) pathSnapshot = GetDataDir() / pathSnapshot;
+                        CSnapshotInfo info;
+                        std::string strError;
+                        if (!LoadChainstateSnapshot(pathSnapshot, uint256(mapArgs["-snapshothash"]), info, strError))
+                            return InitError(_("Error loading chainstate snapshot") + ": " + strError);
+                    } else {
+                        LogPrintf("The chainstate is not empty, ignoring -loadsnapshot\n");
+                    }
+                }
 
                 // sQuorum: load previous sessions sporks if we have them.
                 uiInterface.InitMessage(_("Loading sporks..."));
@@ -1467,6 +1594,13 @@ bool AppInit2()
                     strLoadError = _("You need to rebuild the database using -reindex to change -txindex");
                     break;
                 }
+
+                // Check for changed -prune state. What we are concerned about is a user who has pruned blocks
+                // in the past, but is now trying to run unpruned.
+                if (fHavePruned && !fPruneMode) {
+                    strLoadError = _("You need to rebuild the database using -reindex to go back to unpruned mode.  This will redownload the entire blockchain");
+                    break;
+                }
                 /* NOTE: GJH inappropriate for sQuorum
                 // Populate list of invalid/fraudulent outpoints that are banned from the chain
                 invalid_out::LoadOutpoints();
@@ -1682,6 +1816,17 @@ bool AppInit2()
                 pindexRescan = chainActive.Genesis();
         }
         if (chainActive.Tip() && chainActive.Tip() != pindexRescan) {
+            // We can't rescan beyond pruned blocks, stop and throw an error. This might happen
+            // if an old wallet is loaded in a pruned node, or the wallet was disabled for a while.
+            if (fPruneMode) {
+                CBlockIndex* block = chainActive.Tip();
+                while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA) && block->pprev->nTx > 0 && pindexRescan != block)
+                    block = block->pprev;
+
+                if (pindexRescan != block)
+                    return InitError(_("Prune: last wallet synchronisation goes beyond pruned data. You need to -reindex (download the whole blockchain again in case of pruned node)"));
+            }
+
             uiInterface.InitMessage(_("Rescanning..."));
             LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
             nStart = GetTimeMillis();
@@ -1728,6 +1873,19 @@ bool AppInit2()
 #else  // ENABLE_WALLET
     LogPrintf("No wallet compiled in!\n");
 #endif // !ENABLE_WALLET
+
+    // if pruning, unset the service bit and perform the initial blockstore prune
+    // after any wallet rescanning has taken place.
+    if (fPruneMode) {
+        // Light client zerocoin witnesses are computed from old blocks too
+        LogPrintf("Unsetting NODE_NETWORK and NODE_BLOOM_LIGHT_ZC on prune mode\n");
+        nLocalServices &= ~(NODE_NETWORK | NODE_BLOOM_LIGHT_ZC);
+        if (!fReindex) {
+            uiInterface.InitMessage(_("Pruning blockstore..."));
+            PruneAndFlush();
+        }
+    }
+
     // ********************************************************* Step 9: import blocks
 
     if (mapArgs.count("-blocknotify"))
@@ -1807,6 +1965,10 @@ bool AppInit2()
     fMasterNode = GetBoolArg("-masternode", false);
 
     if ((fMasterNode || masternodeConfig.getCount() > -1) && fTxIndex == false) {
+        // Masternode collateral is found in the coins view, but budget proposal fees are spent
+        // to OP_RETURN outputs, which only the transaction index can find once their block is pruned
+        if (fPruneMode)
+            return InitError(_("Masternodes check budget proposal fees with the transaction index, so they cannot run with -prune or -loadsnapshot."));
         return InitError("Enabling Masternode support requires turning on transaction indexing."
                          "Please add txindex=1 to your configuration and start with -reindex");
     }
@@ -445,17 +445,25 @@ bool initStakeInput(const CBlock block, std::unique_ptr<CStakeInput>& stake, int
         // First try finding the previous transaction in database
         uint256 hashBlock;
         CTransaction txPrev;
-        if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true))
-            return error("%s : INFO: read txPrev failed, tx id prev: %s, block id %s",
-                         __func__, txin.prevout.hash.GetHex(), block.GetHash().GetHex());
+        CSqrStake* sqrInput = new CSqrStake();
+        std::unique_ptr<CStakeInput> sqrStake(sqrInput);
+        if (GetTransaction(txin.prevout.hash, txPrev, hashBlock, true)) {
+            sqrInput->SetInput(txPrev, txin.prevout.n);
+        } else {
+            // The block of an unspent output may have been pruned, the output itself is still in the coins view
+            LOCK(cs_main);
+            const CCoins* coins = fHavePruned ? pcoinsTip->AccessCoins(txin.prevout.hash) : NULL;
+            if (!coins || !coins->IsAvailable(txin.prevout.n) || coins->nHeight > chainActive.Height())
+                return error("%s : INFO: read txPrev failed, tx id prev: %s, block id %s",
+                             __func__, txin.prevout.hash.GetHex(), block.GetHash().GetHex());
+            sqrInput->SetInput(txin.prevout.hash, coins->vout[txin.prevout.n], txin.prevout.n, chainActive[coins->nHeight]);
+        }
 
         //verify signature and script
-        if (!VerifyScript(txin.scriptSig, txPrev.vout[txin.prevout.n].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0)))
+        if (!VerifyScript(txin.scriptSig, sqrInput->GetTxOutFrom().scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0)))
             return error("%s : VerifySignature failed on coinstake %s", __func__, tx.GetHash().ToString().c_str());
 
-        CSqrStake* sqrInput = new CSqrStake();
-        sqrInput->SetInput(txPrev, txin.prevout.n);
-        stake = std::unique_ptr<CStakeInput>(sqrInput);
+        stake = std::move(sqrStake);
     }
     return true;
 }
@@ -49,6 +49,12 @@ public:
         batch.Put(slKey, slValue);
     }
 
+    //! Queue a record whose key and value are serialized already
+    void WriteRaw(const leveldb::Slice& slKey, const leveldb::Slice& slValue)
+    {
+        batch.Put(slKey, slValue);
+    }
+
     template <typename K>
     void Erase(const K& key)
     {
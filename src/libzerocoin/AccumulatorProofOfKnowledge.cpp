@@ -120,14 +120,24 @@ bool AccumulatorProofOfKnowledge:: Verify(const Accumulator& a, const CBigNum& v
 
 	CBigNum c = CBigNum(hasher.GetHash()); //this hash should be of length k_prime bits
 
-	CBigNum st_1_prime = (valueOfCommitmentToCoin.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * sg.pow_mod(s_alpha, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_phi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_2_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * ((valueOfCommitmentToCoin * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(s_gamma, params->accumulatorPoKCommitmentGroup.modulus)) * sh.pow_mod(s_psi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_3_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * (sg * valueOfCommitmentToCoin).pow_mod(s_sigma, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_xi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-
-	CBigNum t_1_prime = (C_r.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_zeta, params->accumulatorModulus) * g_n.pow_mod(s_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_2_prime = (C_e.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_eta, params->accumulatorModulus) * g_n.pow_mod(s_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_3_prime = ((a.getValue()).pow_mod(c, params->accumulatorModulus) * C_u.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
-	CBigNum t_4_prime = (C_r.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_delta, params->accumulatorModulus)) * ((g_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
+	CBigNum st_1_prime, st_2_prime, st_3_prime, t_1_prime, t_2_prime, t_3_prime, t_4_prime;
+	try {
+		// Each equation is a product of powers, computed with one simultaneous exponentiation
+		const CBigNum& modulusPoK = params->accumulatorPoKCommitmentGroup.modulus;
+		st_1_prime = CBigNum::multi_pow_mod({valueOfCommitmentToCoin, sg, sh}, {c, s_alpha, s_phi}, modulusPoK);
+		st_2_prime = CBigNum::multi_pow_mod({sg, valueOfCommitmentToCoin * sg.inverse(modulusPoK), sh}, {c, s_gamma, s_psi}, modulusPoK);
+		st_3_prime = CBigNum::multi_pow_mod({sg, sg * valueOfCommitmentToCoin, sh}, {c, s_sigma, s_xi}, modulusPoK);
+
+		const CBigNum& modulusAcc = params->accumulatorModulus;
+		const CBigNum h_n_inverse = h_n.inverse(modulusAcc);
+		t_1_prime = CBigNum::multi_pow_mod({C_r, h_n, g_n}, {c, s_zeta, s_epsilon}, modulusAcc);
+		t_2_prime = CBigNum::multi_pow_mod({C_e, h_n, g_n}, {c, s_eta, s_alpha}, modulusAcc);
+		t_3_prime = CBigNum::multi_pow_mod({a.getValue(), C_u, h_n_inverse}, {c, s_alpha, s_beta}, modulusAcc);
+		t_4_prime = CBigNum::multi_pow_mod({C_r, h_n_inverse, g_n.inverse(modulusAcc)}, {s_alpha, s_delta, s_beta}, modulusAcc);
+	} catch (bignum_error& e) {
+		// A base without inverse raised to a negative exponent
+		return false;
+	}
 
 	bool result_st1 = (st_1 == st_1_prime);
 	bool result_st2 = (st_2 == st_2_prime);
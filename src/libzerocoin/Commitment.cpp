@@ -125,15 +125,17 @@ bool CommitmentProofOfKnowledge::Verify(const CBigNum& A, const CBigNum& B) cons
 		return false;
 	}
 
-	// Compute T1 = g1^S1 * h1^S2 * inverse(A^{challenge}) mod p1
-	CBigNum T1 = A.pow_mod(this->challenge, ap->modulus).inverse(ap->modulus).mul_mod(
-	                (ap->g.pow_mod(S1, ap->modulus).mul_mod(ap->h.pow_mod(S2, ap->modulus), ap->modulus)),
-	                ap->modulus);
-
-	// Compute T2 = g2^S1 * h2^S3 * inverse(B^{challenge}) mod p2
-	CBigNum T2 = B.pow_mod(this->challenge, bp->modulus).inverse(bp->modulus).mul_mod(
-	                (bp->g.pow_mod(S1, bp->modulus).mul_mod(bp->h.pow_mod(S3, bp->modulus), bp->modulus)),
-	                bp->modulus);
+	CBigNum T1, T2;
+	try {
+		// Compute T1 = g1^S1 * h1^S2 * inverse(A^{challenge}) mod p1
+		T1 = CBigNum::multi_pow_mod({ap->g, ap->h, A}, {S1, S2, -this->challenge}, ap->modulus);
+
+		// Compute T2 = g2^S1 * h2^S3 * inverse(B^{challenge}) mod p2
+		T2 = CBigNum::multi_pow_mod({bp->g, bp->h, B}, {S1, S3, -this->challenge}, bp->modulus);
+	} catch (bignum_error& e) {
+		// A or B have no inverse
+		return false;
+	}
 
 	// Hash T1 and T2 along with all of the public parameters
 	CBigNum computedChallenge = calculateChallenge(A, B, T1, T2);
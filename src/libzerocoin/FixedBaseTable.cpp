@@ -0,0 +1,94 @@
+/**
+ * @file       FixedBaseTable.cpp
+ *
+ * @brief      Fixed-base exponentiation tables for the Zerocoin library.
+ *
+ * @copyright  Copyright 2020 The sQuorum developers
+ * @license    This project is released under the MIT license.
+ **/
+// Copyright (c) 2020 The sQuorum developers
+
+#include <algorithm>
+#include <atomic>
+#include "FixedBaseTable.h"
+
+namespace libzerocoin {
+
+static std::atomic<unsigned int> nFixedBaseWindowBits(DEFAULT_FIXED_BASE_WINDOW_BITS);
+
+void SetFixedBaseWindowBits(unsigned int nWindowBits)
+{
+    nFixedBaseWindowBits = std::min(nWindowBits, MAX_FIXED_BASE_WINDOW_BITS);
+}
+
+unsigned int GetFixedBaseWindowBits()
+{
+    return nFixedBaseWindowBits;
+}
+
+FixedBaseTable::FixedBaseTable(const CBigNum& base, const CBigNum& modulus, const CBigNum& order, unsigned int nWindowBits):
+    base(base), modulus(modulus), order(order), nWindowBits(nWindowBits), nWindows(0), fValid(false)
+{
+    // Reducing the exponent by the order is only sound if base really has that order
+    if (nWindowBits == 0 || nWindowBits > MAX_FIXED_BASE_WINDOW_BITS || order <= CBigNum(0) ||
+            !base.pow_mod_public(order, modulus).isOne())
+        return;
+
+    const unsigned int nDigits = (1U << nWindowBits) - 1;
+    nWindows = (order.bitSize() + nWindowBits - 1) / nWindowBits;
+    vPowers.reserve(nWindows * nDigits);
+
+    // power = base^(2^(w*i))
+    CBigNum power = base % modulus;
+    for (unsigned int i = 0; i < nWindows; i++) {
+        vPowers.push_back(power);
+        for (unsigned int d = 2; d <= nDigits; d++)
+            vPowers.push_back(vPowers.back().mul_mod(power, modulus));
+        power = vPowers.back().mul_mod(power, modulus);
+    }
+    fValid = true;
+}
+
+CBigNum FixedBaseTable::pow_mod(const CBigNum& e) const
+{
+    if (!fValid)
+        return base.pow_mod_public(e, modulus);
+
+    // base^e = base^(e mod order), which also takes care of negative exponents
+    const CBigNum x = e % order;
+    const unsigned int nDigits = (1U << nWindowBits) - 1;
+    CBigNum ret = CBigNum(1) % modulus;
+    for (unsigned int i = 0; i < nWindows; i++) {
+        unsigned int d = 0;
+        for (unsigned int j = 0; j < nWindowBits; j++) {
+            if (x.isBitSet(i * nWindowBits + j))
+                d |= 1U << j;
+        }
+        if (d)
+            ret = ret.mul_mod(vPowers[i * nDigits + d - 1], modulus);
+    }
+    return ret;
+}
+
+size_t FixedBaseTable::MemoryUsage() const
+{
+    size_t nBytes = 0;
+    for (const CBigNum& bn : vPowers)
+        nBytes += (bn.bitSize() + 7) / 8;
+    return nBytes;
+}
+
+SerialNumberSoKTables::SerialNumberSoKTables(const IntegerGroupParams& coinCommitmentGroup, const IntegerGroupParams& serialNumberSoKCommitmentGroup, unsigned int nWindowBits):
+    a(coinCommitmentGroup.g, serialNumberSoKCommitmentGroup.groupOrder, coinCommitmentGroup.groupOrder, nWindowBits),
+    b(coinCommitmentGroup.h, serialNumberSoKCommitmentGroup.groupOrder, coinCommitmentGroup.groupOrder, nWindowBits),
+    g(serialNumberSoKCommitmentGroup.g, serialNumberSoKCommitmentGroup.modulus, serialNumberSoKCommitmentGroup.groupOrder, nWindowBits),
+    h(serialNumberSoKCommitmentGroup.h, serialNumberSoKCommitmentGroup.modulus, serialNumberSoKCommitmentGroup.groupOrder, nWindowBits)
+{
+}
+
+size_t SerialNumberSoKTables::MemoryUsage() const
+{
+    return a.MemoryUsage() + b.MemoryUsage() + g.MemoryUsage() + h.MemoryUsage();
+}
+
+} /* namespace libzerocoin */
@@ -0,0 +1,91 @@
+/**
+ * @file       FixedBaseTable.h
+ *
+ * @brief      Fixed-base exponentiation tables for the Zerocoin library.
+ *
+ * @copyright  Copyright 2020 The sQuorum developers
+ * @license    This project is released under the MIT license.
+ **/
+// Copyright (c) 2020 The sQuorum developers
+
+#ifndef FIXEDBASETABLE_H_
+#define FIXEDBASETABLE_H_
+
+#include <vector>
+#include "bignum.h"
+#include "Params.h"
+
+namespace libzerocoin {
+
+/** Default window size (in bits) of the fixed-base tables. 0 disables the tables. */
+static const unsigned int DEFAULT_FIXED_BASE_WINDOW_BITS = 4;
+/** Largest window size accepted for the fixed-base tables */
+static const unsigned int MAX_FIXED_BASE_WINDOW_BITS = 8;
+
+/** Sets the window size used for tables built from now on. 0 disables the tables. */
+void SetFixedBaseWindowBits(unsigned int nWindowBits);
+unsigned int GetFixedBaseWindowBits();
+
+/**
+ * Precomputed powers of a fixed base of known order.
+ *
+ * Stores base^(d * 2^(w*i)) mod modulus for every window i of the exponent
+ * and every non zero window digit d, so that an exponentiation costs one
+ * modular multiplication per window instead of a full square-and-multiply.
+ *
+ * @warning Lookups are indexed by the exponent digits and do not run in
+ * constant time. Only use for public exponents.
+ */
+class FixedBaseTable {
+public:
+    /**
+     * @param base the fixed base
+     * @param modulus the modulus
+     * @param order the order of base mod modulus. Exponents are reduced by it.
+     * @param nWindowBits the window size in bits
+     */
+    FixedBaseTable(const CBigNum& base, const CBigNum& modulus, const CBigNum& order, unsigned int nWindowBits);
+
+    /**
+     * modular exponentiation: base^e mod modulus.
+     * Gives the same result as base.pow_mod(e, modulus) for any e.
+     * @param e exponent, may be negative
+     */
+    CBigNum pow_mod(const CBigNum& e) const;
+
+    /** @return the number of bytes held by the precomputed powers */
+    size_t MemoryUsage() const;
+
+private:
+    CBigNum base;
+    CBigNum modulus;
+    CBigNum order;
+    unsigned int nWindowBits;
+    unsigned int nWindows;
+    //! False if base^order != 1, in which case every exponentiation falls back to pow_mod_public
+    bool fValid;
+    //! vPowers[i * (2^w - 1) + d - 1] = base^(d * 2^(w*i)) mod modulus
+    std::vector<CBigNum> vPowers;
+};
+
+/**
+ * Fixed-base tables for the four generators raised in the serial number
+ * signature of knowledge.
+ */
+class SerialNumberSoKTables {
+public:
+    SerialNumberSoKTables(const IntegerGroupParams& coinCommitmentGroup, const IntegerGroupParams& serialNumberSoKCommitmentGroup, unsigned int nWindowBits);
+
+    //! coinCommitmentGroup.g and .h mod serialNumberSoKCommitmentGroup.groupOrder
+    FixedBaseTable a;
+    FixedBaseTable b;
+    //! serialNumberSoKCommitmentGroup.g and .h mod serialNumberSoKCommitmentGroup.modulus
+    FixedBaseTable g;
+    FixedBaseTable h;
+
+    size_t MemoryUsage() const;
+};
+
+} /* namespace libzerocoin */
+
+#endif /* FIXEDBASETABLE_H_ */
@@ -0,0 +1,51 @@
+/**
+ * @file       ParallelVerifier.cpp
+ *
+ * @brief      Parallel verification of coin spends for the Zerocoin library.
+ *
+ * @copyright  Copyright 2020 The sQuorum developers
+ * @license    This project is released under the MIT license.
+ **/
+// Copyright (c) 2020 The sQuorum developers
+
+#include <atomic>
+#include "ParallelVerifier.h"
+#include "ProofWorkers.h"
+
+namespace libzerocoin {
+
+void CoinSpendParallelVerifier::Add(const CoinSpend& spend, const Accumulator& accumulator)
+{
+    vSpends.push_back(spend);
+    vAccumulators.push_back(accumulator);
+}
+
+bool CoinSpendParallelVerifier::Verify(std::vector<size_t>* pvInvalid) const
+{
+    std::vector<char> vValid(vSpends.size(), false);
+    std::atomic<bool> fFailed(false);
+
+    ParallelFor(vSpends.size(), [&](uint32_t i) {
+        // Once a spend failed the others only matter to find every invalid one
+        if (fFailed && !pvInvalid)
+            return;
+        try {
+            vValid[i] = vSpends[i].Verify(vAccumulators[i], fVerifyParams);
+        } catch (const std::exception&) {
+            vValid[i] = false;
+        }
+        if (!vValid[i])
+            fFailed = true;
+    });
+
+    if (pvInvalid) {
+        pvInvalid->clear();
+        for (size_t i = 0; i < vValid.size(); i++) {
+            if (!vValid[i])
+                pvInvalid->push_back(i);
+        }
+    }
+    return !fFailed;
+}
+
+} /* namespace libzerocoin */
@@ -0,0 +1,62 @@
+/**
+ * @file       ParallelVerifier.h
+ *
+ * @brief      Parallel verification of coin spends for the Zerocoin library.
+ *
+ * @copyright  Copyright 2020 The sQuorum developers
+ * @license    This project is released under the MIT license.
+ **/
+// Copyright (c) 2020 The sQuorum developers
+
+#ifndef PARALLELVERIFIER_H_
+#define PARALLELVERIFIER_H_
+
+#include <vector>
+#include "Accumulator.h"
+#include "CoinSpend.h"
+
+namespace libzerocoin {
+
+/**
+ * Verifies a set of coin spends, such as all the spends of a block, in parallel.
+ *
+ * Each spend is checked on its own with CoinSpend::Verify(), the spends being
+ * spread over the proof workers. Verification stops at the first invalid spend
+ * unless the caller asks for every invalid one.
+ *
+ * This is not batch verification: the proof equations are not combined into a
+ * single random linear combination. Both groups they live in have elements of
+ * small order anyone can compute (-1 mod N, the cofactor of the commitment
+ * group), which would let a combined check accept proofs that
+ * CoinSpend::Verify() rejects.
+ */
+class CoinSpendParallelVerifier {
+public:
+    /**
+     * @param fVerifyParams passed to CoinSpend::Verify() for every spend
+     */
+    CoinSpendParallelVerifier(bool fVerifyParams = true) : fVerifyParams(fVerifyParams) {}
+
+    /** Adds a spend, to be verified against accumulator */
+    void Add(const CoinSpend& spend, const Accumulator& accumulator);
+
+    size_t size() const { return vSpends.size(); }
+
+    /**
+     * Verifies every spend added.
+     *
+     * @param[out] pvInvalid if not NULL, receives the positions of all the
+     * invalid spends, in the order they were added
+     * @return true if all the spends verify
+     */
+    bool Verify(std::vector<size_t>* pvInvalid = NULL) const;
+
+private:
+    bool fVerifyParams;
+    std::vector<CoinSpend> vSpends;
+    std::vector<Accumulator> vAccumulators;
+};
+
+} /* namespace libzerocoin */
+
+#endif /* PARALLELVERIFIER_H_ */
@@ -15,6 +15,8 @@
 
 #include "Params.h"
 #include "ParamGeneration.h"
+#include "FixedBaseTable.h"
+#include "util.h"
 
 namespace libzerocoin {
 
@@ -32,6 +34,20 @@ ZerocoinParams::ZerocoinParams(CBigNum N, uint32_t securityLevel) {
 	this->initialized = true;
 }
 
+const SerialNumberSoKTables* ZerocoinParams::GetSerialNumberSoKTables() const {
+	// Not before the groups are known, nor while the tables are disabled
+	if (!initialized || GetFixedBaseWindowBits() == 0)
+		return nullptr;
+
+	SerialNumberSoKTablesOnce& once = *serialNumberSoKTables;
+	std::call_once(once.flag, [&]() {
+		once.tables = std::make_shared<const SerialNumberSoKTables>(coinCommitmentGroup, serialNumberSoKCommitmentGroup, GetFixedBaseWindowBits());
+		LogPrintf("%s : built %u-bit window fixed-base tables, %u kB\n", __func__, GetFixedBaseWindowBits(),
+				once.tables->MemoryUsage() / 1024);
+	});
+	return once.tables.get();
+}
+
 AccumulatorAndProofParams::AccumulatorAndProofParams() {
 	this->initialized = false;
 }
@@ -16,11 +16,15 @@
 #ifndef PARAMS_H_
 #define PARAMS_H_
 
+#include <memory>
+#include <mutex>
 #include "bignum.h"
 #include "ZerocoinDefines.h"
 
 namespace libzerocoin {
 
+class SerialNumberSoKTables;
+
 class IntegerGroupParams {
 public:
   /** @brief Integer group class, default constructor
@@ -206,6 +210,14 @@ public:
    */
   uint32_t zkp_hash_len;
 
+  /**
+   * Fixed-base exponentiation tables for the generators of the serial
+   * number signature of knowledge. Built once on first use, then read
+   * without locking. Never serialized.
+   * @return the tables, or NULL if they are disabled
+   */
+  const SerialNumberSoKTables* GetSerialNumberSoKTables() const;
+
   ADD_SERIALIZE_METHODS;
   template <typename Stream, typename Operation>  inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
       READWRITE(initialized);
@@ -215,6 +227,14 @@ public:
       READWRITE(zkp_iterations);
       READWRITE(zkp_hash_len);
   }
+
+private:
+  //! The tables and the flag they are built under, shared by copies of these parameters
+  struct SerialNumberSoKTablesOnce {
+      std::once_flag flag;
+      std::shared_ptr<const SerialNumberSoKTables> tables;
+  };
+  std::shared_ptr<SerialNumberSoKTablesOnce> serialNumberSoKTables = std::make_shared<SerialNumberSoKTablesOnce>();
 };
 
 } /* namespace libzerocoin */
@@ -0,0 +1,175 @@
+/**
+ * @file       ProofWorkers.cpp
+ *
+ * @brief      Worker pool for the independent rounds of the Zerocoin proofs.
+ *
+ * @copyright  Copyright 2020 The sQuorum developers
+ * @license    This project is released under the MIT license.
+ **/
+// Copyright (c) 2020 The sQuorum developers
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ProofWorkers.h"
+#include "util.h"
+
+namespace libzerocoin {
+
+static std::atomic<unsigned int> nProofThreads(DEFAULT_PROOF_THREADS);
+
+void SetProofThreads(unsigned int nThreads)
+{
+    nProofThreads = std::min(nThreads, MAX_PROOF_THREADS);
+}
+
+unsigned int GetProofThreads()
+{
+    unsigned int nThreads = nProofThreads;
+    if (nThreads == 0)
+        nThreads = std::min(std::max(std::thread::hardware_concurrency(), 1U), MAX_PROOF_THREADS);
+    return nThreads;
+}
+
+namespace {
+
+/** One ParallelFor() call */
+struct ProofJob {
+    const std::function<void(uint32_t)>* fn;
+    uint32_t nCount;
+    //! Next index to hand out
+    std::atomic<uint32_t> nNext;
+    //! Set once a call threw: the indices not yet started are skipped
+    std::atomic<bool> fAbort;
+    //! Indices completed, guarded by the pool mutex
+    uint32_t nDone;
+    //! Workers currently running indices of this job, guarded by the pool mutex
+    unsigned int nActive;
+    //! First exception thrown by fn, guarded by the pool mutex
+    std::exception_ptr error;
+
+    ProofJob(const std::function<void(uint32_t)>& fnIn, uint32_t nCountIn) : fn(&fnIn), nCount(nCountIn), nNext(0), fAbort(false), nDone(0), nActive(0) {}
+};
+
+class ProofWorkerPool {
+public:
+    ProofWorkerPool() : fShutdown(false) {}
+
+    ~ProofWorkerPool()
+    {
+        {
+            std::unique_lock<std::mutex> lock(cs);
+            fShutdown = true;
+        }
+        cvWork.notify_all();
+        for (std::thread& t : vThreads)
+            t.join();
+    }
+
+    void Run(ProofJob& job, unsigned int nWorkers)
+    {
+        {
+            std::unique_lock<std::mutex> lock(cs);
+            while (vThreads.size() < nWorkers)
+                vThreads.emplace_back(&ProofWorkerPool::Loop, this);
+            queue.push_back(&job);
+        }
+        cvWork.notify_all();
+
+        Work(job);
+
+        std::unique_lock<std::mutex> lock(cs);
+        while (job.nDone < job.nCount || job.nActive > 0)
+            cvDone.wait(lock);
+        // Workers never touch a job once it left the queue
+        std::deque<ProofJob*>::iterator it = std::find(queue.begin(), queue.end(), &job);
+        if (it != queue.end())
+            queue.erase(it);
+        lock.unlock();
+
+        if (job.error)
+            std::rethrow_exception(job.error);
+    }
+
+private:
+    std::mutex cs;
+    std::condition_variable cvWork;
+    std::condition_variable cvDone;
+    std::deque<ProofJob*> queue;
+    std::vector<std::thread> vThreads;
+    bool fShutdown;
+
+    /** Runs indices of job until none are left */
+    void Work(ProofJob& job)
+    {
+        uint32_t nDone = 0;
+        std::exception_ptr error;
+        for (uint32_t i = job.nNext++; i < job.nCount; i = job.nNext++) {
+            if (!job.fAbort) {
+                try {
+                    (*job.fn)(i);
+                } catch (...) {
+                    if (!error)
+                        error = std::current_exception();
+                    job.fAbort = true;
+                }
+            }
+            nDone++;
+        }
+
+        std::unique_lock<std::mutex> lock(cs);
+        if (error && !job.error)
+            job.error = error;
+        job.nDone += nDone;
+        if (job.nDone == job.nCount)
+            cvDone.notify_all();
+    }
+
+    void Loop()
+    {
+        RenameThread("squorum-zkproof");
+        std::unique_lock<std::mutex> lock(cs);
+        while (true) {
+            while (!fShutdown && queue.empty())
+                cvWork.wait(lock);
+            if (fShutdown)
+                return;
+
+            ProofJob* job = queue.front();
+            if (job->nNext >= job->nCount) {
+                // Every index is handed out, leave the rest to the threads running them
+                queue.pop_front();
+                continue;
+            }
+            job->nActive++;
+            lock.unlock();
+            Work(*job);
+            lock.lock();
+            job->nActive--;
+            cvDone.notify_all();
+        }
+    }
+};
+
+} // anon namespace
+
+void ParallelFor(uint32_t nCount, const std::function<void(uint32_t)>& fn)
+{
+    const unsigned int nThreads = GetProofThreads();
+    if (nThreads <= 1 || nCount <= 1) {
+        for (uint32_t i = 0; i < nCount; i++)
+            fn(i);
+        return;
+    }
+
+    static ProofWorkerPool pool;
+    ProofJob job(fn, nCount);
+    pool.Run(job, std::min(nThreads, nCount) - 1);
+}
+
+} /* namespace libzerocoin */
@@ -0,0 +1,45 @@
+/**
+ * @file       ProofWorkers.h
+ *
+ * @brief      Worker pool for the independent rounds of the Zerocoin proofs.
+ *
+ * @copyright  Copyright 2020 The sQuorum developers
+ * @license    This project is released under the MIT license.
+ **/
+// Copyright (c) 2020 The sQuorum developers
+
+#ifndef PROOFWORKERS_H_
+#define PROOFWORKERS_H_
+
+#include <functional>
+#include <stdint.h>
+
+namespace libzerocoin {
+
+/** Default number of threads computing the rounds of a single proof. 0 uses one per core. */
+static const unsigned int DEFAULT_PROOF_THREADS = 0;
+/** Largest number of threads computing the rounds of a single proof */
+static const unsigned int MAX_PROOF_THREADS = 16;
+
+/** Sets the number of threads computing the rounds of a single proof. 0 uses one per core, 1 disables the pool. */
+void SetProofThreads(unsigned int nThreads);
+/** @return the number of threads computing the rounds of a single proof, including the calling thread */
+unsigned int GetProofThreads();
+
+/**
+ * Runs fn(0) ... fn(nCount - 1) on the calling thread and the proof worker
+ * pool, and returns once they are done.
+ *
+ * The calling thread always takes part, so the rounds still make progress when
+ * every worker is busy with another proof. Runs sequentially if the pool is
+ * disabled. If a call throws, the calls not started yet are skipped and the
+ * first exception is rethrown to the caller once the running ones completed.
+ *
+ * @param nCount number of independent calls
+ * @param fn function called once with each index. Must be safe to run concurrently.
+ */
+void ParallelFor(uint32_t nCount, const std::function<void(uint32_t)>& fn);
+
+} /* namespace libzerocoin */
+
+#endif /* PROOFWORKERS_H_ */
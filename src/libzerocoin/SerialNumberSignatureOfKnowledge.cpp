@@ -15,6 +15,8 @@
 
 #include <streams.h>
 #include "SerialNumberSignatureOfKnowledge.h"
+#include "FixedBaseTable.h"
+#include "ProofWorkers.h"
 
 namespace libzerocoin {
 
@@ -80,21 +82,23 @@ SerialNumberSignatureOfKnowledge::SerialNumberSignatureOfKnowledge(const
         }
     }
 
-    for(uint32_t i=0; i < params->zkp_iterations; i++) {
+    // Build the tables before the rounds race to do it
+    params->GetSerialNumberSoKTables();
+
+    // The rounds are independent: spread them over the proof workers
+    ParallelFor(params->zkp_iterations, [&](uint32_t i) {
         // compute g^{ {a^x b^r} h^v} mod p2
-        c[i] = challengeCalculation(coin.getSerialNumber(), r[i], v_expanded[i]);
-    }
+        c[i] = challengeCalculation(coin.getSerialNumber(), r[i], v_expanded[i], false);
+    });
 
-    // We can't hash data in parallel either
-    // because OPENMP cannot not guarantee loops
-    // execute in order.
+    // The challenges are hashed in order
     for(uint32_t i=0; i < params->zkp_iterations; i++)
         hasher << c[i];
 
     this->hash = hasher.GetHash();
     unsigned char *hashbytes =  (unsigned char*) &hash;
 
-    for(uint32_t i = 0; i < params->zkp_iterations; i++) {
+    ParallelFor(params->zkp_iterations, [&](uint32_t i) {
         int bit = i % 8;
         int byte = i / 8;
 
@@ -107,19 +111,34 @@ SerialNumberSignatureOfKnowledge::SerialNumberSignatureOfKnowledge(const
             sprime[i]           = v_expanded[i] - (commitmentToCoin.getRandomness() *
                     b.pow_mod(r[i] - coin.getRandomness(), params->serialNumberSoKCommitmentGroup.groupOrder));
         }
-    }
+    });
 }
 
 inline CBigNum SerialNumberSignatureOfKnowledge::challengeCalculation(const CBigNum& a_exp,const CBigNum& b_exp,
-        const CBigNum& h_exp) const {
+        const CBigNum& h_exp, bool fPublicExponents) const {
 
     CBigNum a = params->coinCommitmentGroup.g;
     CBigNum b = params->coinCommitmentGroup.h;
     CBigNum g = params->serialNumberSoKCommitmentGroup.g;
     CBigNum h = params->serialNumberSoKCommitmentGroup.h;
 
-    CBigNum exponent = (a.pow_mod(a_exp, params->serialNumberSoKCommitmentGroup.groupOrder) *
-            b.pow_mod(b_exp, params->serialNumberSoKCommitmentGroup.groupOrder)) % params->serialNumberSoKCommitmentGroup.groupOrder;
+    // The verifier only ever sees public values and can use the fixed-base tables
+    // or, without them, a simultaneous exponentiation per product of powers
+    const SerialNumberSoKTables* tables = params->GetSerialNumberSoKTables();
+    if (fPublicExponents) {
+        if (tables) {
+            CBigNum exponent = (tables->a.pow_mod(a_exp) * tables->b.pow_mod(b_exp)) % params->serialNumberSoKCommitmentGroup.groupOrder;
+            return (tables->g.pow_mod(exponent) * tables->h.pow_mod(h_exp)) % params->serialNumberSoKCommitmentGroup.modulus;
+        }
+        CBigNum exponent = CBigNum::multi_pow_mod({a, b}, {a_exp, b_exp}, params->serialNumberSoKCommitmentGroup.groupOrder);
+        return CBigNum::multi_pow_mod({g, h}, {exponent, h_exp}, params->serialNumberSoKCommitmentGroup.modulus);
+    }
+
+    // The prover exponentiates with secret values and must stay constant time.
+    // a_exp is the (public) serial number, so it can always use the table.
+    CBigNum aPow = tables ? tables->a.pow_mod(a_exp) : a.pow_mod(a_exp, params->serialNumberSoKCommitmentGroup.groupOrder);
+
+    CBigNum exponent = (aPow * b.pow_mod(b_exp, params->serialNumberSoKCommitmentGroup.groupOrder)) % params->serialNumberSoKCommitmentGroup.groupOrder;
 
     return (g.pow_mod(exponent, params->serialNumberSoKCommitmentGroup.modulus) * h.pow_mod(h_exp, params->serialNumberSoKCommitmentGroup.modulus)) % params->serialNumberSoKCommitmentGroup.modulus;
 }
@@ -148,32 +167,47 @@ bool SerialNumberSignatureOfKnowledge::Verify(const CBigNum& coinSerialNumber, c
 
     std::vector<CBigNum> tprime(params->zkp_iterations);
     unsigned char *hashbytes = (unsigned char*) &this->hash;
+    const SerialNumberSoKTables* tables = params->GetSerialNumberSoKTables();
+
+    // Rounds with an sprime out of range, checked once all rounds are done
+    std::vector<char> vInvalidSprime(params->zkp_iterations, false);
 
     try {
-        for (uint32_t i = 0; i < params->zkp_iterations; i++) {
+        // The rounds are independent: spread them over the proof workers
+        ParallelFor(params->zkp_iterations, [&](uint32_t i) {
             int bit = i % 8;
             int byte = i / 8;
             bool challenge_bit = ((hashbytes[byte] >> bit) & 0x01);
             if (challenge_bit) {
                 CBigNum bn = SeedTo1024(sprime[i].getuint256());
-                if (bn > params->serialNumberSoKCommitmentGroup.groupOrder && isInParamsValidationRange)
-                    return error("SoK Verify() :: sprime in pos %d not in valid range", i);
-                tprime[i] = challengeCalculation(coinSerialNumber, s_notprime[i], bn);
+                if (bn > params->serialNumberSoKCommitmentGroup.groupOrder && isInParamsValidationRange) {
+                    vInvalidSprime[i] = true;
+                    return;
+                }
+                tprime[i] = challengeCalculation(coinSerialNumber, s_notprime[i], bn, true);
             } else {
-                CBigNum exp = b.pow_mod(s_notprime[i], params->serialNumberSoKCommitmentGroup.groupOrder);
-                tprime[i] = ((valueOfCommitmentToCoin.pow_mod(exp, params->serialNumberSoKCommitmentGroup.modulus) %
-                              params->serialNumberSoKCommitmentGroup.modulus) *
-                             (h.pow_mod(sprime[i], params->serialNumberSoKCommitmentGroup.modulus) %
-                              params->serialNumberSoKCommitmentGroup.modulus)) %
-                            params->serialNumberSoKCommitmentGroup.modulus;
+                if (tables) {
+                    CBigNum exp = tables->b.pow_mod(s_notprime[i]);
+                    tprime[i] = (valueOfCommitmentToCoin.pow_mod_public(exp, params->serialNumberSoKCommitmentGroup.modulus) *
+                                 tables->h.pow_mod(sprime[i])) % params->serialNumberSoKCommitmentGroup.modulus;
+                } else {
+                    CBigNum exp = b.pow_mod_public(s_notprime[i], params->serialNumberSoKCommitmentGroup.groupOrder);
+                    tprime[i] = CBigNum::multi_pow_mod({valueOfCommitmentToCoin, h}, {exp, sprime[i]}, params->serialNumberSoKCommitmentGroup.modulus);
+                }
             }
+        });
+        for (uint32_t i = 0; i < params->zkp_iterations; i++) {
+            if (vInvalidSprime[i])
+                return error("SoK Verify() :: sprime in pos %d not in valid range", i);
         }
         for (uint32_t i = 0; i < params->zkp_iterations; i++) {
             hasher << tprime[i];
         }
         return hasher.GetHash() == hash;
-    }catch (std::range_error e){
+    }catch (const std::range_error& e){
         return error("SoK Verify() :: sprime invalid range.");
+    }catch (const bignum_error& e){
+        return error("SoK Verify() :: %s", e.what());
     }
 }
 
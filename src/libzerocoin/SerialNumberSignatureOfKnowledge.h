@@ -70,7 +70,7 @@ private:
     std::vector<CBigNum> s_notprime;
     std::vector<CBigNum> sprime;
     inline CBigNum challengeCalculation(const CBigNum& a_exp, const CBigNum& b_exp,
-                                       const CBigNum& h_exp) const;
+                                       const CBigNum& h_exp, bool fPublicExponents) const;
 };
 
 } /* namespace libzerocoin */
@@ -147,6 +147,24 @@ public:
      */
     CBigNum pow_mod(const CBigNum& e, const CBigNum& m) const;
 
+    /**
+     * modular exponentiation: this^e mod n, in variable time.
+     * Only for public operands (e.g. proof verification), never for secret exponents.
+     * @param e exponent
+     * @param m modulus
+     */
+    CBigNum pow_mod_public(const CBigNum& e, const CBigNum& m) const;
+
+    /**
+     * simultaneous modular multi-exponentiation: prod(bases[i]^exponents[i]) mod m, in variable time.
+     * Costs about one exponentiation with the largest exponent instead of one per base.
+     * Only for public operands (e.g. proof verification), never for secret exponents.
+     * @param bases the bases
+     * @param exponents the exponents, one per base
+     * @param m modulus
+     */
+    static CBigNum multi_pow_mod(const std::vector<CBigNum>& bases, const std::vector<CBigNum>& exponents, const CBigNum& m);
+
     /**
     * Calculates the inverse of this element mod m.
     * i.e. i such this*i = 1 mod m
@@ -184,6 +202,7 @@ public:
 #endif
 
     bool isOne() const;
+    bool isBitSet(unsigned int n) const;
     bool operator!() const;
     CBigNum& operator+=(const CBigNum& b);
     CBigNum& operator-=(const CBigNum& b);
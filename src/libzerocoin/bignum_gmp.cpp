@@ -245,6 +245,84 @@ CBigNum CBigNum::pow_mod(const CBigNum& e, const CBigNum& m) const
     return ret;
 }
 
+/**
+ * modular exponentiation: this^e mod n, in variable time.
+ * Only for public operands (e.g. proof verification), never for secret exponents.
+ * @param e exponent
+ * @param m modulus
+ */
+CBigNum CBigNum::pow_mod_public(const CBigNum& e, const CBigNum& m) const
+{
+    CBigNum ret;
+    mpz_powm (ret.bn, bn, e.bn, m.bn);
+    return ret;
+}
+
+/**
+ * simultaneous modular multi-exponentiation: prod(bases[i]^exponents[i]) mod m, in variable time.
+ * Interleaves fixed window exponentiations of all bases so that they share one chain of squarings.
+ * @param bases the bases
+ * @param exponents the exponents, one per base
+ * @param m modulus
+ */
+CBigNum CBigNum::multi_pow_mod(const std::vector<CBigNum>& bases, const std::vector<CBigNum>& exponents, const CBigNum& m)
+{
+    if (bases.size() != exponents.size())
+        throw bignum_error("CBigNum::multi_pow_mod : number of bases and exponents differ");
+
+    // Negative exponents raise the inverse of their base, as mpz_powm does
+    const size_t nBases = bases.size();
+    std::vector<CBigNum> vBases(nBases);
+    std::vector<CBigNum> vExponents(nBases);
+    size_t nBits = 0;
+    for (size_t i = 0; i < nBases; i++) {
+        if (mpz_sgn(exponents[i].bn) < 0) {
+            if (!mpz_invert(vBases[i].bn, bases[i].bn, m.bn))
+                throw bignum_error("CBigNum::multi_pow_mod : base is not invertible");
+            mpz_neg(vExponents[i].bn, exponents[i].bn);
+        } else {
+            mpz_mod(vBases[i].bn, bases[i].bn, m.bn);
+            mpz_set(vExponents[i].bn, exponents[i].bn);
+        }
+        nBits = std::max(nBits, mpz_sizeinbase(vExponents[i].bn, 2));
+    }
+
+    const unsigned int nWindowBits = nBits > 512 ? 5 : (nBits > 128 ? 4 : 3);
+    const unsigned int nDigits = (1U << nWindowBits) - 1;
+
+    // vPowers[i * nDigits + d - 1] = bases[i]^d mod m
+    std::vector<CBigNum> vPowers(nBases * nDigits);
+    for (size_t i = 0; i < nBases; i++) {
+        vPowers[i * nDigits] = vBases[i];
+        for (unsigned int d = 1; d < nDigits; d++)
+            vPowers[i * nDigits + d] = vPowers[i * nDigits + d - 1].mul_mod(vBases[i], m);
+    }
+
+    CBigNum ret = CBigNum(1) % m;
+    bool fFirst = true;
+    for (int nWindow = (nBits + nWindowBits - 1) / nWindowBits - 1; nWindow >= 0; nWindow--) {
+        if (!fFirst) {
+            for (unsigned int j = 0; j < nWindowBits; j++) {
+                mpz_mul(ret.bn, ret.bn, ret.bn);
+                mpz_mod(ret.bn, ret.bn, m.bn);
+            }
+        }
+        for (size_t i = 0; i < nBases; i++) {
+            unsigned int d = 0;
+            for (unsigned int j = 0; j < nWindowBits; j++) {
+                if (mpz_tstbit(vExponents[i].bn, nWindow * nWindowBits + j))
+                    d |= 1U << j;
+            }
+            if (d) {
+                mpz_mul(ret.bn, ret.bn, vPowers[i * nDigits + d - 1].bn);
+                mpz_mod(ret.bn, ret.bn, m.bn);
+                fFirst = false;
+            }
+        }
+    }
+    return ret;
+}
+
 /**
 * Calculates the inverse of this element mod m.
 * i.e. i such this*i = 1 mod m
@@ -301,6 +379,11 @@ bool CBigNum::isOne() const
     return mpz_cmp(bn, CBigNum(1).bn) == 0;
 }
 
+bool CBigNum::isBitSet(unsigned int n) const
+{
+    return mpz_tstbit(bn, n);
+}
+
 bool CBigNum::operator!() const
 {
     return mpz_cmp(bn, CBigNum(0).bn) == 0;
@@ -375,6 +375,36 @@ CBigNum CBigNum::pow_mod(const CBigNum& e, const CBigNum& m) const
     return ret;
 }
 
+/**
+ * modular exponentiation: this^e mod n, in variable time.
+ * Only for public operands (e.g. proof verification), never for secret exponents.
+ * BN_mod_exp() already takes the variable time path for non BN_FLG_CONSTTIME numbers.
+ * @param e exponent
+ * @param m modulus
+ */
+CBigNum CBigNum::pow_mod_public(const CBigNum& e, const CBigNum& m) const
+{
+    return pow_mod(e, m);
+}
+
+/**
+ * simultaneous modular multi-exponentiation: prod(bases[i]^exponents[i]) mod m.
+ * The OpenSSL backend multiplies separate exponentiations.
+ * @param bases the bases
+ * @param exponents the exponents, one per base
+ * @param m modulus
+ */
+CBigNum CBigNum::multi_pow_mod(const std::vector<CBigNum>& bases, const std::vector<CBigNum>& exponents, const CBigNum& m)
+{
+    if (bases.size() != exponents.size())
+        throw bignum_error("CBigNum::multi_pow_mod : number of bases and exponents differ");
+
+    CBigNum ret = 1;
+    for (size_t i = 0; i < bases.size(); i++)
+        ret = ret.mul_mod(bases[i].pow_mod_public(exponents[i], m), m);
+    return ret % m;
+}
+
 /**
 * Calculates the inverse of this element mod m.
 * i.e. i such this*i = 1 mod m
@@ -439,6 +469,11 @@ bool CBigNum::isOne() const
     return BN_is_one(bn);
 }
 
+bool CBigNum::isBitSet(unsigned int n) const
+{
+    return BN_is_bit_set(bn, n);
+}
+
 bool CBigNum::operator!() const
 {
     return BN_is_zero(bn);
@@ -11,24 +11,104 @@
 #include "main.h"
 
 /****** Thread ********/
+bool CLightWorker::addWitWork(CGenWit wit) {
+    if (!isWorkerRunning) {
+        LogPrintf("%s not running trying to add wit work \n", "squorum-light-thread");
+        return false;
+    }
+
+    uint256 hashWork = wit.getWorkHash();
+    {
+        std::lock_guard<std::mutex> lock(cs_work);
+        CWitWork& work = mapWork[hashWork];
+        bool fNew = work.vRequests.empty();
+
+        // The peer is answered by a worker, keep it alive until then
+        if (wit.getPfrom())
+            wit.getPfrom()->AddRef();
+        work.vRequests.push_back(wit);
+        work.vRequestTimes.push_back(GetTimeMicros());
+        nRequests++;
+
+        if (!fNew) {
+            nDeduplicated++;
+            LogPrint("zero", "%s joining queued work for %s \n", "squorum-light-thread", wit.toString());
+            return true;
+        }
+    }
+    requestsQueue.push(hashWork);
+    return true;
+}
+
+void CLightWorker::StartLightZsqrThread(boost::thread_group& threadGroup) {
+    nThreads = std::max(1, std::min((int)GetArg("-lightzsqrthreads", DEFAULT_LIGHT_ZSQR_THREADS), MAX_LIGHT_ZSQR_THREADS));
+    LogPrintf("%s thread start, %d workers\n", "squorum-light-thread", nThreads);
+    isWorkerRunning = true;
+    for (int i = 0; i < nThreads; i++)
+        threadWorkers.create_thread(boost::bind(&CLightWorker::ThreadLightZSQRSimplified, this));
+}
+
+void CLightWorker::StopLightZsqrThread() {
+    isWorkerRunning = false;
+    threadWorkers.interrupt_all();
+    // Waiting on the queue is not an interruption point: wake the idle workers
+    // with work that does not exist, they stop at their next sleep
+    for (int i = 0; i < nThreads; i++)
+        requestsQueue.push(uint256());
+    threadWorkers.join_all();
+    LogPrintf("%s thread stopped\n", "squorum-light-thread");
+}
+
+CLightWorkerStats CLightWorker::GetStats() {
+    std::lock_guard<std::mutex> lock(cs_work);
+    CLightWorkerStats stats;
+    stats.nThreads = isWorkerRunning ? nThreads : 0;
+    stats.nQueued = mapWork.size() - nRunning;
+    stats.nRunning = nRunning;
+    stats.nRequests = nRequests;
+    stats.nDeduplicated = nDeduplicated;
+    stats.nCompleted = nCompleted;
+    stats.nRejected = nRejected;
+    stats.nFinished = nFinished;
+    stats.nTotalWaitTime = nTotalWaitTime;
+    stats.nTotalWorkTime = nTotalWorkTime;
+    stats.nMaxLatency = nMaxLatency;
+    return stats;
+}
+
 void CLightWorker::ThreadLightZSQRSimplified() {
     RenameThread("squorum-light-thread");
-    isWorkerRunning = true;
     while (true) {
+        // The work taken from mapWork, until it was finished or rejected
+        uint256 hashWork;
+        CGenWit genWit;
+        int64_t nTimeStart = 0;
+        bool fRunning = false;
         try {
 
             // Take a breath between requests.. TODO: Add processor usage check here
             MilliSleep(2000);
 
-            // TODO: Future: join several similar requests into one calculation if the filter and denom match..
-            CGenWit genWit = requestsQueue.pop();
+            hashWork = requestsQueue.pop();
+            nTimeStart = GetTimeMicros();
+            {
+                std::lock_guard<std::mutex> lock(cs_work);
+                auto it = mapWork.find(hashWork);
+                if (it == mapWork.end())
+                    continue;
+                genWit = it->second.vRequests.front();
+                nTotalWaitTime += nTimeStart - it->second.vRequestTimes.front();
+                nRunning++;
+                fRunning = true;
+            }
             LogPrintf("%s pop work for %s \n\n", "squorum-light-thread", genWit.toString());
 
             libzerocoin::ZerocoinParams *params = Params().Zerocoin_Params(false);
             CBlockIndex *pIndex = chainActive[genWit.getStartingHeight()];
             if (!pIndex) {
                 // Rejects only the failed height
-                rejectWork(genWit, genWit.getStartingHeight(), NON_DETERMINED);
+                fRunning = false;
+                rejectWork(hashWork, genWit, genWit.getStartingHeight(), NON_DETERMINED, nTimeStart);
             } else {
                 LogPrintf("%s calculating work for %s \n\n", "squorum-light-thread", genWit.toString());
                 int blockHeight = pIndex->nHeight;
@@ -62,58 +142,108 @@ void CLightWorker::ThreadLightZSQRSimplified() {
                                 heightStop
                         );
 
-                    } catch (NotEnoughMintsException e) {
+                    } catch (const NotEnoughMintsException& e) {
                         LogPrintStr(std::string("ThreadLightZSQRSimplified: ") + e.message + "\n");
-                        rejectWork(genWit, blockHeight, NOT_ENOUGH_MINTS);
+                        fRunning = false;
+                        rejectWork(hashWork, genWit, blockHeight, NOT_ENOUGH_MINTS, nTimeStart);
                         continue;
                     }
 
                     if (!res) {
                         // TODO: Check if the GenerateAccumulatorWitnessFor can fail for node's fault or it's just because the peer sent an illegal request..
-                        rejectWork(genWit, blockHeight, NON_DETERMINED);
+                        fRunning = false;
+                        rejectWork(hashWork, genWit, blockHeight, NON_DETERMINED, nTimeStart);
                     } else {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(ret.size() * 32);
-
-                        ss << genWit.getRequestNum();
-                        ss << accumulator.getValue(); // TODO: ---> this accumulator value is not necessary. The light node should get it using the other message..
-                        ss << witness.getValue();
-                        uint32_t size = ret.size();
-                        ss << size;
-                        for (CBigNum bnValue : ret) {
-                            ss << bnValue;
+                        // Every request for this witness gets the result under its own request number
+                        fRunning = false;
+                        CWitWork work = finishWork(hashWork, nTimeStart, false);
+                        for (CGenWit& wit : work.vRequests) {
+                            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                            ss.reserve(ret.size() * 32);
+
+                            ss << wit.getRequestNum();
+                            ss << accumulator.getValue(); // TODO: ---> this accumulator value is not necessary. The light node should get it using the other message..
+                            ss << witness.getValue();
+                            uint32_t size = ret.size();
+                            ss << size;
+                            for (CBigNum bnValue : ret) {
+                                ss << bnValue;
+                            }
+                            ss << heightStop;
+                            if (wit.getPfrom()) {
+                                LogPrintf("%s pushing message to %s \n", "squorum-light-thread", wit.getPfrom()->addrName);
+                                wit.getPfrom()->PushMessage("pubcoins", ss);
+                                wit.getPfrom()->Release();
+                            } else
+                                LogPrintf("%s NOT pushing message for request %d \n", "squorum-light-thread", wit.getRequestNum());
                         }
-                        ss << heightStop;
-                        if (genWit.getPfrom()) {
-                            LogPrintf("%s pushing message to %s \n", "squorum-light-thread", genWit.getPfrom()->addrName);
-                            genWit.getPfrom()->PushMessage("pubcoins", ss);
-                        } else
-                            LogPrintf("%s NOT pushing message to %s \n", "squorum-light-thread", genWit.getPfrom()->addrName);
                     }
                 } else {
                     // Rejects only the failed height
-                    rejectWork(genWit, blockHeight, NON_DETERMINED);
+                    fRunning = false;
+                    rejectWork(hashWork, genWit, blockHeight, NON_DETERMINED, nTimeStart);
                 }
             }
+        } catch (const boost::thread_interrupted&) {
+            break;
         } catch (std::exception& e) {
-            //std::cout << "exception in light loop, closing it. " << e.what() << std::endl;
             PrintExceptionContinue(&e, "lightzsqrthread");
-            break;
+            // Answer the requests waiting for this work and release their peers, so that
+            // the same request asked again starts over instead of joining a dead entry
+            if (fRunning) {
+                try {
+                    rejectWork(hashWork, genWit, genWit.getStartingHeight(), NON_DETERMINED, nTimeStart);
+                } catch (std::exception& e) {
+                    PrintExceptionContinue(&e, "lightzsqrthread");
+                }
+            }
         }
     }
 
 
 }
 
+CLightWorker::CWitWork CLightWorker::finishWork(const uint256& hashWork, int64_t nTimeStart, bool fRejected) {
+    int64_t nTimeEnd = GetTimeMicros();
+    std::lock_guard<std::mutex> lock(cs_work);
+    CWitWork work;
+    auto it = mapWork.find(hashWork);
+    if (it != mapWork.end()) {
+        work = it->second;
+        mapWork.erase(it);
+    }
+
+    nRunning--;
+    nFinished++;
+    nTotalWorkTime += nTimeEnd - nTimeStart;
+    for (int64_t nTimeRequest : work.vRequestTimes)
+        nMaxLatency = std::max(nMaxLatency, nTimeEnd - nTimeRequest);
+    if (fRejected)
+        nRejected += work.vRequests.size();
+    else
+        nCompleted += work.vRequests.size();
+    return work;
+}
+
 // TODO: Think more the peer misbehaving policy..
-void CLightWorker::rejectWork(CGenWit& wit, int blockHeight, uint32_t errorNumber) {
+void CLightWorker::rejectWork(const uint256& hashWork, CGenWit& wit, int blockHeight, uint32_t errorNumber, int64_t nTimeStart) {
     if (wit.getStartingHeight() == blockHeight){
-        LogPrintf("%s rejecting work %s , error code: %s\n", "squorum-light-thread", wit.toString(), errorNumber);
-        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-        ss << wit.getRequestNum();
-        ss << errorNumber;
-        wit.getPfrom()->PushMessage("pubcoins", ss);
+        CWitWork work = finishWork(hashWork, nTimeStart, true);
+        for (CGenWit& req : work.vRequests) {
+            LogPrintf("%s rejecting work %s , error code: %s\n", "squorum-light-thread", req.toString(), errorNumber);
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss << req.getRequestNum();
+            ss << errorNumber;
+            if (req.getPfrom()) {
+                req.getPfrom()->PushMessage("pubcoins", ss);
+                req.getPfrom()->Release();
+            }
+        }
     } else {
-        requestsQueue.push(wit);
+        {
+            std::lock_guard<std::mutex> lock(cs_work);
+            nRunning--;
+        }
+        requestsQueue.push(hashWork);
     }
 }
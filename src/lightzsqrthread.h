@@ -10,6 +10,9 @@
 #define sQuorum_LIGHTZSQRTHREAD_H
 
 #include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
 #include "genwit.h"
 #include "zsqr/accumulators.h"
 #include "concurrentqueue.h"
@@ -20,6 +23,26 @@
 extern CChain chainActive;
 // Max amount of computation for a single request
 const int COMP_MAX_AMOUNT = 60 * 24 * 60;
+/** Default number of threads computing light client witnesses */
+static const int DEFAULT_LIGHT_ZSQR_THREADS = 2;
+/** Maximum number of threads computing light client witnesses */
+static const int MAX_LIGHT_ZSQR_THREADS = 16;
+
+
+/** Statistics of the light witness service, as returned by CLightWorker::GetStats() */
+struct CLightWorkerStats {
+    int nThreads;
+    int nQueued;              //! distinct witnesses waiting for a worker
+    int nRunning;             //! distinct witnesses being computed
+    uint64_t nRequests;       //! requests accepted
+    uint64_t nDeduplicated;   //! requests answered by the computation of an identical one
+    uint64_t nCompleted;      //! requests answered with a witness
+    uint64_t nRejected;       //! requests answered with an error
+    uint64_t nFinished;       //! distinct witnesses computed or rejected
+    int64_t nTotalWaitTime;   //! microseconds spent in the queue, summed over computations
+    int64_t nTotalWorkTime;   //! microseconds spent computing, summed over computations
+    int64_t nMaxLatency;      //! largest microseconds between a request and its answer
+};
 
 
 /****** Thread ********/
@@ -28,13 +51,34 @@ class CLightWorker{
 
 private:
 
-    concurrentqueue<CGenWit> requestsQueue;
+    //! One witness to compute, and the requests waiting for it
+    struct CWitWork {
+        std::vector<CGenWit> vRequests;
+        std::vector<int64_t> vRequestTimes;
+    };
+
+    concurrentqueue<uint256> requestsQueue;
+    std::mutex cs_work;
+    std::map<uint256, CWitWork> mapWork;
     std::atomic<bool> isWorkerRunning;
-    boost::thread threadIns;
+    boost::thread_group threadWorkers;
+    int nThreads;
+
+    // Stats, guarded by cs_work
+    int nRunning;
+    uint64_t nRequests;
+    uint64_t nDeduplicated;
+    uint64_t nCompleted;
+    uint64_t nRejected;
+    uint64_t nFinished;
+    int64_t nTotalWaitTime;
+    int64_t nTotalWorkTime;
+    int64_t nMaxLatency;
 
 public:
 
-    CLightWorker() {
+    CLightWorker() : nThreads(0), nRunning(0), nRequests(0), nDeduplicated(0), nCompleted(0), nRejected(0),
+                     nFinished(0), nTotalWaitTime(0), nTotalWorkTime(0), nMaxLatency(0) {
         isWorkerRunning = false;
     }
 
@@ -43,30 +87,27 @@ public:
         NON_DETERMINED = 1
     };
 
-    bool addWitWork(CGenWit wit) {
-        if (!isWorkerRunning) {
-            LogPrintf("%s not running trying to add wit work \n", "squorum-light-thread");
-            return false;
-        }
-        requestsQueue.push(wit);
-        return true;
-    }
+    /**
+     * Queues a witness request. A request identical to one already waiting or
+     * being computed, except for its peer and request number, joins it and
+     * is answered with its result.
+     */
+    bool addWitWork(CGenWit wit);
 
-    void StartLightZsqrThread(boost::thread_group& threadGroup) {
-        LogPrintf("%s thread start\n", "squorum-light-thread");
-        threadIns = boost::thread(boost::bind(&CLightWorker::ThreadLightZSQRSimplified, this));
-    }
+    void StartLightZsqrThread(boost::thread_group& threadGroup);
 
-    void StopLightZsqrThread() {
-        threadIns.interrupt();
-        LogPrintf("%s thread interrupted\n", "squorum-light-thread");
-    }
+    void StopLightZsqrThread();
+
+    CLightWorkerStats GetStats();
 
 private:
 
     void ThreadLightZSQRSimplified();
 
-    void rejectWork(CGenWit& wit, int blockHeight, uint32_t errorNumber);
+    /** Takes the requests waiting for a witness, once it was computed or rejected */
+    CWitWork finishWork(const uint256& hashWork, int64_t nTimeStart, bool fRejected);
+
+    void rejectWork(const uint256& hashWork, CGenWit& wit, int blockHeight, uint32_t errorNumber, int64_t nTimeStart);
 
 };
 
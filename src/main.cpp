@@ -13,7 +13,9 @@
 #include "zsqr/accumulatormap.h"
 #include "addrman.h"
 #include "alert.h"
+#include "blockencodings.h"
 #include "blocksignature.h"
+#include "blockstore.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -23,6 +25,7 @@
 #include "masternode-payments.h"
 #include "masternodeman.h"
 #include "merkleblock.h"
+#include "msgstats.h"
 #include "net.h"
 #include "obfuscation.h"
 #include "pow.h"
@@ -37,7 +40,9 @@
 #include "validationinterface.h"
 #include "zsqrchain.h"
 
+#include "zsqr/spendcache.h"
 #include "zsqr/zerocoin.h"
+#include "libzerocoin/ParallelVerifier.h"
 #include "libzerocoin/Denominations.h"
 #include "invalid.h"
 #include <sstream>
@@ -48,6 +53,7 @@
 #include <boost/thread.hpp>
 #include <boost/foreach.hpp>
 #include <atomic>
+#include <deque>
 #include <queue>
 
 
@@ -62,10 +68,13 @@
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+CBlockIndexArena arenaBlockIndex;
 std::map<uint256, uint256> mapProofOfStake;
 std::map<unsigned int, unsigned int> mapHashedBlocks;
 CChain chainActive;
 CBlockIndex* pindexBestHeader = NULL;
+uint256 hashAssumeValid = 0;
+uint256 nMinimumChainWork = 0;
 int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
@@ -73,10 +82,13 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = true;
+bool fHavePruned = false;
+bool fPruneMode = false;
+uint64_t nPruneTarget = 0;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fVerifyingBlocks = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 bool fClearSpendCache = false;
 
@@ -175,12 +187,45 @@ struct QueuedBlock {
     int64_t nTime;              //! Time of "getdata" request in microseconds.
     int nValidatedQueuedBefore; //! Number of blocks queued with validated headers (globally) at the time this one is requested.
     bool fValidatedHeaders;     //! Whether this block has validated headers at the time of request.
+    std::shared_ptr<CPartiallyDownloadedBlock> partialBlock; //! Optional, for a compact block awaiting its missing transactions.
 };
 std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
 /** Number of blocks in flight with validated headers. */
 int nQueuedValidatedHeaders = 0;
 
+/** Peers asked to announce new blocks with cmpctblock, the most recent last. Protected by cs_main. */
+std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
+/**
+ * Blocks downloaded ahead of their parent during headers-first sync, by hash of
+ * the parent. Proof-of-stake checks need the parent connected, so they are only
+ * processed once it was accepted. Protected by cs_main.
+ */
+struct CBlockAwaitingParent {
+    uint256 hash;
+    //! Null if there was no room for the block, it is fetched again once the parent was accepted
+    std::shared_ptr<CBlock> pblock;
+    NodeId nodeid;
+    size_t nSize;
+};
+std::multimap<uint256, CBlockAwaitingParent> mapBlocksAwaitingParent;
+/** Serialized size of the blocks in mapBlocksAwaitingParent. */
+size_t nBlocksAwaitingParentSize = 0;
+
+/**
+ * Proof-of-stake block index entries added from a header alone past the last
+ * checkpoint, with the peer that sent the header and when. Their stake is only
+ * checked once the block arrives, so they are bounded per peer and in total, and
+ * dropped if the block does not come, see ExpireHeadersAwaitingBlock(). Protected
+ * by cs_main.
+ */
+struct CHeaderAwaitingBlock {
+    NodeId nodeid;
+    int64_t nTimeReceived;
+};
+std::map<CBlockIndex*, CHeaderAwaitingBlock> mapHeadersAwaitingBlock;
+
 /** Number of preferable block download peers. */
 int nPreferredDownload = 0;
 
@@ -189,6 +234,9 @@ std::set<CBlockIndex*> setDirtyBlockIndex;
 
 /** Dirty block file entries. */
 std::set<int> setDirtyFileInfo;
+
+/** Global flag to indicate we should check to see if there are block/undo files that should be deleted. Set on startup or if we allocate more file space when we're in prune mode. */
+bool fCheckForPruning = false;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -308,6 +356,10 @@ struct CNodeState {
     CBlockIndex* pindexLastCommonBlock;
     //! Whether we've started headers synchronization with this peer.
     bool fSyncStarted;
+    //! Whether this peer sent proof-of-stake headers too far ahead of our tip, which are asked for again once it caught up.
+    bool fHeadersAheadOfTip;
+    //! Number of entries in mapHeadersAwaitingBlock from headers this peer sent.
+    int nHeadersAwaitingBlock;
     //! Since when we're stalling block download progress (in microseconds), or 0.
     int64_t nStallingSince;
     std::list<QueuedBlock> vBlocksInFlight;
@@ -326,6 +378,8 @@ struct CNodeState {
         hashLastUnknownBlock = uint256(0);
         pindexLastCommonBlock = NULL;
         fSyncStarted = false;
+        fHeadersAheadOfTip = false;
+        nHeadersAwaitingBlock = 0;
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
@@ -388,6 +442,7 @@ void FinalizeNode(NodeId nodeid)
 
     for (const QueuedBlock& entry : state->vBlocksInFlight)
         mapBlocksInFlight.erase(entry.hash);
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
 
@@ -409,7 +464,7 @@ void MarkBlockAsReceived(const uint256& hash)
 }
 
 // Requires cs_main.
-void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex* pindex = NULL)
+void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex* pindex = NULL, std::shared_ptr<CPartiallyDownloadedBlock> partialBlock = nullptr)
 {
     CNodeState* state = State(nodeid);
     assert(state != NULL);
@@ -417,7 +472,7 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex* pindex
     // Make sure it's not listed somewhere already.
     MarkBlockAsReceived(hash);
 
-    QueuedBlock newentry = {hash, pindex, GetTimeMicros(), nQueuedValidatedHeaders, pindex != NULL};
+    QueuedBlock newentry = {hash, pindex, GetTimeMicros(), nQueuedValidatedHeaders, pindex != NULL, partialBlock};
     nQueuedValidatedHeaders += newentry.fValidatedHeaders;
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
     state->nBlocksInFlight++;
@@ -479,6 +534,36 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb)
     return pa;
 }
 
+/** The entry of a block in mapBlocksAwaitingParent, or NULL. Requires cs_main. */
+CBlockAwaitingParent* FindBlockAwaitingParent(const CBlockIndex* pindex)
+{
+    if (!pindex->pprev)
+        return NULL;
+    std::pair<std::multimap<uint256, CBlockAwaitingParent>::iterator, std::multimap<uint256, CBlockAwaitingParent>::iterator> range =
+        mapBlocksAwaitingParent.equal_range(pindex->pprev->GetBlockHash());
+    for (std::multimap<uint256, CBlockAwaitingParent>::iterator it = range.first; it != range.second; ++it) {
+        if (it->second.hash == pindex->GetBlockHash())
+            return &it->second;
+    }
+    return NULL;
+}
+
+/**
+ * Whether a block was downloaded and waits in mapBlocksAwaitingParent, or was
+ * dropped for lack of room and must not be fetched again before its parent was
+ * accepted. Requires cs_main.
+ */
+bool IsBlockAwaitingParent(const CBlockIndex* pindex)
+{
+    return FindBlockAwaitingParent(pindex) != NULL;
+}
+
+/** Whether headers are synced from a peer, which lets FindNextBlocksToDownload() fetch blocks from it in parallel. */
+bool CanSyncHeadersFrom(const CNode* pnode)
+{
+    return Params().HeadersFirstSyncingActive() && pnode->nVersion >= HEADERS_FIRST_VERSION;
+}
+
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
  *  at most count entries. */
 void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller)
@@ -538,7 +623,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                 // We consider the chain that this peer is on invalid.
                 return;
             }
-            if (pindex->nStatus & BLOCK_HAVE_DATA) {
+            if (pindex->nStatus & BLOCK_HAVE_DATA || chainActive.Contains(pindex) || IsBlockAwaitingParent(pindex)) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
@@ -563,6 +648,141 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     }
 }
 
+/** Stops counting a header against its peer, once its block was accepted or the entry is dropped. Requires cs_main. */
+void ForgetHeaderAwaitingBlock(CBlockIndex* pindex)
+{
+    std::map<CBlockIndex*, CHeaderAwaitingBlock>::iterator it = mapHeadersAwaitingBlock.find(pindex);
+    if (it == mapHeadersAwaitingBlock.end())
+        return;
+    CNodeState* state = State(it->second.nodeid);
+    if (state != NULL)
+        state->nHeadersAwaitingBlock--;
+    mapHeadersAwaitingBlock.erase(it);
+}
+
+/** Marks a header whose block failed the stake check and penalizes the peer that sent the header. Requires cs_main. */
+void HeaderAwaitingBlockFailed(const uint256& hash)
+{
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
+    if (mi == mapBlockIndex.end())
+        return;
+    std::map<CBlockIndex*, CHeaderAwaitingBlock>::iterator it = mapHeadersAwaitingBlock.find(mi->second);
+    if (it == mapHeadersAwaitingBlock.end())
+        return;
+    mi->second->nStatus |= BLOCK_FAILED_VALID;
+    LogPrint("net", "header %s from peer=%d failed the stake check\n", hash.ToString(), it->second.nodeid);
+    Misbehaving(it->second.nodeid, 100);
+}
+
+/**
+ * Drops the blocks in mapBlocksAwaitingParent whose parent is gone from the block
+ * index, or failed before its own block was accepted. Requires cs_main.
+ */
+void PruneBlocksAwaitingParent()
+{
+    std::multimap<uint256, CBlockAwaitingParent>::iterator it = mapBlocksAwaitingParent.begin();
+    while (it != mapBlocksAwaitingParent.end()) {
+        BlockMap::iterator mi = mapBlockIndex.find(it->first);
+        if (mi == mapBlockIndex.end() || (mi->second->nTx == 0 && (mi->second->nStatus & BLOCK_FAILED_MASK))) {
+            LogPrint("net", "dropping block %s, its parent was not accepted\n", it->second.hash.ToString());
+            nBlocksAwaitingParentSize -= it->second.nSize;
+            mapBlocksAwaitingParent.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/**
+ * Removes the headers in mapHeadersAwaitingBlock whose block did not arrive within
+ * POS_HEADER_TIMEOUT or failed, along with the headers building on them, from the
+ * block index. Runs at most once a minute. Requires cs_main.
+ */
+void ExpireHeadersAwaitingBlock()
+{
+    static int64_t nLastExpiry = 0;
+    int64_t nNow = GetTime();
+    if (nNow - nLastExpiry < 60)
+        return;
+    nLastExpiry = nNow;
+
+    // Parents first, so that the headers building on a dropped one follow it
+    std::vector<std::pair<int, CBlockIndex*> > vHeaders;
+    vHeaders.reserve(mapHeadersAwaitingBlock.size());
+    for (const std::pair<CBlockIndex* const, CHeaderAwaitingBlock>& entry : mapHeadersAwaitingBlock)
+        vHeaders.push_back(std::make_pair(entry.first->nHeight, entry.first));
+    std::sort(vHeaders.begin(), vHeaders.end());
+
+    std::set<CBlockIndex*> setErase;
+    for (const std::pair<int, CBlockIndex*>& header : vHeaders) {
+        CBlockIndex* pindex = header.second;
+        if ((pindex->nStatus & BLOCK_FAILED_MASK) || setErase.count(pindex->pprev) ||
+                mapHeadersAwaitingBlock[pindex].nTimeReceived < nNow - POS_HEADER_TIMEOUT)
+            setErase.insert(pindex);
+    }
+    // A block stored on top of one of them keeps it and its ancestors
+    std::set<CBlockIndex*> setKeep;
+    for (std::vector<std::pair<int, CBlockIndex*> >::reverse_iterator it = vHeaders.rbegin(); it != vHeaders.rend(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if (setErase.count(pindex) && (setKeep.count(pindex) || mapBlocksUnlinked.count(pindex))) {
+            setErase.erase(pindex);
+            setKeep.insert(pindex->pprev);
+        }
+    }
+    if (setErase.empty()) {
+        PruneBlocksAwaitingParent();
+        return;
+    }
+
+    // Nothing may point to the removed entries afterwards
+    for (std::pair<const NodeId, CNodeState>& item : mapNodeState) {
+        CNodeState& state = item.second;
+        while (state.pindexBestKnownBlock && setErase.count(state.pindexBestKnownBlock))
+            state.pindexBestKnownBlock = state.pindexBestKnownBlock->pprev;
+        while (state.pindexLastCommonBlock && setErase.count(state.pindexLastCommonBlock))
+            state.pindexLastCommonBlock = state.pindexLastCommonBlock->pprev;
+    }
+    if (setErase.count(pindexBestHeader)) {
+        while (setErase.count(pindexBestHeader))
+            pindexBestHeader = pindexBestHeader->pprev;
+        if (pindexBestHeader->nChainWork < chainActive.Tip()->nChainWork)
+            pindexBestHeader = chainActive.Tip();
+        for (const std::pair<CBlockIndex* const, CHeaderAwaitingBlock>& entry : mapHeadersAwaitingBlock) {
+            if (!setErase.count(entry.first) && !(entry.first->nStatus & BLOCK_FAILED_MASK) &&
+                    entry.first->nChainWork > pindexBestHeader->nChainWork)
+                pindexBestHeader = entry.first;
+        }
+    }
+    if (setErase.count(pindexBestInvalid))
+        pindexBestInvalid = NULL;
+
+    for (CBlockIndex* pindex : setErase) {
+        uint256 hash = pindex->GetBlockHash();
+        LogPrint("net", "dropping header %s (%d), its block did not arrive\n", hash.ToString(), pindex->nHeight);
+        MarkBlockAsReceived(hash);
+        ForgetHeaderAwaitingBlock(pindex);
+        setDirtyBlockIndex.erase(pindex);
+        setBlockIndexCandidates.erase(pindex);
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+        for (std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first; it != range.second;) {
+            if (it->second == pindex)
+                mapBlocksUnlinked.erase(it++);
+            else
+                ++it;
+        }
+        if (pindex->pprev && pindex->pprev->pnext == pindex)
+            pindex->pprev->pnext = NULL;
+    }
+    for (CBlockIndex* pindex : setErase) {
+        uint256 hash = pindex->GetBlockHash();
+        mapBlockIndex.erase(hash);
+        arenaBlockIndex.Delete(pindex);
+    }
+
+    // The blocks that waited for them go too
+    PruneBlocksAwaitingParent();
+}
+
 } // anon namespace
 
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats)
@@ -614,6 +834,8 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache* pcoinsTip = NULL;
+CCoinsViewDB* pcoinsdbview = NULL;
+CCoinsViewFlusher* pcoinsflusher = NULL;
 CBlockTreeDB* pblocktree = NULL;
 CZerocoinDB* zerocoinDB = NULL;
 CSporkDB* pSporkDB = NULL;
@@ -915,6 +1137,16 @@ int GetInputAge(CTxIn& vin)
     }
 }
 
+int GetInputHeight(const CTxIn& vin)
+{
+    // The coins view keeps it after the block was pruned, unlike GetTransaction()
+    LOCK(cs_main);
+    const CCoins* coins = pcoinsTip->AccessCoins(vin.prevout.hash);
+    if (!coins || !coins->IsAvailable(vin.prevout.n))
+        return -1;
+    return coins->nHeight;
+}
+
 int GetInputAgeIX(uint256 nTXHash, CTxIn& vin)
 {
     int sigs = 0;
@@ -1056,7 +1288,7 @@ bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const lib
     return true;
 }
 
-bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state)
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvChecks)
 {
     //max needed non-mint outputs should be 2 - one for redemption address and a possible 2nd for change
     if (tx.vout.size() > 2) {
@@ -1131,12 +1363,25 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
                     return state.DoS(100, error("%s: Zerocoinspend could not find accumulator associated with checksum %s", __func__, HexStr(BEGIN(nChecksum), END(nChecksum))));
                 }
 
-                libzerocoin::Accumulator accumulator(Params().Zerocoin_Params(chainActive.Height() < Params().Zerocoin_Block_V2_Start()),
-                                        newSpend.getDenomination(), bnAccumulatorValue);
+                bool fUseModulusV1 = chainActive.Height() < Params().Zerocoin_Block_V2_Start();
+                libzerocoin::ZerocoinParams* paramsAccumulator = Params().Zerocoin_Params(fUseModulusV1);
+
+                // Proofs already verified when the transaction entered the memory pool are not verified again
+                if (IsZerocoinSpendProofCached(newSpend, fUseModulusV1)) {
+                    // Nothing to do
+                } else if (pvChecks) {
+                    // Defer the proof verification to the check queue if requested
+                    pvChecks->push_back(CZerocoinSpendCheck());
+                    CZerocoinSpendCheck check(newSpend, paramsAccumulator, bnAccumulatorValue, tx.GetHash());
+                    check.swap(pvChecks->back());
+                } else {
+                    libzerocoin::Accumulator accumulator(paramsAccumulator, newSpend.getDenomination(), bnAccumulatorValue);
 
-                //Check that the coin has been accumulated
-                if(!newSpend.Verify(accumulator, true))
+                    //Check that the coin has been accumulated
+                    if(!newSpend.Verify(accumulator, true))
                         return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
+                    CacheZerocoinSpendProof(newSpend, fUseModulusV1);
+                }
             }
 
         if (serials.count(newSpend.getCoinSerialNumber()))
@@ -1156,7 +1401,7 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
     return fValidated;
 }
 
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationState& state)
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks, bool fAssumeValid)
 {
     // Basic checks that don't depend on any context
     if (tx.vin.empty())
@@ -1224,9 +1469,10 @@ bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationS
                                      error("CheckTransaction() : zerocoinspend contains inputs that are not zerocoins"));
             }
 
-            // Do not require signature verification if this is initial sync and a block over 24 hours old
-            bool fVerifySignature = !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60*60*24));
-            if (!CheckZerocoinSpend(tx, fVerifySignature, state))
+            // Do not require signature verification if this is initial sync and a block over 24 hours old,
+            // or if the block is an ancestor of the -assumevalid block
+            bool fVerifySignature = !fAssumeValid && !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60*60*24));
+            if (!CheckZerocoinSpend(tx, fVerifySignature, state, pvZerocoinChecks))
                 return state.DoS(100, error("CheckTransaction() : invalid zerocoin spend"));
         }
     }
@@ -1822,12 +2068,23 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
 
 bool GetOutput(const uint256& hash, unsigned int index, CValidationState& state, CTxOut& out)
 {
+    // Unspent outputs are in the coins view, which does not need the transaction
+    // index nor the block files (both of which a pruned node may lack)
+    {
+        LOCK(cs_main);
+        const CCoins* coins = pcoinsTip->AccessCoins(hash);
+        if (coins && coins->IsAvailable(index)) {
+            out = coins->vout[index];
+            return true;
+        }
+    }
+
     CTransaction txPrev;
     uint256 hashBlock;
     if (!GetTransaction(hash, txPrev, hashBlock, true)) {
         return state.DoS(100, error("Output not found"));
     }
-    if (index > txPrev.vout.size()) {
+    if (index >= txPrev.vout.size()) {
         return state.DoS(100, error("Output not found, invalid index %d for %s",index, hash.GetHex()));
     }
     out = txPrev.vout[index];
@@ -1930,6 +2187,14 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
+    // Read from the mapped block file if enabled, falling back to the file below
+    if (blockFileMapper.ReadBlock(block, pos)) {
+        if (block.IsProofOfWork() && !CheckProofOfWork(block.GetHash(), block.nBits))
+            return error("ReadBlockFromDisk : Errors in block header");
+        return true;
+    }
+    block.SetNull();
+
     // Open history file to read
     CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
@@ -1962,6 +2227,19 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+std::shared_ptr<const CBlock> ReadBlockFromDiskCached(const CBlockIndex* pindex)
+{
+    std::shared_ptr<const CBlock> pblock = blockCache.Get(pindex->GetBlockHash());
+    if (pblock)
+        return pblock;
+
+    std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblockRead, pindex))
+        return nullptr;
+    blockCache.Insert(pblockRead);
+    return pblockRead;
+}
+
 
 double ConvertBitsToDouble(unsigned int nBits)
 {
@@ -2159,6 +2437,7 @@ void Misbehaving(NodeId pnode, int howmuch)
     if (howmuch == 0)
         return;
 
+    LOCK(cs_main);
     CNodeState* state = State(pnode);
     if (state == NULL)
         return;
@@ -2232,6 +2511,29 @@ bool CScriptCheck::operator()()
     return true;
 }
 
+bool CZerocoinSpendCheck::operator()()
+{
+    if (!spend.Verify(GetAccumulator(), true))
+        return ::error("CZerocoinSpendCheck(): zerocoin spend %s in tx %s did not verify", spend.getCoinSerialNumber().GetHex(), txid.GetHex());
+    return true;
+}
+
+/** Verifies zerocoin spend checks in parallel on the libzerocoin proof workers, and logs the spends that fail */
+static bool VerifyZerocoinSpendsInParallel(const std::vector<CZerocoinSpendCheck>& vChecks)
+{
+    libzerocoin::CoinSpendParallelVerifier verifier;
+    for (const CZerocoinSpendCheck& check : vChecks)
+        verifier.Add(check.GetSpend(), check.GetAccumulator());
+
+    std::vector<size_t> vInvalid;
+    if (verifier.Verify(&vInvalid))
+        return true;
+    for (size_t i : vInvalid)
+        LogPrintf("%s : zerocoin spend %s in tx %s did not verify\n", __func__,
+            vChecks[i].GetSpend().getCoinSerialNumber().GetHex(), vChecks[i].GetTxid().GetHex());
+    return false;
+}
+
 /* NOTE: GJH inappropriate for sQuorum
 CBitcoinAddress addressExp1("DQZzqnSR6PXxagep1byLiRg9ZurCZ5KieQ");
 CBitcoinAddress addressExp2("DTQYdnNqKuEHXyNeeYhPQGGGdqHbXYwjpj");
@@ -2560,6 +2862,9 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
+    // the mints of this block are no longer part of the accumulators
+    RemoveBlockFromAccumulatorState(pindex);
+
     if (!fVerifyingBlocks) {
         //if block is an accumulator checkpoint block, remove checkpoint and checksums from db
         uint256 nCheckpoint = pindex->nAccumulatorCheckpoint;
@@ -2610,6 +2915,26 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+/** Zerocoin spend proofs are orders of magnitude more expensive than script checks, so hand them out one at a time */
+static CCheckQueue<CZerocoinSpendCheck> zerocoinspendcheckqueue(1);
+/** CheckBlock() is not always called with cs_main held; only one caller at a time may own the zerocoin check queue */
+static CCriticalSection cs_zerocoinspendcheckqueue;
+
+void ThreadZerocoinSpendCheck()
+{
+    RenameThread("squorum-zcspendch");
+    zerocoinspendcheckqueue.Thread();
+}
+
+/** Each prefetch run reads a whole stretch of the coin database, see PrefetchBlockInputs() */
+static CCheckQueue<CCoinsPrefetch> coinsprefetchqueue(1);
+
+void ThreadCoinsPrefetch()
+{
+    RenameThread("squorum-coinsprefetch");
+    coinsprefetchqueue.Thread();
+}
+
 void RecalculateZSQRMinted()
 {
     CBlockIndex *pindex = chainActive[Params().Zerocoin_StartHeight()];
@@ -2628,10 +2953,9 @@ void RecalculateZSQRMinted()
         std::list<CZerocoinMint> listMints;
         BlockToZerocoinMintList(block, listMints, true);
 
-        std::vector<libzerocoin::CoinDenomination> vDenomsBefore = pindex->vMintDenominationsInBlock;
-        pindex->vMintDenominationsInBlock.clear();
+        pindex->ClearMintsInBlock();
         for (auto mint : listMints)
-            pindex->vMintDenominationsInBlock.emplace_back(mint.GetDenomination());
+            pindex->AddMintInBlock(mint.GetDenomination());
 
         if (pindex->nHeight < chainActive.Height())
             pindex = chainActive.Next(pindex);
@@ -2657,17 +2981,13 @@ void RecalculateZSQRSpent()
         std::list<libzerocoin::CoinDenomination> listDenomsSpent = ZerocoinSpendListFromBlock(block, true);
 
         //Reset the supply to previous block
-        pindex->mapZerocoinSupply = pindex->pprev->mapZerocoinSupply;
-
         //Add mints to zSQR supply
-        for (auto denom : libzerocoin::zerocoinDenomList) {
-            long nDenomAdded = count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
-            pindex->mapZerocoinSupply.at(denom) += nDenomAdded;
-        }
+        for (auto denom : libzerocoin::zerocoinDenomList)
+            pindex->SetZcMints(denom, pindex->pprev->GetZcMints(denom) + pindex->GetMintsInBlock(denom));
 
         //Remove spends from zSQR supply
         for (auto denom : listDenomsSpent)
-            pindex->mapZerocoinSupply.at(denom)--;
+            pindex->AddZcMints(denom, -1);
 
         //Rewrite money supply
         assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
@@ -2816,19 +3136,19 @@ bool UpdateZSQRSupply(const CBlock& block, CBlockIndex* pindex, bool fJustCheck)
     // Initialize zerocoin supply to the supply from previous block
     if (pindex->pprev && pindex->pprev->GetBlockHeader().nVersion > 3) {
         for (auto& denom : libzerocoin::zerocoinDenomList) {
-            pindex->mapZerocoinSupply.at(denom) = pindex->pprev->GetZcMints(denom);
+            pindex->SetZcMints(denom, pindex->pprev->GetZcMints(denom));
         }
     }
 
     // Track zerocoin money supply
     CAmount nAmountZerocoinSpent = 0;
-    pindex->vMintDenominationsInBlock.clear();
+    pindex->ClearMintsInBlock();
     if (pindex->pprev) {
         std::set<uint256> setAddedToWallet;
         for (auto& m : listMints) {
             libzerocoin::CoinDenomination denom = m.GetDenomination();
-            pindex->vMintDenominationsInBlock.push_back(m.GetDenomination());
-            pindex->mapZerocoinSupply.at(denom)++;
+            pindex->AddMintInBlock(denom);
+            pindex->AddZcMints(denom, 1);
 
             //Remove any of our own mints from the mintpool
             if (!fJustCheck && pwalletMain) {
@@ -2853,7 +3173,7 @@ bool UpdateZSQRSupply(const CBlock& block, CBlockIndex* pindex, bool fJustCheck)
         }
 
         for (auto& denom : listSpends) {
-            pindex->mapZerocoinSupply.at(denom)--;
+            pindex->AddZcMints(denom, -1);
             nAmountZerocoinSpent += libzerocoin::ZerocoinDenominationToAmount(denom);
 
             // zerocoin failsafe
@@ -2863,7 +3183,7 @@ bool UpdateZSQRSupply(const CBlock& block, CBlockIndex* pindex, bool fJustCheck)
     }
 
     for (auto& denom : libzerocoin::zerocoinDenomList)
-        LogPrint("zero", "%s coins for denomination %d pubcoin %s\n", __func__, denom, pindex->mapZerocoinSupply.at(denom));
+        LogPrint("zero", "%s coins for denomination %d pubcoin %s\n", __func__, denom, pindex->GetZcMints(denom));
 
     return true;
 }
@@ -2903,7 +3223,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         return state.DoS(100, error("ConnectBlock() : PoW period ended"),
             REJECT_INVALID, "PoW-ended");
 
-    bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
+    // Scripts are not verified below the last checkpoint, nor for the ancestors of the -assumevalid
+    // block. The coins, zerocoin and supply accounting below still run for every block.
+    bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate() && !IsBlockAssumedValid(pindex->pprev, block);
 
     // If scripts won't be checked anyways, don't bother seeing if CLTV is activated
     bool fCLTVIsActivated = false;
@@ -3184,6 +3506,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     //Record accumulator checksums
     //DatabaseChecksums(mapAccumulators);
 
+    // Index the zSQR mints of this block by height
+    if (!AddBlockToAccumulatorState(block, pindex))
+        return state.Abort("Failed to write zerocoin mint index");
+
     if (fTxIndex)
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort("Failed to write transaction index");
@@ -3221,23 +3547,186 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 }
 
 enum FlushStateMode {
+    FLUSH_STATE_NONE,
     FLUSH_STATE_IF_NEEDED,
     FLUSH_STATE_PERIODIC,
     FLUSH_STATE_ALWAYS
 };
 
+/**
+ * Prune a block file (modify associated database entries)
+ */
+void static PruneOneBlockFile(const int fileNumber)
+{
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if (pindex->nFile == fileNumber) {
+            pindex->nStatus &= ~BLOCK_HAVE_DATA;
+            pindex->nStatus &= ~BLOCK_HAVE_UNDO;
+            pindex->nFile = 0;
+            pindex->nDataPos = 0;
+            pindex->nUndoPos = 0;
+            setDirtyBlockIndex.insert(pindex);
+
+            // Prune from mapBlocksUnlinked -- any block we prune would have
+            // to be downloaded again in order to consider its chain, at which
+            // point it would be considered as a candidate for
+            // mapBlocksUnlinked or setBlockIndexCandidates.
+            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+            while (range.first != range.second) {
+                std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
+                range.first++;
+                if (it->second == pindex) {
+                    mapBlocksUnlinked.erase(it);
+                }
+            }
+        }
+    }
+
+    vinfoBlockFile[fileNumber].SetNull();
+    setDirtyFileInfo.insert(fileNumber);
+}
+
+void SelectBlockFilesToPrune(const std::vector<CBlockFileInfo>& vinfo, int nLastFile, int nTipHeight, uint64_t nTarget, std::set<int>& setFilesToPrune)
+{
+    int nBlocksToKeep = std::max<int>(MIN_BLOCKS_TO_KEEP, Params().MaxReorganizationDepth());
+    if (nTarget == 0 || nTipHeight <= nBlocksToKeep)
+        return;
+
+    unsigned int nLastBlockWeCanPrune = nTipHeight - nBlocksToKeep;
+    uint64_t nCurrentUsage = 0;
+    for (const CBlockFileInfo& info : vinfo)
+        nCurrentUsage += info.nSize + info.nUndoSize;
+    // We don't check to prune until after we've allocated new space for files
+    // So we should leave a buffer under our target to account for another allocation
+    // before the next pruning.
+    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+
+    for (int fileNumber = 0; fileNumber < nLastFile && fileNumber < (int)vinfo.size(); fileNumber++) {
+        if (nCurrentUsage + nBuffer < nTarget) // are we below our target?
+            break;
+
+        if (vinfo[fileNumber].nSize == 0)
+            continue;
+
+        // don't prune files that could have a block within MIN_BLOCKS_TO_KEEP of the main chain's tip but keep scanning
+        if (vinfo[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+            continue;
+
+        setFilesToPrune.insert(fileNumber);
+        nCurrentUsage -= vinfo[fileNumber].nSize + vinfo[fileNumber].nUndoSize;
+    }
+}
+
+/**
+ * Calculate the block/rev files that should be deleted to remain under target,
+ * and remove their blocks from the block index.
+ *
+ * The stake modifiers are computed from the block index only, so they do not
+ * need any block data.
+ */
+void static FindFilesToPrune(std::set<int>& setFilesToPrune)
+{
+    LOCK2(cs_main, cs_LastBlockFile);
+    if (chainActive.Tip() == NULL || nPruneTarget == 0)
+        return;
+
+    std::set<int> setSelected;
+    SelectBlockFilesToPrune(vinfoBlockFile, nLastBlockFile, chainActive.Height(), nPruneTarget, setSelected);
+    for (int fileNumber : setSelected)
+        PruneOneBlockFile(fileNumber);
+    setFilesToPrune.insert(setSelected.begin(), setSelected.end());
+
+    uint64_t nCurrentUsage = CalculateCurrentUsage();
+    LogPrint("prune", "Prune: target=%dMiB actual=%dMiB diff=%dMiB removed %d blk/rev pairs\n",
+        nPruneTarget / 1024 / 1024, nCurrentUsage / 1024 / 1024,
+        ((int64_t)nPruneTarget - (int64_t)nCurrentUsage) / 1024 / 1024,
+        setSelected.size());
+}
+
+uint64_t CalculateCurrentUsage()
+{
+    uint64_t retval = 0;
+    for (const CBlockFileInfo& file : vinfoBlockFile) {
+        retval += file.nSize + file.nUndoSize;
+    }
+    return retval;
+}
+
+void CleanupBlockRevFiles()
+{
+    using namespace boost::filesystem;
+    std::map<std::string, path> mapBlockFiles;
+
+    // Glob all blk?????.dat and rev?????.dat files from the blocks directory.
+    // Remove the rev files immediately and insert the blk file paths into an
+    // ordered map keyed by block file index.
+    LogPrintf("Removing unusable blk?????.dat and rev?????.dat files for -reindex with -prune\n");
+    path blocksdir = GetDataDir() / "blocks";
+    for (directory_iterator it(blocksdir); it != directory_iterator(); it++) {
+        std::string strFilename = it->path().filename().string();
+        if (is_regular_file(*it) && strFilename.length() == 12 && strFilename.substr(8, 4) == ".dat") {
+            if (strFilename.substr(0, 3) == "blk")
+                mapBlockFiles[strFilename.substr(3, 5)] = it->path();
+            else if (strFilename.substr(0, 3) == "rev")
+                remove(it->path());
+        }
+    }
+
+    // Remove all block files that aren't part of a contiguous set starting at
+    // zero by walking the ordered map (keys are block file indices) by
+    // keeping a separate counter. Once we hit a gap (or if 0 doesn't exist)
+    // start removing block files.
+    int nContigCounter = 0;
+    for (const std::pair<const std::string, path>& item : mapBlockFiles) {
+        if (atoi(item.first) == nContigCounter) {
+            nContigCounter++;
+            continue;
+        }
+        remove(item.second);
+    }
+}
+
+void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
+{
+    for (std::set<int>::const_iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
+        CDiskBlockPos pos(*it, 0);
+        blockFileMapper.Unmap(*it);
+        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
+        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+    }
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed if either they're too large, forceWrite is set, or
  * fast is not set and it's been a while since the last write.
+ * In prune mode, block and undo files are deleted first if they take more than the target.
  */
 bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
 {
-    LOCK(cs_main);
+    LOCK2(cs_main, cs_LastBlockFile);
     static int64_t nLastWrite = 0;
+    std::set<int> setFilesToPrune;
+    bool fFlushForPrune = false;
     try {
-        if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+        // A failed background write left the coin database behind pcoinsTip
+        if (pcoinsflusher && pcoinsflusher->Failed())
+            return state.Abort("Failed to write to coin database");
+        if (fPruneMode && fCheckForPruning && !fReindex) {
+            FindFilesToPrune(setFilesToPrune);
+            fCheckForPruning = false;
+            if (!setFilesToPrune.empty()) {
+                fFlushForPrune = true;
+                if (!fHavePruned) {
+                    pblocktree->WriteFlag("prunedblockfiles", true);
+                    fHavePruned = true;
+                }
+            }
+        }
+        if ((mode == FLUSH_STATE_ALWAYS) || fFlushForPrune ||
+            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) ||
             (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
             // Typical CCoins structures on disk are around 100 bytes in size.
             // Pushing a new one to the database can cause it to be written
@@ -3266,8 +3755,16 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                     return state.Abort("Files to write to block index database");
                 }
             }
+            // Then remove the pruned files, which the block index no longer refers to.
+            if (fFlushForPrune)
+                UnlinkPrunedFiles(setFilesToPrune);
             // Finally flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // With -asyncflush this only hands the coins over to the background
+            // writer, unless the caller needs them on disk now.
+            // The most recently used coins stay in the cache, clean.
+            if (!pcoinsTip->FlushRetaining(nCoinCacheUsage / 100 * COINS_CACHE_RETAIN_PERCENT))
+                return state.Abort("Failed to write to coin database");
+            if (pcoinsflusher && mode == FLUSH_STATE_ALWAYS && !pcoinsflusher->Wait())
                 return state.Abort("Failed to write to coin database");
             // Update best block in wallet (so we can detect restored wallets).
             if (mode != FLUSH_STATE_IF_NEEDED) {
@@ -3287,6 +3784,13 @@ void FlushStateToDisk()
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+void PruneAndFlush()
+{
+    CValidationState state;
+    fCheckForPruning = true;
+    FlushStateToDisk(state, FLUSH_STATE_NONE);
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex* pindexNew)
 {
@@ -3306,10 +3810,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d version=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d version=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), chainActive.Tip()->nVersion, log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-        Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+        Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -3382,6 +3886,28 @@ static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
 
+/**
+ * Load the coins spent by a block into pcoinsTip before connecting it, with
+ * the database reads spread over as many threads as the script checks.
+ * Requires cs_main, which serializes the use of the prefetch queue.
+ */
+void static PrefetchBlockInputs(const CBlock& block)
+{
+    std::set<uint256> setCreated;
+    std::vector<uint256> vTxids;
+    for (const CTransaction& tx : block.vtx) {
+        if (!tx.IsCoinBase() && !tx.HasZerocoinSpendInputs()) {
+            for (const CTxIn& txin : tx.vin) {
+                // Outputs created earlier in the block are not in the database yet
+                if (!setCreated.count(txin.prevout.hash))
+                    vTxids.push_back(txin.prevout.hash);
+            }
+        }
+        setCreated.insert(tx.GetHash());
+    }
+    pcoinsTip->PrefetchCoins(vTxids, nScriptCheckThreads ? &coinsprefetchqueue : NULL, nScriptCheckThreads);
+}
+
 /**
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
@@ -3408,6 +3934,8 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    PrefetchBlockInputs(*pblock);
+    LogPrint("bench", "  - Prefetch inputs: %.2fms\n", (GetTimeMicros() - nTime2) * 0.001);
     {
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
         bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, fAlreadyChecked);
@@ -3729,10 +4257,27 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock, bool fAlreadyChe
             // Relay inventory, but don't relay old inventory during initial block download.
             int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
             {
+                // Peers that asked for it get the block itself, as a compact block
+                std::unique_ptr<CBlockHeaderAndShortTxIDs> pcmpctblock;
+                if (pblock && pblock->GetHash() == hashNewTip)
+                    pcmpctblock.reset(new CBlockHeaderAndShortTxIDs(*pblock));
+                CInv inv(MSG_BLOCK, hashNewTip);
                 LOCK(cs_vNodes);
-                for (CNode* pnode : vNodes)
-                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                        pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                for (CNode* pnode : vNodes) {
+                    if (chainActive.Height() <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                        continue;
+                    if (pcmpctblock && pnode->fPreferHeaderAndIDs) {
+                        bool fKnown;
+                        {
+                            LOCK(pnode->cs_inventory);
+                            fKnown = !pnode->setInventoryKnown.insert(inv).second;
+                        }
+                        if (!fKnown)
+                            pnode->PushMessage("cmpctblock", *pcmpctblock);
+                    } else {
+                        pnode->PushInventory(inv);
+                    }
+                }
             }
             // Notify external listeners about the new tip.
             // Note: uiInterface, should switch main signals.
@@ -3827,6 +4372,48 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex* pindex)
     return true;
 }
 
+/**
+ * Fills in the stake data of a block index entry, which needs the transactions
+ * of the block and the stake data of its parent.
+ */
+void SetBlockIndexStakeData(CBlockIndex* pindexNew, const CBlock& block)
+{
+    uint256 hash = block.GetHash();
+    if (block.IsProofOfStake()) {
+        pindexNew->SetProofOfStake();
+        pindexNew->prevoutStake = block.vtx[1].vin[0].prevout;
+        pindexNew->nStakeTime = block.nTime;
+    }
+
+    // ppcoin: compute chain trust score
+    pindexNew->bnChainTrust = (pindexNew->pprev ? pindexNew->pprev->bnChainTrust : 0) + pindexNew->GetBlockTrust();
+
+    // ppcoin: compute stake entropy bit for stake modifier
+    if (!pindexNew->SetStakeEntropyBit(pindexNew->GetStakeEntropyBit()))
+        LogPrintf("AddToBlockIndex() : SetStakeEntropyBit() failed \n");
+
+    // ppcoin: record proof-of-stake hash value
+    if (pindexNew->IsProofOfStake()) {
+        if (!mapProofOfStake.count(hash))
+            LogPrintf("AddToBlockIndex() : hashProofOfStake not found in map \n");
+        pindexNew->hashProofOfStake = mapProofOfStake[hash];
+    }
+
+    if (!Params().IsStakeModifierV2(pindexNew->nHeight)) {
+        uint64_t nStakeModifier = 0;
+        bool fGeneratedStakeModifier = false;
+        if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
+            LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
+        pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+        pindexNew->nStakeModifierChecksum = GetStakeModifierChecksum(pindexNew);
+        if (!CheckStakeModifierCheckpoints(pindexNew->nHeight, pindexNew->nStakeModifierChecksum))
+            LogPrintf("AddToBlockIndex() : Rejected by stake modifier checkpoint height=%d, modifier=%s \n", pindexNew->nHeight, std::to_string(nStakeModifier));
+    } else {
+        // compute v2 stake modifier
+        pindexNew->nStakeModifierV2 = ComputeStakeModifier(pindexNew->pprev, block.vtx[1].vin[0].prevout.hash);
+    }
+}
+
 CBlockIndex* AddToBlockIndex(const CBlock& block)
 {
     // Check for duplicate
@@ -3836,7 +4423,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
+    CBlockIndex* pindexNew = arenaBlockIndex.New(block);
     assert(pindexNew);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
@@ -3854,33 +4441,9 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         //update previous block pointer
         pindexNew->pprev->pnext = pindexNew;
 
-        // ppcoin: compute chain trust score
-        pindexNew->bnChainTrust = (pindexNew->pprev ? pindexNew->pprev->bnChainTrust : 0) + pindexNew->GetBlockTrust();
-
-        // ppcoin: compute stake entropy bit for stake modifier
-        if (!pindexNew->SetStakeEntropyBit(pindexNew->GetStakeEntropyBit()))
-            LogPrintf("AddToBlockIndex() : SetStakeEntropyBit() failed \n");
-
-        // ppcoin: record proof-of-stake hash value
-        if (pindexNew->IsProofOfStake()) {
-            if (!mapProofOfStake.count(hash))
-                LogPrintf("AddToBlockIndex() : hashProofOfStake not found in map \n");
-            pindexNew->hashProofOfStake = mapProofOfStake[hash];
-        }
-
-        if (!Params().IsStakeModifierV2(pindexNew->nHeight)) {
-            uint64_t nStakeModifier = 0;
-            bool fGeneratedStakeModifier = false;
-            if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
-                LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
-            pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
-            pindexNew->nStakeModifierChecksum = GetStakeModifierChecksum(pindexNew);
-            if (!CheckStakeModifierCheckpoints(pindexNew->nHeight, pindexNew->nStakeModifierChecksum))
-                LogPrintf("AddToBlockIndex() : Rejected by stake modifier checkpoint height=%d, modifier=%s \n", pindexNew->nHeight, std::to_string(nStakeModifier));
-        } else {
-            // compute v2 stake modifier
-            pindexNew->nStakeModifierV2 = ComputeStakeModifier(pindexNew->pprev, block.vtx[1].vin[0].prevout.hash);
-        }
+        // A header alone gets its stake data once the block is accepted, see AcceptBlock()
+        if (!block.vtx.empty())
+            SetBlockIndexStakeData(pindexNew, block);
     }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
@@ -3891,7 +4454,9 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
     if (pindexNew->nHeight)
         pindexNew->pprev->pnext = pindexNew;
 
-    setDirtyBlockIndex.insert(pindexNew);
+    // A header alone is written once its block was accepted, see AcceptBlock()
+    if (!block.vtx.empty())
+        setDirtyBlockIndex.insert(pindexNew);
 
     return pindexNew;
 }
@@ -3977,6 +4542,8 @@ bool FindBlockPos(CValidationState& state, CDiskBlockPos& pos, unsigned int nAdd
         unsigned int nOldChunks = (pos.nPos + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         if (nNewChunks > nOldChunks) {
+            if (fPruneMode)
+                fCheckForPruning = true;
             if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
                 FILE* file = OpenBlockFile(pos);
                 if (file) {
@@ -4007,6 +4574,8 @@ bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigne
     unsigned int nOldChunks = (pos.nPos + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     unsigned int nNewChunks = (nNewSize + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     if (nNewChunks > nOldChunks) {
+        if (fPruneMode)
+            fCheckForPruning = true;
         if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
             FILE* file = OpenUndoFile(pos);
             if (file) {
@@ -4021,6 +4590,30 @@ bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigne
     return true;
 }
 
+bool IsBlockAssumedValid(const CBlockIndex* pindexPrev, const CBlockHeader& block)
+{
+    AssertLockHeld(cs_main);
+    if (hashAssumeValid == 0 || pindexPrev == NULL || pindexBestHeader == NULL)
+        return false;
+
+    // The block must be an ancestor of the assumed valid block...
+    BlockMap::iterator mi = mapBlockIndex.find(hashAssumeValid);
+    if (mi == mapBlockIndex.end())
+        return false;
+    const CBlockIndex* pindexAssumeValid = mi->second;
+    if (pindexAssumeValid->nHeight <= pindexPrev->nHeight ||
+        pindexAssumeValid->GetAncestor(pindexPrev->nHeight + 1)->GetBlockHash() != block.GetHash())
+        return false;
+
+    // ...which must be in the best header chain, with enough work behind it...
+    if (pindexBestHeader->GetAncestor(pindexAssumeValid->nHeight) != pindexAssumeValid ||
+        pindexBestHeader->nChainWork < nMinimumChainWork)
+        return false;
+
+    // ...and the block buried deep enough that faking the headers on top of it would be costly
+    return pindexBestHeader->GetBlockTime() - block.GetBlockTime() > ASSUME_VALID_MIN_AGE;
+}
+
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
 {
     LogPrint("debug", "CheckBlockHeader calling CheckProofOfWork with %0x vs %0x\n", block.nBits, block.GetHash().GetCompact());
@@ -4052,7 +4645,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, (fCheckPOW && !IsPoS)))
+    if (!CheckBlockHeader(block, state, (fCheckPOW && !IsPoS && !block.fPreChecked)))
         return state.DoS(100, error("%s : CheckBlockHeader failed", __func__), REJECT_INVALID, "bad-header", true);
 
     // All potential-corruption validation must be done before we do any
@@ -4066,7 +4659,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
             REJECT_INVALID, "time-too-new");
 
     // Check the merkle root.
-    if (fCheckMerkleRoot) {
+    if (fCheckMerkleRoot && !block.fPreChecked) {
         bool mutated;
         uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
@@ -4161,12 +4754,37 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         }
     }
 
+    // Zerocoin spend proofs of the ancestors of the -assumevalid block are not verified
+    bool fAssumeValid = false;
+    if (hashAssumeValid != 0) {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+        fAssumeValid = mi != mapBlockIndex.end() && IsBlockAssumedValid(mi->second, block);
+    }
+
     // Check transactions
     bool fZerocoinActive = block.GetBlockTime() > Params().Zerocoin_StartTime();
     std::vector<CBigNum> vBlockSerials;
+
+    // Zerocoin spend proofs are verified on the check queue workers while the rest of the block is checked,
+    // or all together on the proof workers once the rest of the block is checked if the queue is not available
+    TRY_LOCK(cs_zerocoinspendcheckqueue, fZerocoinCheckQueue);
+    bool fParallelZerocoinChecks = fZerocoinCheckQueue && nScriptCheckThreads;
+    CCheckQueueControl<CZerocoinSpendCheck> control(fParallelZerocoinChecks ? &zerocoinspendcheckqueue : NULL);
+    std::vector<CZerocoinSpendCheck> vZerocoinDeferred;
+
     for (const CTransaction& tx : block.vtx) {
-        if (!CheckTransaction(tx, fZerocoinActive, state))
+        std::vector<CZerocoinSpendCheck> vZerocoinChecks;
+        if (!CheckTransaction(tx, fZerocoinActive, state, &vZerocoinChecks, fAssumeValid))
             return error("CheckBlock() : CheckTransaction failed");
+        if (fParallelZerocoinChecks) {
+            control.Add(vZerocoinChecks);
+        } else {
+            for (CZerocoinSpendCheck& check : vZerocoinChecks) {
+                vZerocoinDeferred.push_back(CZerocoinSpendCheck());
+                check.swap(vZerocoinDeferred.back());
+            }
+        }
 
         // double check that there are no double spent zSQR spends in this block
         if (tx.HasZerocoinSpendInputs()) {
@@ -4203,6 +4821,10 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         return state.DoS(100, error("%s : out-of-bounds SigOpCount", __func__),
             REJECT_INVALID, "bad-blk-sigops", true);
 
+    if (!control.Wait() || !VerifyZerocoinSpendsInParallel(vZerocoinDeferred))
+        return state.DoS(100, error("%s : zerocoin spend did not verify", __func__),
+            REJECT_INVALID, "bad-txns-invalid-zsqr");
+
     return true;
 }
 
@@ -4332,7 +4954,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex, CNode* pfrom)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -4358,6 +4980,7 @@ bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex
 
     // Get prev block index
     CBlockIndex* pindexPrev = NULL;
+    bool fAwaitingBlock = false;
     if (hash != Params().HashGenesisBlock()) {
         BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
         if (mi == mapBlockIndex.end())
@@ -4379,6 +5002,30 @@ bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex
                              REJECT_INVALID, "bad-prevblk");
         }
 
+        // A header alone is checked for what it commits to on its own: the time, the
+        // difficulty and, in the proof-of-work era, the work. The block is checked in full
+        // by AcceptBlock() once it arrives.
+        if (block.vtx.empty()) {
+            const int nHeight = pindexPrev->nHeight + 1;
+            const bool fProofOfWork = nHeight <= Params().LAST_POW_BLOCK();
+            if (Params().NetworkID() != CBaseChainParams::REGTEST &&
+                    block.GetBlockTime() > Params().MaxFutureBlockTime(GetAdjustedTime(), !fProofOfWork))
+                return state.Invalid(error("%s : header timestamp too far in the future", __func__), REJECT_INVALID, "time-too-new");
+            if (fProofOfWork && !CheckProofOfWork(hash, block.nBits))
+                return state.DoS(50, error("%s : header proof of work failed", __func__), REJECT_INVALID, "high-hash");
+            if (!CheckWork(block, pindexPrev))
+                return state.DoS(50, error("%s : header has incorrect difficulty", __func__), REJECT_INVALID, "bad-diffbits");
+            // Past the last checkpoint, made up proof-of-stake headers could otherwise move
+            // pindexBestHeader far ahead of the tip, or fill the block index
+            if (!fProofOfWork && nHeight > Checkpoints::GetTotalBlocksEstimate()) {
+                if (nHeight > chainActive.Height() + MAX_POS_HEADERS_AHEAD_OF_TIP)
+                    return state.Invalid(false, 0, "pos-header-ahead");
+                if (mapHeadersAwaitingBlock.size() >= (size_t)MAX_POS_HEADERS ||
+                        (pfrom && State(pfrom->GetId())->nHeadersAwaitingBlock >= MAX_POS_HEADERS_PER_PEER))
+                    return state.Invalid(false, 0, "pos-headers-full");
+                fAwaitingBlock = true;
+            }
+        }
     }
 
     if (!ContextualCheckBlockHeader(block, state, pindexPrev))
@@ -4387,6 +5034,13 @@ bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex
     if (pindex == NULL)
         pindex = AddToBlockIndex(block);
 
+    if (fAwaitingBlock) {
+        CHeaderAwaitingBlock entry = {pfrom ? pfrom->GetId() : -1, GetTime()};
+        mapHeadersAwaitingBlock.insert(std::make_pair(pindex, entry));
+        if (pfrom)
+            State(pfrom->GetId())->nHeadersAwaitingBlock++;
+    }
+
     if (ppindex)
         *ppindex = pindex;
 
@@ -4431,8 +5085,10 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         uint256 hashProofOfStake = 0;
         std::unique_ptr<CStakeInput> stake;
 
-        if (!CheckProofOfStake(block, hashProofOfStake, stake, pindexPrev->nHeight))
+        if (!CheckProofOfStake(block, hashProofOfStake, stake, pindexPrev->nHeight)) {
+            HeaderAwaitingBlockFailed(block.GetHash());
             return state.DoS(100, error("%s: proof of stake check failed", __func__));
+        }
 
         if (!stake)
             return error("%s: null stake ptr", __func__);
@@ -4442,6 +5098,10 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
             mapProofOfStake.insert(std::make_pair(hash, hashProofOfStake));
     }
 
+    // Entries added from a header during headers-first sync have no transactions yet
+    BlockMap::iterator miKnown = mapBlockIndex.find(block.GetHash());
+    bool fFromHeader = miKnown != mapBlockIndex.end() && miKnown->second->nTx == 0;
+
     if (!AcceptBlockHeader(block, state, &pindex))
         return false;
 
@@ -4460,6 +5120,11 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         return false;
     }
 
+    if (fFromHeader && pindexPrev) {
+        SetBlockIndexStakeData(pindex, block);
+        setDirtyBlockIndex.insert(pindex);
+    }
+
     int nHeight = pindex->nHeight;
     int splitHeight = -1;
 
@@ -4595,6 +5260,8 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
 
             // Now that this loop if completed. Check if we have zSQR inputs.
             if(hasZSQRInputs){
+                // The zero knowledge proofs are verified together once the cheaper checks passed
+                libzerocoin::CoinSpendParallelVerifier verifier;
                 for (const CTxIn& zSqrInput : zSQRInputs) {
                     libzerocoin::CoinSpend spend = TxInToZerocoinSpend(zSqrInput);
 
@@ -4625,14 +5292,17 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
                         return state.DoS(100, error("%s: stake zerocoinspend not ready to be spent", __func__));
                     }
 
-                    libzerocoin::Accumulator accumulator(Params().Zerocoin_Params(chainActive.Height() < Params().Zerocoin_Block_V2_Start()),
+                    bool fUseModulusV1 = chainActive.Height() < Params().Zerocoin_Block_V2_Start();
+                    libzerocoin::Accumulator accumulator(Params().Zerocoin_Params(fUseModulusV1),
                                             spend.getDenomination(), bnAccumulatorValue);
 
-                    //Check that the coinspend is valid
-                    if(!spend.Verify(accumulator, true))
-                        return state.DoS(100, error("%s: zerocoin spend did not verify", __func__));
-
+                    if (!IsZerocoinSpendProofCached(spend, fUseModulusV1))
+                        verifier.Add(spend, accumulator);
                 }
+
+                //Check that the coinspends are valid
+                if (!verifier.Verify())
+                    return state.DoS(100, error("%s: zerocoin spend did not verify", __func__));
             }
 
         }
@@ -4684,6 +5354,10 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
     } catch (std::runtime_error& e) {
         return state.Abort(std::string("System error: ") + e.what());
     }
+    ForgetHeaderAwaitingBlock(pindex);
+
+    if (fCheckForPruning)
+        FlushStateToDisk(state, FLUSH_STATE_NONE); // we just allocated more disk space for block files
 
     return true;
 }
@@ -4754,7 +5428,7 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     // check block
     bool checked = CheckBlock(*pblock, state);
 
-    if (!CheckBlockSignature(*pblock))
+    if (!pblock->fPreChecked && !CheckBlockSignature(*pblock))
         return error("ProcessNewBlock() : bad proof-of-stake block signature");
 
     {
@@ -4927,7 +5601,7 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
+    CBlockIndex* pindexNew = arenaBlockIndex.New();
     if (!pindexNew)
         throw std::runtime_error("LoadBlockIndex() : new CBlockIndex failed");
     mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
@@ -4945,6 +5619,7 @@ bool static LoadBlockIndexDB(std::string& strError)
     boost::this_thread::interruption_point();
 
     // Calculate nChainWork
+    int64_t nTimeChainWork = GetTimeMillis();
     std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex) {
@@ -4955,7 +5630,9 @@ bool static LoadBlockIndexDB(std::string& strError)
     for (const PAIRTYPE(int, CBlockIndex*) & item : vSortedByHeight) {
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
-        if (pindex->nStatus & BLOCK_HAVE_DATA) {
+        // We can link the chain of blocks for which we've received transactions at some point.
+        // Pruned nodes may have deleted the block.
+        if (pindex->nTx > 0) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
@@ -4976,6 +5653,7 @@ bool static LoadBlockIndexDB(std::string& strError)
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    LogPrintf("%s: calculated chain work of %u block index entries in %dms\n", __func__, vSortedByHeight.size(), GetTimeMillis() - nTimeChainWork);
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -5015,6 +5693,11 @@ bool static LoadBlockIndexDB(std::string& strError)
     pblocktree->ReadFlag("shutdown", fLastShutdownWasPrepared);
     LogPrintf("%s: Last shutdown was prepared: %s\n", __func__, fLastShutdownWasPrepared);
 
+    // Check whether we have ever pruned block & undo files
+    pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
+    if (fHavePruned)
+        LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -5076,6 +5759,11 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height() - nCheckDepth)
             break;
+        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, only go back as far as we have data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -5093,7 +5781,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -5147,16 +5835,19 @@ void UnloadBlockIndex()
     nBlockSequenceId = 1;
     mapBlockSource.clear();
     mapBlocksInFlight.clear();
+    mapBlocksAwaitingParent.clear();
+    mapHeadersAwaitingBlock.clear();
+    nBlocksAwaitingParentSize = 0;
     nQueuedValidatedHeaders = 0;
     nPreferredDownload = 0;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
+    fHavePruned = false;
+    fCheckForPruning = false;
     mapNodeState.clear();
 
-    for (BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    arenaBlockIndex.Clear();
 }
 
 bool LoadBlockIndex(std::string& strError)
@@ -5208,13 +5899,18 @@ bool InitBlockIndex()
 }
 
 
-bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
-{
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+namespace {
 
-    int nLoaded = 0;
+/** Map of disk positions for blocks with unknown parent (only used for reindex) */
+std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+/**
+ * Reads the blocks stored in a block file, passing each of them to fnBlock
+ * (with its position in dbp, if given) until the end of the file or until
+ * fnBlock returns false.
+ */
+void ReadBlockFile(FILE* fileIn, CDiskBlockPos* dbp, const std::function<bool(CBlock&)>& fnBlock)
+{
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE_CURRENT, MAX_BLOCK_SIZE_CURRENT + 8, SER_DISK, CLIENT_VERSION);
@@ -5253,49 +5949,8 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
                 blkdat >> block;
                 nRewind = blkdat.GetPos();
 
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                        block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
-
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
-
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second)) {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, NULL, &block, &it->second)) {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                    }
-                }
+                if (!fnBlock(block))
+                    break;
             } catch (std::exception& e) {
                 LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
@@ -5303,11 +5958,233 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
     } catch (std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
+}
+
+/**
+ * Processes a block read from a block file, and the blocks read earlier that
+ * were waiting for it as their parent. Returns false if the block could not be
+ * processed because of a system error.
+ */
+bool ImportBlock(CBlock& block, CDiskBlockPos* dbp, int& nLoaded)
+{
+    // detect out of order blocks, and store them for later
+    uint256 hash = block.GetHash();
+    if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+            block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
+
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        CValidationState state;
+        if (ProcessNewBlock(state, NULL, &block, dbp))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Recursively process earlier encountered successors of this block
+    std::deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            if (ReadBlockFromDisk(block, it->second)) {
+                LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                    head.ToString());
+                CValidationState dummy;
+                if (ProcessNewBlock(dummy, NULL, &block, &it->second)) {
+                    nLoaded++;
+                    queue.push_back(block.GetHash());
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+        }
+    }
+    return true;
+}
+
+/**
+ * Reindex pipeline: one thread reads and deserializes the block files, a pool
+ * of threads runs PreCheckBlock() on the blocks read, and the importing thread
+ * connects them in the order they were read.
+ */
+class CReindexPipeline
+{
+public:
+    struct CEntry {
+        CBlock block;
+        CDiskBlockPos pos;
+        bool fChecked;
+    };
+
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::deque<std::shared_ptr<CEntry> > queue; //! blocks read, in file order
+    size_t nNextCheck;                          //! index in queue of the next block to check
+    size_t nMaxQueue;
+    bool fReadDone;
+    bool fStop;
+    boost::thread_group threads;
+
+    bool Push(CBlock& block, const CDiskBlockPos& pos)
+    {
+        std::shared_ptr<CEntry> entry = std::make_shared<CEntry>();
+        entry->block = std::move(block);
+        entry->pos = pos;
+        entry->fChecked = false;
+
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (!fStop && queue.size() >= nMaxQueue)
+            cond.wait(lock);
+        if (fStop)
+            return false;
+        queue.push_back(entry);
+        cond.notify_all();
+        return true;
+    }
+
+    void ThreadRead()
+    {
+        RenameThread("squorum-reindexrd");
+        for (int nFile = 0; ; nFile++) {
+            CDiskBlockPos pos(nFile, 0);
+            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
+                break; // No block files left to reindex
+            FILE* file = OpenBlockFile(pos, true);
+            if (!file)
+                break; // This error is logged in OpenBlockFile
+            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+            ReadBlockFile(file, &pos, [&](CBlock& block) { return Push(block, pos); });
+
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (fStop)
+                break;
+        }
+
+        boost::unique_lock<boost::mutex> lock(cs);
+        fReadDone = true;
+        cond.notify_all();
+    }
+
+    void ThreadCheck()
+    {
+        RenameThread("squorum-reindexck");
+        while (true) {
+            std::shared_ptr<CEntry> entry;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (!fStop && !fReadDone && nNextCheck >= queue.size())
+                    cond.wait(lock);
+                if (fStop || nNextCheck >= queue.size())
+                    return;
+                entry = queue[nNextCheck++];
+            }
+
+            entry->block.fPreChecked = PreCheckBlock(entry->block);
+
+            boost::unique_lock<boost::mutex> lock(cs);
+            entry->fChecked = true;
+            cond.notify_all();
+        }
+    }
+
+public:
+    CReindexPipeline(size_t nMaxQueueIn) : nNextCheck(0), nMaxQueue(nMaxQueueIn), fReadDone(false), fStop(false) {}
+
+    ~CReindexPipeline()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
+            cond.notify_all();
+        }
+        threads.join_all();
+    }
+
+    void Start(int nCheckThreads)
+    {
+        threads.create_thread(boost::bind(&CReindexPipeline::ThreadRead, this));
+        for (int i = 0; i < nCheckThreads; i++)
+            threads.create_thread(boost::bind(&CReindexPipeline::ThreadCheck, this));
+    }
+
+    //! Returns the next block once it was checked, or nothing once all block files were read
+    std::shared_ptr<CEntry> Pop()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while ((queue.empty() || !queue.front()->fChecked) && !(fReadDone && queue.empty()))
+            cond.wait(lock);
+        if (queue.empty())
+            return nullptr;
+        std::shared_ptr<CEntry> entry = queue.front();
+        queue.pop_front();
+        nNextCheck--;
+        cond.notify_all();
+        return entry;
+    }
+};
+
+}
+
+bool PreCheckBlock(const CBlock& block)
+{
+    if (block.IsProofOfWork() && !CheckProofOfWork(block.GetHash(), block.nBits))
+        return false;
+    bool mutated;
+    if (block.BuildMerkleTree(&mutated) != block.hashMerkleRoot || mutated)
+        return false;
+    return CheckBlockSignature(block);
+}
+
+bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    ReadBlockFile(fileIn, dbp, [&](CBlock& block) { return ImportBlock(block, dbp, nLoaded); });
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
 }
 
+bool ReindexBlockFiles()
+{
+    int64_t nStart = GetTimeMillis();
+    int64_t nTimeWait = 0;
+
+    int nLoaded = 0;
+    int nFileFailed = -1;
+    CReindexPipeline pipeline(REINDEX_QUEUE_BLOCKS);
+    pipeline.Start(std::max(nScriptCheckThreads, 1));
+    while (true) {
+        int64_t nTimeWaitStart = GetTimeMicros();
+        std::shared_ptr<CReindexPipeline::CEntry> entry = pipeline.Pop();
+        nTimeWait += GetTimeMicros() - nTimeWaitStart;
+        if (!entry)
+            break;
+
+        // as when loading a single file, a system error skips the rest of the file
+        if (entry->pos.nFile == nFileFailed)
+            continue;
+        if (!ImportBlock(entry->block, &entry->pos, nLoaded))
+            nFileFailed = entry->pos.nFile;
+    }
+    LogPrintf("Reindexed %i blocks in %dms, %dms of which waiting for blocks to be read and checked\n",
+        nLoaded, GetTimeMillis() - nStart, nTimeWait / 1000);
+    return nLoaded > 0;
+}
+
 void static CheckBlockIndex()
 {
     if (!fCheckBlockIndex) {
@@ -5344,6 +6221,7 @@ void static CheckBlockIndex()
     int nHeight = 0;
     CBlockIndex* pindexFirstInvalid = NULL;         // Oldest ancestor of pindex which is invalid.
     CBlockIndex* pindexFirstMissing = NULL;         // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
+    CBlockIndex* pindexFirstNeverProcessed = NULL;  // Oldest ancestor of pindex for which nTx == 0.
     CBlockIndex* pindexFirstNotTreeValid = NULL;    // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = NULL;   // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
@@ -5351,6 +6229,7 @@ void static CheckBlockIndex()
         nNodes++;
         if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
         if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
@@ -5361,12 +6240,21 @@ void static CheckBlockIndex()
             assert(pindex->GetBlockHash() == Params().HashGenesisBlock()); // Genesis block's hash must match.
             assert(pindex == chainActive.Genesis());                       // The current active chain's genesis block must be this block.
         }
-        // HAVE_DATA is equivalent to VALID_TRANSACTIONS and equivalent to nTx > 0 (we stored the number of transactions in the block)
-        assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
-        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0));
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0); // nSequenceId can't be set for blocks that aren't linked
-        // All parents having data is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstMissing != NULL) == (pindex->nChainTx == 0));                                             // nChainTx == 0 is used to signal that all parent block's transaction data is available.
+        // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
+        // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
+        if (!fHavePruned) {
+            // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
+            assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+            assert(pindexFirstMissing == pindexFirstNeverProcessed);
+        } else {
+            // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
+            if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
+        }
+        if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
+        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0));
+        // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
+        assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0));                                      // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
         assert(pindex->nHeight == nHeight);                                                                          // nHeight must be consistent.
         assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork);                            // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight)));                                // The pskip pointer must point back for all but the first 2 blocks.
@@ -5378,9 +6266,15 @@ void static CheckBlockIndex()
             // Checks for not-invalid blocks.
             assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
         }
-        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstMissing == NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block sorts at least as good as the current tip and is valid, it must be in setBlockIndexCandidates.
-                assert(setBlockIndexCandidates.count(pindex));
+        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstNeverProcessed == NULL) {
+            if (pindexFirstInvalid == NULL) {
+                // If this block sorts at least as good as the current tip and
+                // is valid and we have all data for its parents, it must be in
+                // setBlockIndexCandidates.  chainActive.Tip() must also be there
+                // even if some data has been pruned.
+                if (pindexFirstMissing == NULL || pindex == chainActive.Tip()) {
+                    assert(setBlockIndexCandidates.count(pindex));
+                }
             }
         } else { // If this block sorts worse than the current tip, it cannot be in setBlockIndexCandidates.
             assert(setBlockIndexCandidates.count(pindex) == 0);
@@ -5396,12 +6290,25 @@ void static CheckBlockIndex()
             }
             rangeUnlinked.first++;
         }
-        if (pindex->pprev && pindex->nStatus & BLOCK_HAVE_DATA && pindexFirstMissing != NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block has block data available, some parent doesn't, and has no invalid parents, it must be in mapBlocksUnlinked.
-                assert(foundInUnlinked);
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed != NULL && pindexFirstInvalid == NULL) {
+            // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
+            assert(foundInUnlinked);
+        }
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA)) assert(!foundInUnlinked); // Can't be in mapBlocksUnlinked if we don't HAVE_DATA
+        if (pindexFirstMissing == NULL) assert(!foundInUnlinked);          // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) {
+            // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
+            assert(fHavePruned); // We must have pruned.
+            // This block may have entered mapBlocksUnlinked if it has a descendant
+            // that at some point had more work than the tip, and we tried switching
+            // to it but were missing data for some block in between. So if this
+            // block is itself better than chainActive.Tip() and it wasn't in
+            // setBlockIndexCandidates, then it must be in mapBlocksUnlinked.
+            if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && setBlockIndexCandidates.count(pindex) == 0) {
+                if (pindexFirstInvalid == NULL) {
+                    assert(foundInUnlinked);
+                }
             }
-        } else { // If this block does not have block data available, or all parents do, it cannot be in mapBlocksUnlinked.
-            assert(!foundInUnlinked);
         }
         // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
         // End: actual consistency checks.
@@ -5421,6 +6328,7 @@ void static CheckBlockIndex()
             // If pindex was the first with a certain property, unset the corresponding variable.
             if (pindex == pindexFirstInvalid) pindexFirstInvalid = NULL;
             if (pindex == pindexFirstMissing) pindexFirstMissing = NULL;
+            if (pindex == pindexFirstNeverProcessed) pindexFirstNeverProcessed = NULL;
             if (pindex == pindexFirstNotTreeValid) pindexFirstNotTreeValid = NULL;
             if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = NULL;
             if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = NULL;
@@ -5528,10 +6436,12 @@ bool static AlreadyHave(const CInv& inv)
                mapTxLockReqRejected.count(inv.hash);
     case MSG_TXLOCK_VOTE:
         return mapTxLockVote.count(inv.hash);
-    case MSG_SPORK:
+    case MSG_SPORK: {
+        LOCK(cs_mapSporks);
         return mapSporks.count(inv.hash);
+    }
     case MSG_MASTERNODE_WINNER:
-        if (masternodePayments.mapMasternodePayeeVotes.count(inv.hash)) {
+        if (masternodePayments.HasPaymentVote(inv.hash)) {
             masternodeSync.AddedMasternodeWinner(inv.hash);
             return true;
         }
@@ -5592,7 +6502,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end()) {
@@ -5611,13 +6521,20 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 // Don't send not-validated blocks
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
+                    // Send block from disk, or from memory if recently sent
+                    std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached((*mi).second);
+                    if (!pblock)
                         assert(!"cannot load block from disk");
+                    const CBlock& block = *pblock;
                     if (inv.type == MSG_BLOCK)
                         pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    else if (inv.type == MSG_CMPCT_BLOCK) {
+                        // Deeper blocks are unlikely to be rebuilt from the mempool, they go in full
+                        if (mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH)
+                            pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+                        else
+                            pfrom->PushMessage("block", block);
+                    } else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
@@ -5715,106 +6632,121 @@ void static ProcessGetData(CNode* pfrom)
                 }
 
                 if (!pushed && inv.type == MSG_TXLOCK_VOTE) {
-                    if (mapTxLockVote.count(inv.hash)) {
+                    auto mi = mapTxLockVote.find(inv.hash);
+                    if (mi != mapTxLockVote.end()) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapTxLockVote[inv.hash];
+                        ss << mi->second;
                         pfrom->PushMessage("txlvote", ss);
                         pushed = true;
                     }
                 }
                 if (!pushed && inv.type == MSG_TXLOCK_REQUEST) {
-                    if (mapTxLockReq.count(inv.hash)) {
+                    auto mi = mapTxLockReq.find(inv.hash);
+                    if (mi != mapTxLockReq.end()) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapTxLockReq[inv.hash];
+                        ss << mi->second;
                         pfrom->PushMessage("ix", ss);
                         pushed = true;
                     }
                 }
                 if (!pushed && inv.type == MSG_SPORK) {
-                    if (mapSporks.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << mapSporks[inv.hash];
-                        pfrom->PushMessage("spork", ss);
-                        pushed = true;
+                    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                    {
+                        LOCK(cs_mapSporks);
+                        auto mi = mapSporks.find(inv.hash);
+                        if (mi != mapSporks.end()) {
+                            ss.reserve(1000);
+                            ss << mi->second;
+                            pushed = true;
+                        }
                     }
+                    if (pushed)
+                        pfrom->PushMessage("spork", ss);
                 }
                 if (!pushed && inv.type == MSG_MASTERNODE_WINNER) {
-                    if (masternodePayments.mapMasternodePayeeVotes.count(inv.hash)) {
+                    CMasternodePaymentWinner winner;
+                    if (masternodePayments.GetPaymentVote(inv.hash, winner)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << masternodePayments.mapMasternodePayeeVotes[inv.hash];
+                        ss << winner;
                         pfrom->PushMessage("mnw", ss);
                         pushed = true;
                     }
                 }
                 if (!pushed && inv.type == MSG_BUDGET_VOTE) {
-                    if (budget.mapSeenMasternodeBudgetVotes.count(inv.hash)) {
+                    auto mi = budget.mapSeenMasternodeBudgetVotes.find(inv.hash);
+                    if (mi != budget.mapSeenMasternodeBudgetVotes.end()) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << budget.mapSeenMasternodeBudgetVotes[inv.hash];
+                        ss << mi->second;
                         pfrom->PushMessage("mvote", ss);
                         pushed = true;
                     }
                 }
 
                 if (!pushed && inv.type == MSG_BUDGET_PROPOSAL) {
-                    if (budget.mapSeenMasternodeBudgetProposals.count(inv.hash)) {
+                    auto mi = budget.mapSeenMasternodeBudgetProposals.find(inv.hash);
+                    if (mi != budget.mapSeenMasternodeBudgetProposals.end()) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << budget.mapSeenMasternodeBudgetProposals[inv.hash];
+                        ss << mi->second;
                         pfrom->PushMessage("mprop", ss);
                         pushed = true;
                     }
                 }
 
                 if (!pushed && inv.type == MSG_BUDGET_FINALIZED_VOTE) {
-                    if (budget.mapSeenFinalizedBudgetVotes.count(inv.hash)) {
+                    auto mi = budget.mapSeenFinalizedBudgetVotes.find(inv.hash);
+                    if (mi != budget.mapSeenFinalizedBudgetVotes.end()) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << budget.mapSeenFinalizedBudgetVotes[inv.hash];
+                        ss << mi->second;
                         pfrom->PushMessage("fbvote", ss);
                         pushed = true;
                     }
                 }
 
                 if (!pushed && inv.type == MSG_BUDGET_FINALIZED) {
-                    if (budget.mapSeenFinalizedBudgets.count(inv.hash)) {
+                    auto mi = budget.mapSeenFinalizedBudgets.find(inv.hash);
+                    if (mi != budget.mapSeenFinalizedBudgets.end()) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << budget.mapSeenFinalizedBudgets[inv.hash];
+                        ss << mi->second;
                         pfrom->PushMessage("fbs", ss);
                         pushed = true;
                     }
                 }
 
                 if (!pushed && inv.type == MSG_MASTERNODE_ANNOUNCE) {
-                    if (mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)) {
+                    auto mi = mnodeman.mapSeenMasternodeBroadcast.find(inv.hash);
+                    if (mi != mnodeman.mapSeenMasternodeBroadcast.end()) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mnodeman.mapSeenMasternodeBroadcast[inv.hash];
+                        ss << mi->second;
                         pfrom->PushMessage("mnb", ss);
                         pushed = true;
                     }
                 }
 
                 if (!pushed && inv.type == MSG_MASTERNODE_PING) {
-                    if (mnodeman.mapSeenMasternodePing.count(inv.hash)) {
+                    auto mi = mnodeman.mapSeenMasternodePing.find(inv.hash);
+                    if (mi != mnodeman.mapSeenMasternodePing.end()) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mnodeman.mapSeenMasternodePing[inv.hash];
+                        ss << mi->second;
                         pfrom->PushMessage("mnp", ss);
                         pushed = true;
                     }
                 }
 
                 if (!pushed && inv.type == MSG_DSTX) {
-                    if (mapObfuscationBroadcastTxes.count(inv.hash)) {
+                    auto mi = mapObfuscationBroadcastTxes.find(inv.hash);
+                    if (mi != mapObfuscationBroadcastTxes.end()) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapObfuscationBroadcastTxes[inv.hash].tx << mapObfuscationBroadcastTxes[inv.hash].vin << mapObfuscationBroadcastTxes[inv.hash].vchSig << mapObfuscationBroadcastTxes[inv.hash].sigTime;
+                        ss << mi->second.tx << mi->second.vin << mi->second.vchSig << mi->second.sigTime;
 
                         pfrom->PushMessage("dstx", ss);
                         pushed = true;
@@ -5849,8 +6781,114 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/**
+ * Processes the blocks that were downloaded ahead of a block once it is accepted,
+ * then their own waiting descendants. Blocks whose parent was not accepted are
+ * dropped; they are requested again if still needed.
+ */
+void static ProcessBlocksAwaitingParent(const uint256& hashParent)
+{
+    std::deque<uint256> queue;
+    queue.push_back(hashParent);
+    while (!queue.empty()) {
+        std::vector<CBlockAwaitingParent> vChildren;
+        bool fParentAccepted;
+        {
+            LOCK(cs_main);
+            std::pair<std::multimap<uint256, CBlockAwaitingParent>::iterator, std::multimap<uint256, CBlockAwaitingParent>::iterator> range =
+                mapBlocksAwaitingParent.equal_range(queue.front());
+            for (std::multimap<uint256, CBlockAwaitingParent>::iterator it = range.first; it != range.second; ++it) {
+                vChildren.push_back(it->second);
+                nBlocksAwaitingParentSize -= it->second.nSize;
+            }
+            mapBlocksAwaitingParent.erase(range.first, range.second);
+            BlockMap::iterator mi = mapBlockIndex.find(queue.front());
+            fParentAccepted = mi != mapBlockIndex.end() && mi->second->nTx > 0 && !(mi->second->nStatus & BLOCK_FAILED_MASK);
+        }
+        queue.pop_front();
+
+        for (const CBlockAwaitingParent& child : vChildren) {
+            if (!fParentAccepted) {
+                LogPrint("net", "dropping block %s, its parent was not accepted\n", child.hash.ToString());
+                // and with it the blocks waiting for it
+                queue.push_back(child.hash);
+                continue;
+            }
+            // Dropped for lack of room, FindNextBlocksToDownload() fetches it again now
+            if (!child.pblock)
+                continue;
+            {
+                LOCK(cs_main);
+                mapBlockSource[child.hash] = child.nodeid;
+            }
+            CValidationState state;
+            ProcessNewBlock(state, NULL, child.pblock.get());
+            int nDoS;
+            if (state.IsInvalid(nDoS) && nDoS > 0) {
+                LOCK(cs_main);
+                Misbehaving(child.nodeid, nDoS);
+            }
+            queue.push_back(child.hash);
+        }
+    }
+}
+
+// Requires cs_main.
+/** Asks pfrom, which just gave us a new tip, to announce its next blocks with cmpctblock right away */
+static void MaybeSetPeerAsAnnouncingHeaderAndIDs(CNode* pfrom)
+{
+    if (!pfrom->fSupportsCompactBlocks)
+        return;
+    std::list<NodeId>::iterator it = std::find(lNodesAnnouncingHeaderAndIDs.begin(), lNodesAnnouncingHeaderAndIDs.end(), pfrom->GetId());
+    if (it != lNodesAnnouncingHeaderAndIDs.end()) {
+        lNodesAnnouncingHeaderAndIDs.splice(lNodesAnnouncingHeaderAndIDs.end(), lNodesAnnouncingHeaderAndIDs, it);
+        return;
+    }
+
+    if (lNodesAnnouncingHeaderAndIDs.size() >= MAX_HIGH_BANDWIDTH_CMPCT_PEERS) {
+        // The peer that gave us a new tip the longest time ago goes back to inv
+        NodeId nodeidOldest = lNodesAnnouncingHeaderAndIDs.front();
+        lNodesAnnouncingHeaderAndIDs.pop_front();
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes) {
+            if (pnode->GetId() == nodeidOldest)
+                pnode->PushMessage("sendcmpct", false, CMPCTBLOCKS_VERSION);
+        }
+    }
+    pfrom->PushMessage("sendcmpct", true, CMPCTBLOCKS_VERSION);
+    lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
+}
+
+// Requires cs_main.
+/** Downloads a block announced by a compact block in full, when it cannot be rebuilt */
+static void RequestFullBlock(CNode* pfrom, CBlockIndex* pindex)
+{
+    std::vector<CInv> vGetData(1, CInv(MSG_BLOCK, pindex->GetBlockHash()));
+    MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), pindex);
+    pfrom->PushMessage("getdata", vGetData);
+}
+
+// Requires cs_main.
+/** Processes a block rebuilt from a compact block, see "cmpctblock" and "blocktxn" */
+static void ProcessReconstructedBlock(CNode* pfrom, CBlock& block)
+{
+    uint256 hashBlock = block.GetHash();
+    CValidationState state;
+    ProcessNewBlock(state, pfrom, &block);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", std::string("block"), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), hashBlock);
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    } else if (chainActive.Tip()->GetBlockHash() == hashBlock) {
+        MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom);
+    }
+    ProcessBlocksAwaitingParent(hashBlock);
+}
+
 bool fRequestedSporksIDB = false;
-bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
+bool static ProcessMessage(CNode* pfrom, std::string strCommand, CBufferReader& vRecv, int64_t nTimeReceived)
 {
     RandAddSeedPerfmon();
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -5923,7 +6961,10 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         pfrom->fClient = !(pfrom->nServices & NODE_NETWORK);
 
         // Potentially mark this peer as a preferred download peer.
-        UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        {
+            LOCK(cs_main);
+            UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        }
 
         // Change version
         pfrom->PushMessage("verack");
@@ -5991,6 +7032,10 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     else if (strCommand == "verack") {
         pfrom->SetRecvVersion(std::min(pfrom->nVersion, PROTOCOL_VERSION));
 
+        // We accept compact blocks, announced by inv until the peer gave us a new tip first
+        if (pfrom->nVersion >= COMPACT_BLOCKS_VERSION)
+            pfrom->PushMessage("sendcmpct", false, CMPCTBLOCKS_VERSION);
+
         // Mark this node as currently connected, so we update its timestamp later.
         if (pfrom->fNetworkNode) {
             LOCK(cs_main);
@@ -6091,9 +7136,24 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
                 if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
-                    LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    if (CanSyncHeadersFrom(pfrom)) {
+                        // Ask for the headers leading up to the announced block first, so the block connects
+                        // once it arrives. Close to the tip, also ask for the block itself to save a round trip;
+                        // otherwise it is fetched along with the others by FindNextBlocksToDownload().
+                        pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
+                        CNodeState* nodestate = State(pfrom->GetId());
+                        if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().TargetSpacing() * 20 &&
+                            nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                            // As a compact block if the peer supports them, rebuilt from our mempool
+                            vToFetch.push_back(CInv(pfrom->fSupportsCompactBlocks ? MSG_CMPCT_BLOCK : MSG_BLOCK, inv.hash));
+                            MarkBlockAsInFlight(pfrom->GetId(), inv.hash);
+                        }
+                        LogPrint("net", "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    } else {
+                        // Add this to the list of blocks to request
+                        vToFetch.push_back(inv);
+                        LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    }
                 }
             }
 
@@ -6131,7 +7191,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     }
 
 
-    else if (strCommand == "getblocks" || strCommand == "getheaders") {
+    else if (strCommand == "getblocks") {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
@@ -6151,6 +7211,15 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                 LogPrint("net", "  getblocks stopping at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
                 break;
             }
+            // If pruning, don't inv blocks unless we have them on disk and are likely to still
+            // have them for the hour that block relay might require.
+            if (fPruneMode) {
+                const int nPrunedBlocksLikelyToHave = std::max<int>(MIN_BLOCKS_TO_KEEP, Params().MaxReorganizationDepth()) - 3600 / Params().TargetSpacing();
+                if (!(pindex->nStatus & BLOCK_HAVE_DATA) || pindex->nHeight <= chainActive.Tip()->nHeight - nPrunedBlocksLikelyToHave) {
+                    LogPrint("net", "  getblocks stopping, pruned or too old block at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+                    break;
+                }
+            }
             pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
             if (--nLimit <= 0) {
                 // When this block is requested, we'll send an inv that'll make them
@@ -6163,14 +7232,14 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     }
 
 
-    else if (strCommand == "headers" && Params().HeadersFirstSyncingActive()) {
+    else if (strCommand == "getheaders") {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
 
         LOCK(cs_main);
 
-        if (IsInitialBlockDownload())
+        if (IsInitialBlockDownload() && !pfrom->fWhitelisted)
             return true;
 
         CBlockIndex* pindex = NULL;
@@ -6240,6 +7309,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                 ignoreFees = true;
                 pmn->allowFreeTx = false;
 
+                LOCK(cs_main);
                 if (!mapObfuscationBroadcastTxes.count(tx.GetHash())) {
                     CObfuscationBroadcastTx dstx;
                     dstx.tx = tx;
@@ -6384,6 +7454,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             return true;
         }
         CBlockIndex* pindexLast = NULL;
+        bool fAheadOfTip = false;
         for (const CBlockHeader& header : headers) {
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
@@ -6391,10 +7462,14 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                 return error("non-continuous headers sequence");
             }
 
-            /*TODO: this has a CBlock cast on it so that it will compile. There should be a solution for this
-             * before headers are reimplemented on mainnet
-             */
-            if (!AcceptBlockHeader((CBlock)header, state, &pindexLast)) {
+            // A block without transactions, which AcceptBlockHeader() checks as a header alone
+            if (!AcceptBlockHeader(CBlock(header), state, &pindexLast, pfrom)) {
+                if (state.GetRejectReason() == "pos-header-ahead" || state.GetRejectReason() == "pos-headers-full") {
+                    LogPrint("net", "headers from peer=%d stop at %d (%s), continuing later\n", pfrom->id, pindexLast ? pindexLast->nHeight : -1, state.GetRejectReason());
+                    State(pfrom->GetId())->fHeadersAheadOfTip = true;
+                    fAheadOfTip = true;
+                    break;
+                }
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -6408,7 +7483,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         if (pindexLast)
             UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
 
-        if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
+        if (nCount == MAX_HEADERS_RESULTS && pindexLast && !fAheadOfTip) {
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
@@ -6421,15 +7496,26 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
 
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
-        CBlock block;
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        CBlock& block = *pblock;
         vRecv >> block;
         uint256 hashBlock = block.GetHash();
         CInv inv(MSG_BLOCK, hashBlock);
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
 
+        bool fHavePrev;
+        {
+            LOCK(cs_main);
+            fHavePrev = mapBlockIndex.count(block.hashPrevBlock) > 0;
+        }
+
         //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
-        if (!mapBlockIndex.count(block.hashPrevBlock)) {
-            if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
+        if (!fHavePrev) {
+            LOCK(cs_main);
+            if (CanSyncHeadersFrom(pfrom)) {
+                // ask for the headers connecting it, the block is fetched again once they arrived
+                pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), hashBlock);
+            } else if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
                 //we already asked for this block, so lets work backwards and ask for the previous block
                 pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
                 pfrom->vBlockRequested.push_back(block.hashPrevBlock);
@@ -6441,8 +7527,43 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         } else {
             pfrom->AddInventoryKnown(inv);
 
+            bool fNewBlock;
+            bool fAwaitingParent = false;
+            {
+                LOCK(cs_main);
+                BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+                fNewBlock = mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA);
+                // A block downloaded ahead of its parent during headers-first sync waits for it
+                if (fNewBlock && mi != mapBlockIndex.end() && mi->second->pprev && mi->second->pprev->nTx == 0) {
+                    fAwaitingParent = true;
+                    MarkBlockAsReceived(hashBlock);
+                    size_t nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+                    CBlockAwaitingParent* pentry = FindBlockAwaitingParent(mi->second);
+                    if (pentry && pentry->pblock) {
+                        LogPrint("net", "block %s already awaits its parent, peer=%d\n", hashBlock.ToString(), pfrom->id);
+                    } else {
+                        // Without room, only the hash is kept, so FindNextBlocksToDownload() does not
+                        // fetch the block again before its parent was accepted
+                        bool fRoom = nBlocksAwaitingParentSize + nSize <= MAX_BLOCKS_AWAITING_PARENT_SIZE;
+                        CBlockAwaitingParent entry = {hashBlock, fRoom ? pblock : nullptr, pfrom->GetId(), fRoom ? nSize : 0};
+                        if (pentry)
+                            *pentry = entry;
+                        else
+                            mapBlocksAwaitingParent.insert(std::make_pair(block.hashPrevBlock, entry));
+                        nBlocksAwaitingParentSize += entry.nSize;
+                        if (fRoom)
+                            LogPrint("net", "block %s (%d) awaits its parent, %u bytes of blocks waiting, peer=%d\n",
+                                hashBlock.ToString(), mi->second->nHeight, nBlocksAwaitingParentSize, pfrom->id);
+                        else
+                            LogPrint("net", "no room for block %s ahead of its parent, peer=%d\n", hashBlock.ToString(), pfrom->id);
+                    }
+                }
+            }
+
             CValidationState state;
-            if (!mapBlockIndex.count(block.GetHash())) {
+            if (fAwaitingParent) {
+                // processed by ProcessBlocksAwaitingParent()
+            } else if (fNewBlock) {
                 ProcessNewBlock(state, pfrom, &block);
                 int nDoS;
                 if(state.IsInvalid(nDoS)) {
@@ -6453,6 +7574,12 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                         if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
                     }
                 }
+                {
+                    LOCK(cs_main);
+                    if (!state.IsInvalid() && chainActive.Tip()->GetBlockHash() == hashBlock)
+                        MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom);
+                    ProcessBlocksAwaitingParent(hashBlock);
+                }
                 //disconnect this node if its old protocol version
                 pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
             } else {
@@ -6461,6 +7588,172 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         }
     }
 
+    else if (strCommand == "sendcmpct") {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == CMPCTBLOCKS_VERSION) {
+            pfrom->fSupportsCompactBlocks = true;
+            pfrom->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
+    }
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        uint256 hashBlock = cmpctblock.header.GetHash();
+        LogPrint("cmpctblock", "received compact block %s peer=%d\n", hashBlock.ToString(), pfrom->id);
+
+        LOCK(cs_main);
+
+        // Whether we asked this peer for the block (inv handler) or another one. A
+        // request to this peer that is not answered by the compact block is either
+        // turned into a full block request or dropped, so that it cannot time out.
+        std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hashBlock);
+        bool fInFlightHere = itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId();
+        bool fInFlightElsewhere = itInFlight != mapBlocksInFlight.end() && !fInFlightHere;
+
+        if (!mapBlockIndex.count(cmpctblock.header.hashPrevBlock)) {
+            // Ask for the headers connecting it, the block is fetched again once they arrived
+            if (fInFlightHere)
+                MarkBlockAsReceived(hashBlock);
+            if (CanSyncHeadersFrom(pfrom))
+                pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), hashBlock);
+            return true;
+        }
+
+        CBlockIndex* pindex = NULL;
+        CValidationState state;
+        if (!AcceptBlockHeader(CBlock(cmpctblock.header), state, &pindex, pfrom)) {
+            if (fInFlightHere)
+                MarkBlockAsReceived(hashBlock);
+            int nDoS;
+            if (state.IsInvalid(nDoS)) {
+                if (nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+                return error("invalid header received in compact block %s", hashBlock.ToString());
+            }
+            return true;
+        }
+        UpdateBlockAvailability(pfrom->GetId(), hashBlock);
+        pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hashBlock));
+        if (pindex->nStatus & BLOCK_HAVE_DATA) {
+            if (fInFlightHere)
+                MarkBlockAsReceived(hashBlock);
+            return true;
+        }
+
+        // Proof-of-stake checks need the parent connected: blocks further ahead, or
+        // on a competing fork, are downloaded in full, along with the ones before them
+        if (pindex->pprev != chainActive.Tip()) {
+            if (fInFlightHere || (!fInFlightElsewhere && pindex->nChainWork > chainActive.Tip()->nChainWork))
+                RequestFullBlock(pfrom, pindex);
+            return true;
+        }
+
+        std::shared_ptr<CPartiallyDownloadedBlock> partialBlock = std::make_shared<CPartiallyDownloadedBlock>(&mempool);
+        CompactBlockReadStatus status = partialBlock->InitData(cmpctblock);
+        if (status == READ_STATUS_INVALID) {
+            if (!fInFlightElsewhere)
+                MarkBlockAsReceived(hashBlock);
+            Misbehaving(pfrom->GetId(), 100);
+            return error("invalid compact block %s from peer=%d", hashBlock.ToString(), pfrom->id);
+        }
+
+        CBlockTransactionsRequest req;
+        if (status == READ_STATUS_OK) {
+            for (size_t i = 0; i < partialBlock->BlockTxCount(); i++) {
+                if (!partialBlock->IsTxAvailable(i))
+                    req.indexes.push_back(i);
+            }
+            if (req.indexes.empty()) {
+                CBlock block;
+                status = partialBlock->FillBlock(block, std::vector<CTransaction>());
+                if (status == READ_STATUS_OK) {
+                    ProcessReconstructedBlock(pfrom, block);
+                    return true;
+                }
+            }
+        }
+
+        // Another peer already sends it
+        if (fInFlightElsewhere)
+            return true;
+        if (status != READ_STATUS_OK) {
+            RequestFullBlock(pfrom, pindex);
+            return true;
+        }
+        req.blockhash = hashBlock;
+        MarkBlockAsInFlight(pfrom->GetId(), hashBlock, pindex, partialBlock);
+        pfrom->PushMessage("getblocktxn", req);
+        LogPrint("cmpctblock", "getblocktxn for %u of %u transactions of block %s to peer=%d\n",
+            req.indexes.size(), partialBlock->BlockTxCount(), hashBlock.ToString(), pfrom->id);
+    }
+
+    else if (strCommand == "getblocktxn") {
+        CBlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "peer=%d asked for transactions of unknown block %s\n", pfrom->id, req.blockhash.ToString());
+            return true;
+        }
+        if (!chainActive.Contains(mi->second) || mi->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // Not sent as a compact block, answer with the whole block, as getdata would
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom);
+            return true;
+        }
+
+        std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(mi->second);
+        if (!pblock)
+            return error("cannot load block %s from disk", req.blockhash.ToString());
+        CBlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= pblock->vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("getblocktxn with out of range index from peer=%d", pfrom->id);
+            }
+            resp.txn[i] = pblock->vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockTransactions resp;
+        vRecv >> resp;
+
+        LOCK(cs_main);
+
+        std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(resp.blockhash);
+        if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != pfrom->GetId() ||
+            !itInFlight->second.second->partialBlock) {
+            LogPrint("cmpctblock", "unexpected block transactions for %s from peer=%d\n", resp.blockhash.ToString(), pfrom->id);
+            return true;
+        }
+        std::shared_ptr<CPartiallyDownloadedBlock> partialBlock = itInFlight->second.second->partialBlock;
+        CBlockIndex* pindex = itInFlight->second.second->pindex;
+
+        CBlock block;
+        CompactBlockReadStatus status = partialBlock->FillBlock(block, resp.txn);
+        if (status == READ_STATUS_INVALID) {
+            MarkBlockAsReceived(resp.blockhash);
+            Misbehaving(pfrom->GetId(), 100);
+            return error("invalid block transactions for %s from peer=%d", resp.blockhash.ToString(), pfrom->id);
+        }
+        if (status == READ_STATUS_FAILED) {
+            // A short id matched the wrong mempool transaction
+            RequestFullBlock(pfrom, pindex);
+            return true;
+        }
+        ProcessReconstructedBlock(pfrom, block);
+    }
+
     else if (strCommand == "accvalue"){
         if(nLocalServices & NODE_BLOOM_LIGHT_ZC) {
             try {
@@ -6470,6 +7763,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                 vRecv >> den;
                 CBigNum bnAccValue = 0;
                 //std::cout << "asking for checkpoint value in height: " << height << ", den: " << den << std::endl;
+                LOCK(cs_main);
                 if (!GetAccumulatorValue(height, den, bnAccValue)) {
                     LogPrint("zsqr", "peer misbehaving for request an invalid acc checkpoint \n", __func__);
                     Misbehaving(pfrom->GetId(), 50);
@@ -6494,7 +7788,12 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                 CGenWit gen;
                 vRecv >> gen;
                 gen.setPfrom(pfrom);
-                if (gen.isValid(chainActive.Height())) {
+                int nHeight;
+                {
+                    LOCK(cs_main);
+                    nHeight = chainActive.Height();
+                }
+                if (gen.isValid(nHeight)) {
                     if (!lightWorker.addWitWork(gen)) {
                         LogPrint("zsqr", "%s : add genwit request failed \n", __func__);
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
@@ -6521,7 +7820,10 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     // Making users (which are behind NAT and can only make outgoing connections) ignore
     // getaddr message mitigates the attack.
     else if ((strCommand == "getaddr") && (pfrom->fInbound)) {
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         std::vector<CAddress> vAddr = addrman.GetAddr();
         for (const CAddress& addr : vAddr)
             pfrom->PushAddress(addr);
@@ -6575,7 +7877,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     else if (strCommand == "pong") {
         int64_t pingUsecEnd = nTimeReceived;
         uint64_t nonce = 0;
-        size_t nAvail = vRecv.in_avail();
+        size_t nAvail = vRecv.size();
         bool bPingFinished = false;
         std::string sProblem;
 
@@ -6735,6 +8037,9 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         }
     } else {
         //probably one the extensions
+        // Their seen-maps are also read and filled by AlreadyHave() and ProcessGetData()
+        // under cs_main, so the message handler threads run them one at a time under it
+        LOCK(cs_main);
         mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
         budget.ProcessMessage(pfrom, strCommand, vRecv);
         masternodePayments.ProcessMessageMasternodePayments(pfrom, strCommand, vRecv);
@@ -6797,7 +8102,7 @@ bool ProcessMessages(CNode* pfrom)
 
         //if (fDebug)
         //    LogPrintf("ProcessMessages(message %u msgsz, %u bytes, complete:%s)\n",
-        //            msg.hdr.nMessageSize, msg.vRecv.size(),
+        //            msg.hdr.nMessageSize, msg.nDataPos,
         //            msg.complete() ? "Y" : "N");
 
         // end, if an incomplete message is found
@@ -6826,8 +8131,7 @@ bool ProcessMessages(CNode* pfrom)
         unsigned int nMessageSize = hdr.nMessageSize;
 
         // Checksum
-        CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+        uint256 hash = Hash(msg.vRecv.data(), msg.vRecv.data() + nMessageSize);
         unsigned int nChecksum = 0;
         memcpy(&nChecksum, &hash, sizeof(nChecksum));
         if (nChecksum != hdr.nChecksum) {
@@ -6836,8 +8140,10 @@ bool ProcessMessages(CNode* pfrom)
             continue;
         }
 
-        // Process message
+        // Process message, read in place from the receive buffer
+        CBufferReader vRecv = msg.GetPayload();
         bool fRet = false;
+        int64_t nTimeStart = GetTimeMicros();
         try {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
             boost::this_thread::interruption_point();
@@ -6860,6 +8166,8 @@ bool ProcessMessages(CNode* pfrom)
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
 
+        messageStats.Add(SanitizeString(strCommand), GetTimeMicros() - nTimeStart);
+
         if (!fRet)
             LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
 
@@ -6920,8 +8228,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             LOCK(cs_vNodes);
             for (CNode* pnode : vNodes) {
                 // Periodically clear setAddrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_vAddrToSend);
                     pnode->setAddrKnown.clear();
+                }
 
                 // Rebroadcast our address
                 AdvertiseLocal(pnode);
@@ -6934,6 +8244,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: addr
         //
         if (fSendTrickle) {
+            LOCK(pto->cs_vAddrToSend);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             for (const CAddress& addr : pto->vAddrToSend) {
@@ -6971,6 +8282,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             pto->PushMessage("reject", (std::string) "block", reject.chRejectCode, reject.strRejectReason, reject.hashBlock);
         state.rejects.clear();
 
+        // Drop the proof-of-stake headers whose block did not arrive
+        ExpireHeadersAwaitingBlock();
+
         // Start block sync
         if (pindexBestHeader == NULL)
             pindexBestHeader = chainActive.Tip();
@@ -6980,12 +8294,22 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             if (nSyncStarted == 0 || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
                 state.fSyncStarted = true;
                 nSyncStarted++;
-                //CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
-                //LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                //pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
-                pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
+                if (CanSyncHeadersFrom(pto)) {
+                    // Blocks are then fetched from every peer that has them, see FindNextBlocksToDownload()
+                    CBlockIndex* pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+                    LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
+                    pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
+                } else {
+                    pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
+                }
             }
         }
+        // Continue with the proof-of-stake headers that were too far ahead, once the tip caught up
+        if (state.fHeadersAheadOfTip && pindexBestHeader->nHeight < chainActive.Height() + MAX_POS_HEADERS_AHEAD_OF_TIP / 2) {
+            state.fHeadersAheadOfTip = false;
+            LogPrint("net", "more getheaders (%d) to peer=%d\n", pindexBestHeader->nHeight, pto->id);
+            pto->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256(0));
+        }
 
         // Resend wallet transactions that haven't gotten in a block yet
         // Except during reindex, importing and IBD, when old wallet
@@ -7167,10 +8491,8 @@ public:
     ~CMainCleanup()
     {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        arenaBlockIndex.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
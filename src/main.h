@@ -36,6 +36,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -47,13 +48,17 @@
 
 #include <boost/unordered_map.hpp>
 
+class CBlockFileInfo;
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
+class CCoinsViewFlusher;
 class CZerocoinDB;
 class CSporkDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
+class CZerocoinSpendCheck;
 class CValidationInterface;
 class CValidationState;
 
@@ -86,12 +91,24 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Block files containing a block within MIN_BLOCKS_TO_KEEP of the tip are never pruned, so reorgs and accumulator checkpoint recalculation keep their block and undo data */
+static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+/**
+ * Minimum -prune target: MIN_BLOCKS_TO_KEEP blocks of MAX_BLOCK_SIZE_CURRENT with
+ * 15% more for their undo data, plus the chunks preallocated in the files being
+ * written (just under 649 MiB)
+ */
+static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = (uint64_t)MIN_BLOCKS_TO_KEEP * MAX_BLOCK_SIZE_CURRENT * 115 / 100 + BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** How much older than the best header a block must be to skip checks because of -assumevalid */
+static const int64_t ASSUME_VALID_MIN_AGE = 14 * 24 * 60 * 60;
+/** Number of blocks read and checked ahead of the block being connected during -reindex */
+static const unsigned int REINDEX_QUEUE_BLOCKS = 128;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -102,8 +119,20 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Serialized size of the blocks downloaded ahead of their parent that are kept in memory until it is accepted. */
+static const unsigned int MAX_BLOCKS_AWAITING_PARENT_SIZE = 64 * 1024 * 1024;
+/** How far above the tip proof-of-stake headers past the last checkpoint are accepted before their block,
+ *  as their stake can only be checked with it. Kept below the 144 blocks behind the best header that count as initial download. */
+static const int MAX_POS_HEADERS_AHEAD_OF_TIP = 100;
+/** Maximum number of such proof-of-stake headers waiting for their block that one peer sent, and that all peers sent. */
+static const int MAX_POS_HEADERS_PER_PEER = 2 * MAX_POS_HEADERS_AHEAD_OF_TIP;
+static const int MAX_POS_HEADERS = 10 * MAX_POS_HEADERS_PER_PEER;
+/** Time (in seconds) after which such a proof-of-stake header whose block did not arrive is dropped again. */
+static const int64_t POS_HEADER_TIMEOUT = 20 * 60;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
+/** Share (in percent) of the coins cache kept of its most recently used entries when it is flushed. */
+static const unsigned int COINS_CACHE_RETAIN_PERCENT = 50;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 
@@ -146,6 +175,7 @@ extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
+extern CBlockIndexArena arenaBlockIndex;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern const std::string strMessageMagic;
@@ -156,9 +186,15 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+/** True if any block files have ever been pruned. */
+extern bool fHavePruned;
+/** True if we're running in -prune mode. */
+extern bool fPruneMode;
+/** Size in bytes of the block and undo files that we are trying to stay below (-prune). */
+extern uint64_t nPruneTarget;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern int64_t nMaxTipAge;
@@ -178,6 +214,10 @@ extern std::map<uint256, int64_t> mapZerocoinspends; //txid, time received
 
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex* pindexBestHeader;
+/** Block whose ancestors are assumed to have valid scripts and zerocoin spend proofs (-assumevalid), 0 if none */
+extern uint256 hashAssumeValid;
+/** Chain work the best header chain needs before -assumevalid takes effect (-minimumchainwork) */
+extern uint256 nMinimumChainWork;
 
 /**  */
 extern CLightWorker lightWorker;
@@ -212,6 +252,14 @@ FILE* OpenUndoFile(const CDiskBlockPos& pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos& pos, const char* prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp = NULL);
+/** Rebuild the block index from all the block files (-reindex), reading and checking blocks ahead of connecting them */
+bool ReindexBlockFiles();
+/**
+ * Runs the checks of a block that depend neither on the chain nor on cs_main
+ * (proof of work, merkle root and block signature), so that -reindex can run
+ * them on other threads than the one connecting blocks.
+ */
+bool PreCheckBlock(const CBlock& block);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
@@ -231,6 +279,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the zerocoin spend proof checking thread */
+void ThreadZerocoinSpendCheck();
+/** Run an instance of the coin prefetch thread */
+void ThreadCoinsPrefetch();
 
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
@@ -256,10 +308,25 @@ CBlockIndex* InsertBlockIndex(uint256 hash);
 bool AbortNode(const std::string& msg, const std::string& userMessage = "");
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
-/** Increase a node's misbehavior score. */
+/** Increase a node's misbehavior score. Takes cs_main, for the message handlers that run without it. */
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Prune block files and flush state to disk. */
+void PruneAndFlush();
+/** Calculate the amount of disk space the block & undo files currently use */
+uint64_t CalculateCurrentUsage();
+/**
+ * Select the block files to delete so that those in vinfo take less than nTarget
+ * with room for another allocation: the oldest first, before nLastFile, and none
+ * with a block less than MIN_BLOCKS_TO_KEEP (or the maximum reorganization depth)
+ * below nTipHeight.
+ */
+void SelectBlockFilesToPrune(const std::vector<CBlockFileInfo>& vinfo, int nLastFile, int nTipHeight, uint64_t nTarget, std::set<int>& setFilesToPrune);
+/** Actually unlink the specified files */
+void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune);
+/** Delete the rev files, and the blk files past the first gap, before a -reindex in prune mode */
+void CleanupBlockRevFiles();
 
 
 /** (try to) add transaction to memory pool **/
@@ -268,6 +335,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
 int GetInputAge(CTxIn& vin);
+/** Height of the block with the unspent output vin spends, from the coins view, or -1 */
+int GetInputHeight(const CTxIn& vin);
 int GetInputAgeIX(uint256 nTXHash, CTxIn& vin);
 int GetIXConfirmations(uint256 nTXHash);
 
@@ -357,9 +426,9 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
 
 /** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationState& state);
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks = NULL, bool fAssumeValid = false);
 bool CheckZerocoinMint(const uint256& txHash, const CTxOut& txout, CValidationState& state, bool fCheckOnly = false);
-bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state);
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvChecks = NULL);
 bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend& spend, CBlockIndex* pindex, const uint256& hashBlock);
 bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const libzerocoin::CoinSpend* spend, CBlockIndex* pindex, const uint256& hashBlock);
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx, CTransaction& tx);
@@ -446,11 +515,45 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing one zerocoin spend proof verification
+ * (commitment PoK, accumulator PoK and serial number SoK)
+ */
+class CZerocoinSpendCheck
+{
+private:
+    libzerocoin::CoinSpend spend;
+    libzerocoin::ZerocoinParams* params;
+    CBigNum bnAccumulatorValue;
+    uint256 txid;
+
+public:
+    CZerocoinSpendCheck() : params(NULL) {}
+    CZerocoinSpendCheck(const libzerocoin::CoinSpend& spendIn, libzerocoin::ZerocoinParams* paramsIn, const CBigNum& bnAccumulatorValueIn, const uint256& txidIn) :
+        spend(spendIn), params(paramsIn), bnAccumulatorValue(bnAccumulatorValueIn), txid(txidIn) {}
+
+    bool operator()();
+
+    const libzerocoin::CoinSpend& GetSpend() const { return spend; }
+    libzerocoin::Accumulator GetAccumulator() const { return libzerocoin::Accumulator(params, spend.getDenomination(), bnAccumulatorValue); }
+    const uint256& GetTxid() const { return txid; }
+
+    void swap(CZerocoinSpendCheck& check)
+    {
+        std::swap(spend, check.spend);
+        std::swap(params, check.params);
+        std::swap(bnAccumulatorValue, check.bnAccumulatorValue);
+        std::swap(txid, check.txid);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Returns a block from the block cache, reading it from disk (and caching it) if needed. Null on read errors. */
+std::shared_ptr<const CBlock> ReadBlockFromDiskCached(const CBlockIndex* pindex);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -467,6 +570,9 @@ bool DisconnectBlocksAndReprocess(int blocks);
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck, bool fAlreadyChecked = false);
 
+/** Whether a block building on pindexPrev may skip script and zerocoin proof verification because of -assumevalid */
+bool IsBlockAssumedValid(const CBlockIndex* pindexPrev, const CBlockHeader& block);
+
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true);
@@ -481,7 +587,8 @@ bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex
 
 /** Store block on disk. If dbp is provided, the file is known to already reside on disk */
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** pindex, CDiskBlockPos* dbp = NULL, bool fAlreadyCheckedBlock = false);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex = NULL);
+/** Add a block to the block index after checking its header. A block without transactions is a header from a "headers" message. */
+bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex = NULL, CNode* pfrom = NULL);
 
 
 class CBlockFileInfo
@@ -639,6 +746,12 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache* pcoinsTip;
 
+/** Global variable that points to the coin database at the bottom of pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB* pcoinsdbview;
+
+/** Background writer of the coin database under pcoinsTip with -asyncflush, NULL otherwise (protected by cs_main) */
+extern CCoinsViewFlusher* pcoinsflusher;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB* pblocktree;
 
@@ -220,7 +220,7 @@ public:
     void Sync(CNode* node, uint256 nProp, bool fPartial = false);
 
     void Calculate();
-    void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    void ProcessMessage(CNode* pfrom, std::string& strCommand, CBufferReader& vRecv);
     void NewBlock();
     CBudgetProposal* FindProposal(const std::string& strProposalName);
     CBudgetProposal* FindProposal(uint256 nHash);
@@ -26,7 +26,7 @@ extern CMasternodePayments masternodePayments;
 #define MNPAYMENTS_SIGNATURES_REQUIRED 6
 #define MNPAYMENTS_SIGNATURES_TOTAL 10
 
-void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CBufferReader& vRecv);
 bool IsBlockPayeeValid(const CBlock& block, int nBlockHeight);
 std::string GetRequiredPaymentsString(int nBlockHeight);
 bool IsBlockValueValid(const CBlock& block, CAmount nExpectedValue, CAmount nMinted);
@@ -254,6 +254,22 @@ public:
         mapMasternodePayeeVotes.clear();
     }
 
+    bool HasPaymentVote(const uint256& hash)
+    {
+        LOCK(cs_mapMasternodePayeeVotes);
+        return mapMasternodePayeeVotes.count(hash);
+    }
+
+    bool GetPaymentVote(const uint256& hash, CMasternodePaymentWinner& winner)
+    {
+        LOCK(cs_mapMasternodePayeeVotes);
+        std::map<uint256, CMasternodePaymentWinner>::const_iterator it = mapMasternodePayeeVotes.find(hash);
+        if (it == mapMasternodePayeeVotes.end())
+            return false;
+        winner = it->second;
+        return true;
+    }
+
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
     bool ProcessBlock(int nBlockHeight);
 
@@ -281,7 +297,7 @@ public:
     }
 
     int GetMinMasternodePaymentsProto();
-    void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CBufferReader& vRecv);
     std::string GetRequiredPaymentsString(int nBlockHeight);
     void FillBlockPayee(CMutableTransaction& txNew, int64_t nFees, bool fProofOfStake, bool fZSQRStake);
     std::string ToString() const;
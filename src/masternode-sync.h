@@ -21,6 +21,8 @@
 #define MASTERNODE_SYNC_TIMEOUT 5
 #define MASTERNODE_SYNC_THRESHOLD 2
 
+#include "sync.h"
+
 class CMasternodeSync;
 extern CMasternodeSync masternodeSync;
 
@@ -31,6 +33,10 @@ extern CMasternodeSync masternodeSync;
 class CMasternodeSync
 {
 public:
+    // Guards the seen maps and the counts reported by peers, no other lock is
+    // taken while holding it
+    CCriticalSection cs;
+
     std::map<uint256, int> mapSeenSyncMNB;
     std::map<uint256, int> mapSeenSyncMNW;
     std::map<uint256, int> mapSeenSyncBudget;
@@ -64,9 +70,11 @@ public:
     void AddedMasternodeList(uint256 hash);
     void AddedMasternodeWinner(uint256 hash);
     void AddedBudgetItem(uint256 hash);
+    void RemovedMasternodeList(const uint256& hash);
+    void RemovedMasternodeWinner(const uint256& hash);
     void GetNextAsset();
     std::string GetSyncStatus();
-    void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    void ProcessMessage(CNode* pfrom, std::string& strCommand, CBufferReader& vRecv);
     bool IsBudgetFinEmpty();
     bool IsBudgetPropEmpty();
 
@@ -596,7 +596,7 @@ bool CMasternodeBroadcast::CheckInputsAndAdd(int& nDoS)
         if (!lockMain) {
             // not mnb fault, let it to be checked again later
             mnodeman.mapSeenMasternodeBroadcast.erase(GetHash());
-            masternodeSync.mapSeenSyncMNB.erase(GetHash());
+            masternodeSync.RemovedMasternodeList(GetHash());
             return false;
         }
 
@@ -613,20 +613,17 @@ bool CMasternodeBroadcast::CheckInputsAndAdd(int& nDoS)
         LogPrint("masternode","mnb - Input must have at least %d confirmations\n", MASTERNODE_MIN_CONFIRMATIONS);
         // maybe we miss few blocks, let this mnb to be checked again later
         mnodeman.mapSeenMasternodeBroadcast.erase(GetHash());
-        masternodeSync.mapSeenSyncMNB.erase(GetHash());
+        masternodeSync.RemovedMasternodeList(GetHash());
         return false;
     }
 
     // verify that sig time is legit in past
     // should be at least not earlier than block when 1000 SQR tx got MASTERNODE_MIN_CONFIRMATIONS
-    uint256 hashBlock = 0;
-    CTransaction tx2;
-    GetTransaction(vin.prevout.hash, tx2, hashBlock, true);
-    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-    if (mi != mapBlockIndex.end() && (*mi).second) {
-        CBlockIndex* pMNIndex = (*mi).second;                                                        // block for 1000 SQR tx -> 1 confirmation
-        CBlockIndex* pConfIndex = chainActive[pMNIndex->nHeight + MASTERNODE_MIN_CONFIRMATIONS - 1]; // block where tx got MASTERNODE_MIN_CONFIRMATIONS
-        if (pConfIndex->GetBlockTime() > sigTime) {
+    int nCollateralHeight = GetInputHeight(vin);
+    if (nCollateralHeight > 0) {
+        // block for 1000 SQR tx -> 1 confirmation, pConfIndex is where it got MASTERNODE_MIN_CONFIRMATIONS
+        CBlockIndex* pConfIndex = chainActive[nCollateralHeight + MASTERNODE_MIN_CONFIRMATIONS - 1];
+        if (pConfIndex && pConfIndex->GetBlockTime() > sigTime) {
             LogPrint("masternode","mnb - Bad sigTime %d for Masternode %s (%i conf block is at %d)\n",
                 sigTime, vin.prevout.hash.ToString(), MASTERNODE_MIN_CONFIRMATIONS, pConfIndex->GetBlockTime());
             return false;
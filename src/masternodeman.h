@@ -142,7 +142,7 @@ public:
 
     void ProcessMasternodeConnections();
 
-    void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    void ProcessMessage(CNode* pfrom, std::string& strCommand, CBufferReader& vRecv);
 
     /// Return the number of (unique) Masternodes
     int size() { return vMasternodes.size(); }
@@ -0,0 +1,50 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "msgstats.h"
+
+CMessageStats messageStats;
+
+int CLatencyHistogram::GetBucket(int64_t nMicros)
+{
+    int nBucket = 0;
+    while (nBucket < LATENCY_HISTOGRAM_BUCKETS - 1 && nMicros >= ((int64_t)1 << nBucket))
+        nBucket++;
+    return nBucket;
+}
+
+void CLatencyHistogram::Add(int64_t nMicros)
+{
+    if (nMicros < 0)
+        nMicros = 0;
+    nCount++;
+    nTotalMicros += nMicros;
+    if (nMicros > nMaxMicros)
+        nMaxMicros = nMicros;
+    vBuckets[GetBucket(nMicros)]++;
+}
+
+void CMessageStats::Add(const std::string& strCommand, int64_t nMicros)
+{
+    std::lock_guard<std::mutex> lock(cs_stats);
+    std::map<std::string, CLatencyHistogram>::iterator it = mapCommands.find(strCommand);
+    if (it == mapCommands.end()) {
+        // Peers choose the commands, so their number is bounded
+        const std::string strKey = mapCommands.size() < MAX_MESSAGE_STATS_COMMANDS ? strCommand : MESSAGE_STATS_OTHER;
+        it = mapCommands.insert(std::make_pair(strKey, CLatencyHistogram())).first;
+    }
+    it->second.Add(nMicros);
+}
+
+std::map<std::string, CLatencyHistogram> CMessageStats::Get()
+{
+    std::lock_guard<std::mutex> lock(cs_stats);
+    return mapCommands;
+}
+
+void CMessageStats::Clear()
+{
+    std::lock_guard<std::mutex> lock(cs_stats);
+    mapCommands.clear();
+}
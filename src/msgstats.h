@@ -0,0 +1,52 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef sQuorum_MSGSTATS_H
+#define sQuorum_MSGSTATS_H
+
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+/** Buckets of a latency histogram: bucket i counts times below 2^i microseconds, the last one everything else */
+static const int LATENCY_HISTOGRAM_BUCKETS = 25;
+/** Commands tracked separately, further unknown commands are counted as MESSAGE_STATS_OTHER */
+static const size_t MAX_MESSAGE_STATS_COMMANDS = 128;
+static const char* const MESSAGE_STATS_OTHER = "*other*";
+
+/** Processing times of one message command */
+struct CLatencyHistogram {
+    uint64_t nCount;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    uint64_t vBuckets[LATENCY_HISTOGRAM_BUCKETS];
+
+    CLatencyHistogram() : nCount(0), nTotalMicros(0), nMaxMicros(0), vBuckets() {}
+
+    void Add(int64_t nMicros);
+    //! Index of the bucket a time falls into
+    static int GetBucket(int64_t nMicros);
+};
+
+/**
+ * How long the message handler threads took for each command received from
+ * peers, from waiting for the locks it needs to having handled it. Shared by
+ * all message handler threads, see getmessagestats.
+ */
+class CMessageStats
+{
+private:
+    std::mutex cs_stats;
+    std::map<std::string, CLatencyHistogram> mapCommands;
+
+public:
+    void Add(const std::string& strCommand, int64_t nMicros);
+    std::map<std::string, CLatencyHistogram> Get();
+    void Clear();
+};
+
+extern CMessageStats messageStats;
+
+#endif // sQuorum_MSGSTATS_H
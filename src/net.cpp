@@ -27,6 +27,11 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
 #endif
 
 #ifdef USE_UPNP
@@ -36,6 +41,8 @@
 #include <miniupnpc/upnperrors.h>
 #endif
 
+#include <mutex>
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -68,6 +75,56 @@ struct ListenSocket {
 
     ListenSocket(SOCKET socket, bool whitelisted) : socket(socket), whitelisted(whitelisted) {}
 };
+
+/** Payload buffers of destroyed messages, up to MAX_RECV_BUFFER_POOL_SIZE bytes, see CNetMessageBuffer */
+class CNetMessageBufferPool
+{
+private:
+    std::mutex cs_pool;
+    std::multimap<size_t, char*> mapBuffers; // by capacity
+    size_t nBytes;
+
+public:
+    CNetMessageBufferPool() : nBytes(0) {}
+    ~CNetMessageBufferPool()
+    {
+        for (const auto& item : mapBuffers)
+            delete[] item.second;
+    }
+
+    // The smallest buffer of at least nWanted bytes, unless it would waste
+    // most of its memory, or else the largest one of at least nMin bytes
+    char* Take(size_t nMin, size_t nWanted, size_t& nCapacity)
+    {
+        std::lock_guard<std::mutex> lock(cs_pool);
+        std::multimap<size_t, char*>::iterator it = mapBuffers.lower_bound(nWanted);
+        if (it == mapBuffers.end() || it->first > 4 * nWanted + 64 * 1024) {
+            if (it == mapBuffers.begin())
+                return NULL;
+            --it;
+            if (it->first < nMin)
+                return NULL;
+        }
+        char* pdata = it->second;
+        nCapacity = it->first;
+        nBytes -= nCapacity;
+        mapBuffers.erase(it);
+        return pdata;
+    }
+
+    void Give(char* pdata, size_t nCapacity)
+    {
+        {
+            std::lock_guard<std::mutex> lock(cs_pool);
+            if (nBytes + nCapacity <= MAX_RECV_BUFFER_POOL_SIZE) {
+                mapBuffers.insert(std::make_pair(nCapacity, pdata));
+                nBytes += nCapacity;
+                return;
+            }
+        }
+        delete[] pdata;
+    }
+};
 }
 
 //
@@ -84,6 +141,7 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = 125;
+SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
 bool fAddressesInitialized = false;
 std::string strSubVersion;
 
@@ -107,7 +165,29 @@ NodeId nLastNodeId = 0;
 CCriticalSection cs_nLastNodeId;
 
 static CSemaphore* semOutbound = NULL;
-boost::condition_variable messageHandlerCondition;
+
+// Destroyed after the nodes, whose messages hand their buffers back to it
+static CNetMessageBufferPool netMessageBufferPool;
+
+// Threads running ThreadMessageHandler(), see GetMessageHandlerThread()
+static int nMessageHandlerThreads = 1;
+static boost::condition_variable messageHandlerConditions[MAX_MSGHAND_THREADS];
+// The one node whose inventory is trickled, picked by the first message handler thread for all of them
+static std::atomic<NodeId> nodeIdTrickle(-1);
+
+/** The message handler thread a node is pinned to, so its messages are processed in order */
+static int GetMessageHandlerThread(const CNode* pnode)
+{
+    return pnode->id % nMessageHandlerThreads;
+}
+
+// Wakes ThreadSocketHandler() from select() or epoll_wait(), see WakeSocketHandler()
+static int wakeupPipe[2] = {-1, -1};
+static std::atomic<bool> fWakeupPending(false);
+#ifdef HAVE_SYS_EPOLL_H
+static int epollFd = -1;
+#endif
+static void AddNodeSocketEvents(CNode* pnode);
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -414,7 +494,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
     bool proxyConnectionFailed = false;
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed)) {
-        if (!IsSelectableSocket(hSocket)) {
+        if (socketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -425,6 +505,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
         // Add node
         CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
         pnode->AddRef();
+        AddNodeSocketEvents(pnode);
 
         {
             LOCK(cs_vNodes);
@@ -449,6 +530,10 @@ void CNode::CloseSocketDisconnect()
     fDisconnect = true;
     if (hSocket != INVALID_SOCKET) {
         LogPrint("net", "disconnecting peer=%d\n", id);
+#ifdef HAVE_SYS_EPOLL_H
+        if (epollFd != -1)
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, hSocket, NULL);
+#endif
         CloseSocket(hSocket);
     }
 
@@ -736,29 +821,69 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            messageHandlerConditions[GetMessageHandlerThread(this)].notify_one();
         }
     }
 
     return true;
 }
 
+char* CNode::GetRecvPayloadBuffer(unsigned int nBytes)
+{
+    if (vRecvMsg.empty() || !vRecvMsg.back().in_data)
+        return NULL;
+    CNetMessage& msg = vRecvMsg.back();
+    if (msg.hdr.nMessageSize - msg.nDataPos < nBytes)
+        return NULL;
+    return msg.PrepareData(nBytes);
+}
+
+CNetMessageBuffer::~CNetMessageBuffer()
+{
+    if (pdata)
+        netMessageBufferPool.Give(pdata, nCapacity);
+}
+
+void CNetMessageBuffer::Acquire(size_t nMin, size_t nWanted)
+{
+    assert(!pdata);
+    pdata = netMessageBufferPool.Take(nMin, nWanted, nCapacity);
+    if (!pdata) {
+        pdata = new char[nMin];
+        nCapacity = nMin;
+    }
+}
+
+void CNetMessageBuffer::Reserve(size_t nSize, size_t nKeep)
+{
+    if (nSize <= nCapacity)
+        return;
+    char* pdataNew = new char[nSize];
+    if (nKeep)
+        memcpy(pdataNew, pdata, nKeep);
+    if (pdata)
+        netMessageBufferPool.Give(pdata, nCapacity);
+    pdata = pdataNew;
+    nCapacity = nSize;
+}
+
 int CNetMessage::readHeader(const char* pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     memcpy(&hdrbuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
     // deserialize to CMessageHeader
     try {
-        hdrbuf >> hdr;
+        CBufferReader reader(hdrbuf, hdrbuf + CMessageHeader::HEADER_SIZE, nType, nVersion);
+        reader >> hdr;
     } catch (const std::exception&) {
         return -1;
     }
@@ -773,17 +898,31 @@ int CNetMessage::readHeader(const char* pch, unsigned int nBytes)
     return nCopy;
 }
 
-int CNetMessage::readData(const char* pch, unsigned int nBytes)
+char* CNetMessage::PrepareData(unsigned int& nBytes)
 {
-    unsigned int nRemaining = hdr.nMessageSize - nDataPos;
-    unsigned int nCopy = std::min(nRemaining, nBytes);
+    nBytes = std::min(hdr.nMessageSize - nDataPos, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
-    }
+    // Allocate up to 256 KiB ahead of the data received, but never more than the
+    // total message size. A pooled buffer of the whole size is taken if there is
+    // one. Growth stays within the same bound, so with messages capped at
+    // MAX_PROTOCOL_MESSAGE_LENGTH an unpooled payload is moved at most 8 times.
+    size_t nAhead = std::min((size_t)hdr.nMessageSize, (size_t)nDataPos + nBytes + 256 * 1024);
+    if (!vRecv.data())
+        vRecv.Acquire(nAhead, hdr.nMessageSize);
+    else if (vRecv.capacity() < nDataPos + nBytes)
+        vRecv.Reserve(nAhead, nDataPos);
+
+    return vRecv.data() + nDataPos;
+}
+
+int CNetMessage::readData(const char* pch, unsigned int nBytes)
+{
+    unsigned int nCopy = nBytes;
+    char* pchDest = PrepareData(nCopy);
 
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // Received directly into the buffer, see CNode::GetRecvPayloadBuffer()
+    if (pchDest != pch)
+        memcpy(pchDest, pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
@@ -835,6 +974,465 @@ void SocketSendData(CNode* pnode)
 
 static std::list<CNode*> vNodesDisconnected;
 
+// Nodes epoll reported ready that still have work left (-socketevents=epoll),
+// only used by ThreadSocketHandler()
+static std::set<CNode*> setNodesReady;
+
+void WakeSocketHandler()
+{
+#ifndef WIN32
+    // One byte in the pipe is enough until ThreadSocketHandler() drained it
+    if (wakeupPipe[1] == -1 || fWakeupPending.exchange(true))
+        return;
+    char c = 0;
+    if (write(wakeupPipe[1], &c, 1) != 1)
+        fWakeupPending = false;
+#endif
+}
+
+static void DrainWakeupPipe()
+{
+#ifndef WIN32
+    fWakeupPending = false;
+    char buf[128];
+    while (read(wakeupPipe[0], buf, sizeof(buf)) > 0) {
+    }
+#endif
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/** Registers a socket with epoll, events for it carry ptr */
+static bool RegisterSocketEvents(SOCKET hSocket, void* ptr, uint32_t nEvents)
+{
+    struct epoll_event event;
+    event.events = nEvents;
+    event.data.ptr = ptr;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, hSocket, &event) != 0) {
+        LogPrintf("%s : epoll_ctl failed: %s\n", __func__, NetworkErrorString(WSAGetLastError()));
+        return false;
+    }
+    return true;
+}
+#endif
+
+/** Starts watching the socket of a new node, before it is added to vNodes */
+static void AddNodeSocketEvents(CNode* pnode)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    // Edge triggered: every change is reported once, ThreadSocketHandler() keeps
+    // it in fHasRecvData/fCanSendData until the socket would block again
+    if (epollFd != -1 && !RegisterSocketEvents(pnode->hSocket, pnode, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET))
+        pnode->fDisconnect = true;
+#endif
+}
+
+static void StartSocketEvents()
+{
+#ifndef WIN32
+    if (pipe(wakeupPipe) != 0) {
+        LogPrintf("%s : could not create wakeup pipe: %s\n", __func__, NetworkErrorString(WSAGetLastError()));
+        wakeupPipe[0] = wakeupPipe[1] = -1;
+    } else {
+        for (int i = 0; i < 2; i++)
+            fcntl(wakeupPipe[i], F_SETFL, fcntl(wakeupPipe[i], F_GETFL, 0) | O_NONBLOCK);
+    }
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd == -1) {
+            LogPrintf("%s : epoll_create1 failed: %s, using select()\n", __func__, NetworkErrorString(WSAGetLastError()));
+            socketEventsMode = SOCKETEVENTS_SELECT;
+            return;
+        }
+        // Level triggered: one connection is accepted per event
+        for (ListenSocket& hListenSocket : vhListenSocket)
+            RegisterSocketEvents(hListenSocket.socket, &hListenSocket, EPOLLIN);
+        if (wakeupPipe[0] != -1)
+            RegisterSocketEvents(wakeupPipe[0], wakeupPipe, EPOLLIN);
+    }
+#endif
+    LogPrintf("Using %s for socket events\n", socketEventsMode == SOCKETEVENTS_EPOLL ? "epoll" : "select");
+}
+
+// requires LOCK(pnode->cs_vRecvMsg)
+static bool IsRecvFlooded(CNode* pnode)
+{
+    return !pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() &&
+           pnode->GetTotalRecvSize() > ReceiveFloodSize();
+}
+
+// requires LOCK(pnode->cs_vRecvMsg)
+// Returns false once the socket would block, or was closed
+static bool SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+
+    // The payload of large messages is read straight into their buffer, headers
+    // and small messages go through pchBuf
+    char* pchRecv = pnode->GetRecvPayloadBuffer(sizeof(pchBuf));
+    if (!pchRecv)
+        pchRecv = pchBuf;
+    int nBytes = recv(pnode->hSocket, pchRecv, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0) {
+        if (!pnode->ReceiveMsgBytes(pchRecv, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+    } else if (nBytes == 0) {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    } else if (nBytes < 0) {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr == WSAEWOULDBLOCK)
+            return false;
+        if (nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
+            if (!pnode->fDisconnect)
+                LogPrint("net","socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return pnode->hSocket != INVALID_SOCKET;
+}
+
+static void AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+    } else if (socketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket)) {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (CNode::IsBanned(addr) && !whitelisted) {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+        AddNodeSocketEvents(pnode);
+
+        {
+            LOCK(cs_vNodes);
+            vNodes.push_back(pnode);
+        }
+    }
+}
+
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+static void ServiceSocketsSelect()
+{
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+#ifndef WIN32
+    if (wakeupPipe[0] != -1) {
+        FD_SET(wakeupPipe[0], &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, (SOCKET)wakeupPipe[0]);
+        have_fds = true;
+    }
+#endif
+
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes) {
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = std::max(hSocketMax, pnode->hSocket);
+            have_fds = true;
+
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is no (complete) message in the receive buffer,
+            //   or there is space left in the buffer, select() for receiving data.
+            // * (if neither of the above applies, there is certainly one message
+            //   in the receiver buffer ready to be processed).
+            // Together, that means that at least one of the following is always possible,
+            // so we don't deadlock:
+            // * We send some data.
+            // * We wait for data to be received (and disconnect after timeout).
+            // * We process a message in the buffer (message handler thread).
+            {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend && !pnode->vSendMsg.empty()) {
+                    FD_SET(pnode->hSocket, &fdsetSend);
+                    continue;
+                }
+            }
+            {
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (lockRecv) {
+                    pnode->fPauseRecv = IsRecvFlooded(pnode);
+                    if (!pnode->fPauseRecv)
+                        FD_SET(pnode->hSocket, &fdsetRecv);
+                }
+            }
+        }
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+        &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    boost::this_thread::interruption_point();
+
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        MilliSleep(timeout.tv_usec / 1000);
+    }
+
+#ifndef WIN32
+    if (wakeupPipe[0] != -1 && FD_ISSET(wakeupPipe[0], &fdsetRecv))
+        DrainWakeupPipe();
+#endif
+
+    //
+    // Accept new connections
+    //
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            AcceptConnection(hListenSocket);
+    }
+
+    //
+    // Service each socket
+    //
+    std::vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        for (CNode* pnode : vNodesCopy)
+            pnode->AddRef();
+    }
+    for (CNode* pnode : vNodesCopy) {
+        boost::this_thread::interruption_point();
+
+        //
+        // Receive
+        //
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv)
+                SocketRecvData(pnode);
+        }
+
+        //
+        // Send
+        //
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (FD_ISSET(pnode->hSocket, &fdsetSend)) {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend)
+                SocketSendData(pnode);
+        }
+
+        //
+        // Inactivity checking
+        //
+        InactivityCheck(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodesCopy)
+            pnode->Release();
+    }
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static void ServiceSocketsEpoll()
+{
+    // Nodes are only deleted by ThreadSocketHandler() itself, and their sockets
+    // are removed from epoll when closed, so no references are taken here.
+    static int64_t nLastInactivityCheck = 0;
+    static bool fRetry = false;
+
+    // Nodes left in setNodesReady wait for the message handler to make room in
+    // their receive buffer, which wakes us up, unless a lock was busy
+    const int MAX_EVENTS = 256;
+    struct epoll_event events[MAX_EVENTS];
+    int nEvents = epoll_wait(epollFd, events, MAX_EVENTS, fRetry || wakeupPipe[0] == -1 ? 50 : 1000);
+    boost::this_thread::interruption_point();
+
+    if (nEvents < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            MilliSleep(50);
+        }
+        nEvents = 0;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        void* ptr = events[i].data.ptr;
+        if (ptr == wakeupPipe) {
+            DrainWakeupPipe();
+            continue;
+        }
+
+        bool fListenSocket = false;
+        for (const ListenSocket& hListenSocket : vhListenSocket) {
+            if (ptr == &hListenSocket) {
+                AcceptConnection(hListenSocket);
+                fListenSocket = true;
+            }
+        }
+        if (fListenSocket)
+            continue;
+
+        CNode* pnode = static_cast<CNode*>(ptr);
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            pnode->fHasRecvData = true;
+        if (events[i].events & EPOLLOUT)
+            pnode->fCanSendData = true;
+        setNodesReady.insert(pnode);
+    }
+
+    //
+    // Service the sockets that are ready
+    //
+    fRetry = false;
+    std::set<CNode*>::iterator it = setNodesReady.begin();
+    while (it != setNodesReady.end()) {
+        CNode* pnode = *it;
+        boost::this_thread::interruption_point();
+        bool fKeep = false;
+
+        //
+        // Send, before receiving more, as with select()
+        //
+        bool fSendBlocked = false;
+        if (pnode->hSocket != INVALID_SOCKET) {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (!lockSend) {
+                fKeep = fRetry = true;
+            } else if (!pnode->vSendMsg.empty()) {
+                if (pnode->fCanSendData) {
+                    SocketSendData(pnode);
+                    // What is left did not fit, epoll reports when there is room again
+                    pnode->fCanSendData = pnode->vSendMsg.empty();
+                }
+                fSendBlocked = !pnode->vSendMsg.empty();
+            }
+        }
+
+        //
+        // Receive
+        //
+        if (pnode->hSocket != INVALID_SOCKET && pnode->fHasRecvData && !fSendBlocked) {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (!lockRecv) {
+                fKeep = fRetry = true;
+            } else {
+                pnode->fPauseRecv = IsRecvFlooded(pnode);
+                while (!pnode->fPauseRecv && SocketRecvData(pnode))
+                    pnode->fPauseRecv = IsRecvFlooded(pnode);
+                if (pnode->fPauseRecv)
+                    fKeep = true;
+                else
+                    pnode->fHasRecvData = false;
+            }
+        }
+
+        if (fKeep && pnode->hSocket != INVALID_SOCKET)
+            ++it;
+        else
+            setNodesReady.erase(it++);
+    }
+
+    //
+    // Inactivity checking
+    //
+    int64_t nNow = GetTimeMillis();
+    if (nNow - nLastInactivityCheck >= 1000) {
+        nLastInactivityCheck = nNow;
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes) {
+            if (pnode->hSocket != INVALID_SOCKET)
+                InactivityCheck(pnode);
+        }
+    }
+}
+#endif
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -885,6 +1483,7 @@ void ThreadSocketHandler()
                     }
                     if (fDelete) {
                         vNodesDisconnected.remove(pnode);
+                        setNodesReady.erase(pnode);
                         delete pnode;
                     }
                 }
@@ -900,222 +1499,16 @@ void ThreadSocketHandler()
             uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes) {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-            &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
-
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec / 1000);
-        }
-
-        //
-        // Accept new connections
-        //
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
-
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
-
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    for (CNode* pnode : vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
-
-                if (hSocket == INVALID_SOCKET) {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                } else if (!IsSelectableSocket(hSocket)) {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (CNode::IsBanned(addr) && !whitelisted) {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
-
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
-            }
-        }
-
-        //
-        // Service each socket
-        //
-        std::vector<CNode*> vNodesCopy;
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy)
-                pnode->AddRef();
-        }
-        for (CNode* pnode : vNodesCopy) {
-            boost::this_thread::interruption_point();
-
-            //
-            // Receive
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        } else if (nBytes == 0) {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        } else if (nBytes < 0) {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                                if (!pnode->fDisconnect)
-                                    LogPrint("net","socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
-            }
-
-            //
-            // Send
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend)) {
-                TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    SocketSendData(pnode);
-            }
-
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
-        }
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodesCopy)
-                pnode->Release();
+#ifdef HAVE_SYS_EPOLL_H
+        if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+            ServiceSocketsEpoll();
+            continue;
         }
+#endif
+        ServiceSocketsSelect();
     }
 }
 
-
 #ifdef USE_UPNP
 void ThreadMapPort()
 {
@@ -1492,7 +1885,7 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant* grantOu
 }
 
 
-void ThreadMessageHandler()
+void ThreadMessageHandler(int nThread)
 {
     boost::mutex condition_mutex;
     boost::unique_lock<boost::mutex> lock(condition_mutex);
@@ -1502,17 +1895,17 @@ void ThreadMessageHandler()
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
+            if (nThread == 0)
+                nodeIdTrickle = vNodes.empty() ? -1 : vNodes[GetRand(vNodes.size())]->GetId();
+            for (CNode* pnode : vNodes) {
+                if (GetMessageHandlerThread(pnode) != nThread)
+                    continue;
                 pnode->AddRef();
+                vNodesCopy.push_back(pnode);
             }
         }
 
         // Poll the connected nodes for messages
-        CNode* pnodeTrickle = NULL;
-        if (!vNodesCopy.empty())
-            pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
-
         bool fSleep = true;
 
         for (CNode* pnode : vNodesCopy) {
@@ -1526,6 +1919,10 @@ void ThreadMessageHandler()
                     if (!g_signals.ProcessMessages(pnode))
                         pnode->CloseSocketDisconnect();
 
+                    // Let the socket handler read again as soon as there is room
+                    if (pnode->fPauseRecv && !IsRecvFlooded(pnode))
+                        WakeSocketHandler();
+
                     if (pnode->nSendSize < SendBufferSize()) {
                         if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete())) {
                             fSleep = false;
@@ -1539,7 +1936,7 @@ void ThreadMessageHandler()
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
-                    g_signals.SendMessages(pnode, pnode == pnodeTrickle || pnode->fWhitelisted);
+                    g_signals.SendMessages(pnode, pnode->GetId() == nodeIdTrickle || pnode->fWhitelisted);
             }
             boost::this_thread::interruption_point();
         }
@@ -1552,7 +1949,7 @@ void ThreadMessageHandler()
         }
 
         if (fSleep)
-            messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+            messageHandlerConditions[nThread].timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
     }
 }
 
@@ -1727,6 +2124,8 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     Discover(threadGroup);
 
+    StartSocketEvents();
+
     //
     // Start threads
     //
@@ -1748,8 +2147,10 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Initiate outbound connections
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
-    // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    // Process messages, every node on the thread it is pinned to
+    nMessageHandlerThreads = std::max(1, std::min((int)GetArg("-msghandthreads", DEFAULT_MSGHAND_THREADS), MAX_MSGHAND_THREADS));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", boost::function<void()>(boost::bind(&ThreadMessageHandler, i))));
 
     // Dump network addresses
     scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
@@ -1795,6 +2196,18 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+#ifdef HAVE_SYS_EPOLL_H
+        if (epollFd != -1)
+            close(epollFd);
+        epollFd = -1;
+#endif
+#ifndef WIN32
+        for (int i = 0; i < 2; i++) {
+            if (wakeupPipe[i] != -1)
+                close(wakeupPipe[i]);
+            wakeupPipe[i] = -1;
+        }
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -2030,6 +2443,30 @@ bool CAddrDB::Read(CAddrMan& addr)
 unsigned int ReceiveFloodSize() { return 1000 * GetArg("-maxreceivebuffer", 5 * 1000); }
 unsigned int SendBufferSize() { return 1000 * GetArg("-maxsendbuffer", 1 * 1000); }
 
+bool SetSocketEventsMode(const std::string& strMode)
+{
+    if (strMode == "select") {
+        socketEventsMode = SOCKETEVENTS_SELECT;
+        return true;
+    }
+#ifdef HAVE_SYS_EPOLL_H
+    if (strMode == "epoll") {
+        socketEventsMode = SOCKETEVENTS_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string GetSupportedSocketEventsModes()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    return "select, epoll";
+#else
+    return "select";
+#endif
+}
+
 CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
 {
     nServices = 0;
@@ -2052,6 +2489,9 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fPauseRecv = false;
+    fHasRecvData = false;
+    fCanSendData = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -2059,6 +2499,8 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
+    fSupportsCompactBlocks = false;
+    fPreferHeaderAndIDs = false;
     setInventoryKnown.max_size(SendBufferSize() / 1000);
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
@@ -2180,6 +2622,12 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     if (it == vSendMsg.begin())
         SocketSendData(this);
 
+    // select() only waits for sockets to become writable that had data queued
+    // when it was called. With epoll, the socket was found full and reports
+    // when it has room again.
+    if (!vSendMsg.empty() && socketEventsMode == SOCKETEVENTS_SELECT)
+        WakeSocketHandler();
+
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
 
@@ -22,6 +22,7 @@
 #include "uint256.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
 #include <deque>
 #include <stdint.h>
 
@@ -52,6 +53,8 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 2 MiB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 2 * 1024 * 1024;
+/** Maximum size of the payload buffers kept for reuse by later messages */
+static const size_t MAX_RECV_BUFFER_POOL_SIZE = 16 * 1024 * 1024;
 /** Maximum length of strSubVer in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** -listen default */
@@ -62,12 +65,35 @@ static const bool DEFAULT_UPNP = USE_UPNP;
 #else
 static const bool DEFAULT_UPNP = false;
 #endif
+/** -socketevents default */
+#ifdef HAVE_SYS_EPOLL_H
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
+/** -msghandthreads default, the threads processing messages from peers */
+static const int DEFAULT_MSGHAND_THREADS = 4;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHAND_THREADS = 16;
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
 
+/** How ThreadSocketHandler() waits for sockets to become ready (-socketevents) */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT, //! select() on all sockets every loop, limited to FD_SETSIZE
+    SOCKETEVENTS_EPOLL,  //! sockets stay registered with an epoll instance, only ready ones are serviced
+};
+
+/** Sets the mode from a -socketevents value, returns false if it is not supported by this build */
+bool SetSocketEventsMode(const std::string& strMode);
+/** The -socketevents values supported by this build, for help and error messages */
+std::string GetSupportedSocketEventsModes();
+/** Makes ThreadSocketHandler() look at the nodes again without waiting for its timeout */
+void WakeSocketHandler();
+
 void AddOneShot(std::string strDest);
 bool RecvLine(SOCKET hSocket, std::string& strLine);
 void AddressCurrentlyConnected(const CService& addr);
@@ -131,6 +157,7 @@ extern uint64_t nLocalServices;
 extern uint64_t nLocalHostNonce;
 extern CAddrMan addrman;
 extern int nMaxConnections;
+extern SocketEventsMode socketEventsMode;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
@@ -179,26 +206,67 @@ public:
 };
 
 
+/**
+ * Uninitialized storage for the payload of a received message. Buffers are
+ * handed back to a shared pool when their message is destroyed, so that the
+ * next messages are read into an allocation that already has the right size.
+ */
+class CNetMessageBuffer
+{
+private:
+    char* pdata;
+    size_t nCapacity;
+
+    CNetMessageBuffer(const CNetMessageBuffer&);
+    CNetMessageBuffer& operator=(const CNetMessageBuffer&);
+
+public:
+    CNetMessageBuffer() : pdata(NULL), nCapacity(0) {}
+    CNetMessageBuffer(CNetMessageBuffer&& other) : pdata(other.pdata), nCapacity(other.nCapacity)
+    {
+        other.pdata = NULL;
+        other.nCapacity = 0;
+    }
+    CNetMessageBuffer& operator=(CNetMessageBuffer&& other)
+    {
+        std::swap(pdata, other.pdata);
+        std::swap(nCapacity, other.nCapacity);
+        return *this;
+    }
+    ~CNetMessageBuffer();
+
+    char* data() const { return pdata; }
+    size_t capacity() const { return nCapacity; }
+
+    //! Takes a buffer of nWanted bytes from the pool, or allocates nMin
+    void Acquire(size_t nMin, size_t nWanted);
+    //! Grows to nSize bytes, keeping the first nKeep
+    void Reserve(size_t nSize, size_t nKeep);
+};
+
 class CNetMessage
 {
 public:
     bool in_data; // parsing header (false) or data (true)
 
-    CDataStream hdrbuf; // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr; // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv; // received message data
+    CNetMessageBuffer vRecv; // received message data
     unsigned int nDataPos;
 
+    int nType;
+    int nVersion;
     int64_t nTime; // time (in microseconds) of message receipt.
 
-    CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn)
+    CNetMessage(int nTypeIn, int nVersionIn)
     {
-        hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
+        nType = nTypeIn;
+        nVersion = nVersionIn;
         nTime = 0;
     }
 
@@ -211,12 +279,20 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
-        vRecv.SetVersion(nVersionIn);
+        nVersion = nVersionIn;
+    }
+
+    //! Non-owning view of the payload, valid as long as the message
+    CBufferReader GetPayload() const
+    {
+        return CBufferReader(vRecv.data(), vRecv.data() + nDataPos, nType, nVersion);
     }
 
     int readHeader(const char* pch, unsigned int nBytes);
     int readData(const char* pch, unsigned int nBytes);
+
+    //! Makes room for up to nBytes more of the payload (never past its end) and returns where they go
+    char* PrepareData(unsigned int& nBytes);
 };
 
 
@@ -300,6 +376,13 @@ public:
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
     uint64_t nRecvBytes;
+    // Set when ThreadSocketHandler() stopped reading from this node because
+    // its receive buffer is full, until the message handler makes room
+    std::atomic<bool> fPauseRecv;
+    // -socketevents=epoll only: readiness of hSocket as reported by epoll, until
+    // a recv() or send() would block. Only used by ThreadSocketHandler().
+    bool fHasRecvData;
+    bool fCanSendData;
     int nRecvVersion;
 
     int64_t nLastSend;
@@ -327,6 +410,10 @@ public:
     // b) the peer may tell us in their version message that we should not relay tx invs
     //    until they have initialized their bloom filter.
     bool fRelayTxes;
+    // The peer sent sendcmpct: it takes compact blocks, and wants them announced
+    // with cmpctblock right away rather than by inv if fPreferHeaderAndIDs
+    std::atomic<bool> fSupportsCompactBlocks;
+    std::atomic<bool> fPreferHeaderAndIDs;
     // Should be 'true' only if we connected to this node to actually mix funds.
     // In this case node will be released automatically via CMasternodeMan::ProcessMasternodeConnections().
     // Connecting to verify connectability/status or connecting for sending/relaying single message
@@ -363,6 +450,8 @@ public:
     // flood relay
     std::vector<CAddress> vAddrToSend;
     mruset<CAddress> setAddrKnown;
+    // Protects vAddrToSend and setAddrKnown, which other nodes' message handler threads relay to
+    CCriticalSection cs_vAddrToSend;
     bool fGetAddr;
     std::set<uint256> setKnown;
 
@@ -413,13 +502,17 @@ public:
     {
         unsigned int total = 0;
         for (const CNetMessage& msg : vRecvMsg)
-            total += msg.vRecv.size() + 24;
+            total += msg.nDataPos + CMessageHeader::HEADER_SIZE;
         return total;
     }
 
     // requires LOCK(cs_vRecvMsg)
     bool ReceiveMsgBytes(const char* pch, unsigned int nBytes);
 
+    // requires LOCK(cs_vRecvMsg)
+    //! Where to recv() the next nBytes, if they all belong to the payload of the message being received
+    char* GetRecvPayloadBuffer(unsigned int nBytes);
+
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
     {
@@ -442,6 +535,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         setAddrKnown.insert(addr);
     }
 
@@ -450,6 +544,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !setAddrKnown.count(addr)) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
@@ -531,13 +531,13 @@ bool CObfuScationSigner::IsVinAssociatedWithPubkey(CTxIn& vin, CPubKey& pubkey)
     CScript payee2;
     payee2 = GetScriptForDestination(pubkey.GetID());
 
-    CTransaction txVin;
-    uint256 hash;
-    if (GetTransaction(vin.prevout.hash, txVin, hash, true)) {
-        for (CTxOut out : txVin.vout) {
-            if (out.nValue == MASTERNODE_COLLATERAL_AMOUNT * COIN) {
-                if (out.scriptPubKey == payee2) return true;
-            }
+    // The collateral is unspent, so GetOutput() finds it in the coins view even
+    // when its block was pruned
+    CTxOut out;
+    CValidationState state;
+    if (GetOutput(vin.prevout.hash, vin.prevout.n, state, out)) {
+        if (out.nValue == MASTERNODE_COLLATERAL_AMOUNT * COIN) {
+            if (out.scriptPubKey == payee2) return true;
         }
     }
 
@@ -97,6 +97,8 @@ public:
     // memory only
     mutable CScript payee;
     mutable std::vector<uint256> vMerkleTree;
+    // set once the proof of work, merkle root and signature were checked ahead of connecting the block
+    mutable bool fPreChecked;
 
     CBlock()
     {
@@ -126,6 +128,7 @@ public:
         vMerkleTree.clear();
         payee = CScript();
         vchBlockSig.clear();
+        fPreChecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
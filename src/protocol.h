@@ -179,7 +179,9 @@ enum {
     MSG_DSTX,
     MSG_PUBCOINS,
     MSG_GENWIT,
-    MSG_ACC_VALUE
+    MSG_ACC_VALUE,
+    // Only in getdata, for a block to be sent as a cmpctblock
+    MSG_CMPCT_BLOCK
 };
 
 #endif // BITCOIN_PROTOCOL_H
@@ -8,11 +8,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "base58.h"
+#include "blockstore.h"
 #include "checkpoints.h"
 #include "clientversion.h"
 #include "kernel.h"
 #include "main.h"
 #include "rpc/server.h"
+#include "snapshot.h"
 #include "sync.h"
 #include "txdb.h"
 #include "util.h"
@@ -27,6 +29,8 @@
 #include <fstream>
 #include <iostream>
 #include <univalue.h>
+
+#include <boost/filesystem.hpp>
 #include <mutex>
 #include <numeric>
 #include <condition_variable>
@@ -144,7 +148,7 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
 
     UniValue zsqrObj(UniValue::VOBJ);
     for (auto denom : libzerocoin::zerocoinDenomList) {
-        zsqrObj.push_back(Pair(std::to_string(denom), ValueFromAmount(blockindex->mapZerocoinSupply.at(denom) * (denom*COIN))));
+        zsqrObj.push_back(Pair(std::to_string(denom), ValueFromAmount(blockindex->GetZcMints(denom) * (denom*COIN))));
     }
     zsqrObj.push_back(Pair("total", ValueFromAmount(blockindex->GetZerocoinSupply())));
     result.push_back(Pair("zSQRsupply", zsqrObj));
@@ -255,11 +259,14 @@ UniValue getchecksumblock(const UniValue& params, bool fHelp)
     if (!fVerbose)
         return pblockindex->GetBlockHash().GetHex();
 
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pblockindex))
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
+    std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pblockindex);
+    if (!pblock)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
-    return blockToJSON(block, pblockindex);
+    return blockToJSON(*pblock, pblockindex);
 }
 
 
@@ -640,11 +647,15 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
-    if (!ReadBlockFromDisk(block, pblockindex))
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
+    std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pblockindex);
+    if (!pblock)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    const CBlock& block = *pblock;
 
     if (!fVerbose) {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
@@ -748,6 +759,55 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the chainstate at the tip to a file that another node can start from with -loadsnapshot.\n"
+            "The file holds the block index of the active chain, the unspent transaction outputs and the zerocoin database.\n"
+            "Note this call may take some time.\n"
+
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The file to write, relative to the data directory unless absolute. It must not exist yet.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",             (string) The file written\n"
+            "  \"base_hash\": \"hash\",        (string) The block the chainstate is at\n"
+            "  \"base_height\": n,             (numeric) The height of that block\n"
+            "  \"transactions\": n,            (numeric) The number of transactions with unspent outputs\n"
+            "  \"txouts\": n,                  (numeric) The number of unspent outputs\n"
+            "  \"hash_serialized\": \"hash\",  (string) The hash of the unspent outputs, as reported by gettxoutsetinfo\n"
+            "  \"zerocoin_records\": n,        (numeric) The number of zerocoin database records\n"
+            "  \"snapshot_hash\": \"hash\"     (string) The hash of the file, to be passed to -snapshothash\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("dumptxoutset", "\"utxo.dat\"") + HelpExampleRpc("dumptxoutset", "\"utxo.dat\""));
+
+    boost::filesystem::path path(params[0].get_str());
+    if (!path.is_complete()) path = GetDataDir() / path;
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CSnapshotInfo info;
+    std::string strError;
+    if (!DumpChainstateSnapshot(path, info, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("base_hash", info.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", info.nHeight));
+    ret.push_back(Pair("transactions", (int64_t)info.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)info.nTransactionOutputs));
+    ret.push_back(Pair("hash_serialized", info.hashSerialized.GetHex()));
+    ret.push_back(Pair("zerocoin_records", (int64_t)info.nZerocoinRecords));
+    ret.push_back(Pair("snapshot_hash", info.hashSnapshot.GetHex()));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -906,6 +966,8 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
+            "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored (only present if pruning is enabled)\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -930,7 +992,15 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("difficulty", (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress", Checkpoints::GuessVerificationProgress(chainActive.Tip())));
     obj.push_back(Pair("chainwork", chainActive.Tip()->nChainWork.GetHex()));
+    obj.push_back(Pair("pruned", fPruneMode));
     CBlockIndex* tip = chainActive.Tip();
+    if (fPruneMode) {
+        CBlockIndex* block = tip;
+        while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
+            block = block->pprev;
+
+        obj.push_back(Pair("pruneheight", block->nHeight));
+    }
     UniValue softforks(UniValue::VARR);
     softforks.push_back(SoftForkDesc("bip65", 5, tip));
     obj.push_back(Pair("softforks",             softforks));
@@ -1109,6 +1179,40 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue getblockcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getblockcacheinfo\n"
+            "\nReturns details on the cache of blocks read from disk.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"hits\": xxxxx          (numeric) Block reads answered from memory\n"
+            "  \"misses\": xxxxx        (numeric) Block reads that went to disk\n"
+            "  \"blocks\": xxxxx        (numeric) Blocks currently cached\n"
+            "  \"bytes\": xxxxx         (numeric) Serialized size of the cached blocks\n"
+            "  \"maxbytes\": xxxxx      (numeric) Size limit of the cache (-blockcachesize)\n"
+            "  \"mmap\": true|false     (boolean) Whether block files are read through memory mappings (-blockmmap)\n"
+            "  \"mappedfiles\": xxxxx   (numeric) Block files currently mapped\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getblockcacheinfo", "") + HelpExampleRpc("getblockcacheinfo", ""));
+
+    CBlockCacheStats stats = blockCache.GetStats();
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("hits", stats.nHits));
+    ret.push_back(Pair("misses", stats.nMisses));
+    ret.push_back(Pair("blocks", (uint64_t)stats.nBlocks));
+    ret.push_back(Pair("bytes", (uint64_t)stats.nBytes));
+    ret.push_back(Pair("maxbytes", (uint64_t)stats.nMaxBytes));
+    ret.push_back(Pair("mmap", blockFileMapper.IsEnabled()));
+    ret.push_back(Pair("mappedfiles", (uint64_t)blockFileMapper.MappedFiles()));
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -1340,9 +1444,9 @@ void validaterange(const UniValue& params, int& heightStart, int& heightEnd, int
 }
 
 UniValue getmintsinblocks(const UniValue& params, bool fHelp) {
-    if (fHelp || params.size() != 3)
+    if (fHelp || params.size() < 3 || params.size() > 4)
         throw std::runtime_error(
-                "getmintsinblocks height range coinDenomination\n"
+                "getmintsinblocks height range coinDenomination ( fVerbose )\n"
                 "\nReturns the number of mints of a certain denomination"
                 "\noccurred in blocks [height, height+1, height+2, ..., height+range-1]\n"
 
@@ -1350,12 +1454,20 @@ UniValue getmintsinblocks(const UniValue& params, bool fHelp) {
                 "1. height             (numeric, required) block height where the search starts.\n"
                 "2. range              (numeric, required) number of blocks to include.\n"
                 "3. coinDenomination   (numeric, required) coin denomination.\n"
+                "4. fVerbose           (boolean, optional, default=False) also list the mints\n"
 
                 "\nResult:\n"
                 "{\n"
                 "  \"Starting block\": \"x\"           (integer) First counted block\n"
                 "  \"Ending block\": \"x\"             (integer) Last counted block\n"
                 "  \"Number of d-denom mints\": \"x\"  (integer) number of mints of the required d denomination\n"
+                "  \"mints\": [                        (array, if fVerbose) the mints of the required d denomination\n"
+                "    {\n"
+                "      \"pubcoin\": \"xxx\",           (string) public coin value, in hex\n"
+                "      \"blocknum\": n                 (integer) height of the block of the mint\n"
+                "    }\n"
+                "    ,...\n"
+                "  ]\n"
                 "}\n"
 
                 "\nExamples:\n" +
@@ -1370,13 +1482,36 @@ UniValue getmintsinblocks(const UniValue& params, bool fHelp) {
     if (denom == libzerocoin::CoinDenomination::ZQ_ERROR)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid denomination. Must be in {1, 5, 10, 50, 100, 500, 1000, 5000}");
 
+    bool fVerbose = false;
+    if (params.size() > 3) {
+        fVerbose = params[3].get_bool();
+    }
+
     int num_of_mints = 0;
+    UniValue mintsArr(UniValue::VARR);  // for fVerbose
     {
         LOCK(cs_main);
         CBlockIndex* pindex = chainActive[heightStart];
 
         while (true) {
-            num_of_mints += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
+            num_of_mints += pindex->GetMintsInBlock(denom);
+            if (fVerbose && pindex->MintedDenomination(denom)) {
+                // read from the mint index, which only falls back to the block for blocks it does not have
+                std::list<libzerocoin::PublicCoin> listPubcoins;
+                try {
+                    listPubcoins = GetPubcoinFromBlock(pindex);
+                } catch (const GetPubcoinException& e) {
+                    throw JSONRPCError(RPC_INTERNAL_ERROR, e.message);
+                }
+                for (const libzerocoin::PublicCoin& pubcoin : listPubcoins) {
+                    if (pubcoin.getDenomination() != denom)
+                        continue;
+                    UniValue m(UniValue::VOBJ);
+                    m.push_back(Pair("pubcoin", pubcoin.getValue().GetHex()));
+                    m.push_back(Pair("blocknum", pindex->nHeight));
+                    mintsArr.push_back(m);
+                }
+            }
             if (pindex->nHeight < heightEnd) {
                 pindex = chainActive.Next(pindex);
             } else {
@@ -1389,6 +1524,8 @@ UniValue getmintsinblocks(const UniValue& params, bool fHelp) {
     obj.push_back(Pair("Starting block", heightStart));
     obj.push_back(Pair("Ending block", heightEnd-1));
     obj.push_back(Pair("Number of "+ std::to_string(d) +"-denom mints", num_of_mints));
+    if (fVerbose)
+        obj.push_back(Pair("mints", mintsArr));
 
     return obj;
 }
@@ -1431,6 +1568,8 @@ UniValue getserials(const UniValue& params, bool fHelp) {
 
     while (true) {
         CBlock block;
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
         if (!ReadBlockFromDisk(block, pblockindex))
                 throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
@@ -1591,6 +1730,8 @@ UniValue getblockindexstats(const UniValue& params, bool fHelp) {
 
     while (true) {
         CBlock block;
+        if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "block not available (pruned data)");
         if (!ReadBlockFromDisk(block, pindex)) {
             throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read block from disk");
         }
@@ -1647,7 +1788,7 @@ UniValue getblockindexstats(const UniValue& params, bool fHelp) {
         // add mints to map
         if (!fFeeOnly) {
             for (auto& denom : libzerocoin::zerocoinDenomList) {
-                mapMintCount[denom] += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
+                mapMintCount[denom] += pindex->GetMintsInBlock(denom);
             }
         }
 
@@ -111,6 +111,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"prioritisetransaction", 2},
         {"setban", 2},
         {"setban", 3},
+        {"getmessagestats", 0},
         {"spork", 1},
         {"preparebudget", 2},
         {"preparebudget", 3},
@@ -160,6 +161,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"getmintsinblocks", 0},
         {"getmintsinblocks", 1},
         {"getmintsinblocks", 2},
+        {"getmintsinblocks", 3},
         {"getserials", 0},
         {"getserials", 1},
         {"getserials", 2},
@@ -11,6 +11,7 @@
 
 #include "clientversion.h"
 #include "main.h"
+#include "msgstats.h"
 #include "net.h"
 #include "netbase.h"
 #include "protocol.h"
@@ -368,6 +369,95 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     return obj;
 }
 
+UniValue getlightzsqrinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getlightzsqrinfo\n"
+            "\nReturns statistics of the witness service for zerocoin light nodes.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"threads\": n,          (numeric) Number of witness workers, 0 if the service is disabled\n"
+            "  \"queued\": n,           (numeric) Witnesses waiting for a worker\n"
+            "  \"running\": n,          (numeric) Witnesses being computed\n"
+            "  \"requests\": n,         (numeric) Requests accepted\n"
+            "  \"deduplicated\": n,     (numeric) Requests answered by the computation of an identical request\n"
+            "  \"completed\": n,        (numeric) Requests answered with a witness\n"
+            "  \"rejected\": n,         (numeric) Requests answered with an error\n"
+            "  \"avgwaitms\": n,        (numeric) Average time a witness waited for a worker, in milliseconds\n"
+            "  \"avgworkms\": n,        (numeric) Average time spent computing a witness, in milliseconds\n"
+            "  \"maxlatencyms\": n      (numeric) Longest time between a request and its answer, in milliseconds\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getlightzsqrinfo", "") + HelpExampleRpc("getlightzsqrinfo", ""));
+
+    CLightWorkerStats stats = lightWorker.GetStats();
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("threads", stats.nThreads));
+    obj.push_back(Pair("queued", stats.nQueued));
+    obj.push_back(Pair("running", stats.nRunning));
+    obj.push_back(Pair("requests", stats.nRequests));
+    obj.push_back(Pair("deduplicated", stats.nDeduplicated));
+    obj.push_back(Pair("completed", stats.nCompleted));
+    obj.push_back(Pair("rejected", stats.nRejected));
+    obj.push_back(Pair("avgwaitms", stats.nFinished ? 0.001 * stats.nTotalWaitTime / stats.nFinished : 0));
+    obj.push_back(Pair("avgworkms", stats.nFinished ? 0.001 * stats.nTotalWorkTime / stats.nFinished : 0));
+    obj.push_back(Pair("maxlatencyms", 0.001 * stats.nMaxLatency));
+    return obj;
+}
+
+UniValue getmessagestats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw std::runtime_error(
+            "getmessagestats ( reset )\n"
+            "\nReturns how long messages from peers took to process, per command, since the start\n"
+            "or the last reset. The time includes waiting for the locks the command needs.\n"
+
+            "\nArguments:\n"
+            "1. reset        (boolean, optional, default=false) Start over once the statistics are returned\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"command\": {         (object) Statistics of a command, unknown commands past the first " + strprintf("%u", MAX_MESSAGE_STATS_COMMANDS) + " are counted as \"" + MESSAGE_STATS_OTHER + "\"\n"
+            "    \"count\": n,        (numeric) Messages processed\n"
+            "    \"totalms\": n,      (numeric) Total processing time, in milliseconds\n"
+            "    \"avgms\": n,        (numeric) Average processing time, in milliseconds\n"
+            "    \"maxms\": n,        (numeric) Longest processing time, in milliseconds\n"
+            "    \"histogram\": [     (array) Element i counts the messages that took less than 2^i microseconds,\n"
+            "      n, ...           the last one those that took longer\n"
+            "    ]\n"
+            "  }, ...\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getmessagestats", "") + HelpExampleRpc("getmessagestats", "true"));
+
+    std::map<std::string, CLatencyHistogram> mapStats = messageStats.Get();
+    if (params.size() > 0 && params[0].get_bool())
+        messageStats.Clear();
+
+    UniValue ret(UniValue::VOBJ);
+    for (const auto& item : mapStats) {
+        const CLatencyHistogram& stats = item.second;
+        UniValue histogram(UniValue::VARR);
+        for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+            histogram.push_back(stats.vBuckets[i]);
+
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("count", stats.nCount));
+        obj.push_back(Pair("totalms", 0.001 * stats.nTotalMicros));
+        obj.push_back(Pair("avgms", stats.nCount ? 0.001 * stats.nTotalMicros / stats.nCount : 0));
+        obj.push_back(Pair("maxms", 0.001 * stats.nMaxMicros));
+        obj.push_back(Pair("histogram", histogram));
+        ret.push_back(Pair(item.first, obj));
+    }
+    return ret;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
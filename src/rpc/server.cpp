@@ -295,6 +295,8 @@ static const CRPCCommand vRPCCommands[] =
         {"network", "getaddednodeinfo", &getaddednodeinfo, true, true, false},
         {"network", "getconnectioncount", &getconnectioncount, true, false, false},
         {"network", "getnettotals", &getnettotals, true, true, false},
+        {"network", "getlightzsqrinfo", &getlightzsqrinfo, true, true, false},
+        {"network", "getmessagestats", &getmessagestats, true, true, false},
         {"network", "getpeerinfo", &getpeerinfo, true, false, false},
         {"network", "ping", &ping, true, false, false},
         {"network", "setban", &setban, true, false, false},
@@ -311,7 +313,9 @@ static const CRPCCommand vRPCCommands[] =
         {"blockchain", "getblockchaininfo", &getblockchaininfo, true, false, false},
         {"blockchain", "getbestblockhash", &getbestblockhash, true, false, false},
         {"blockchain", "getblockcount", &getblockcount, true, false, false},
+        {"blockchain", "dumptxoutset", &dumptxoutset, true, false, false},
         {"blockchain", "getblock", &getblock, true, false, false},
+        {"blockchain", "getblockcacheinfo", &getblockcacheinfo, true, false, false},
         {"blockchain", "getblockhash", &getblockhash, true, false, false},
         {"blockchain", "getblockheader", &getblockheader, false, false, false},
         {"blockchain", "getchaintips", &getchaintips, true, false, false},
@@ -0,0 +1,450 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "snapshot.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "guiinterface.h"
+#include "hash.h"
+#include "init.h"
+#include "main.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+#include "zsqr/accumulators.h"
+
+#include <memory>
+#include <string.h>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace {
+
+//! Start of every snapshot file
+const char SNAPSHOT_MAGIC[8] = {'s', 'q', 'r', 's', 'n', 'a', 'p', 0};
+
+//! Transactions written to the coin database per batch while loading
+const size_t SNAPSHOT_BATCH_COINS = 100000;
+//! Block index entries or zerocoin records written per batch while loading
+const size_t SNAPSHOT_BATCH_RECORDS = 10000;
+
+/** Start of a snapshot file: its format and the chainstate it holds */
+class CSnapshotHeader
+{
+public:
+    char pchMagic[sizeof(SNAPSHOT_MAGIC)];
+    uint32_t nVersion;
+    MessageStartChars pchMessageStart;
+    uint256 hashBlock;
+    int32_t nHeight;
+
+    CSnapshotHeader() : nVersion(0), hashBlock(0), nHeight(0)
+    {
+        memset(pchMagic, 0, sizeof(pchMagic));
+        memset(pchMessageStart, 0, sizeof(pchMessageStart));
+    }
+
+    CSnapshotHeader(const uint256& hashBlockIn, int nHeightIn) : nVersion(SNAPSHOT_VERSION), hashBlock(hashBlockIn), nHeight(nHeightIn)
+    {
+        memcpy(pchMagic, SNAPSHOT_MAGIC, sizeof(pchMagic));
+        memcpy(pchMessageStart, Params().MessageStart(), sizeof(pchMessageStart));
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(FLATDATA(pchMagic));
+        READWRITE(this->nVersion);
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+    }
+};
+
+/** End of the hashed part of a snapshot file, to check what was read against */
+class CSnapshotFooter
+{
+public:
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint256 hashSerialized;
+    uint64_t nZerocoinRecords;
+
+    CSnapshotFooter() : nTransactions(0), nTransactionOutputs(0), hashSerialized(0), nZerocoinRecords(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(hashSerialized);
+        READWRITE(nZerocoinRecords);
+    }
+};
+
+/** Serializes to a file, hashing what is written */
+class CHashedFileWriter
+{
+private:
+    CAutoFile& file;
+    CHashWriter hasher;
+
+public:
+    explicit CHashedFileWriter(CAutoFile& fileIn) : file(fileIn), hasher(fileIn.GetType(), fileIn.GetVersion()) {}
+
+    int GetType() { return file.GetType(); }
+    int GetVersion() { return file.GetVersion(); }
+
+    CHashedFileWriter& write(const char* pch, size_t nSize)
+    {
+        file.write(pch, nSize);
+        hasher.write(pch, nSize);
+        return (*this);
+    }
+
+    template <typename T>
+    CHashedFileWriter& operator<<(const T& obj)
+    {
+        // Serialize to this stream
+        ::Serialize(*this, obj, GetType(), GetVersion());
+        return (*this);
+    }
+
+    // invalidates the object
+    uint256 GetHash() { return hasher.GetHash(); }
+};
+
+//! Hashes the file up to its last 32 bytes, which hold the hash it was written with
+bool HashSnapshotFile(CAutoFile& file, uint64_t nSize, uint256& hashComputed, uint256& hashStored)
+{
+    if (nSize < sizeof(uint256))
+        return false;
+    CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+    std::vector<char> vBuffer(1 << 20);
+    for (uint64_t nLeft = nSize - sizeof(uint256); nLeft > 0;) {
+        size_t nRead = std::min<uint64_t>(nLeft, vBuffer.size());
+        file.read(&vBuffer[0], nRead);
+        hasher.write(&vBuffer[0], nRead);
+        nLeft -= nRead;
+    }
+    file >> hashStored;
+    hashComputed = hasher.GetHash();
+    return true;
+}
+
+} // anon namespace
+
+bool DumpChainstateSnapshot(const boost::filesystem::path& path, CSnapshotInfo& info, std::string& strError)
+{
+    std::unique_ptr<CCoinsViewDBCursor> pcursor;
+    std::unique_ptr<leveldb::Iterator> pzerocoin;
+    std::vector<CDiskBlockIndex> vIndex;
+    {
+        LOCK(cs_main);
+        if (!chainActive.Tip()) {
+            strError = "No active chain";
+            return false;
+        }
+
+        // Take views of the databases once they hold the tip: blocks connected
+        // while the file is written do not change them
+        FlushStateToDisk();
+        if (pcoinsflusher && !pcoinsflusher->Wait()) {
+            strError = "Failed to write to coin database";
+            return false;
+        }
+        try {
+            pcursor.reset(pcoinsdbview->Cursor());
+        } catch (const std::exception& e) {
+            strError = strprintf("Failed to read coin database: %s", e.what());
+            return false;
+        }
+        if (pcursor->GetBestBlock() != chainActive.Tip()->GetBlockHash()) {
+            strError = "Coin database is not at the tip of the active chain";
+            return false;
+        }
+        // Accumulators are recomputed from the mint index once the blocks are
+        // gone, so the snapshot must index the mints of every zerocoin block
+        if (!IndexChainMints(chainActive.Tip())) {
+            strError = "The zerocoin mint index is incomplete and the blocks it misses are not on disk";
+            return false;
+        }
+        pzerocoin.reset(zerocoinDB->NewIterator());
+
+        vIndex.reserve(chainActive.Height() + 1);
+        for (CBlockIndex* pindex = chainActive.Genesis(); pindex; pindex = chainActive.Next(pindex)) {
+            CDiskBlockIndex index(pindex);
+            index.nStatus &= ~BLOCK_HAVE_MASK;
+            index.nFile = 0;
+            index.nDataPos = 0;
+            index.nUndoPos = 0;
+            vIndex.push_back(index);
+        }
+        info.hashBlock = chainActive.Tip()->GetBlockHash();
+        info.nHeight = chainActive.Height();
+    }
+
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".incomplete";
+    CAutoFile file(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = strprintf("Unable to open %s for writing", pathTmp.string());
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    try {
+        CHashedFileWriter writer(file);
+        writer << CSnapshotHeader(info.hashBlock, info.nHeight);
+        for (const CDiskBlockIndex& index : vIndex)
+            writer << index;
+        std::vector<CDiskBlockIndex>().swap(vIndex);
+
+        // Unspent outputs, hashed as gettxoutsetinfo does
+        CCoinsStats stats;
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << info.hashBlock;
+        for (; pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            writer << pcursor->GetTxid() << pcursor->GetCoins();
+            ApplyCoinsStats(stats, ss, pcursor->GetTxid(), pcursor->GetCoins());
+        }
+        writer << uint256(0);
+
+        // Zerocoin database records, as they are stored
+        for (pzerocoin->SeekToFirst(); pzerocoin->Valid(); pzerocoin->Next()) {
+            writer << pzerocoin->key().ToString() << pzerocoin->value().ToString();
+            info.nZerocoinRecords++;
+        }
+        writer << std::string();
+
+        CSnapshotFooter footer;
+        footer.nTransactions = info.nTransactions = stats.nTransactions;
+        footer.nTransactionOutputs = info.nTransactionOutputs = stats.nTransactionOutputs;
+        footer.hashSerialized = info.hashSerialized = ss.GetHash();
+        footer.nZerocoinRecords = info.nZerocoinRecords;
+        writer << footer;
+
+        info.hashSnapshot = writer.GetHash();
+        file << info.hashSnapshot;
+        FileCommit(file.Get());
+        file.fclose();
+    } catch (const std::exception& e) {
+        file.fclose();
+        boost::filesystem::remove(pathTmp);
+        strError = strprintf("Failed to write snapshot: %s", e.what());
+        return false;
+    }
+
+    if (!RenameOver(pathTmp, path)) {
+        strError = strprintf("Unable to rename %s to %s", pathTmp.string(), path.string());
+        return false;
+    }
+    LogPrintf("%s: wrote chainstate at block %s (height %d, %u transactions, %u zerocoin records) to %s in %dms\n", __func__,
+        info.hashBlock.GetHex(), info.nHeight, info.nTransactions, info.nZerocoinRecords, path.string(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool LoadChainstateSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, CSnapshotInfo& info, std::string& strError)
+{
+    LOCK(cs_main);
+    if (pcoinsdbview->GetBestBlock() != 0) {
+        strError = "The chainstate is not empty";
+        return false;
+    }
+
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = strprintf("Unable to open %s", path.string());
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    try {
+        // Check the whole file before anything is written
+        uint256 hashStored;
+        if (!HashSnapshotFile(file, boost::filesystem::file_size(path), info.hashSnapshot, hashStored) || info.hashSnapshot != hashStored) {
+            strError = strprintf("%s is truncated or corrupted", path.string());
+            return false;
+        }
+        if (info.hashSnapshot != hashExpected) {
+            strError = strprintf("The hash of %s is %s, not the expected %s", path.string(), info.hashSnapshot.GetHex(), hashExpected.GetHex());
+            return false;
+        }
+        LogPrintf("%s: %s has the expected hash %s\n", __func__, path.string(), info.hashSnapshot.GetHex());
+        if (fseek(file.Get(), 0, SEEK_SET) != 0) {
+            strError = strprintf("Unable to rewind %s", path.string());
+            return false;
+        }
+
+        CSnapshotHeader header;
+        file >> header;
+        if (memcmp(header.pchMagic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.nVersion != SNAPSHOT_VERSION) {
+            strError = strprintf("%s is not a snapshot this version can read", path.string());
+            return false;
+        }
+        if (memcmp(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart)) != 0) {
+            strError = strprintf("%s is a snapshot of another network", path.string());
+            return false;
+        }
+        info.hashBlock = header.hashBlock;
+        info.nHeight = header.nHeight;
+
+        // An interrupted load leaves this flag behind, see AppInit2()
+        pblocktree->WriteFlag("snapshotloading", true);
+
+        // Block index of the chain up to the snapshot, linked by hash from the genesis block
+        std::vector<uint256> vHashes;
+        vHashes.reserve(header.nHeight + 1);
+        CLevelDBBatch batchIndex;
+        size_t nBatchIndex = 0;
+        uint256 hashPrev = 0;
+        for (int nHeight = 0; nHeight <= header.nHeight; nHeight++) {
+            CDiskBlockIndex index;
+            file >> index;
+            if (index.nHeight != nHeight || index.hashPrev != hashPrev || !index.IsValid(BLOCK_VALID_TRANSACTIONS) || index.nTx == 0) {
+                strError = strprintf("Inconsistent block index at height %d", nHeight);
+                return false;
+            }
+            hashPrev = index.GetBlockHash();
+            if (nHeight == 0 && hashPrev != Params().HashGenesisBlock()) {
+                strError = strprintf("%s is a snapshot of another chain", path.string());
+                return false;
+            }
+            index.nStatus &= ~BLOCK_HAVE_MASK;
+            index.nFile = 0;
+            index.nDataPos = 0;
+            index.nUndoPos = 0;
+            vHashes.push_back(hashPrev);
+            batchIndex.Write(std::make_pair('b', hashPrev), index);
+            if (++nBatchIndex >= SNAPSHOT_BATCH_RECORDS || nHeight == header.nHeight) {
+                if (!pblocktree->WriteBatch(batchIndex)) {
+                    strError = "Failed to write to block index database";
+                    return false;
+                }
+                batchIndex = CLevelDBBatch();
+                nBatchIndex = 0;
+            }
+        }
+        if (hashPrev != header.hashBlock) {
+            strError = "The block index does not lead to the snapshot block";
+            return false;
+        }
+
+        // Unspent outputs, written without a best block until the end
+        CCoinsStats stats;
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << header.hashBlock;
+        CCoinsMap mapCoins;
+        while (true) {
+            uint256 txid;
+            file >> txid;
+            if (txid == 0)
+                break;
+            CCoinsCacheEntry& entry = mapCoins[txid];
+            file >> entry.coins;
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            ApplyCoinsStats(stats, ss, txid, entry.coins);
+            if (mapCoins.size() >= SNAPSHOT_BATCH_COINS) {
+                if (!pcoinsdbview->BatchWrite(mapCoins, uint256(0))) {
+                    strError = "Failed to write to coin database";
+                    return false;
+                }
+                if (ShutdownRequested()) {
+                    strError = "Interrupted";
+                    return false;
+                }
+                uiInterface.InitMessage(strprintf(_("Loading chainstate snapshot... (%u transactions)"), stats.nTransactions));
+            }
+        }
+        if (!pcoinsdbview->BatchWrite(mapCoins, uint256(0))) {
+            strError = "Failed to write to coin database";
+            return false;
+        }
+
+        // Zerocoin database records. Mint index entries, ('b', height) keys holding
+        // the block hash first, are checked against the block index.
+        std::vector<bool> vMintsIndexed(vHashes.size(), false);
+        CLevelDBBatch batch;
+        size_t nBatch = 0;
+        while (true) {
+            std::string strKey;
+            file >> strKey;
+            if (strKey.empty())
+                break;
+            std::string strValue;
+            file >> strValue;
+            if (strKey.size() == 1 + sizeof(int32_t) && strKey[0] == 'b' && strValue.size() >= sizeof(uint256)) {
+                CDataStream ssKey(strKey.data(), strKey.data() + strKey.size(), SER_DISK, CLIENT_VERSION);
+                CDataStream ssValue(strValue.data(), strValue.data() + sizeof(uint256), SER_DISK, CLIENT_VERSION);
+                char chType;
+                int32_t nHeight;
+                uint256 hashBlock;
+                ssKey >> chType >> nHeight;
+                ssValue >> hashBlock;
+                if (nHeight >= 0 && nHeight < (int)vHashes.size() && vHashes[nHeight] == hashBlock)
+                    vMintsIndexed[nHeight] = true;
+            }
+            batch.WriteRaw(strKey, strValue);
+            info.nZerocoinRecords++;
+            if (++nBatch >= SNAPSHOT_BATCH_RECORDS) {
+                if (!zerocoinDB->WriteBatch(batch)) {
+                    strError = "Failed to write to zerocoin database";
+                    return false;
+                }
+                batch = CLevelDBBatch();
+                nBatch = 0;
+            }
+        }
+        if (!zerocoinDB->WriteBatch(batch, true)) {
+            strError = "Failed to write to zerocoin database";
+            return false;
+        }
+
+        for (int nHeight = std::max(Params().Zerocoin_StartHeight(), 0); nHeight < (int)vMintsIndexed.size(); nHeight++) {
+            if (!vMintsIndexed[nHeight]) {
+                strError = strprintf("The snapshot does not index the zerocoin mints of block %d", nHeight);
+                return false;
+            }
+        }
+
+        CSnapshotFooter footer;
+        file >> footer;
+        info.nTransactions = stats.nTransactions;
+        info.nTransactionOutputs = stats.nTransactionOutputs;
+        info.hashSerialized = ss.GetHash();
+        if (footer.nTransactions != info.nTransactions || footer.nTransactionOutputs != info.nTransactionOutputs ||
+            footer.hashSerialized != info.hashSerialized || footer.nZerocoinRecords != info.nZerocoinRecords) {
+            strError = "The content of the snapshot does not match its summary";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Failed to read %s: %s", path.string(), e.what());
+        return false;
+    }
+
+    // The chainstate is complete: point it at the snapshot block. The blocks
+    // below it are missing, as on a pruned node, and not indexed.
+    CCoinsMap mapEmpty;
+    if (!pcoinsdbview->BatchWrite(mapEmpty, info.hashBlock) ||
+        !pblocktree->WriteFlag("txindex", false) ||
+        !pblocktree->WriteFlag("prunedblockfiles", true) ||
+        !pblocktree->WriteFlag("snapshotloading", false) ||
+        !pblocktree->Sync()) {
+        strError = "Failed to write to block index database";
+        return false;
+    }
+
+    LogPrintf("%s: loaded chainstate at block %s (height %d, %u transactions, %u zerocoin records) in %dms\n", __func__,
+        info.hashBlock.GetHex(), info.nHeight, info.nTransactions, info.nZerocoinRecords, GetTimeMillis() - nStart);
+    return true;
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef sQuorum_SNAPSHOT_H
+#define sQuorum_SNAPSHOT_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+/** Version of the chainstate snapshot files written by dumptxoutset */
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+/** What a chainstate snapshot holds, as returned by dumptxoutset */
+struct CSnapshotInfo {
+    uint256 hashBlock;            //! block the chainstate is at
+    int nHeight;
+    uint64_t nTransactions;       //! transactions with unspent outputs
+    uint64_t nTransactionOutputs;
+    uint256 hashSerialized;       //! hash of the unspent outputs, as reported by gettxoutsetinfo at that block
+    uint64_t nZerocoinRecords;    //! records of the zerocoin database: serials, mints and accumulators
+    uint256 hashSnapshot;         //! hash of the file, to be passed to -snapshothash
+
+    CSnapshotInfo() : hashBlock(0), nHeight(0), nTransactions(0), nTransactionOutputs(0), hashSerialized(0), nZerocoinRecords(0), hashSnapshot(0) {}
+};
+
+/**
+ * Writes the chainstate at the tip to a file: the block index of the active
+ * chain (without block file positions), the unspent outputs and the zerocoin
+ * database. Blocks are only held back while the databases are flushed, the
+ * file is written from a view of them taken at that point. Blocks missing from
+ * the zerocoin mint index are indexed first, and must still be on disk.
+ */
+bool DumpChainstateSnapshot(const boost::filesystem::path& path, CSnapshotInfo& info, std::string& strError);
+
+/**
+ * Loads a snapshot written by DumpChainstateSnapshot() into empty databases,
+ * before the block index is loaded (-loadsnapshot). Nothing is written unless
+ * the hash of the whole file is hashExpected, and the load fails if a block
+ * from the zerocoin start height on has no entry in the mint index. The blocks
+ * below the snapshot are then missing, as if they had been pruned.
+ */
+bool LoadChainstateSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, CSnapshotInfo& info, std::string& strError);
+
+#endif // sQuorum_SNAPSHOT_H
@@ -24,6 +24,9 @@ CSporkManager sporkManager;
 
 std::map<uint256, CSporkMessage> mapSporks;
 std::map<int, CSporkMessage> mapSporksActive;
+CCriticalSection cs_mapSporks;
+// Serializes ProcessSpork(), message handler threads call it without cs_main
+static CCriticalSection cs_process_spork;
 
 // sQuorum: on startup load spork values from previous session if they exist in the sporkDB
 void LoadSporksFromDB()
@@ -41,8 +44,11 @@ void LoadSporksFromDB()
         }
 
         // add spork to memory
-        mapSporks[spork.GetHash()] = spork;
-        mapSporksActive[spork.nSporkID] = spork;
+        {
+            LOCK(cs_mapSporks);
+            mapSporks[spork.GetHash()] = spork;
+            mapSporksActive[spork.nSporkID] = spork;
+        }
         std::time_t result = spork.nValue;
         // If SPORK Value is greater than 1,000,000 assume it's actually a Date and then convert to a more readable format
         if (spork.nValue > 1000000) {
@@ -56,13 +62,13 @@ void LoadSporksFromDB()
     }
 }
 
-void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
+void ProcessSpork(CNode* pfrom, std::string& strCommand, CBufferReader& vRecv)
 {
     if (fLiteMode) return; //disable all obfuscation/masternode related functionality
 
+    LOCK(cs_process_spork);
     if (strCommand == "spork") {
         //LogPrintf("ProcessSpork::spork\n");
-        CDataStream vMsg(vRecv);
         CSporkMessage spork;
         vRecv >> spork;
 
@@ -73,8 +79,17 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
         if (strSpork == "Unknown") return;
 
         uint256 hash = spork.GetHash();
-        if (mapSporksActive.count(spork.nSporkID)) {
-            if (mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned) {
+        bool fSeen = false;
+        int64_t nTimeSignedActive = 0;
+        {
+            LOCK(cs_mapSporks);
+            if (mapSporksActive.count(spork.nSporkID)) {
+                fSeen = true;
+                nTimeSignedActive = mapSporksActive[spork.nSporkID].nTimeSigned;
+            }
+        }
+        if (fSeen) {
+            if (nTimeSignedActive >= spork.nTimeSigned) {
                 if (fDebug) LogPrintf("%s : seen %s block %d \n", __func__, hash.ToString(), chainActive.Tip()->nHeight);
                 return;
             } else {
@@ -91,20 +106,26 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
             return;
         }
 
-        mapSporks[hash] = spork;
-        mapSporksActive[spork.nSporkID] = spork;
+        {
+            LOCK(cs_mapSporks);
+            mapSporks[hash] = spork;
+            mapSporksActive[spork.nSporkID] = spork;
+        }
         sporkManager.Relay(spork);
 
         // sQuorum: add to spork database.
         pSporkDB->WriteSpork(spork.nSporkID, spork);
     }
     if (strCommand == "getsporks") {
-        std::map<int, CSporkMessage>::iterator it = mapSporksActive.begin();
-
-        while (it != mapSporksActive.end()) {
-            pfrom->PushMessage("spork", it->second);
-            it++;
+        std::vector<CSporkMessage> vSporks;
+        {
+            LOCK(cs_mapSporks);
+            for (const auto& item : mapSporksActive)
+                vSporks.push_back(item.second);
         }
+
+        for (const CSporkMessage& spork : vSporks)
+            pfrom->PushMessage("spork", spork);
     }
 }
 
@@ -113,10 +134,16 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 int64_t GetSporkValue(int nSporkID)
 {
     int64_t r = -1;
+    bool fActive = false;
 
-    if (mapSporksActive.count(nSporkID)) {
-        r = mapSporksActive[nSporkID].nValue;
-    } else {
+    {
+        LOCK(cs_mapSporks);
+        if (mapSporksActive.count(nSporkID)) {
+            r = mapSporksActive[nSporkID].nValue;
+            fActive = true;
+        }
+    }
+    if (!fActive) {
         if (nSporkID == SPORK_2_SWIFTTX) r = SPORK_2_SWIFTTX_DEFAULT;
         if (nSporkID == SPORK_3_SWIFTTX_BLOCK_FILTERING) r = SPORK_3_SWIFTTX_BLOCK_FILTERING_DEFAULT;
         if (nSporkID == SPORK_5_MAX_VALUE) r = SPORK_5_MAX_VALUE_DEFAULT;
@@ -231,6 +258,7 @@ bool CSporkManager::UpdateSpork(int nSporkID, int64_t nValue)
 
     if (Sign(msg)) {
         Relay(msg);
+        LOCK(cs_mapSporks);
         mapSporks[msg.GetHash()] = msg;
         mapSporksActive[nSporkID] = msg;
         return true;
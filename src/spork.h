@@ -60,10 +60,12 @@ class CSporkManager;
 
 extern std::map<uint256, CSporkMessage> mapSporks;
 extern std::map<int, CSporkMessage> mapSporksActive;
+// Guards mapSporks and mapSporksActive, no other lock is taken while holding it
+extern CCriticalSection cs_mapSporks;
 extern CSporkManager sporkManager;
 
 void LoadSporksFromDB();
-void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+void ProcessSpork(CNode* pfrom, std::string& strCommand, CBufferReader& vRecv);
 int64_t GetSporkValue(int nSporkID);
 bool IsSporkActive(int nSporkID);
 void ReprocessBlocks(int nBlocks);
@@ -175,32 +175,45 @@ bool CZSqrStake::MarkSpent(CWallet *pwallet, const uint256& txid)
 bool CSqrStake::SetInput(CTransaction txPrev, unsigned int n)
 {
     this->txFrom = txPrev;
+    this->hashFrom = txPrev.GetHash();
+    this->txOutFrom = txPrev.vout[n];
     this->nPosition = n;
     return true;
 }
 
+bool CSqrStake::SetInput(const uint256& hashPrev, const CTxOut& txOutPrev, unsigned int n, CBlockIndex* pindexPrev)
+{
+    this->hashFrom = hashPrev;
+    this->txOutFrom = txOutPrev;
+    this->nPosition = n;
+    this->pindexFrom = pindexPrev;
+    return true;
+}
+
 bool CSqrStake::GetTxFrom(CTransaction& tx)
 {
+    if (txFrom.IsNull())
+        return false;
     tx = txFrom;
     return true;
 }
 
 bool CSqrStake::CreateTxIn(CWallet* pwallet, CTxIn& txIn, uint256 hashTxOut)
 {
-    txIn = CTxIn(txFrom.GetHash(), nPosition);
+    txIn = CTxIn(hashFrom, nPosition);
     return true;
 }
 
 CAmount CSqrStake::GetValue()
 {
-    return txFrom.vout[nPosition].nValue;
+    return txOutFrom.nValue;
 }
 
 bool CSqrStake::CreateTxOuts(CWallet* pwallet, std::vector<CTxOut>& vout, CAmount nTotal)
 {
     std::vector<valtype> vSolutions;
     txnouttype whichType;
-    CScript scriptPubKeyKernel = txFrom.vout[nPosition].scriptPubKey;
+    CScript scriptPubKeyKernel = txOutFrom.scriptPubKey;
     if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
         LogPrintf("CreateCoinStake : failed to parse kernel\n");
         return false;
@@ -250,7 +263,7 @@ CDataStream CSqrStake::GetUniqueness()
 {
     //The unique identifier for a SQR stake is the outpoint
     CDataStream ss(SER_NETWORK, 0);
-    ss << nPosition << txFrom.GetHash();
+    ss << nPosition << hashFrom;
     return ss;
 }
 
@@ -261,7 +274,7 @@ CBlockIndex* CSqrStake::GetIndexFrom()
         return pindexFrom;
     uint256 hashBlock = 0;
     CTransaction tx;
-    if (GetTransaction(txFrom.GetHash(), tx, hashBlock, true)) {
+    if (GetTransaction(hashFrom, tx, hashBlock, true)) {
         // If the index is in the chain, then set it as the "index from"
         if (mapBlockIndex.count(hashBlock)) {
             CBlockIndex* pindex = mapBlockIndex.at(hashBlock);
@@ -269,7 +282,7 @@ CBlockIndex* CSqrStake::GetIndexFrom()
                 pindexFrom = pindex;
         }
     } else {
-        LogPrintf("%s : failed to find tx %s\n", __func__, txFrom.GetHash().GetHex());
+        LogPrintf("%s : failed to find tx %s\n", __func__, hashFrom.GetHex());
     }
 
     return pindexFrom;
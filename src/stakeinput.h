@@ -78,6 +78,8 @@ class CSqrStake : public CStakeInput
 {
 private:
     CTransaction txFrom;
+    uint256 hashFrom;
+    CTxOut txOutFrom;
     unsigned int nPosition;
 
     // cached data
@@ -88,9 +90,12 @@ public:
     CSqrStake(){}
 
     bool SetInput(CTransaction txPrev, unsigned int n);
+    //! Sets the input from the coins view, for outputs whose block has been pruned
+    bool SetInput(const uint256& hashPrev, const CTxOut& txOutPrev, unsigned int n, CBlockIndex* pindexPrev);
 
     CBlockIndex* GetIndexFrom() override;
     bool GetTxFrom(CTransaction& tx) override;
+    const CTxOut& GetTxOutFrom() const { return txOutFrom; }
     CAmount GetValue() override;
     bool GetModifier(uint64_t& nStakeModifier) override;
     CDataStream GetUniqueness() override;
@@ -414,6 +414,47 @@ public:
     }
 };
 
+/** Read-only stream over memory it does not own, such as a memory mapped
+ *  file, to deserialize from without copying the data into a buffer first.
+ */
+class CBufferReader
+{
+private:
+    int nType;
+    int nVersion;
+
+    const char* pcur;
+    const char* pend;
+
+public:
+    CBufferReader(const char* pbegin, const char* pendIn, int nTypeIn, int nVersionIn) : nType(nTypeIn), nVersion(nVersionIn), pcur(pbegin), pend(pendIn) {}
+
+    //
+    // Stream subset
+    //
+    int GetType() { return nType; }
+    int GetVersion() { return nVersion; }
+    size_t size() const { return pend - pcur; }
+    bool empty() const { return pcur == pend; }
+
+    CBufferReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CBufferReader::read : end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    template <typename T>
+    CBufferReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 /** Non-refcounted RAII wrapper around a FILE* that implements a ring buffer to
  *  deserialize from. It guarantees the ability to rewind a given number of bytes.
  *
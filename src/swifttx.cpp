@@ -27,6 +27,8 @@ std::map<uint256, CConsensusVote> mapTxLockVote;
 std::map<uint256, CTransactionLock> mapTxLocks;
 std::map<COutPoint, uint256> mapLockedInputs;
 std::map<uint256, int64_t> mapUnknownVotes; //track votes with no tx for DOS
+// Serializes ProcessMessageSwiftTX(), message handler threads call it without cs_main
+static CCriticalSection cs_process_swifttx;
 int nCompleteTXLocks;
 
 //txlock - Locks transaction
@@ -36,15 +38,16 @@ int nCompleteTXLocks;
 //         Send "txvote", CTransaction, Signature, Approve
 //step 3.) Top 1 masternode, waits for SWIFTTX_SIGNATURES_REQUIRED messages. Upon success, sends "txlock'
 
-void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
+void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CBufferReader& vRecv)
 {
     if (fLiteMode) return; //disable all obfuscation/masternode related functionality
     if (!IsSporkActive(SPORK_2_SWIFTTX)) return;
+
+    LOCK(cs_process_swifttx);
     if (!masternodeSync.IsBlockchainSynced()) return;
 
     if (strCommand == "ix") {
         //LogPrintf("ProcessMessageSwiftTX::ix\n");
-        CDataStream vMsg(vRecv);
         CTransaction tx;
         vRecv >> tx;
 
@@ -188,12 +191,10 @@ bool IsIXTXValid(const CTransaction& txCollateral)
         nValueOut += o.nValue;
 
     for (const CTxIn &i : txCollateral.vin) {
-        CTransaction tx2;
-        uint256 hash;
-        if (GetTransaction(i.prevout.hash, tx2, hash, true)) {
-            if (tx2.vout.size() > i.prevout.n) {
-                nValueIn += tx2.vout[i.prevout.n].nValue;
-            }
+        CTxOut out;
+        CValidationState state;
+        if (GetOutput(i.prevout.hash, i.prevout.n, state, out)) {
+            nValueIn += out.nValue;
         } else {
             missingTx = true;
         }
@@ -27,6 +27,7 @@
 #include "libzerocoin/Coin.h"
 #include "libzerocoin/CoinSpend.h"
 #include "libzerocoin/Accumulator.h"
+#include "libzerocoin/ParallelVerifier.h"
 #include "test_squorum.h"
 
 
@@ -370,6 +371,68 @@ Testb_MintAndSpend()
     return false;
 }
 
+bool
+Testb_PowModPublic()
+{
+    const uint32_t nIterations = 200;
+    const libzerocoin::IntegerGroupParams& group = gg_Params->accumulatorParams.accumulatorPoKCommitmentGroup;
+
+    std::vector<CBigNum> vExponents(nIterations);
+    for (uint32_t i = 0; i < nIterations; i++)
+        vExponents[i] = CBigNum::randBignum(group.groupOrder);
+
+    std::vector<CBigNum> vSecure(nIterations);
+    std::vector<CBigNum> vPublic(nIterations);
+    for (uint32_t i = 0; i < nIterations; i++) {
+        vSecure[i] = group.g.pow_mod(vExponents[i], group.modulus);
+        vPublic[i] = group.g.pow_mod_public(vExponents[i], group.modulus);
+    }
+
+    return vSecure == vPublic;
+}
+
+bool
+Testb_SpendVerify()
+{
+    const uint32_t nSpends = 10;
+    try {
+        if (ggCoins[0] == NULL)
+            return false;
+
+        libzerocoin::Accumulator acc(&gg_Params->accumulatorParams, libzerocoin::CoinDenomination::ZQ_ONE);
+        libzerocoin::AccumulatorWitness wAcc(gg_Params, acc, ggCoins[0]->getPublicCoin());
+        for (uint32_t i = 0; i < TESTS_COINS_TO_ACCUMULATE; i++) {
+            acc += ggCoins[i]->getPublicCoin();
+            wAcc += ggCoins[i]->getPublicCoin();
+        }
+        libzerocoin::CoinSpend spend(gg_Params, gg_Params, *(ggCoins[0]), acc, 0, wAcc, 0, libzerocoin::SpendType::SPEND);
+
+        // One after the other, as CheckZerocoinSpend() does for each transaction
+        bool fValid = true;
+        timer.start();
+        for (uint32_t i = 0; i < nSpends; i++)
+            fValid &= spend.Verify(acc);
+        timer.stop();
+        int nSerialDuration = timer.duration();
+
+        // All at once on the proof workers, as the spends of a block
+        libzerocoin::CoinSpendParallelVerifier verifier;
+        for (uint32_t i = 0; i < nSpends; i++)
+            verifier.Add(spend, acc);
+        timer.start();
+        fValid &= verifier.Verify();
+        timer.stop();
+        int nParallelDuration = timer.duration();
+
+        std::cout << "\tSPEND VERIFY ELAPSED TIME (" << nSpends << " spends):\n\t\tOne by one: " << nSerialDuration << " ms\t" << nSerialDuration / nSpends << " ms per spend\n\t\tParallel verifier: " << nParallelDuration << " ms\t" << nParallelDuration / nSpends << " ms per spend" << std::endl;
+
+        return fValid;
+    } catch (std::runtime_error &e) {
+        std::cout << e.what() << std::endl;
+        return false;
+    }
+}
+
 void
 Testb_RunAllTests()
 {
@@ -389,6 +452,8 @@ Testb_RunAllTests()
     gLogTestResult("coins can be minted", Testb_MintCoin);
     gLogTestResult("the accumulator works", Testb_Accumulator);
     gLogTestResult("a minted coin can be spent", Testb_MintAndSpend);
+    gLogTestResult("variable time exponentiation matches pow_mod", Testb_PowModPublic);
+    gLogTestResult("spends can be verified", Testb_SpendVerify);
 
     // Summarize test results
     if (ggSuccessfulTests < ggNumTests) {
@@ -0,0 +1,232 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "amount.h"
+#include "streams.h"
+#include "test/test_squorum.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockencodings_tests, BasicTestingSetup)
+
+static CBlock BuildBlock()
+{
+    CBlock block;
+    block.nBits = 0x207fffff;
+    block.nTime = 1577836800;
+    for (int i = 0; i < 4; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i << OP_TRUE;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = (i + 1) * COIN;
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+/** A compact block with its fields open, to build the ones a peer could send */
+struct TestHeaderAndShortIDs {
+    CBlockHeader header;
+    uint64_t nonce;
+    std::vector<uint64_t> shorttxids;
+    std::vector<CPrefilledTransaction> prefilledtxn;
+    std::vector<unsigned char> vchBlockSig;
+
+    explicit TestHeaderAndShortIDs(const CBlockHeaderAndShortTxIDs& orig)
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << orig;
+        ss >> *this;
+    }
+
+    CBlockHeaderAndShortTxIDs Get() const
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << *this;
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        ss >> cmpctblock;
+        return cmpctblock;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(header);
+        READWRITE(nonce);
+        uint64_t nShortTxIDs = shorttxids.size();
+        READWRITE(COMPACTSIZE(nShortTxIDs));
+        shorttxids.resize(nShortTxIDs);
+        for (size_t i = 0; i < shorttxids.size(); i++) {
+            uint32_t lsb = shorttxids[i] & 0xffffffff;
+            uint16_t msb = (shorttxids[i] >> 32) & 0xffff;
+            READWRITE(lsb);
+            READWRITE(msb);
+            shorttxids[i] = (uint64_t(msb) << 32) | uint64_t(lsb);
+        }
+        READWRITE(prefilledtxn);
+        READWRITE(vchBlockSig);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(compact_block_roundtrip_test)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block = BuildBlock();
+    pool.addUnchecked(block.vtx[1].GetHash(), CTxMemPoolEntry(block.vtx[1], 0, 0, 0.0, 1));
+    pool.addUnchecked(block.vtx[3].GetHash(), CTxMemPoolEntry(block.vtx[3], 0, 0, 0.0, 1));
+
+    // Relayed with the coinbase prefilled and short ids for the rest
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CBlockHeaderAndShortTxIDs(block);
+    CBlockHeaderAndShortTxIDs cmpctblock;
+    ss >> cmpctblock;
+    BOOST_CHECK(cmpctblock.header.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(cmpctblock.BlockTxCount(), 4U);
+
+    CPartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK_EQUAL(partialBlock.InitData(cmpctblock), READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+    BOOST_CHECK(partialBlock.IsTxAvailable(3));
+
+    // A wrong transaction shows in the merkle root, which asks for the full block
+    CBlock blockFilled;
+    CPartiallyDownloadedBlock partialWrong(&pool);
+    BOOST_CHECK_EQUAL(partialWrong.InitData(cmpctblock), READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(partialWrong.FillBlock(blockFilled, std::vector<CTransaction>(1, block.vtx[1])), READ_STATUS_FAILED);
+
+    // Too few or too many transactions is the fault of the peer
+    CPartiallyDownloadedBlock partialShort(&pool);
+    BOOST_CHECK_EQUAL(partialShort.InitData(cmpctblock), READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(partialShort.FillBlock(blockFilled, std::vector<CTransaction>()), READ_STATUS_INVALID);
+    CPartiallyDownloadedBlock partialLong(&pool);
+    BOOST_CHECK_EQUAL(partialLong.InitData(cmpctblock), READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(partialLong.FillBlock(blockFilled, std::vector<CTransaction>(2, block.vtx[2])), READ_STATUS_INVALID);
+
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(blockFilled, std::vector<CTransaction>(1, block.vtx[2])), READ_STATUS_OK);
+    BOOST_CHECK(blockFilled.GetHash() == block.GetHash());
+    BOOST_CHECK(blockFilled.hashMerkleRoot == block.BuildMerkleTree());
+
+    // With everything in the mempool, nothing has to be requested
+    pool.addUnchecked(block.vtx[2].GetHash(), CTxMemPoolEntry(block.vtx[2], 0, 0, 0.0, 1));
+    CPartiallyDownloadedBlock partialFull(&pool);
+    BOOST_CHECK_EQUAL(partialFull.InitData(cmpctblock), READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(partialFull.FillBlock(blockFilled, std::vector<CTransaction>()), READ_STATUS_OK);
+    BOOST_CHECK(blockFilled.GetHash() == block.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_empty_mempool_test)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block = BuildBlock();
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+
+    // Only the coinbase is available, the rest is requested in block order
+    CPartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK_EQUAL(partialBlock.InitData(cmpctblock), READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    for (size_t i = 1; i < block.vtx.size(); i++)
+        BOOST_CHECK(!partialBlock.IsTxAvailable(i));
+
+    std::vector<CTransaction> vtx_missing(block.vtx.begin() + 1, block.vtx.end());
+    CBlock blockFilled;
+    CPartiallyDownloadedBlock partialReordered(&pool);
+    BOOST_CHECK_EQUAL(partialReordered.InitData(cmpctblock), READ_STATUS_OK);
+    std::vector<CTransaction> vtx_reordered(vtx_missing.rbegin(), vtx_missing.rend());
+    BOOST_CHECK_EQUAL(partialReordered.FillBlock(blockFilled, vtx_reordered), READ_STATUS_FAILED);
+
+    CPartiallyDownloadedBlock partialExtra(&pool);
+    BOOST_CHECK_EQUAL(partialExtra.InitData(cmpctblock), READ_STATUS_OK);
+    std::vector<CTransaction> vtx_extra(vtx_missing);
+    vtx_extra.push_back(block.vtx[1]);
+    BOOST_CHECK_EQUAL(partialExtra.FillBlock(blockFilled, vtx_extra), READ_STATUS_INVALID);
+
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(blockFilled, vtx_missing), READ_STATUS_OK);
+    BOOST_CHECK(blockFilled.GetHash() == block.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_short_id_collision_test)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block = BuildBlock();
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    TestHeaderAndShortIDs test(cmpctblock);
+    BOOST_CHECK_EQUAL(test.shorttxids.size(), 3U);
+
+    // Two transactions of the block that cannot be told apart ask for the full block
+    test.shorttxids[2] = test.shorttxids[0];
+    CPartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK_EQUAL(partialBlock.InitData(test.Get()), READ_STATUS_FAILED);
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_prefilled_index_test)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block = BuildBlock();
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    TestHeaderAndShortIDs test(cmpctblock);
+    BOOST_CHECK_EQUAL(test.prefilledtxn.size(), 1U);
+
+    // The last transaction can be prefilled instead of the first
+    TestHeaderAndShortIDs testLast(test);
+    testLast.prefilledtxn[0].index = 3;
+    CPartiallyDownloadedBlock partialLast(&pool);
+    BOOST_CHECK_EQUAL(partialLast.InitData(testLast.Get()), READ_STATUS_OK);
+    BOOST_CHECK(!partialLast.IsTxAvailable(0));
+    BOOST_CHECK(partialLast.IsTxAvailable(3));
+
+    // An index past the end of the block
+    TestHeaderAndShortIDs testPastEnd(test);
+    testPastEnd.prefilledtxn[0].index = 4;
+    CPartiallyDownloadedBlock partialPastEnd(&pool);
+    BOOST_CHECK_EQUAL(partialPastEnd.InitData(testPastEnd.Get()), READ_STATUS_INVALID);
+
+    // Differential indexes that add up past 16 bits
+    TestHeaderAndShortIDs testOverflow(test);
+    testOverflow.prefilledtxn.push_back(test.prefilledtxn[0]);
+    testOverflow.prefilledtxn[1].index = std::numeric_limits<uint16_t>::max();
+    CPartiallyDownloadedBlock partialOverflow(&pool);
+    BOOST_CHECK_EQUAL(partialOverflow.InitData(testOverflow.Get()), READ_STATUS_INVALID);
+
+    // An index that does not fit 16 bits is rejected when reading
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nIndex = std::numeric_limits<uint16_t>::max() + 1;
+    ss << COMPACTSIZE(nIndex) << block.vtx[0];
+    CPrefilledTransaction prefilled;
+    BOOST_CHECK_THROW(ss >> prefilled, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(getblocktxn_indexes_test)
+{
+    CBlockTransactionsRequest req;
+    req.blockhash = uint256(42);
+    req.indexes.push_back(0);
+    req.indexes.push_back(1);
+    req.indexes.push_back(3);
+    req.indexes.push_back(1000);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << req;
+    CBlockTransactionsRequest reqRead;
+    ss >> reqRead;
+    BOOST_CHECK(reqRead.blockhash == req.blockhash);
+    BOOST_CHECK(reqRead.indexes == req.indexes);
+
+    // Differences that add up past 16 bits are rejected
+    CDataStream ssOverflow(SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nCount = 2, nFirst = 0xffff, nSecond = 1;
+    ssOverflow << req.blockhash << COMPACTSIZE(nCount) << COMPACTSIZE(nFirst) << COMPACTSIZE(nSecond);
+    BOOST_CHECK_THROW(ssOverflow >> reqRead, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
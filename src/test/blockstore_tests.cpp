@@ -0,0 +1,94 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstore.h"
+
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "test/test_squorum.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockstore_tests, BasicTestingSetup)
+
+static std::shared_ptr<const CBlock> TestBlock(uint32_t nNonce)
+{
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    pblock->nVersion = 1;
+    pblock->nNonce = nNonce;
+    return pblock;
+}
+
+BOOST_AUTO_TEST_CASE(bufferreader_test)
+{
+    CBlock block = *TestBlock(42);
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1234;
+    block.vtx.push_back(tx);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+    std::vector<char> vData(ss.begin(), ss.end());
+
+    // A block deserialized from memory is the same as one read from a stream
+    CBufferReader reader(vData.data(), vData.data() + vData.size(), SER_DISK, CLIENT_VERSION);
+    CBlock blockRead;
+    reader >> blockRead;
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK(blockRead.GetHash() == block.GetHash());
+    BOOST_CHECK(blockRead.vtx.size() == 1 && blockRead.vtx[0].GetHash() == block.vtx[0].GetHash());
+
+    // Reading past the end of the buffer fails instead of reading on
+    CBufferReader truncated(vData.data(), vData.data() + vData.size() - 1, SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_THROW(truncated >> blockRead, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_lru_test)
+{
+    std::shared_ptr<const CBlock> pblockA = TestBlock(1);
+    std::shared_ptr<const CBlock> pblockB = TestBlock(2);
+    std::shared_ptr<const CBlock> pblockC = TestBlock(3);
+    size_t nSize = ::GetSerializeSize(*pblockA, SER_DISK, CLIENT_VERSION);
+
+    CBlockCache cache;
+
+    // Disabled until given a size
+    cache.Insert(pblockA);
+    BOOST_CHECK(!cache.Get(pblockA->GetHash()));
+
+    // Room for two blocks
+    cache.SetMaxSize(nSize * 2 + nSize / 2);
+    cache.Insert(pblockA);
+    cache.Insert(pblockB);
+    BOOST_CHECK(cache.Get(pblockA->GetHash()) == pblockA);
+
+    // B is now the least recently used, so it makes room for C
+    cache.Insert(pblockC);
+    BOOST_CHECK(cache.Get(pblockA->GetHash()) == pblockA);
+    BOOST_CHECK(!cache.Get(pblockB->GetHash()));
+    BOOST_CHECK(cache.Get(pblockC->GetHash()) == pblockC);
+
+    CBlockCacheStats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nHits, 3U);
+    BOOST_CHECK_EQUAL(stats.nMisses, 2U);
+    BOOST_CHECK_EQUAL(stats.nBlocks, 2U);
+    BOOST_CHECK_EQUAL(stats.nBytes, nSize * 2);
+
+    // Shrinking evicts down to the new size, and the evicted blocks stay usable
+    cache.SetMaxSize(nSize);
+    stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nBlocks, 1U);
+    BOOST_CHECK(cache.Get(pblockC->GetHash()) == pblockC);
+    BOOST_CHECK(!cache.Get(pblockA->GetHash()));
+    BOOST_CHECK(pblockA->nNonce == 1);
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.GetStats().nBytes, 0U);
+    BOOST_CHECK(!cache.Get(pblockC->GetHash()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
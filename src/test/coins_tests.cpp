@@ -2,15 +2,19 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "checkqueue.h"
 #include "coins.h"
 #include "random.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "test/test_squorum.h"
 
 #include <vector>
 #include <map>
 
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 namespace
 {
@@ -59,6 +63,24 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += it->second.coins.DynamicMemoryUsage();
+        }
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+
+    const CCoinsMap& Map() const { return cacheCoins; }
+};
 }
 
 BOOST_FIXTURE_TEST_SUITE(coins_tests, BasicTestingSetup)
@@ -176,4 +198,203 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+BOOST_AUTO_TEST_CASE(coins_cache_retain_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    std::vector<uint256> txids;
+    for (unsigned int i = 0; i < 100; i++) {
+        txids.push_back(GetRandHash());
+        CCoinsModifier coins = cache.ModifyCoins(txids.back());
+        coins->vout.resize(1);
+        coins->vout[0].nValue = i + 1;
+        coins->vout[0].scriptPubKey.assign(40, 0x51);
+    }
+    cache.SelfTest();
+    size_t nEntryUsage = (cache.DynamicMemoryUsage() - memusage::DynamicUsage(cache.Map())) / txids.size() +
+                         memusage::MallocUsage(sizeof(memusage::boost_unordered_node<CCoinsMap::value_type>));
+
+    // Use the first ten again, and spend the next one
+    for (unsigned int i = 0; i < 10; i++)
+        BOOST_CHECK(cache.AccessCoins(txids[i]));
+    cache.ModifyCoins(txids[10])->Clear();
+    cache.SelfTest();
+
+    BOOST_CHECK(cache.FlushRetaining(10 * nEntryUsage));
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 10U);
+    for (unsigned int i = 0; i < 10; i++) {
+        BOOST_CHECK(cache.Map().count(txids[i]));
+        BOOST_CHECK_EQUAL(cache.Map().find(txids[i])->second.flags, 0);
+    }
+
+    // Everything was written, retained or not
+    CCoins coins;
+    for (unsigned int i = 0; i < txids.size(); i++) {
+        if (i == 10)
+            continue;
+        BOOST_CHECK(base.GetCoins(txids[i], coins));
+        BOOST_CHECK_EQUAL(coins.vout[0].nValue, (CAmount)(i + 1));
+    }
+
+    // Retaining nothing empties the cache
+    BOOST_CHECK(cache.FlushRetaining(0));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), memusage::DynamicUsage(cache.Map()));
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_prefetch_test)
+{
+    CCoinsViewTest base;
+    std::vector<uint256> txids;
+    {
+        CCoinsViewCacheTest cache(&base);
+        for (unsigned int i = 0; i < 50; i++) {
+            txids.push_back(GetRandHash());
+            CCoinsModifier coins = cache.ModifyCoins(txids.back());
+            coins->vout.resize(1);
+            coins->vout[0].nValue = i + 1;
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+
+    std::vector<uint256> vPrefetch(txids);
+    vPrefetch.push_back(txids[1]);
+    vPrefetch.push_back(GetRandHash());
+
+    // On this thread, and split into runs for the threads of a queue
+    CCheckQueue<CCoinsPrefetch> queue(1);
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(boost::bind(&CCheckQueue<CCoinsPrefetch>::Thread, &queue));
+    for (int nRun = 0; nRun < 2; nRun++) {
+        CCoinsViewCacheTest cache(&base);
+        BOOST_CHECK(cache.AccessCoins(txids[0]));
+        cache.PrefetchCoins(vPrefetch, nRun == 0 ? NULL : &queue, 4);
+        cache.SelfTest();
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), txids.size());
+        for (unsigned int i = 0; i < txids.size(); i++) {
+            BOOST_CHECK(cache.Map().count(txids[i]));
+            BOOST_CHECK_EQUAL(cache.AccessCoins(txids[i])->vout[0].nValue, (CAmount)(i + 1));
+        }
+    }
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_outpoint_layout_test, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    BOOST_CHECK(!db.IsOutpointLayout());
+
+    uint256 txid1 = GetRandHash();
+    uint256 txid2 = GetRandHash();
+    CCoins coins1;
+    coins1.nVersion = 1;
+    coins1.nHeight = 10;
+    coins1.fCoinStake = true;
+    coins1.vout.resize(3);
+    for (unsigned int i = 0; i < coins1.vout.size(); i++) {
+        coins1.vout[i].nValue = i + 1;
+        coins1.vout[i].scriptPubKey.assign(25, 0x51 + i);
+    }
+    {
+        CCoinsMap mapCoins;
+        mapCoins[txid1].coins = coins1;
+        mapCoins[txid1].flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+        BOOST_CHECK(db.BatchWrite(mapCoins, GetRandHash()));
+    }
+
+    // The upgrade converts the per-transaction record
+    BOOST_CHECK(db.UpgradeToOutpoints());
+    BOOST_CHECK(db.IsOutpointLayout());
+    CCoins coins;
+    BOOST_CHECK(db.GetCoins(txid1, coins));
+    BOOST_CHECK(coins == coins1);
+    BOOST_CHECK(coins.fCoinStake && !coins.fCoinBase && coins.nHeight == 10);
+
+    // Spend an output and add a transaction through a cache
+    {
+        CCoinsViewCache cache(&db);
+        BOOST_CHECK(cache.ModifyCoins(txid1)->Spend(2));
+        {
+            CCoinsModifier coins2 = cache.ModifyCoins(txid2);
+            coins2->vout.resize(2);
+            coins2->vout[1].nValue = 5;
+            coins2->nHeight = 11;
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(coins1.Spend(2));
+    BOOST_CHECK(db.GetCoins(txid1, coins));
+    BOOST_CHECK(coins == coins1);
+    BOOST_CHECK_EQUAL(coins.vout.size(), 2U);
+    BOOST_CHECK(db.GetCoins(txid2, coins));
+    BOOST_CHECK(coins.vout.size() == 2 && coins.vout[0].IsNull() && coins.vout[1].nValue == 5 && coins.nHeight == 11);
+
+    // Spending every output erases the transaction
+    {
+        CCoinsViewCache cache(&db);
+        {
+            CCoinsModifier coins1Spent = cache.ModifyCoins(txid1);
+            coins1Spent->Spend(0);
+            coins1Spent->Spend(1);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.HaveCoins(txid1));
+    BOOST_CHECK(db.HaveCoins(txid2));
+
+    // A batch read answers in request order whatever the key order
+    std::vector<uint256> vTxids;
+    vTxids.push_back(txid2);
+    vTxids.push_back(txid1);
+    vTxids.push_back(txid2);
+    std::vector<CCoins> vCoins;
+    std::vector<char> vFound;
+    db.GetCoinsBatch(vTxids, vCoins, vFound);
+    BOOST_CHECK(vCoins.size() == 3 && vFound.size() == 3);
+    BOOST_CHECK(vFound[0] && !vFound[1] && vFound[2]);
+    BOOST_CHECK(vCoins[0] == vCoins[2] && vCoins[0].nHeight == 11);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_flusher_test, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    uint256 txid = GetRandHash();
+    uint256 hashBlock1 = GetRandHash();
+    uint256 hashBlock2 = GetRandHash();
+    {
+        CCoinsViewFlusher flusher(&db);
+        CCoinsViewCache cache(&flusher);
+
+        // The cache starts over empty while its coins are written
+        {
+            CCoinsModifier coins = cache.ModifyCoins(txid);
+            coins->vout.resize(1);
+            coins->vout[0].nValue = 1;
+        }
+        cache.SetBestBlock(hashBlock1);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+        BOOST_CHECK(cache.HaveCoins(txid));
+        BOOST_CHECK(cache.GetBestBlock() == hashBlock1);
+
+        BOOST_CHECK(flusher.Wait());
+        BOOST_CHECK(db.HaveCoins(txid));
+        BOOST_CHECK(db.GetBestBlock() == hashBlock1);
+
+        // Spending the coins erases them from the database
+        cache.ModifyCoins(txid)->Clear();
+        cache.SetBestBlock(hashBlock2);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(!cache.HaveCoins(txid));
+
+        // The destructor writes what is still pending
+    }
+    BOOST_CHECK(!db.HaveCoins(txid));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock2);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
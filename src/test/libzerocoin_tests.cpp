@@ -20,12 +20,15 @@
 #include <cmath>
 // #include <curses.h>
 #include <exception>
+#include <algorithm>
 #include "streams.h"
 #include "libzerocoin/ParamGeneration.h"
 #include "libzerocoin/Denominations.h"
 #include "libzerocoin/Coin.h"
 #include "libzerocoin/CoinSpend.h"
 #include "libzerocoin/Accumulator.h"
+#include "libzerocoin/ParallelVerifier.h"
+#include "libzerocoin/ProofWorkers.h"
 #include "test_squorum.h"
 
 
@@ -445,6 +448,79 @@ Test_MintAndSpend()
     return false;
 }
 
+bool
+Test_ParallelSpend()
+{
+    try {
+        // This test assumes a list of coins were generated in Test_MintCoin()
+        if (gCoins[0] == NULL)
+            return false;
+
+        libzerocoin::Accumulator acc(&g_Params->accumulatorParams, libzerocoin::CoinDenomination::ZQ_ONE);
+        libzerocoin::AccumulatorWitness wAcc(g_Params, acc, gCoins[0]->getPublicCoin());
+        for (uint32_t i = 0; i < TESTS_COINS_TO_ACCUMULATE; i++) {
+            acc += gCoins[i]->getPublicCoin();
+            wAcc += gCoins[i]->getPublicCoin();
+        }
+
+        // A proof built on the worker pool verifies sequentially, and the other way around
+        libzerocoin::SetProofThreads(4);
+        libzerocoin::CoinSpend parallelSpend(g_Params, g_Params, *gCoins[0], acc, 0, wAcc, 0, libzerocoin::SpendType::SPEND);
+        libzerocoin::SetProofThreads(1);
+        libzerocoin::CoinSpend sequentialSpend(g_Params, g_Params, *gCoins[0], acc, 0, wAcc, 0, libzerocoin::SpendType::SPEND);
+        bool ret = parallelSpend.Verify(acc);
+        libzerocoin::SetProofThreads(4);
+        ret = ret && sequentialSpend.Verify(acc);
+        libzerocoin::SetProofThreads(libzerocoin::DEFAULT_PROOF_THREADS);
+        return ret;
+    } catch (std::runtime_error &e) {
+        std::cout << e.what() << std::endl;
+        libzerocoin::SetProofThreads(libzerocoin::DEFAULT_PROOF_THREADS);
+        return false;
+    }
+}
+
+bool
+Test_ParallelVerify()
+{
+    try {
+        // This test assumes a list of coins were generated in Test_MintCoin()
+        if (gCoins[0] == NULL || gCoins[1] == NULL)
+            return false;
+
+        libzerocoin::Accumulator acc(&g_Params->accumulatorParams, libzerocoin::CoinDenomination::ZQ_ONE);
+        libzerocoin::Accumulator otherAcc(&g_Params->accumulatorParams, libzerocoin::CoinDenomination::ZQ_ONE);
+        libzerocoin::AccumulatorWitness wAcc0(g_Params, acc, gCoins[0]->getPublicCoin());
+        libzerocoin::AccumulatorWitness wAcc1(g_Params, acc, gCoins[1]->getPublicCoin());
+        for (uint32_t i = 0; i < TESTS_COINS_TO_ACCUMULATE; i++) {
+            acc += gCoins[i]->getPublicCoin();
+            wAcc0 += gCoins[i]->getPublicCoin();
+            wAcc1 += gCoins[i]->getPublicCoin();
+        }
+        otherAcc += gCoins[0]->getPublicCoin();
+
+        libzerocoin::CoinSpend spend0(g_Params, g_Params, *gCoins[0], acc, 0, wAcc0, 0, libzerocoin::SpendType::SPEND);
+        libzerocoin::CoinSpend spend1(g_Params, g_Params, *gCoins[1], acc, 0, wAcc1, 0, libzerocoin::SpendType::SPEND);
+
+        libzerocoin::CoinSpendParallelVerifier verifier;
+        verifier.Add(spend0, acc);
+        verifier.Add(spend1, acc);
+        if (!verifier.Verify())
+            return false;
+
+        // A spend checked against the wrong accumulator is pinpointed
+        verifier.Add(spend1, otherAcc);
+        verifier.Add(spend0, acc);
+        std::vector<size_t> vInvalid;
+        if (verifier.Verify() || verifier.Verify(&vInvalid))
+            return false;
+        return vInvalid.size() == 1 && vInvalid[0] == 2;
+    } catch (std::runtime_error &e) {
+        std::cout << e.what() << std::endl;
+        return false;
+    }
+}
+
 void
 Test_RunAllTests()
 {
@@ -466,6 +542,8 @@ Test_RunAllTests()
     LogTestResult("the accumulator works", Test_Accumulator);
     LogTestResult("the commitment equality PoK works", Test_EqualityPoK);
     LogTestResult("a minted coin can be spent", Test_MintAndSpend);
+    LogTestResult("spend proofs match with and without proof workers", Test_ParallelSpend);
+    LogTestResult("spends can be verified in parallel", Test_ParallelVerify);
 
     std::cout << std::endl << "Average coin size is " << gCoinSize << " bytes." << std::endl;
     std::cout << "Serial number size is " << gSerialNumberSize << " bytes." << std::endl;
@@ -492,4 +570,32 @@ BOOST_AUTO_TEST_CASE(libzerocoin_tests)
 
     Test_RunAllTests();
 }
+
+BOOST_AUTO_TEST_CASE(libzerocoin_proof_workers_tests)
+{
+    for (unsigned int nThreads = 1; nThreads <= 4; nThreads++) {
+        libzerocoin::SetProofThreads(nThreads);
+        BOOST_CHECK_EQUAL(libzerocoin::GetProofThreads(), nThreads);
+
+        // Every index runs exactly once
+        std::vector<int> vCalls(100, 0);
+        libzerocoin::ParallelFor(vCalls.size(), [&](uint32_t i) { vCalls[i]++; });
+        BOOST_CHECK(std::count(vCalls.begin(), vCalls.end(), 1) == (int)vCalls.size());
+
+        // Exceptions reach the caller, and no index runs twice
+        std::fill(vCalls.begin(), vCalls.end(), 0);
+        BOOST_CHECK_THROW(libzerocoin::ParallelFor(vCalls.size(), [&](uint32_t i) {
+            vCalls[i]++;
+            if (i == 10)
+                throw std::runtime_error("round failed");
+        }), std::runtime_error);
+        BOOST_CHECK_EQUAL(vCalls[10], 1);
+        BOOST_CHECK(std::count(vCalls.begin(), vCalls.end(), 2) == 0);
+    }
+
+    libzerocoin::SetProofThreads(libzerocoin::MAX_PROOF_THREADS + 1);
+    BOOST_CHECK_EQUAL(libzerocoin::GetProofThreads(), libzerocoin::MAX_PROOF_THREADS);
+    libzerocoin::SetProofThreads(libzerocoin::DEFAULT_PROOF_THREADS);
+    BOOST_CHECK(libzerocoin::GetProofThreads() >= 1);
+}
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,53 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "lightzsqrthread.h"
+
+#include "bloom.h"
+#include "utiltime.h"
+#include "test/test_squorum.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(lightzsqrthread_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(witness_request_test)
+{
+    CLightWorker worker;
+    CBloomFilter filter(10, 0.000001, 0, BLOOM_UPDATE_NONE);
+
+    // A height above the tip is answered with an error
+    CGenWit wit(filter, chainActive.Height() + 1000, libzerocoin::CoinDenomination::ZQ_ONE, 1, CBigNum(2));
+    BOOST_CHECK(!worker.addWitWork(wit));
+
+    boost::thread_group threadGroup;
+    worker.StartLightZsqrThread(threadGroup);
+    BOOST_CHECK(worker.addWitWork(wit));
+    CGenWit witSame(filter, chainActive.Height() + 1000, libzerocoin::CoinDenomination::ZQ_ONE, 2, CBigNum(2));
+    BOOST_CHECK(worker.addWitWork(witSame));
+
+    // Workers take a request after a two second pause
+    CLightWorkerStats stats;
+    for (int i = 0; i < 200; i++) {
+        stats = worker.GetStats();
+        if (stats.nFinished)
+            break;
+        MilliSleep(100);
+    }
+    BOOST_CHECK_EQUAL(stats.nThreads, DEFAULT_LIGHT_ZSQR_THREADS);
+    BOOST_CHECK_EQUAL(stats.nRequests, 2U);
+    BOOST_CHECK_EQUAL(stats.nDeduplicated, 1U);
+    BOOST_CHECK_EQUAL(stats.nFinished, 1U);
+    BOOST_CHECK_EQUAL(stats.nRejected, 2U);
+    BOOST_CHECK_EQUAL(stats.nCompleted, 0U);
+    BOOST_CHECK_EQUAL(stats.nQueued, 0);
+    BOOST_CHECK_EQUAL(stats.nRunning, 0);
+
+    // Stopping joins the idle workers
+    worker.StopLightZsqrThread();
+    BOOST_CHECK_EQUAL(worker.GetStats().nThreads, 0);
+    BOOST_CHECK(!worker.addWitWork(wit));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,9 +7,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "primitives/transaction.h"
+#include "chainparams.h"
 #include "main.h"
+#include "obfuscation.h"
+#include "script/standard.h"
 #include "test_squorum.h"
 
+#include <boost/filesystem/fstream.hpp>
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(main_tests, TestingSetup)
@@ -100,4 +104,226 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     //BOOST_CHECK(nSum == 4109975100000000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(assumevalid_test)
+{
+    LOCK(cs_main);
+
+    // A header chain with a block a day
+    const int nBlocks = 40;
+    std::vector<CBlock> vBlocks(nBlocks);
+    std::vector<uint256> vHashes(nBlocks);
+    std::vector<CBlockIndex> vIndex(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        vBlocks[i].nTime = 1500000000 + i * 24 * 60 * 60;
+        vBlocks[i].nNonce = i;
+        vBlocks[i].hashPrevBlock = i ? vHashes[i - 1] : uint256(0);
+        vHashes[i] = vBlocks[i].GetHash();
+        vIndex[i] = CBlockIndex(vBlocks[i]);
+        vIndex[i].phashBlock = &vHashes[i];
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i ? &vIndex[i - 1] : NULL;
+        vIndex[i].nChainWork = i;
+        vIndex[i].BuildSkip();
+        mapBlockIndex[vHashes[i]] = &vIndex[i];
+    }
+    CBlockIndex* pindexBestHeaderOld = pindexBestHeader;
+    pindexBestHeader = &vIndex[nBlocks - 1];
+
+    // Disabled by default
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[9], vBlocks[10]));
+
+    hashAssumeValid = vHashes[30];
+    BOOST_CHECK(IsBlockAssumedValid(&vIndex[9], vBlocks[10]));
+    BOOST_CHECK(IsBlockAssumedValid(&vIndex[24], vBlocks[25]));
+    // Not buried deep enough below the best header
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[29], vBlocks[30]));
+    // Not an ancestor of the assumed valid block
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[30], vBlocks[31]));
+    CBlock blockFork = vBlocks[10];
+    blockFork.nNonce = nBlocks;
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[9], blockFork));
+
+    // Not enough work in the best header chain
+    nMinimumChainWork = nBlocks;
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[9], vBlocks[10]));
+    nMinimumChainWork = 0;
+
+    // Assumed valid block not in the best header chain
+    pindexBestHeader = &vIndex[20];
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[4], vBlocks[5]));
+
+    // Unknown assumed valid block
+    pindexBestHeader = &vIndex[nBlocks - 1];
+    hashAssumeValid = blockFork.GetHash();
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[9], vBlocks[10]));
+
+    hashAssumeValid = 0;
+    pindexBestHeader = pindexBestHeaderOld;
+    for (const uint256& hash : vHashes)
+        mapBlockIndex.erase(hash);
+}
+
+BOOST_AUTO_TEST_CASE(reindex_precheck_test)
+{
+    CBlock block;
+    block.nTime = 1500000000;
+    block.nBits = 0;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i << OP_TRUE;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = (i + 1) * COIN;
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    BOOST_CHECK(block.IsProofOfWork());
+    BOOST_CHECK(!block.fPreChecked);
+
+    // Below the minimum work
+    BOOST_CHECK(!PreCheckBlock(block));
+
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    BOOST_CHECK(PreCheckBlock(block));
+
+    CBlock blockBadRoot(block);
+    blockBadRoot.hashMerkleRoot = uint256(1);
+    BOOST_CHECK(!PreCheckBlock(blockBadRoot));
+
+    // Same merkle root with the last transaction repeated
+    CBlock blockMutated(block);
+    blockMutated.vtx.push_back(block.vtx.back());
+    BOOST_CHECK(blockMutated.BuildMerkleTree() == block.hashMerkleRoot);
+    BOOST_CHECK(!PreCheckBlock(blockMutated));
+
+    // Proof-of-work blocks are not signed
+    CBlock blockSigned(block);
+    blockSigned.vchBlockSig.push_back(1);
+    BOOST_CHECK(!PreCheckBlock(blockSigned));
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+
+    // The result is memory only and does not survive the block being reset
+    block.fPreChecked = true;
+    block.SetNull();
+    BOOST_CHECK(!block.fPreChecked);
+}
+
+BOOST_AUTO_TEST_CASE(prune_selection_test)
+{
+    // Four files of 100 MiB with 1000 blocks each, the last one being written
+    std::vector<CBlockFileInfo> vinfo(4);
+    for (int i = 0; i < 4; i++) {
+        vinfo[i].nSize = 90 * 1024 * 1024;
+        vinfo[i].nUndoSize = 10 * 1024 * 1024;
+        vinfo[i].nHeightFirst = i * 1000;
+        vinfo[i].nHeightLast = i * 1000 + 999;
+    }
+    const uint64_t nMiB = 1024 * 1024;
+
+    // Oldest first, until there is room for another allocation under the target
+    std::set<int> setFiles;
+    SelectBlockFilesToPrune(vinfo, 3, 3500, 400 * nMiB, setFiles);
+    BOOST_CHECK(setFiles == std::set<int>({0}));
+    setFiles.clear();
+    SelectBlockFilesToPrune(vinfo, 3, 3500, 250 * nMiB, setFiles);
+    BOOST_CHECK(setFiles == std::set<int>({0, 1}));
+
+    // Never the file being written, nor one with a block near the tip
+    setFiles.clear();
+    SelectBlockFilesToPrune(vinfo, 3, 3500, 1, setFiles);
+    BOOST_CHECK(setFiles == std::set<int>({0, 1, 2}));
+    setFiles.clear();
+    SelectBlockFilesToPrune(vinfo, 3, 2999 + MIN_BLOCKS_TO_KEEP - 1, 1, setFiles);
+    BOOST_CHECK(setFiles == std::set<int>({0, 1}));
+    setFiles.clear();
+    SelectBlockFilesToPrune(vinfo, 3, MIN_BLOCKS_TO_KEEP, 1, setFiles);
+    BOOST_CHECK(setFiles.empty());
+
+    // Files already pruned are skipped, and pruning is off without a target
+    vinfo[0].SetNull();
+    setFiles.clear();
+    SelectBlockFilesToPrune(vinfo, 3, 3500, 250 * nMiB, setFiles);
+    BOOST_CHECK(setFiles == std::set<int>({1}));
+    setFiles.clear();
+    SelectBlockFilesToPrune(vinfo, 3, 3500, 0, setFiles);
+    BOOST_CHECK(setFiles.empty());
+
+    // The minimum target holds the blocks that are never pruned
+    BOOST_CHECK(MIN_DISK_SPACE_FOR_BLOCK_FILES > (uint64_t)MIN_BLOCKS_TO_KEEP * MAX_BLOCK_SIZE_CURRENT);
+}
+
+BOOST_AUTO_TEST_CASE(collateral_lookup_test)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CPubKey pubkeyOther = keyOther.GetPubKey();
+
+    CMutableTransaction txMutable;
+    txMutable.vin.resize(1);
+    txMutable.vout.resize(2);
+    txMutable.vout[0].nValue = MASTERNODE_COLLATERAL_AMOUNT * COIN;
+    txMutable.vout[0].scriptPubKey = GetScriptForDestination(pubkey.GetID());
+    txMutable.vout[1].nValue = 1 * COIN;
+    txMutable.vout[1].scriptPubKey = GetScriptForDestination(pubkey.GetID());
+    CTransaction tx(txMutable);
+    uint256 hash = tx.GetHash();
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyCoins(hash)->FromTx(tx, 42);
+    }
+
+    // Unspent outputs are found in the coins view, without the block
+    CTxIn vin(hash, 0);
+    BOOST_CHECK_EQUAL(GetInputHeight(vin), 42);
+    CTxOut out;
+    CValidationState state;
+    BOOST_CHECK(GetOutput(hash, 1, state, out) && out.nValue == 1 * COIN);
+    CObfuScationSigner signer;
+    BOOST_CHECK(signer.IsVinAssociatedWithPubkey(vin, pubkey));
+    BOOST_CHECK(!signer.IsVinAssociatedWithPubkey(vin, pubkeyOther));
+    CTxIn vinSmall(hash, 1);
+    BOOST_CHECK(!signer.IsVinAssociatedWithPubkey(vinSmall, pubkey));
+
+    // The block of the transaction is not available, so anything else is refused
+    int nDoS = 0;
+    BOOST_CHECK(!GetOutput(hash, 2, state, out));
+    BOOST_CHECK(state.IsInvalid(nDoS) && nDoS == 100);
+
+    // A spent collateral is not associated with the masternode anymore
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(pcoinsTip->ModifyCoins(hash)->Spend(0));
+    }
+    BOOST_CHECK_EQUAL(GetInputHeight(vin), -1);
+    BOOST_CHECK(!signer.IsVinAssociatedWithPubkey(vin, pubkey));
+
+    // A transaction found elsewhere is checked for the index: one past the last output is refused
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 0, 0, 0.0, 1));
+    CValidationState stateMempool;
+    BOOST_CHECK(GetOutput(hash, 0, stateMempool, out) && out.nValue == MASTERNODE_COLLATERAL_AMOUNT * COIN);
+    BOOST_CHECK(!GetOutput(hash, 2, stateMempool, out));
+    BOOST_CHECK(stateMempool.IsInvalid(nDoS) && nDoS == 100);
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(cleanup_block_rev_files_test)
+{
+    boost::filesystem::path blocksdir = GetDataDir() / "blocks";
+    boost::filesystem::create_directories(blocksdir);
+    const char* vFiles[] = {"blk00000.dat", "blk00001.dat", "blk00003.dat", "rev00000.dat", "rev00001.dat"};
+    for (const char* strFile : vFiles)
+        boost::filesystem::ofstream(blocksdir / strFile) << "x";
+
+    // Undo files are gone, block files are kept up to the first gap
+    CleanupBlockRevFiles();
+    BOOST_CHECK(boost::filesystem::exists(blocksdir / "blk00000.dat"));
+    BOOST_CHECK(boost::filesystem::exists(blocksdir / "blk00001.dat"));
+    BOOST_CHECK(!boost::filesystem::exists(blocksdir / "blk00003.dat"));
+    BOOST_CHECK(!boost::filesystem::exists(blocksdir / "rev00000.dat"));
+    BOOST_CHECK(!boost::filesystem::exists(blocksdir / "rev00001.dat"));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
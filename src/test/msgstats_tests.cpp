@@ -0,0 +1,62 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "msgstats.h"
+
+#include "test/test_squorum.h"
+#include "tinyformat.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(msgstats_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(histogram_buckets_test)
+{
+    BOOST_CHECK_EQUAL(CLatencyHistogram::GetBucket(0), 0);
+    BOOST_CHECK_EQUAL(CLatencyHistogram::GetBucket(1), 1);
+    BOOST_CHECK_EQUAL(CLatencyHistogram::GetBucket(2), 2);
+    BOOST_CHECK_EQUAL(CLatencyHistogram::GetBucket(3), 2);
+    BOOST_CHECK_EQUAL(CLatencyHistogram::GetBucket(1000), 10);
+    BOOST_CHECK_EQUAL(CLatencyHistogram::GetBucket(1024), 11);
+    // Everything too slow for the last but one bucket ends up in the last
+    BOOST_CHECK_EQUAL(CLatencyHistogram::GetBucket((int64_t)1 << 40), LATENCY_HISTOGRAM_BUCKETS - 1);
+
+    CLatencyHistogram histogram;
+    histogram.Add(3);
+    histogram.Add(1000);
+    histogram.Add(-5);
+    BOOST_CHECK_EQUAL(histogram.nCount, 3U);
+    BOOST_CHECK_EQUAL(histogram.nTotalMicros, 1003);
+    BOOST_CHECK_EQUAL(histogram.nMaxMicros, 1000);
+    BOOST_CHECK_EQUAL(histogram.vBuckets[0], 1U);
+    BOOST_CHECK_EQUAL(histogram.vBuckets[2], 1U);
+    BOOST_CHECK_EQUAL(histogram.vBuckets[10], 1U);
+}
+
+BOOST_AUTO_TEST_CASE(message_stats_test)
+{
+    CMessageStats stats;
+    stats.Add("ping", 10);
+    stats.Add("ping", 30);
+    stats.Add("block", 50000);
+
+    std::map<std::string, CLatencyHistogram> mapStats = stats.Get();
+    BOOST_CHECK_EQUAL(mapStats.size(), 2U);
+    BOOST_CHECK_EQUAL(mapStats["ping"].nCount, 2U);
+    BOOST_CHECK_EQUAL(mapStats["ping"].nMaxMicros, 30);
+    BOOST_CHECK_EQUAL(mapStats["block"].nTotalMicros, 50000);
+
+    // Made up commands cannot grow the statistics without bounds
+    for (size_t i = 0; i < 2 * MAX_MESSAGE_STATS_COMMANDS; i++)
+        stats.Add(strprintf("junk%u", i), 1);
+    mapStats = stats.Get();
+    BOOST_CHECK(mapStats.size() <= MAX_MESSAGE_STATS_COMMANDS + 1);
+    BOOST_CHECK(mapStats[MESSAGE_STATS_OTHER].nCount > MAX_MESSAGE_STATS_COMMANDS);
+    BOOST_CHECK_EQUAL(mapStats["ping"].nCount, 2U);
+
+    stats.Clear();
+    BOOST_CHECK(stats.Get().empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
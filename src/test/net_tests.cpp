@@ -0,0 +1,101 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net.h"
+
+#include "hash.h"
+#include "streams.h"
+#include "test/test_squorum.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
+
+static CDataStream NetMessage(const char* pszCommand, const std::vector<unsigned char>& vPayload)
+{
+    CDataStream ssPayload(SER_NETWORK, PROTOCOL_VERSION);
+    ssPayload << vPayload;
+    CMessageHeader hdr(pszCommand, ssPayload.size());
+    uint256 hash = Hash(ssPayload.begin(), ssPayload.end());
+    memcpy(&hdr.nChecksum, &hash, sizeof(hdr.nChecksum));
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << hdr;
+    ss.write(&ssPayload[0], ssPayload.size());
+    return ss;
+}
+
+// Feeds a message to the node the way SocketRecvData() does, in 64 KiB reads
+static bool ReceiveMessage(CNode& node, const CDataStream& ss, bool& fDirect)
+{
+    const unsigned int nChunk = 0x10000;
+    unsigned int nPos = 0;
+    while (nPos < ss.size()) {
+        unsigned int nBytes = std::min(nChunk, (unsigned int)ss.size() - nPos);
+        char* pch = node.GetRecvPayloadBuffer(nChunk);
+        if (pch) {
+            fDirect = true;
+            memcpy(pch, &ss[nPos], nBytes);
+        } else {
+            pch = (char*)&ss[nPos];
+        }
+        if (!node.ReceiveMsgBytes(pch, nBytes))
+            return false;
+        nPos += nBytes;
+    }
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(receive_payload_test)
+{
+    CNode node(INVALID_SOCKET, CAddress(), "", true);
+    LOCK(node.cs_vRecvMsg);
+
+    std::vector<unsigned char> vPayload(300 * 1024);
+    for (unsigned int i = 0; i < vPayload.size(); i++)
+        vPayload[i] = i * 7;
+    CDataStream ss = NetMessage("block", vPayload);
+    unsigned int nMessageSize = ss.size() - CMessageHeader::HEADER_SIZE;
+
+    // Large payloads are read straight into the message buffer
+    bool fDirect = false;
+    BOOST_CHECK(ReceiveMessage(node, ss, fDirect));
+    BOOST_CHECK(fDirect);
+    BOOST_CHECK_EQUAL(node.vRecvMsg.size(), 1U);
+    const CNetMessage& msg = node.vRecvMsg.front();
+    BOOST_CHECK(msg.complete());
+    BOOST_CHECK_EQUAL(msg.hdr.GetCommand(), "block");
+    BOOST_CHECK_EQUAL(node.GetTotalRecvSize(), ss.size());
+
+    uint256 hash = Hash(msg.vRecv.data(), msg.vRecv.data() + nMessageSize);
+    BOOST_CHECK_EQUAL(memcmp(&hash, &msg.hdr.nChecksum, sizeof(msg.hdr.nChecksum)), 0);
+    CBufferReader vRecv = msg.GetPayload();
+    std::vector<unsigned char> vRead;
+    vRecv >> vRead;
+    BOOST_CHECK(vRecv.empty());
+    BOOST_CHECK(vRead == vPayload);
+
+    // Truncated payloads fail to deserialize instead of reading past the end
+    CBufferReader truncated(msg.vRecv.data(), msg.vRecv.data() + 1, SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK_THROW(truncated >> vRead, std::ios_base::failure);
+
+    // A small message that follows arrives through the stack buffer
+    std::vector<unsigned char> vSmall(10, 0x42);
+    CDataStream ssSmall = NetMessage("ping", vSmall);
+    fDirect = false;
+    BOOST_CHECK(ReceiveMessage(node, ssSmall, fDirect));
+    BOOST_CHECK(!fDirect);
+    BOOST_CHECK_EQUAL(node.vRecvMsg.size(), 2U);
+    vRecv = node.vRecvMsg.back().GetPayload();
+    vRecv >> vRead;
+    BOOST_CHECK(vRead == vSmall);
+
+    // Once processed, the buffer of the large message is reused by the next
+    // one, which gets the whole size as soon as its payload starts
+    node.vRecvMsg.clear();
+    BOOST_CHECK(node.ReceiveMsgBytes(&ss[0], CMessageHeader::HEADER_SIZE + 1));
+    BOOST_CHECK(node.vRecvMsg.back().vRecv.capacity() >= nMessageSize);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
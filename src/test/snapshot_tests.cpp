@@ -0,0 +1,82 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "snapshot.h"
+
+#include "main.h"
+#include "primitives/transaction.h"
+#include "txdb.h"
+#include "test/test_squorum.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(snapshot_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(dump_and_load_test)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 1 * COIN;
+    tx.vout[1].nValue = 2 * COIN;
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyCoins(tx.GetHash())->FromTx(tx, 0);
+    }
+    BOOST_CHECK(zerocoinDB->WriteAccumulatorValue(42, CBigNum(1234)));
+
+    CCoinsStats stats;
+    FlushStateToDisk();
+    BOOST_CHECK(pcoinsdbview->GetStats(stats));
+
+    boost::filesystem::path path = pathTemp / "utxo.dat";
+    CSnapshotInfo info;
+    std::string strError;
+    BOOST_CHECK_MESSAGE(DumpChainstateSnapshot(path, info, strError), strError);
+    BOOST_CHECK(info.hashBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(info.nTransactions, 1U);
+    BOOST_CHECK_EQUAL(info.nTransactionOutputs, 2U);
+    BOOST_CHECK(info.hashSerialized == stats.hashSerialized);
+    BOOST_CHECK(info.nZerocoinRecords >= 1);
+
+    // Start over with empty databases, as a new node would
+    UnloadBlockIndex();
+    delete pcoinsTip;
+    delete pcoinsdbview;
+    delete pblocktree;
+    delete zerocoinDB;
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+    pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+    zerocoinDB = new CZerocoinDB(0, true);
+    pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+
+    // Nothing is written from a file that does not have the expected hash
+    CSnapshotInfo infoLoaded;
+    BOOST_CHECK(!LoadChainstateSnapshot(path, uint256(1), infoLoaded, strError));
+    BOOST_CHECK(pcoinsdbview->GetBestBlock() == 0);
+    bool fLoading = false;
+    BOOST_CHECK(!pblocktree->ReadFlag("snapshotloading", fLoading));
+
+    BOOST_CHECK_MESSAGE(LoadChainstateSnapshot(path, info.hashSnapshot, infoLoaded, strError), strError);
+    BOOST_CHECK(infoLoaded.hashBlock == info.hashBlock);
+    BOOST_CHECK_EQUAL(infoLoaded.nZerocoinRecords, info.nZerocoinRecords);
+    BOOST_CHECK(pcoinsdbview->GetBestBlock() == info.hashBlock);
+
+    CCoinsStats statsLoaded;
+    BOOST_CHECK(pcoinsdbview->GetStats(statsLoaded));
+    BOOST_CHECK(statsLoaded.hashSerialized == stats.hashSerialized);
+    BOOST_CHECK_EQUAL(statsLoaded.nTotalAmount, 3 * COIN);
+    CBigNum bnValue;
+    BOOST_CHECK(zerocoinDB->ReadAccumulatorValue(42, bnValue) && bnValue == CBigNum(1234));
+
+    // The node starts at the snapshot block, without its data
+    std::string strLoadError;
+    BOOST_CHECK(LoadBlockIndex(strLoadError));
+    BOOST_CHECK(chainActive.Tip() && chainActive.Tip()->GetBlockHash() == info.hashBlock);
+    BOOST_CHECK(!(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA));
+    BOOST_CHECK(fHavePruned);
+    fHavePruned = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -51,6 +51,7 @@ TestingSetup::TestingSetup()
         mapArgs["-datadir"] = pathTemp.string();
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+        zerocoinDB = new CZerocoinDB(0, true);
         pcoinsTip = new CCoinsViewCache(pcoinsdbview);
         InitBlockIndex();
 #ifdef ENABLE_WALLET
@@ -79,6 +80,8 @@ TestingSetup::~TestingSetup()
         delete pcoinsTip;
         delete pcoinsdbview;
         delete pblocktree;
+        delete zerocoinDB;
+        zerocoinDB = NULL;
 #ifdef ENABLE_WALLET
         bitdb.Flush(true);
         bitdb.Reset();
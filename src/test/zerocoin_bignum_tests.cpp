@@ -10,6 +10,7 @@
 #include "libzerocoin/Denominations.h"
 #include "libzerocoin/CoinSpend.h"
 #include "libzerocoin/Accumulator.h"
+#include "libzerocoin/FixedBaseTable.h"
 #include "zsqr/zerocoin.h"
 
 
@@ -88,4 +89,78 @@ BOOST_AUTO_TEST_CASE(bignum_random_generation_tests)
     }
 }
 
+BOOST_AUTO_TEST_CASE(bignum_pow_mod_public_tests)
+{
+    CBigNum modulus;
+    modulus.SetHex(strHexModulus);
+    for (int i = 0; i < 50; i++) {
+        CBigNum base = CBigNum::randBignum(modulus);
+        CBigNum exponent = CBigNum::randKBitBignum(1 + i * 40);
+        BOOST_CHECK_MESSAGE(base.pow_mod_public(exponent, modulus) == base.pow_mod(exponent, modulus),
+                            strprintf("CBigNum::pow_mod_public() differs from pow_mod() for exponent %s", exponent.GetHex()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bignum_fixed_base_table_tests)
+{
+    CBigNum modulus;
+    modulus.SetDec(zerocoinModulus);
+    libzerocoin::ZerocoinParams params(modulus);
+    const libzerocoin::IntegerGroupParams& group = params.serialNumberSoKCommitmentGroup;
+
+    for (unsigned int nWindowBits = 1; nWindowBits <= 6; nWindowBits++) {
+        libzerocoin::FixedBaseTable table(group.g, group.modulus, group.groupOrder, nWindowBits);
+        for (int i = 0; i < 20; i++) {
+            // Cover negative exponents and exponents larger than the group order
+            CBigNum exponent = CBigNum::randKBitBignum(1 + i * 60);
+            if (i % 2)
+                exponent = -exponent;
+            BOOST_CHECK_MESSAGE(table.pow_mod(exponent) == group.g.pow_mod(exponent, group.modulus),
+                                strprintf("FixedBaseTable::pow_mod() differs from pow_mod() for window %u and exponent %s", nWindowBits, exponent.GetHex()));
+        }
+    }
+
+    // A base that is not of the given order must still give the right result
+    CBigNum base = group.g + 1;
+    libzerocoin::FixedBaseTable table(base, group.modulus, group.groupOrder, 4);
+    CBigNum exponent = group.groupOrder + 5;
+    BOOST_CHECK(table.pow_mod(exponent) == base.pow_mod(exponent, group.modulus));
+
+    BOOST_CHECK(params.GetSerialNumberSoKTables() != NULL);
+}
+
+BOOST_AUTO_TEST_CASE(bignum_multi_pow_mod_tests)
+{
+    CBigNum modulus;
+    modulus.SetDec(zerocoinModulus);
+    libzerocoin::ZerocoinParams params(modulus);
+    const CBigNum& p = params.serialNumberSoKCommitmentGroup.modulus;
+
+    for (size_t nBases = 0; nBases <= 4; nBases++) {
+        for (int i = 0; i < 10; i++) {
+            std::vector<CBigNum> bases, exponents;
+            CBigNum expected = 1;
+            for (size_t j = 0; j < nBases; j++) {
+                // Mix exponent sizes and signs; p is prime so every base is invertible
+                CBigNum base = CBigNum::randBignum(p - 1) + 1;
+                CBigNum exponent = CBigNum::randKBitBignum(1 + (i + j) * 100);
+                if ((i + j) % 3 == 1)
+                    exponent = -exponent;
+                bases.push_back(base);
+                exponents.push_back(exponent);
+                expected = expected.mul_mod(base.pow_mod_public(exponent, p), p);
+            }
+            BOOST_CHECK_MESSAGE(CBigNum::multi_pow_mod(bases, exponents, p) == expected,
+                                strprintf("CBigNum::multi_pow_mod() differs from pow_mod() for %u bases", nBases));
+        }
+    }
+
+    // A zero exponent and a zero base
+    BOOST_CHECK(CBigNum::multi_pow_mod({CBigNum(0), CBigNum(7)}, {CBigNum(0), CBigNum(2)}, p) == 49);
+
+    // Mismatched sizes and a negative power of a non invertible base are rejected
+    BOOST_CHECK_THROW(CBigNum::multi_pow_mod({CBigNum(2)}, {}, p), bignum_error);
+    BOOST_CHECK_THROW(CBigNum::multi_pow_mod({CBigNum(0)}, {CBigNum(-1)}, p), bignum_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
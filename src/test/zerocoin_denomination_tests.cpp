@@ -70,6 +70,43 @@ BOOST_AUTO_TEST_CASE(denomination_to_value_test)
     BOOST_CHECK_MESSAGE(libzerocoin::ZerocoinDenominationToAmount(denomination) == Value, "Wrong Value - should be 0");
 }
 
+BOOST_AUTO_TEST_CASE(denomination_to_index_test)
+{
+    for (unsigned int i = 0; i < libzerocoin::zerocoinDenomList.size(); i++)
+        BOOST_CHECK_EQUAL(libzerocoin::ZerocoinDenominationToIndex(libzerocoin::zerocoinDenomList[i]), (int)i);
+    BOOST_CHECK_EQUAL(libzerocoin::ZerocoinDenominationToIndex(libzerocoin::ZQ_ERROR), -1);
+    BOOST_CHECK_EQUAL((int)libzerocoin::zerocoinDenomList.size(), libzerocoin::zerocoinDenomCount);
+}
+
+BOOST_AUTO_TEST_CASE(block_index_zerocoin_supply_test)
+{
+    CBlockIndex index;
+    index.nVersion = 4;
+    index.SetZcMints(libzerocoin::ZQ_FIVE, 7);
+    index.AddZcMints(libzerocoin::ZQ_FIVE_THOUSAND, 3);
+    index.AddMintInBlock(libzerocoin::ZQ_TEN);
+    index.AddMintInBlock(libzerocoin::ZQ_TEN);
+    index.AddMintInBlock(libzerocoin::ZQ_ONE);
+
+    BOOST_CHECK_EQUAL(index.GetZcMints(libzerocoin::ZQ_FIVE), 7);
+    BOOST_CHECK_EQUAL(index.GetZerocoinSupply(), (7 * 5 + 3 * 5000) * COIN);
+    BOOST_CHECK_EQUAL(index.GetMintsInBlock(libzerocoin::ZQ_TEN), 2);
+    BOOST_CHECK(index.MintedDenomination(libzerocoin::ZQ_ONE));
+    BOOST_CHECK(!index.MintedDenomination(libzerocoin::ZQ_FIFTY));
+    BOOST_CHECK(!index.MintedDenomination(libzerocoin::ZQ_ERROR));
+    BOOST_CHECK_THROW(index.GetZcMints(libzerocoin::ZQ_ERROR), std::out_of_range);
+
+    // the index is stored as a supply map and a list of minted denominations
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CDiskBlockIndex(&index);
+    CDiskBlockIndex diskindex;
+    ss >> diskindex;
+    for (auto& denom : libzerocoin::zerocoinDenomList) {
+        BOOST_CHECK_EQUAL(diskindex.GetZcMints(denom), index.GetZcMints(denom));
+        BOOST_CHECK_EQUAL(diskindex.GetMintsInBlock(denom), index.GetMintsInBlock(denom));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(zerocoin_spend_test241)
 {
     const int nMaxNumberOfSpends = 4;
@@ -12,6 +12,7 @@
 #include "zsqr/deterministicmint.h"
 #include "key.h"
 #include "zsqr/accumulatorcheckpoints.h"
+#include "zsqr/spendcache.h"
 #include "libzerocoin/bignum.h"
 #include <boost/test/unit_test.hpp>
 #include <iostream>
@@ -297,6 +298,13 @@ BOOST_AUTO_TEST_CASE(checkzerocoinspend_test)
     libzerocoin::CoinSpend spend1(Params().Zerocoin_Params(true), Params().Zerocoin_Params(false), serializedCoinSpend);
     BOOST_CHECK_MESSAGE(spend1.Verify(accumulator), "Failed deserialized check of CoinSpend");
 
+    // The proof cache matches the same spend only under the same params version
+    BOOST_CHECK(!IsZerocoinSpendProofCached(spend1, false));
+    CacheZerocoinSpendProof(spend1, false);
+    BOOST_CHECK(IsZerocoinSpendProofCached(spend1, false));
+    BOOST_CHECK(IsZerocoinSpendProofCached(coinSpend, false));
+    BOOST_CHECK(!IsZerocoinSpendProofCached(spend1, true));
+
     CScript script;
     CTxOut txOut(1 * COIN, script);
 
@@ -367,6 +375,7 @@ BOOST_AUTO_TEST_CASE(checkzerocoinspend_test)
     BOOST_CHECK_MESSAGE(coinSpend_v2.HasValidSignature(), "coinspend_v2 does not have valid signature");
     BOOST_CHECK_MESSAGE(coinSpend_v2.getVersion() == 2, "coinspend_v2 version is wrong");
     BOOST_CHECK_MESSAGE(coinSpend_v2.getPubKey() == privateCoin_v2.getPubKey(), "pub keys do not match");
+    BOOST_CHECK(!IsZerocoinSpendProofCached(coinSpend_v2, false));
 }
 
 BOOST_AUTO_TEST_CASE(setup_exceptions_test)
@@ -466,6 +475,48 @@ BOOST_AUTO_TEST_CASE(test_checkpoints)
                                 .GetHex() == "fad7cf992b67792695619224fbbe311c6e60bf80d5bc1680fd9e32b5b3f00f373c9305c72c82bfaf1ce56adb617dc71bb8ddaf61326858ae4b01c3acf443bc7d22d4d2c77704b44fbe4f4fd260f13e0e12e82c531c390e72770e1d444e0877844d35a76c1e45072ddf02e101cf9c0a05a125f19ac5205ee1216732f4040cc3e8a68528685f2f39325efb2b7ba4d681fe13aaabb80ef07d8de8ef883a07e0a4f9771e8c370924fe4959de3c2a6e6e7ad74b12dd7e666765d7d660febe4d4cab3f49cb33cb51e44f756eef609184d8eeeb1c4dfe13b123251166c877d8e992f60cefd568644918c3617aec4d5564a9fe008540add903b9739973838d667721f8d", "does not match");
 }
 
+BOOST_AUTO_TEST_CASE(accumulator_state_test)
+{
+    CBlock block;
+    for (auto& raw : vecRawMints) {
+        CTransaction tx;
+        BOOST_CHECK(DecodeHexTx(tx, raw.first));
+        block.vtx.emplace_back(tx);
+    }
+
+    uint256 hashBlock = block.GetHash();
+    CBlockIndex index(block);
+    index.phashBlock = &hashBlock;
+    index.nHeight = Params().Zerocoin_StartHeight();
+
+    // mints of a connected block are served from memory
+    BOOST_CHECK(AddBlockToAccumulatorState(block, &index));
+    std::list<libzerocoin::PublicCoin> listPubcoins = GetPubcoinFromBlock(&index);
+    BOOST_CHECK_EQUAL(listPubcoins.size(), vecRawMints.size());
+    CBigNum bnPubcoin;
+    bnPubcoin.SetHex(rawTxpub1);
+    BOOST_CHECK(listPubcoins.front().getValue() == bnPubcoin);
+
+    // a different block at the same height is not
+    uint256 hashOther = 1;
+    CBlockIndex indexOther(block);
+    indexOther.phashBlock = &hashOther;
+    indexOther.nHeight = index.nHeight;
+    BOOST_CHECK_THROW(GetPubcoinFromBlock(&indexOther), GetPubcoinException);
+
+    // once out of memory, they are still read from the mint index
+    RemoveBlockFromAccumulatorState(&index);
+    listPubcoins = GetPubcoinFromBlock(&index);
+    BOOST_CHECK_EQUAL(listPubcoins.size(), vecRawMints.size());
+    BOOST_CHECK(listPubcoins.front().getValue() == bnPubcoin);
+    BOOST_CHECK(listPubcoins.front().getDenomination() == libzerocoin::CoinDenomination::ZQ_ONE);
+
+    uint256 hashIndexed;
+    BOOST_CHECK(zerocoinDB->ReadBlockMints(index.nHeight, hashIndexed, listPubcoins));
+    BOOST_CHECK(hashIndexed == hashBlock);
+    BOOST_CHECK_EQUAL(listPubcoins.size(), vecRawMints.size());
+}
+
 BOOST_AUTO_TEST_CASE(deterministic_tests)
 {
     SelectParams(CBaseChainParams::UNITTEST);
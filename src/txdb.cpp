@@ -8,11 +8,15 @@
 
 #include "txdb.h"
 
+#include "crypto/common.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
 #include "uint256.h"
 #include "zsqr/accumulators.h"
 
+#include <functional>
+#include <set>
 #include <stdint.h>
 
 #include <boost/thread.hpp>
@@ -31,20 +35,243 @@ void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
     batch.Write('B', hash);
 }
 
+namespace {
+
+//! Value of the 'L' key once the coin database holds per-output records
+const int COINS_LAYOUT_OUTPOINTS = 1;
+
+//! Number of transactions converted per batch by UpgradeToOutpoints()
+const unsigned int COINS_UPGRADE_BATCH_SIZE = 10000;
+
+/** One unspent output in the per-output layout, with the fields of its transaction */
+class CCoinOutputRecord
+{
+public:
+    CTxOut txout;
+    int nVersion;
+    int nHeight;
+    bool fCoinBase;
+    bool fCoinStake;
+
+    CCoinOutputRecord() : nVersion(0), nHeight(0), fCoinBase(false), fCoinStake(false) {}
+    CCoinOutputRecord(const CCoins& coins, uint32_t n) : txout(coins.vout[n]), nVersion(coins.nVersion), nHeight(coins.nHeight),
+                                                         fCoinBase(coins.fCoinBase), fCoinStake(coins.fCoinStake) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(VARINT(this->nVersion));
+        uint64_t nCode = (uint64_t)nHeight * 4 + (fCoinBase ? 1 : 0) + (fCoinStake ? 2 : 0);
+        READWRITE(VARINT(nCode));
+        if (ser_action.ForRead()) {
+            nHeight = nCode / 4;
+            fCoinBase = nCode & 1;
+            fCoinStake = (nCode & 2) != 0;
+        }
+        CTxOutCompressor compressor(txout);
+        READWRITE(compressor);
+    }
+};
+
+//! Keys of the per-output records of txid all start with these 33 bytes
+std::string CoinOutputsPrefix(const uint256& txid)
+{
+    std::string strPrefix(1, 'C');
+    strPrefix.append(reinterpret_cast<const char*>(txid.begin()), txid.size());
+    return strPrefix;
+}
+
+void BatchWriteCoinOutput(CLevelDBBatch& batch, const uint256& txid, const CCoins& coins, uint32_t n)
+{
+    batch.Write(std::make_pair('C', COutPoint(txid, n)), CCoinOutputRecord(coins, n));
+}
+
+//! Orders txids like the keys of their records
+bool TxidKeyLess(const uint256& a, const uint256& b)
+{
+    return memcmp(a.begin(), b.begin(), a.size()) < 0;
+}
+
+}
+
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
 {
+    int nLayout = 0;
+    fOutpoints = db.Read('L', nLayout) && nLayout == COINS_LAYOUT_OUTPOINTS;
+    fLegacyCoins = true;
+    if (fOutpoints) {
+        // The 'c' records come last, so an upgrade left some if anything is found from there
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+        pcursor->Seek(std::string(1, 'c'));
+        fLegacyCoins = pcursor->Valid() && pcursor->key().size() == 33 && pcursor->key()[0] == 'c';
+    }
+}
+
+bool CCoinsViewDB::ReadCoinOutputs(leveldb::Iterator* pcursor, const uint256& txid, CCoins* pcoins, std::set<uint32_t>* psetOutputs) const
+{
+    const std::string strPrefix = CoinOutputsPrefix(txid);
+    bool fFound = false;
+    if (pcoins)
+        pcoins->Clear();
+    for (pcursor->Seek(strPrefix); pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() != strPrefix.size() + 4 || !slKey.starts_with(strPrefix))
+            break;
+        uint32_t n = ReadLE32(reinterpret_cast<const unsigned char*>(slKey.data()) + strPrefix.size());
+        fFound = true;
+        if (psetOutputs)
+            psetOutputs->insert(n);
+        if (!pcoins)
+            continue;
+
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        CCoinOutputRecord record;
+        ssValue >> record;
+        if (pcoins->vout.size() <= n)
+            pcoins->vout.resize(n + 1);
+        pcoins->vout[n] = record.txout;
+        pcoins->nVersion = record.nVersion;
+        pcoins->nHeight = record.nHeight;
+        pcoins->fCoinBase = record.fCoinBase;
+        pcoins->fCoinStake = record.fCoinStake;
+    }
+    return fFound;
 }
 
 bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
 {
+    if (fOutpoints) {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+        if (ReadCoinOutputs(pcursor.get(), txid, &coins, NULL))
+            return true;
+        // Not converted yet, if at all
+        if (!fLegacyCoins)
+            return false;
+    }
     return db.Read(std::make_pair('c', txid), coins);
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256& txid) const
 {
+    if (fOutpoints) {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+        if (ReadCoinOutputs(pcursor.get(), txid, NULL, NULL))
+            return true;
+        if (!fLegacyCoins)
+            return false;
+    }
     return db.Exists(std::make_pair('c', txid));
 }
 
+void CCoinsViewDB::GetCoinsBatch(const std::vector<uint256>& vTxids, std::vector<CCoins>& vCoins, std::vector<char>& vFound) const
+{
+    if (!fOutpoints) {
+        CCoinsView::GetCoinsBatch(vTxids, vCoins, vFound);
+        return;
+    }
+
+    vCoins.assign(vTxids.size(), CCoins());
+    vFound.assign(vTxids.size(), false);
+    std::vector<size_t> vOrder(vTxids.size());
+    for (size_t i = 0; i < vOrder.size(); i++)
+        vOrder[i] = i;
+    std::sort(vOrder.begin(), vOrder.end(), [&vTxids](size_t a, size_t b) { return TxidKeyLess(vTxids[a], vTxids[b]); });
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+    for (size_t i : vOrder) {
+        vFound[i] = ReadCoinOutputs(pcursor.get(), vTxids[i], &vCoins[i], NULL) ||
+                    (fLegacyCoins && db.Read(std::make_pair('c', vTxids[i]), vCoins[i]));
+    }
+}
+
+void CCoinsViewDB::BatchWriteCoinOutputs(CLevelDBBatch& batch, leveldb::Iterator* pcursor, const uint256& txid, const CCoinsCacheEntry& entry)
+{
+    const CCoins& coins = entry.coins;
+
+    // Outputs never change once created, so only the outputs spent or
+    // restored since the last write need a record written or erased. A
+    // FRESH entry has nothing on disk.
+    std::set<uint32_t> setOnDisk;
+    if (!(entry.flags & CCoinsCacheEntry::FRESH)) {
+        if (fLegacyCoins && db.Exists(std::make_pair('c', txid)))
+            batch.Erase(std::make_pair('c', txid)); // convert it, writing every output below
+        else
+            ReadCoinOutputs(pcursor, txid, NULL, &setOnDisk);
+    }
+
+    for (uint32_t n : setOnDisk) {
+        if (n >= coins.vout.size() || coins.vout[n].IsNull())
+            batch.Erase(std::make_pair('C', COutPoint(txid, n)));
+    }
+    for (uint32_t n = 0; n < coins.vout.size(); n++) {
+        if (!coins.vout[n].IsNull() && !setOnDisk.count(n))
+            BatchWriteCoinOutput(batch, txid, coins, n);
+    }
+}
+
+bool CCoinsViewDB::UpgradeToOutpoints()
+{
+    // Record the switch first: from then on the 'c' records left are read as well
+    if (!fOutpoints) {
+        if (!db.Write('L', COINS_LAYOUT_OUTPOINTS, true))
+            return error("%s : failed to write the coin database layout", __func__);
+        fOutpoints = true;
+    }
+
+    int64_t nTimeStart = GetTimeMillis();
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::string(1, 'c'));
+
+    size_t nConverted = 0;
+    size_t nOutputs = 0;
+    while (pcursor->Valid()) {
+        if (ShutdownRequested()) {
+            LogPrintf("%s: interrupted after %u transactions, resuming at the next start\n", __func__, nConverted);
+            return true;
+        }
+
+        CLevelDBBatch batch;
+        for (unsigned int i = 0; i < COINS_UPGRADE_BATCH_SIZE && pcursor->Valid(); i++, pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() != 33 || slKey[0] != 'c')
+                break;
+            uint256 txid;
+            memcpy(txid.begin(), slKey.data() + 1, txid.size());
+
+            try {
+                leveldb::Slice slValue = pcursor->value();
+                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+                CCoins coins;
+                ssValue >> coins;
+                for (uint32_t n = 0; n < coins.vout.size(); n++) {
+                    if (!coins.vout[n].IsNull()) {
+                        BatchWriteCoinOutput(batch, txid, coins, n);
+                        nOutputs++;
+                    }
+                }
+            } catch (const std::exception& e) {
+                return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            }
+            batch.Erase(std::make_pair('c', txid));
+            nConverted++;
+        }
+        if (!db.WriteBatch(batch))
+            return error("%s : failed to write to coin database", __func__);
+        if (pcursor->Valid() && (pcursor->key().size() != 33 || pcursor->key()[0] != 'c'))
+            break;
+        if (nConverted % (10 * COINS_UPGRADE_BATCH_SIZE) == 0)
+            LogPrintf("%s: converted %u transactions\n", __func__, nConverted);
+    }
+
+    fLegacyCoins = false;
+    if (nConverted)
+        LogPrintf("%s: converted %u transactions into %u output records in %dms\n", __func__, nConverted, nOutputs, GetTimeMillis() - nTimeStart);
+    return true;
+}
+
 uint256 CCoinsViewDB::GetBestBlock() const
 {
     uint256 hashBestChain;
@@ -54,24 +281,192 @@ uint256 CCoinsViewDB::GetBestBlock() const
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    bool fOk = WriteCoins(mapCoins, hashBlock, false);
+    mapCoins.clear();
+    return fOk;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock, bool fSync)
 {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
-        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
-            changed++;
-        }
+    std::vector<CCoinsMap::const_iterator> vDirty;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            vDirty.push_back(it);
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+    }
+    changed = vDirty.size();
+    if (fOutpoints) {
+        // The records of the entries not FRESH are looked up with a single cursor, moving forward through the keys
+        std::sort(vDirty.begin(), vDirty.end(), [](const CCoinsMap::const_iterator& a, const CCoinsMap::const_iterator& b) {
+            return TxidKeyLess(a->first, b->first);
+        });
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+        for (const CCoinsMap::const_iterator& it : vDirty)
+            BatchWriteCoinOutputs(batch, pcursor.get(), it->first, it->second);
+    } else {
+        for (const CCoinsMap::const_iterator& it : vDirty)
+            BatchWriteCoins(batch, it->first, it->second.coins);
     }
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
 
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    return db.WriteBatch(batch, fSync);
+}
+
+CCoinsViewFlusher::CCoinsViewFlusher(CCoinsViewDB* dbIn) : db(dbIn), fPending(false), fFailed(false), fStop(false)
+{
+    threadFlush = std::thread(&CCoinsViewFlusher::ThreadFlush, this);
+}
+
+CCoinsViewFlusher::~CCoinsViewFlusher()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs_flush);
+        fStop = true;
+    }
+    condFlush.notify_all();
+    threadFlush.join();
+}
+
+void CCoinsViewFlusher::ThreadFlush()
+{
+    RenameThread("squorum-coinsflush");
+
+    std::unique_lock<std::mutex> lock(cs_flush);
+    while (true) {
+        condFlush.wait(lock, [this] { return fPending || fStop; });
+        if (!fPending)
+            return;
+        uint256 hashBlock = hashFlushing;
+        lock.unlock();
+
+        int64_t nTimeStart = GetTimeMicros();
+        bool fOk = false;
+        try {
+            fOk = db->WriteCoins(mapFlushing, hashBlock, true);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+        LogPrint("coindb", "%s: wrote %u transactions in %.2fms\n", __func__, (unsigned int)mapFlushing.size(), 0.001 * (GetTimeMicros() - nTimeStart));
+
+        // Free the written coins outside of the lock. After a failure they stay
+        // visible, as the database no longer matches them.
+        CCoinsMap mapDone;
+        lock.lock();
+        if (fOk)
+            mapDone.swap(mapFlushing);
+        else
+            fFailed = true;
+        fPending = false;
+        condFlush.notify_all();
+        lock.unlock();
+        mapDone.clear();
+        lock.lock();
+    }
+}
+
+bool CCoinsViewFlusher::GetCoins(const uint256& txid, CCoins& coins) const
+{
+    {
+        std::lock_guard<std::mutex> lock(cs_flush);
+        CCoinsMap::const_iterator it = mapFlushing.find(txid);
+        if (it != mapFlushing.end()) {
+            if (it->second.coins.IsPruned())
+                return false;
+            coins = it->second.coins;
+            return true;
+        }
+    }
+    return db->GetCoins(txid, coins);
+}
+
+bool CCoinsViewFlusher::HaveCoins(const uint256& txid) const
+{
+    {
+        std::lock_guard<std::mutex> lock(cs_flush);
+        CCoinsMap::const_iterator it = mapFlushing.find(txid);
+        if (it != mapFlushing.end())
+            return !it->second.coins.IsPruned();
+    }
+    return db->HaveCoins(txid);
+}
+
+void CCoinsViewFlusher::GetCoinsBatch(const std::vector<uint256>& vTxids, std::vector<CCoins>& vCoins, std::vector<char>& vFound) const
+{
+    vCoins.assign(vTxids.size(), CCoins());
+    vFound.assign(vTxids.size(), false);
+    std::vector<uint256> vRead;
+    std::vector<size_t> vReadIndex;
+    {
+        std::lock_guard<std::mutex> lock(cs_flush);
+        for (size_t i = 0; i < vTxids.size(); i++) {
+            CCoinsMap::const_iterator it = mapFlushing.find(vTxids[i]);
+            if (it == mapFlushing.end()) {
+                vRead.push_back(vTxids[i]);
+                vReadIndex.push_back(i);
+            } else if (!it->second.coins.IsPruned()) {
+                vCoins[i] = it->second.coins;
+                vFound[i] = true;
+            }
+        }
+    }
+    std::vector<CCoins> vReadCoins;
+    std::vector<char> vReadFound;
+    db->GetCoinsBatch(vRead, vReadCoins, vReadFound);
+    for (size_t j = 0; j < vRead.size(); j++) {
+        vFound[vReadIndex[j]] = vReadFound[j];
+        vCoins[vReadIndex[j]].swap(vReadCoins[j]);
+    }
+}
+
+uint256 CCoinsViewFlusher::GetBestBlock() const
+{
+    {
+        std::lock_guard<std::mutex> lock(cs_flush);
+        if ((fPending || fFailed) && hashFlushing != uint256(0))
+            return hashFlushing;
+    }
+    return db->GetBestBlock();
+}
+
+bool CCoinsViewFlusher::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    std::unique_lock<std::mutex> lock(cs_flush);
+    condFlush.wait(lock, [this] { return !fPending; });
+    if (fFailed)
+        return false;
+
+    // mapFlushing is empty here, and the caller clears what it gets back
+    mapFlushing.swap(mapCoins);
+    hashFlushing = hashBlock;
+    fPending = true;
+    condFlush.notify_all();
+    return true;
+}
+
+bool CCoinsViewFlusher::GetStats(CCoinsStats& stats) const
+{
+    if (!Wait())
+        return false;
+    return db->GetStats(stats);
+}
+
+bool CCoinsViewFlusher::Wait() const
+{
+    std::unique_lock<std::mutex> lock(cs_flush);
+    condFlush.wait(lock, [this] { return !fPending; });
+    return !fFailed;
+}
+
+bool CCoinsViewFlusher::Failed() const
+{
+    std::lock_guard<std::mutex> lock(cs_flush);
+    return fFailed;
 }
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
@@ -107,57 +502,111 @@ bool CBlockTreeDB::ReadLastBlockFile(int& nFile)
     return Read('l', nFile);
 }
 
-bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
+void ApplyCoinsStats(CCoinsStats& stats, CHashWriter& ss, const uint256& txhash, const CCoins& coins)
+{
+    ss << txhash;
+    ss << VARINT(coins.nVersion);
+    ss << (coins.fCoinBase ? 'c' : 'n');
+    ss << VARINT(coins.nHeight);
+    stats.nTransactions++;
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        const CTxOut& out = coins.vout[i];
+        if (!out.IsNull()) {
+            stats.nTransactionOutputs++;
+            ss << VARINT(i + 1);
+            ss << out;
+            stats.nTotalAmount += out.nValue;
+        }
+    }
+    ss << VARINT(0);
+}
+
+CCoinsViewDBCursor::CCoinsViewDBCursor(leveldb::Iterator* pcursorIn) : pcursor(pcursorIn), hashBlock(0), nSerializedSize(0), fValid(false)
+{
+    // The iterator sees the database as it was when it was created: read the
+    // best block through it as well
+    pcursor->Seek(std::string(1, 'B'));
+    if (pcursor->Valid() && pcursor->key() == leveldb::Slice("B", 1)) {
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> hashBlock;
+    }
+    pcursor->SeekToFirst();
+    Next();
+}
+
+void CCoinsViewDBCursor::Next()
+{
+    fValid = false;
+    coins.Clear();
+    nSerializedSize = 0;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+        char chType;
+        ssKey >> chType;
+        if (chType == 'C') {
+            COutPoint outpoint;
+            ssKey >> outpoint;
+            if (fValid && outpoint.hash != txid)
+                return; // the records of the next transaction start here
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoinOutputRecord record;
+            ssValue >> record;
+            txid = outpoint.hash;
+            if (coins.vout.size() <= outpoint.n)
+                coins.vout.resize(outpoint.n + 1);
+            coins.vout[outpoint.n] = record.txout;
+            coins.nVersion = record.nVersion;
+            coins.nHeight = record.nHeight;
+            coins.fCoinBase = record.fCoinBase;
+            coins.fCoinStake = record.fCoinStake;
+            nSerializedSize += 36 + slValue.size();
+            fValid = true;
+        } else if (chType == 'c') {
+            if (fValid)
+                return;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> coins;
+            ssKey >> txid;
+            nSerializedSize = 32 + slValue.size();
+            fValid = true;
+            pcursor->Next();
+            return;
+        } else if (fValid) {
+            return;
+        }
+    }
+}
+
+CCoinsViewDBCursor* CCoinsViewDB::Cursor() const
 {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    return new CCoinsViewDBCursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+}
 
+bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
+{
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i = 0; i < coins.vout.size(); i++) {
-                    const CTxOut& out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i + 1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
-            }
-            pcursor->Next();
-        } catch (std::exception& e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    try {
+        std::unique_ptr<CCoinsViewDBCursor> pcursor(Cursor());
+        stats.hashBlock = pcursor->GetBestBlock();
+        ss << stats.hashBlock;
+        stats.nTotalAmount = 0;
+        for (; pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            ApplyCoinsStats(stats, ss, pcursor->GetTxid(), pcursor->GetCoins());
+            stats.nSerializedSize += pcursor->GetSerializedSize();
         }
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
+    stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
@@ -210,85 +659,190 @@ bool CBlockTreeDB::ReadInt(const std::string& name, int& nValue)
     return Read(std::make_pair('I', name), nValue);
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
+namespace {
+
+//! Upper bound on the threads used to load the block index
+const int MAX_BLOCK_INDEX_LOAD_THREADS = 8;
+
+//! A block index entry read from disk, waiting for its pprev and pnext to be linked
+struct CBlockIndexLoadEntry {
+    CBlockIndex* pindex;
+    uint256 hash;
+    uint256 hashPrev;
+    uint256 hashNext;
+};
+
+/** Runs fn(i) for i in [0, nThreads) on nThreads threads, and returns the first error any of them reported */
+std::string RunPartitioned(int nThreads, const std::function<std::string(int)>& fn)
 {
-    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    std::vector<std::string> vErrors(nThreads);
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads; i++) {
+        threads.create_thread([&fn, &vErrors, i]() {
+            try {
+                vErrors[i] = fn(i);
+            } catch (const std::exception& e) {
+                vErrors[i] = strprintf("Deserialize or I/O error - %s", e.what());
+            }
+        });
+    }
+    threads.join_all();
 
-    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
-    ssKeySet << std::make_pair('b', uint256(0));
-    pcursor->Seek(ssKeySet.str());
+    for (const std::string& strError : vErrors) {
+        if (!strError.empty())
+            return strError;
+    }
+    return "";
+}
+
+/**
+ * Reads the 'b' entries whose hash starts with a byte in [nBegin, nEnd).
+ * Keys are ('b', hash) and the hash serializes least significant byte first,
+ * so the ranges split the keyspace evenly.
+ */
+std::string ReadBlockIndexRange(CBlockTreeDB& db, unsigned int nBegin, unsigned int nEnd, std::vector<CBlockIndexLoadEntry>& vEntries)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+
+    const char chKeyBegin[2] = {'b', static_cast<char>(nBegin)};
+    pcursor->Seek(leveldb::Slice(chKeyBegin, sizeof(chKeyBegin)));
+
+    // One stream for the whole range: clear() keeps its buffer
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    for (; pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() < 2 || slKey[0] != 'b' || static_cast<unsigned char>(slKey[1]) >= nEnd)
+            break;
+
+        leveldb::Slice slValue = pcursor->value();
+        ssValue.clear();
+        ssValue.write(slValue.data(), slValue.size());
+        CDiskBlockIndex diskindex;
+        ssValue >> diskindex;
+
+        // Construct block index object
+        CBlockIndexLoadEntry entry;
+        entry.pindex = arenaBlockIndex.New();
+        entry.hash = diskindex.GetBlockHash();
+        entry.hashPrev = diskindex.hashPrev;
+        entry.hashNext = diskindex.hashNext;
+
+        CBlockIndex* pindexNew = entry.pindex;
+        pindexNew->nHeight = diskindex.nHeight;
+        pindexNew->nFile = diskindex.nFile;
+        pindexNew->nDataPos = diskindex.nDataPos;
+        pindexNew->nUndoPos = diskindex.nUndoPos;
+        pindexNew->nVersion = diskindex.nVersion;
+        pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+        pindexNew->nTime = diskindex.nTime;
+        pindexNew->nBits = diskindex.nBits;
+        pindexNew->nNonce = diskindex.nNonce;
+        pindexNew->nStatus = diskindex.nStatus;
+        pindexNew->nTx = diskindex.nTx;
+
+        //zerocoin
+        pindexNew->nAccumulatorCheckpoint = diskindex.nAccumulatorCheckpoint;
+        std::copy(std::begin(diskindex.nZerocoinSupply), std::end(diskindex.nZerocoinSupply), pindexNew->nZerocoinSupply);
+        std::copy(std::begin(diskindex.nMintsInBlock), std::end(diskindex.nMintsInBlock), pindexNew->nMintsInBlock);
+
+        //Proof Of Stake
+        pindexNew->nMint = diskindex.nMint;
+        pindexNew->nMoneySupply = diskindex.nMoneySupply;
+        pindexNew->nFlags = diskindex.nFlags;
+        if (!Params().IsStakeModifierV2(pindexNew->nHeight)) {
+            pindexNew->nStakeModifier = diskindex.nStakeModifier;
+        } else {
+            pindexNew->nStakeModifierV2 = diskindex.nStakeModifierV2;
+        }
+        pindexNew->prevoutStake = diskindex.prevoutStake;
+        pindexNew->nStakeTime = diskindex.nStakeTime;
+        pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
 
-    // Load mapBlockIndex
-    uint256 nPreviousCheckpoint;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'b') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
-
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
-                pindexNew->nHeight = diskindex.nHeight;
-                pindexNew->nFile = diskindex.nFile;
-                pindexNew->nDataPos = diskindex.nDataPos;
-                pindexNew->nUndoPos = diskindex.nUndoPos;
-                pindexNew->nVersion = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime = diskindex.nTime;
-                pindexNew->nBits = diskindex.nBits;
-                pindexNew->nNonce = diskindex.nNonce;
-                pindexNew->nStatus = diskindex.nStatus;
-                pindexNew->nTx = diskindex.nTx;
-
-                //zerocoin
-                pindexNew->nAccumulatorCheckpoint = diskindex.nAccumulatorCheckpoint;
-                pindexNew->mapZerocoinSupply = diskindex.mapZerocoinSupply;
-                pindexNew->vMintDenominationsInBlock = diskindex.vMintDenominationsInBlock;
-
-                //Proof Of Stake
-                pindexNew->nMint = diskindex.nMint;
-                pindexNew->nMoneySupply = diskindex.nMoneySupply;
-                pindexNew->nFlags = diskindex.nFlags;
-                if (!Params().IsStakeModifierV2(pindexNew->nHeight)) {
-                    pindexNew->nStakeModifier = diskindex.nStakeModifier;
-                } else {
-                    pindexNew->nStakeModifierV2 = diskindex.nStakeModifierV2;
-                }
-                pindexNew->prevoutStake = diskindex.prevoutStake;
-                pindexNew->nStakeTime = diskindex.nStakeTime;
-                pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
+        if (pindexNew->nHeight <= Params().LAST_POW_BLOCK()) {
+            if (!CheckProofOfWork(entry.hash, pindexNew->nBits))
+                return strprintf("CheckProofOfWork failed: %s", entry.hash.GetHex());
+        }
 
-                if (pindexNew->nHeight <= Params().LAST_POW_BLOCK()) {
-                    if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
-                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
-                }
+        vEntries.push_back(entry);
+    }
 
-                //populate accumulator checksum map in memory
-                if(pindexNew->nAccumulatorCheckpoint != 0 && pindexNew->nAccumulatorCheckpoint != nPreviousCheckpoint) {
-                    //Don't load any checkpoints that exist before v2 zsqr. The accumulator is invalid for v1 and not used.
-                    if (pindexNew->nHeight >= Params().Zerocoin_Block_V2_Start())
-                        LoadAccumulatorValuesFromDB(pindexNew->nAccumulatorCheckpoint);
+    return "";
+}
 
-                    nPreviousCheckpoint = pindexNew->nAccumulatorCheckpoint;
-                }
+}
 
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
+bool CBlockTreeDB::LoadBlockIndexGuts()
+{
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_BLOCK_INDEX_LOAD_THREADS));
+    int64_t nTimeStart = GetTimeMillis();
+
+    // Read and deserialize the entries, each thread taking a range of the keyspace
+    std::vector<std::vector<CBlockIndexLoadEntry> > vRanges(nThreads);
+    std::string strError = RunPartitioned(nThreads, [&](int i) {
+        return ReadBlockIndexRange(*this, 256 * i / nThreads, 256 * (i + 1) / nThreads, vRanges[i]);
+    });
+    if (!strError.empty())
+        return error("%s : %s", __func__, strError);
+    boost::this_thread::interruption_point();
+
+    size_t nEntries = 0;
+    for (const std::vector<CBlockIndexLoadEntry>& vEntries : vRanges)
+        nEntries += vEntries.size();
+    int64_t nTimeRead = GetTimeMillis();
+    LogPrintf("%s: read %u block index entries in %dms (%d threads)\n", __func__, nEntries, nTimeRead - nTimeStart, nThreads);
+
+    // Load mapBlockIndex
+    mapBlockIndex.reserve(mapBlockIndex.size() + nEntries);
+    std::set<uint256> setCheckpointsSeen;
+    for (const std::vector<CBlockIndexLoadEntry>& vEntries : vRanges) {
+        for (const CBlockIndexLoadEntry& entry : vEntries) {
+            std::pair<BlockMap::iterator, bool> ret = mapBlockIndex.insert(std::make_pair(entry.hash, entry.pindex));
+            if (!ret.second)
+                return error("%s : duplicate block index entry %s", __func__, entry.hash.GetHex());
+            entry.pindex->phashBlock = &ret.first->first;
+
+            //populate accumulator checksum map in memory
+            const uint256& nCheckpoint = entry.pindex->nAccumulatorCheckpoint;
+            //Don't load any checkpoints that exist before v2 zsqr. The accumulator is invalid for v1 and not used.
+            if (nCheckpoint != 0 && entry.pindex->nHeight >= Params().Zerocoin_Block_V2_Start() && setCheckpointsSeen.insert(nCheckpoint).second)
+                LoadAccumulatorValuesFromDB(nCheckpoint);
+        }
+    }
+    int64_t nTimeInsert = GetTimeMillis();
+    LogPrintf("%s: indexed block hashes in %dms\n", __func__, nTimeInsert - nTimeRead);
+
+    // Link pprev and pnext, the map being only read by the threads. Pointers
+    // to blocks missing from the index are left for a serial pass to create.
+    std::vector<std::vector<const CBlockIndexLoadEntry*> > vMissing(nThreads);
+    RunPartitioned(nThreads, [&](int i) {
+        for (const CBlockIndexLoadEntry& entry : vRanges[i]) {
+            BlockMap::const_iterator mi;
+            if (entry.hashPrev != 0) {
+                mi = mapBlockIndex.find(entry.hashPrev);
+                if (mi != mapBlockIndex.end())
+                    entry.pindex->pprev = mi->second;
+                else
+                    vMissing[i].push_back(&entry);
+            }
+            if (entry.hashNext != 0) {
+                mi = mapBlockIndex.find(entry.hashNext);
+                if (mi != mapBlockIndex.end())
+                    entry.pindex->pnext = mi->second;
+                else
+                    vMissing[i].push_back(&entry);
             }
-        } catch (std::exception& e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+        return std::string();
+    });
+    for (const std::vector<const CBlockIndexLoadEntry*>& vEntries : vMissing) {
+        for (const CBlockIndexLoadEntry* pentry : vEntries) {
+            if (pentry->hashPrev != 0 && !pentry->pindex->pprev)
+                pentry->pindex->pprev = InsertBlockIndex(pentry->hashPrev);
+            if (pentry->hashNext != 0 && !pentry->pindex->pnext)
+                pentry->pindex->pnext = InsertBlockIndex(pentry->hashNext);
         }
     }
+    LogPrintf("%s: linked block index entries in %dms\n", __func__, GetTimeMillis() - nTimeInsert);
 
     return true;
 }
@@ -429,3 +983,25 @@ bool CZerocoinDB::EraseAccumulatorValue(const uint32_t& nChecksum)
     LogPrint("zero", "%s : checksum:%d\n", __func__, nChecksum);
     return Erase(std::make_pair('2', nChecksum));
 }
+
+bool CZerocoinDB::WriteBlockMints(const int nHeight, const uint256& hashBlock, const std::list<libzerocoin::PublicCoin>& listPubcoins)
+{
+    std::vector<std::pair<libzerocoin::CoinDenomination, CBigNum> > vMints;
+    for (const libzerocoin::PublicCoin& pubcoin : listPubcoins)
+        vMints.emplace_back(std::make_pair(pubcoin.getDenomination(), pubcoin.getValue()));
+
+    return Write(std::make_pair('b', nHeight), std::make_pair(hashBlock, vMints));
+}
+
+bool CZerocoinDB::ReadBlockMints(const int nHeight, uint256& hashBlock, std::list<libzerocoin::PublicCoin>& listPubcoins)
+{
+    std::pair<uint256, std::vector<std::pair<libzerocoin::CoinDenomination, CBigNum> > > blockMints;
+    if (!Read(std::make_pair('b', nHeight), blockMints))
+        return false;
+
+    hashBlock = blockMints.first;
+    listPubcoins.clear();
+    for (auto& mint : blockMints.second)
+        listPubcoins.emplace_back(libzerocoin::PublicCoin(Params().Zerocoin_Params(false), mint.second, mint.first));
+    return true;
+}
@@ -13,12 +13,19 @@
 #include "main.h"
 #include "zsqr/zerocoin.h"
 
+#include <condition_variable>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 class CCoins;
+class CCoinsViewDBCursor;
+class CHashWriter;
 class uint256;
 
 //! -dbcache default (MiB)
@@ -27,21 +34,140 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -asyncflush default
+static const bool DEFAULT_ASYNC_FLUSH = false;
+//! -coinsbyoutpoint default
+static const bool DEFAULT_COINS_BY_OUTPOINT = false;
 
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+/**
+ * CCoinsView backed by the LevelDB coin database (chainstate/)
+ *
+ * Coins are stored either as one 'c' record per transaction, or, once the
+ * database was upgraded (-coinsbyoutpoint), as one 'C' record per unspent
+ * output. Spending an output then erases its record instead of rewriting the
+ * record of the whole transaction. The 'c' records not converted yet stay
+ * readable, so an interrupted upgrade resumes at the next start.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
+    //! whether coins are written as per-output records
+    bool fOutpoints;
+    //! whether per-transaction records may be left, which lookups then fall back to
+    bool fLegacyCoins;
+
+    bool ReadCoinOutputs(leveldb::Iterator* pcursor, const uint256& txid, CCoins* pcoins, std::set<uint32_t>* psetOutputs) const;
+    void BatchWriteCoinOutputs(CLevelDBBatch& batch, leveldb::Iterator* pcursor, const uint256& txid, const CCoinsCacheEntry& entry);
 
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
     bool GetCoins(const uint256& txid, CCoins& coins) const;
     bool HaveCoins(const uint256& txid) const;
+    //! Reads the coins with a single cursor, moving forward through the keys
+    void GetCoinsBatch(const std::vector<uint256>& vTxids, std::vector<CCoins>& vCoins, std::vector<char>& vFound) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    bool GetStats(CCoinsStats& stats) const;
+
+    //! Write the dirty entries of mapCoins and the best block in one batch, leaving mapCoins untouched
+    bool WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock, bool fSync);
+
+    bool IsOutpointLayout() const { return fOutpoints; }
+
+    //! Walk the coins as they are now, whatever is written meanwhile. The caller owns the cursor.
+    CCoinsViewDBCursor* Cursor() const;
+
+    /**
+     * Switch to per-output records and convert the per-transaction records
+     * left. Stops early, with the database consistent, if shutdown is requested.
+     * The switch cannot be undone without rebuilding the chainstate.
+     */
+    bool UpgradeToOutpoints();
+};
+
+/**
+ * Walks the coin database as it was when the cursor was created, one
+ * transaction at a time: per-output records are grouped back into the coins
+ * of their transaction. Transactions in both layouts, during an upgrade, come
+ * in a different order than after.
+ */
+class CCoinsViewDBCursor
+{
+private:
+    std::unique_ptr<leveldb::Iterator> pcursor;
+    uint256 hashBlock;
+    uint256 txid;
+    CCoins coins;
+    size_t nSerializedSize;
+    bool fValid;
+
+public:
+    //! Takes ownership of the iterator. Throws if the database cannot be read.
+    explicit CCoinsViewDBCursor(leveldb::Iterator* pcursorIn);
+
+    //! The best block of the database when the cursor was created
+    const uint256& GetBestBlock() const { return hashBlock; }
+    bool Valid() const { return fValid; }
+    const uint256& GetTxid() const { return txid; }
+    const CCoins& GetCoins() const { return coins; }
+    //! Size of the records of the current transaction in the database
+    size_t GetSerializedSize() const { return nSerializedSize; }
+    //! Moves to the next transaction. Throws if the database cannot be read.
+    void Next();
+};
+
+/** Adds the coins of a transaction to the statistics and the serialized hash reported by gettxoutsetinfo */
+void ApplyCoinsStats(CCoinsStats& stats, CHashWriter& ss, const uint256& txhash, const CCoins& coins);
+
+/**
+ * CCoinsView that writes the coins flushed into it to the coin database on a
+ * background thread (-asyncflush).
+ *
+ * BatchWrite() takes the flushed coins by swapping maps and returns at once,
+ * so the cache above it starts over empty while the coins are written. Lookups
+ * see the coins being written until they are in the database. The coins and
+ * the best block go to the database in one synced batch, so the best block on
+ * disk only moves once the coins it refers to are durable.
+ *
+ * A single flush is in progress at a time: BatchWrite() waits for the previous
+ * one to finish.
+ */
+class CCoinsViewFlusher : public CCoinsView
+{
+private:
+    CCoinsViewDB* db;
+
+    mutable std::mutex cs_flush;
+    mutable std::condition_variable condFlush;
+    //! coins handed over and not written yet. The flush thread reads it without
+    //! holding cs_flush, so it only changes while no flush is pending.
+    CCoinsMap mapFlushing;
+    uint256 hashFlushing;
+    bool fPending;
+    bool fFailed;
+    bool fStop;
+    std::thread threadFlush;
+
+    void ThreadFlush();
+
+public:
+    CCoinsViewFlusher(CCoinsViewDB* dbIn);
+    //! Writes the pending coins, if any, before returning
+    ~CCoinsViewFlusher();
+
+    bool GetCoins(const uint256& txid, CCoins& coins) const;
+    bool HaveCoins(const uint256& txid) const;
+    void GetCoinsBatch(const std::vector<uint256>& vTxids, std::vector<CCoins>& vCoins, std::vector<char>& vFound) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+
+    //! Wait until the coins handed over so far are durable. Returns false if a write failed.
+    bool Wait() const;
+    //! Whether a background write failed, leaving the coin database behind the coins in memory
+    bool Failed() const;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -95,6 +221,9 @@ public:
     bool WriteAccumulatorValue(const uint32_t& nChecksum, const CBigNum& bnValue);
     bool ReadAccumulatorValue(const uint32_t& nChecksum, CBigNum& bnValue);
     bool EraseAccumulatorValue(const uint32_t& nChecksum);
+    /** Write the zSQR mints of the block at a height, tagged with the hash of the block */
+    bool WriteBlockMints(const int nHeight, const uint256& hashBlock, const std::list<libzerocoin::PublicCoin>& listPubcoins);
+    bool ReadBlockMints(const int nHeight, uint256& hashBlock, std::list<libzerocoin::PublicCoin>& listPubcoins);
 };
 
 #endif // BITCOIN_TXDB_H
@@ -13,7 +13,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 71031;
+static const int PROTOCOL_VERSION = 71033;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -21,6 +21,12 @@ static const int INIT_PROTO_VERSION = 209;
 //! In this version, 'getheaders' was introduced.
 static const int GETHEADERS_VERSION = 70077;
 
+//! In this version, 'getheaders' is answered with 'headers', so blocks can be synced headers-first
+static const int HEADERS_FIRST_VERSION = 71032;
+
+//! In this version, blocks can be relayed as compact blocks (BIP 152)
+static const int COMPACT_BLOCKS_VERSION = 71033;
+
 //! disconnect from peers older than this proto version
 static const int MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT = 71030;
 static const int MIN_PEER_PROTO_VERSION_AFTER_ENFORCEMENT = 71031;
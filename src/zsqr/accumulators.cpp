@@ -20,6 +20,155 @@ std::map<uint32_t, CBigNum> mapAccumulatorValues;
 std::list<uint256> listAccCheckpointsNoDB;
 
 
+namespace {
+
+/**
+ * In memory state of the accumulators near the tip of the active chain.
+ *
+ * Holds the mints of the recently connected blocks and the accumulator values
+ * of the recently calculated checkpoints, so that a new checkpoint only has to
+ * accumulate the mints of the last ten blocks on top of the previous one,
+ * without reading blocks from disk or accumulator values from the database.
+ *
+ * Both are indexed by height and tagged with the hash of their block. Blocks
+ * that are disconnected are erased, and anything that is not on the active
+ * chain anymore is ignored, so a cache miss falls back to the disk.
+ */
+class CAccumulatorState
+{
+private:
+    //! Number of blocks below the tip the state is kept for
+    static const int nDepth = 100;
+
+    //! mints of a block, as indexed by the zerocoin database
+    std::map<int, std::pair<uint256, std::list<libzerocoin::PublicCoin> > > mapBlockMints;
+    //! accumulator values once all the mints up to and including a block have been accumulated
+    std::map<int, std::pair<uint256, AccumulatorCheckpoints::Checkpoint> > mapBlockValues;
+    CCriticalSection cs_accumulatorstate;
+
+public:
+    void AddBlock(const CBlockIndex* pindex, const std::list<libzerocoin::PublicCoin>& listPubcoins)
+    {
+        LOCK(cs_accumulatorstate);
+        mapBlockMints[pindex->nHeight] = std::make_pair(pindex->GetBlockHash(), listPubcoins);
+
+        int nHeightPrune = pindex->nHeight - nDepth;
+        mapBlockMints.erase(mapBlockMints.begin(), mapBlockMints.lower_bound(nHeightPrune));
+        mapBlockValues.erase(mapBlockValues.begin(), mapBlockValues.lower_bound(nHeightPrune));
+    }
+
+    void RemoveBlock(const CBlockIndex* pindex)
+    {
+        LOCK(cs_accumulatorstate);
+        mapBlockMints.erase(mapBlockMints.lower_bound(pindex->nHeight), mapBlockMints.end());
+        mapBlockValues.erase(mapBlockValues.lower_bound(pindex->nHeight), mapBlockValues.end());
+    }
+
+    bool GetMints(const CBlockIndex* pindex, std::list<libzerocoin::PublicCoin>& listPubcoins)
+    {
+        LOCK(cs_accumulatorstate);
+        auto it = mapBlockMints.find(pindex->nHeight);
+        if (it == mapBlockMints.end() || it->second.first != pindex->GetBlockHash())
+            return false;
+
+        listPubcoins = it->second.second;
+        return true;
+    }
+
+    void SetValues(const CBlockIndex* pindex, AccumulatorMap& mapAccumulators)
+    {
+        AccumulatorCheckpoints::Checkpoint values;
+        for (auto& denom : libzerocoin::zerocoinDenomList)
+            values[denom] = mapAccumulators.GetValue(denom);
+
+        LOCK(cs_accumulatorstate);
+        mapBlockValues[pindex->nHeight] = std::make_pair(pindex->GetBlockHash(), values);
+    }
+
+    bool GetValues(const CBlockIndex* pindex, AccumulatorCheckpoints::Checkpoint& values)
+    {
+        LOCK(cs_accumulatorstate);
+        auto it = mapBlockValues.find(pindex->nHeight);
+        if (it == mapBlockValues.end() || it->second.first != pindex->GetBlockHash())
+            return false;
+
+        values = it->second.second;
+        return true;
+    }
+};
+
+CAccumulatorState accumulatorState;
+
+}
+
+
+bool AddBlockToAccumulatorState(const CBlock& block, const CBlockIndex* pindex)
+{
+    if (pindex->nHeight < Params().Zerocoin_StartHeight())
+        return true;
+
+    std::list<libzerocoin::PublicCoin> listPubcoins;
+    if (!BlockToPubcoinList(block, listPubcoins, true))
+        return error("%s: failed to get zerocoin mintlist from block %d", __func__, pindex->nHeight);
+
+    //index the mints by height, blocks without mints included, so that they never have to be read from disk again
+    if (!zerocoinDB->WriteBlockMints(pindex->nHeight, pindex->GetBlockHash(), listPubcoins))
+        return error("%s: failed to write zerocoin mints of block %d", __func__, pindex->nHeight);
+
+    accumulatorState.AddBlock(pindex, listPubcoins);
+    return true;
+}
+
+
+void RemoveBlockFromAccumulatorState(const CBlockIndex* pindex)
+{
+    accumulatorState.RemoveBlock(pindex);
+}
+
+
+bool IndexChainMints(const CBlockIndex* pindexTip)
+{
+    for (const CBlockIndex* pindex = pindexTip; pindex && pindex->nHeight >= Params().Zerocoin_StartHeight(); pindex = pindex->pprev) {
+        uint256 hashBlock;
+        std::list<libzerocoin::PublicCoin> listPubcoins;
+        if (zerocoinDB->ReadBlockMints(pindex->nHeight, hashBlock, listPubcoins) && hashBlock == pindex->GetBlockHash())
+            continue;
+
+        CBlock block;
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !ReadBlockFromDisk(block, pindex))
+            return error("%s: block %d is not indexed and not on disk", __func__, pindex->nHeight);
+        listPubcoins.clear();
+        if (!BlockToPubcoinList(block, listPubcoins, true))
+            return error("%s: failed to get zerocoin mintlist from block %d", __func__, pindex->nHeight);
+        if (!zerocoinDB->WriteBlockMints(pindex->nHeight, pindex->GetBlockHash(), listPubcoins))
+            return error("%s: failed to write zerocoin mints of block %d", __func__, pindex->nHeight);
+    }
+    return true;
+}
+
+
+//Get the mints of a block from the accumulator state or the mint index, and from the disk if it was not indexed
+static bool GetBlockMints(const CBlockIndex* pindex, std::list<libzerocoin::PublicCoin>& listPubcoins, bool fFilterInvalid)
+{
+    if (fFilterInvalid) {
+        if (accumulatorState.GetMints(pindex, listPubcoins))
+            return true;
+
+        //the index is written by height, make sure the entry belongs to this block and not to a reorganized one
+        uint256 hashBlock;
+        if (zerocoinDB->ReadBlockMints(pindex->nHeight, hashBlock, listPubcoins) && hashBlock == pindex->GetBlockHash())
+            return true;
+        listPubcoins.clear();
+    }
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return error("%s: failed to read block from disk", __func__);
+
+    return BlockToPubcoinList(block, listPubcoins, fFilterInvalid);
+}
+
+
 uint32_t ParseChecksum(uint256 nChecksum, libzerocoin::CoinDenomination denomination)
 {
     //shift to the beginning bit of this denomination and trim any remaining bits by returning 32 bits only
@@ -221,6 +370,19 @@ bool InitializeAccumulators(const int nHeight, int& nHeightCheckpoint, Accumulat
 
     //Use the previous block's checkpoint to initialize the accumulator's state
     uint256 nCheckpointPrev = chainActive[nHeight - 1]->nAccumulatorCheckpoint;
+
+    //The previous checkpoint accumulated up to 21 blocks back, its values may still be in memory
+    CBlockIndex* pindexAccumulated = chainActive[nHeight - 21];
+    AccumulatorCheckpoints::Checkpoint values;
+    if (nCheckpointPrev != 0 && pindexAccumulated && accumulatorState.GetValues(pindexAccumulated, values)) {
+        mapAccumulators.Load(values);
+        if (mapAccumulators.GetCheckpoint() == nCheckpointPrev) {
+            nHeightCheckpoint = nHeight;
+            return true;
+        }
+        mapAccumulators.Reset();
+    }
+
     if (nCheckpointPrev == 0)
         mapAccumulators.Reset();
     else if (!mapAccumulators.Load(nCheckpointPrev))
@@ -270,12 +432,8 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, Accumulat
         }
 
         //grab mints from this block
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex))
-            return error("%s: failed to read block from disk", __func__);
-
         std::list<libzerocoin::PublicCoin> listPubcoins;
-        if (!BlockToPubcoinList(block, listPubcoins, fFilterInvalid))
+        if (!GetBlockMints(pindex, listPubcoins, fFilterInvalid))
             return error("%s: failed to get zerocoin mintlist from block %d", __func__, pindex->nHeight);
 
         nTotalMintsFound += listPubcoins.size();
@@ -289,6 +447,9 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, Accumulat
         pindex = chainActive.Next(pindex);
     }
 
+    //keep the values for the next checkpoint, which starts where this one stopped
+    accumulatorState.SetValues(chainActive[nHeight - 11], mapAccumulators);
+
     // if there were no new mints found, the accumulator checkpoint will be the same as the last checkpoint
     if (nTotalMintsFound == 0)
         nCheckpoint = chainActive[nHeight - 1]->nAccumulatorCheckpoint;
@@ -341,7 +502,7 @@ int ComputeAccumulatedCoins(int nHeightEnd, libzerocoin::CoinDenomination denom)
     CBlockIndex* pindex = chainActive[GetZerocoinStartHeight()];
     int n = 0;
     while (pindex->nHeight < nHeightEnd) {
-        n += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
+        n += pindex->GetMintsInBlock(denom);
         pindex = chainActive.Next(pindex);
     }
 
@@ -351,11 +512,8 @@ int ComputeAccumulatedCoins(int nHeightEnd, libzerocoin::CoinDenomination denom)
 
 std::list<libzerocoin::PublicCoin> GetPubcoinFromBlock(const CBlockIndex* pindex){
     //grab mints from this block
-    CBlock block;
-    if(!ReadBlockFromDisk(block, pindex))
-        throw GetPubcoinException("GetPubcoinFromBlock: failed to read block from disk while adding pubcoins to witness");
     std::list<libzerocoin::PublicCoin> listPubcoins;
-    if(!BlockToPubcoinList(block, listPubcoins, true))
+    if(!GetBlockMints(pindex, listPubcoins, true))
         throw GetPubcoinException("GetPubcoinFromBlock: failed to get zerocoin mintlist from block "+std::to_string(pindex->nHeight)+"\n");
     return listPubcoins;
 }
@@ -895,8 +1053,7 @@ std::map<libzerocoin::CoinDenomination, int> GetMintMaturityHeight()
         for (auto denom : libzerocoin::zerocoinDenomList) {
             //If the denom has not already had a mint added to it, then see if it has a mint added on this block
             if (mapDenomMaturity.at(denom).first < Params().Zerocoin_RequiredAccumulation()) {
-                mapDenomMaturity.at(denom).first += count(pindex->vMintDenominationsInBlock.begin(),
-                                                          pindex->vMintDenominationsInBlock.end(), denom);
+                mapDenomMaturity.at(denom).first += pindex->GetMintsInBlock(denom);
 
                 //if mint was found then record this block as the first block that maturity occurs.
                 if (mapDenomMaturity.at(denom).first >= Params().Zerocoin_RequiredAccumulation())
@@ -50,6 +50,21 @@ bool GenerateAccumulatorWitness(
 
 
 bool GenerateAccumulatorWitness(CoinWitnessData* coinWitness, AccumulatorMap& mapAccumulators, CBlockIndex* pindexCheckpoint);
+
+/**
+ * Keep the in memory accumulator state in sync with the active chain, so that
+ * checkpoints and witnesses near the tip don't have to read blocks from disk.
+ * Connected blocks also have their mints written to the zerocoin database.
+ */
+bool AddBlockToAccumulatorState(const CBlock& block, const CBlockIndex* pindex);
+void RemoveBlockFromAccumulatorState(const CBlockIndex* pindex);
+
+/**
+ * Index the mints of the blocks up to pindexTip that were connected before the
+ * mint index existed, reading them from disk. Fails if one of them is not there.
+ */
+bool IndexChainMints(const CBlockIndex* pindexTip);
+
 std::list<libzerocoin::PublicCoin> GetPubcoinFromBlock(const CBlockIndex* pindex);
 bool GetAccumulatorValueFromDB(uint256 nCheckpoint, libzerocoin::CoinDenomination denom, CBigNum& bnAccValue);
 bool GetAccumulatorValue(int& nHeight, const libzerocoin::CoinDenomination denom, CBigNum& bnAccValue);
@@ -0,0 +1,76 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zsqr/spendcache.h"
+
+#include "hash.h"
+#include "random.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+
+namespace {
+
+class CZerocoinSpendCache
+{
+private:
+    //! spenddata_type is (spend hash, accumulator checksum, params version):
+    typedef boost::tuple<uint256, uint32_t, int> spenddata_type;
+    std::set<spenddata_type> setValid;
+    boost::shared_mutex cs_spendcache;
+
+    static spenddata_type Key(const libzerocoin::CoinSpend& spend, bool fUseModulusV1)
+    {
+        return spenddata_type(SerializeHash(spend), spend.getAccumulatorChecksum(), fUseModulusV1 ? 1 : 2);
+    }
+
+public:
+    bool Get(const libzerocoin::CoinSpend& spend, bool fUseModulusV1)
+    {
+        spenddata_type k = Key(spend, fUseModulusV1);
+
+        boost::shared_lock<boost::shared_mutex> lock(cs_spendcache);
+        return setValid.count(k) > 0;
+    }
+
+    void Set(const libzerocoin::CoinSpend& spend, bool fUseModulusV1)
+    {
+        // DoS prevention: limit cache size to less than 1MB
+        // (~80 bytes per cache entry times 10,000 entries)
+        int64_t nMaxCacheSize = GetArg("-maxzerocoinspendcachesize", DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE);
+        if (nMaxCacheSize <= 0) return;
+
+        spenddata_type k = Key(spend, fUseModulusV1);
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_spendcache);
+
+        while (static_cast<int64_t>(setValid.size()) >= nMaxCacheSize)
+        {
+            // Evict a random entry, as the signature cache does
+            uint256 randomHash = GetRandHash();
+            std::set<spenddata_type>::iterator it = setValid.lower_bound(spenddata_type(randomHash));
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+
+        setValid.insert(k);
+    }
+};
+
+CZerocoinSpendCache spendCache;
+
+}
+
+bool IsZerocoinSpendProofCached(const libzerocoin::CoinSpend& spend, bool fUseModulusV1)
+{
+    return spendCache.Get(spend, fUseModulusV1);
+}
+
+void CacheZerocoinSpendProof(const libzerocoin::CoinSpend& spend, bool fUseModulusV1)
+{
+    spendCache.Set(spend, fUseModulusV1);
+}
@@ -0,0 +1,24 @@
+// Copyright (c) 2020 The sQuorum developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef sQuorum_SPENDCACHE_H
+#define sQuorum_SPENDCACHE_H
+
+#include "libzerocoin/CoinSpend.h"
+
+/** Default for -maxzerocoinspendcachesize, the number of verified zerocoin spend proofs kept in memory */
+static const unsigned int DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE = 10000;
+
+/**
+ * Cache of valid zerocoin spend proofs, to avoid verifying the zero knowledge
+ * proofs of a spend twice (once when accepted into the memory pool, and again
+ * when accepted into the block chain).
+ *
+ * Entries are keyed by the hash of the whole serialized spend, its accumulator
+ * checksum and the version of the zerocoin params it was verified with.
+ */
+bool IsZerocoinSpendProofCached(const libzerocoin::CoinSpend& spend, bool fUseModulusV1);
+void CacheZerocoinSpendProof(const libzerocoin::CoinSpend& spend, bool fUseModulusV1);
+
+#endif //sQuorum_SPENDCACHE_H